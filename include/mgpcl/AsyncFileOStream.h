@@ -0,0 +1,151 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "FileIOStream.h"
+#include "Thread.h"
+#include "Mutex.h"
+#include "Cond.h"
+#include "List.h"
+
+namespace m
+{
+    //Write-behind file stream. write() copies data into chunks that are
+    //written by a background thread, several chunks at a time using a single
+    //gathered write. The amount of bytes waiting to be written is bounded:
+    //write() blocks once maxInFlight() is reached.
+    //
+    //Durable flush points are requested using requestSync(). Requests that
+    //pile up while the worker is busy are batched into a single fdatasync().
+    //
+    //write(), requestSync() and flush() are meant to be called from the
+    //same thread; waitSync() can be called from any thread.
+    class MGPCL_PREFIX AsyncFileOutputStream : public OutputStream
+    {
+        M_NON_COPYABLE(AsyncFileOutputStream)
+
+    public:
+        AsyncFileOutputStream();
+        AsyncFileOutputStream(const String &fname, FileOutputStream::OpenMode mode);
+        ~AsyncFileOutputStream() override;
+
+        bool open(const String &fname, FileOutputStream::OpenMode mode);
+        int write(const uint8_t *src, int sz) override;
+        bool flush() override; //Same as waitSync(requestSync())
+        void close() override;
+
+        //Returns a ticket to be passed to waitSync(), or 0 on error
+        uint64_t requestSync();
+        bool waitSync(uint64_t ticket);
+
+        //Bytes accepted so far, relative to where the file was opened
+        uint64_t pos() override
+        {
+            return m_pos;
+        }
+
+        bool seek(int amount, SeekPos sp = SeekPos::Beginning) override
+        {
+            return false;
+        }
+
+        bool seekSupported() const override
+        {
+            return false;
+        }
+
+        //Can only be changed while the stream is closed
+        void setChunkSize(uint32_t sz);
+
+        uint32_t chunkSize() const
+        {
+            return m_chunkSz;
+        }
+
+        void setMaxInFlight(uint32_t bytes)
+        {
+            m_lock.lock();
+            m_maxInFlight = bytes;
+            m_lock.unlock();
+        }
+
+        uint32_t maxInFlight() const
+        {
+            return m_maxInFlight;
+        }
+
+        uint32_t inFlight()
+        {
+            m_lock.lock();
+            volatile uint32_t ret = m_inFlight;
+            m_lock.unlock();
+
+            return ret;
+        }
+
+        //Once a write or a sync failed, every subsequent operation fails
+        bool hasFailed()
+        {
+            m_lock.lock();
+            volatile bool ret = m_failed;
+            m_lock.unlock();
+
+            return ret;
+        }
+
+    private:
+        class Chunk
+        {
+        public:
+            Chunk() : data(nullptr), len(0), ticket(0) {}
+            Chunk(uint8_t *d, uint32_t l, uint64_t t) : data(d), len(l), ticket(t) {}
+
+            uint8_t *data;
+            uint32_t len;
+            uint64_t ticket; //Sync ticket, 0 if none
+        };
+
+        void threadFunc();
+        bool submit(uint64_t ticket); //Hands m_cur to the worker
+        void freeChunks(); //Stream must be closed
+
+        FileOutputStream m_file;
+        ClassThread<AsyncFileOutputStream> m_thread;
+        bool m_open;
+        uint64_t m_pos;
+
+        //Chunk being filled by write()
+        uint8_t *m_cur;
+        uint32_t m_curLen;
+        uint32_t m_chunkSz;
+
+        //Shared with the worker
+        Mutex m_lock;
+        Cond m_workCond;
+        Cond m_doneCond;
+        List<Chunk> m_queue;
+        List<uint8_t*> m_freeChunks;
+        uint32_t m_inFlight;
+        uint32_t m_maxInFlight;
+        uint64_t m_lastTicket;
+        uint64_t m_syncedTicket;
+        bool m_failed;
+        bool m_stop;
+    };
+}
@@ -19,6 +19,7 @@
 
 #pragma once
 #include "Config.h"
+#include <cstdint>
 
 #if defined(MGPCL_WIN)
 #define WIN32_LEAN_AND_MEAN
@@ -76,6 +77,65 @@ namespace m
     private:
         volatile LONG m_data;
     };
+
+    //64 bits counter, for things that may overflow a long
+    class MGPCL_PREFIX Atomic64
+    {
+    public:
+        Atomic64()
+        {
+            m_data = 0;
+        }
+
+        Atomic64(int64_t val)
+        {
+            m_data = val;
+        }
+
+        //Returns the new value
+        int64_t add(int64_t val)
+        {
+            return InterlockedExchangeAdd64(&m_data, val) + val;
+        }
+
+        int64_t increment()
+        {
+            return InterlockedIncrement64(&m_data);
+        }
+
+        int64_t get()
+        {
+            return InterlockedCompareExchange64(&m_data, 0, 0);
+        }
+
+        void set(int64_t val)
+        {
+            InterlockedExchange64(&m_data, val);
+        }
+
+        //Returns true if the value was expected and has been replaced
+        bool compareAndSwap(int64_t expected, int64_t val)
+        {
+            return InterlockedCompareExchange64(&m_data, val, expected) == expected;
+        }
+
+        //Acquire load and release store; cheaper than get() and set()
+        int64_t load() const
+        {
+            int64_t ret = m_data;
+            _ReadWriteBarrier();
+            return ret;
+        }
+
+        void store(int64_t val)
+        {
+            _ReadWriteBarrier();
+            m_data = val;
+        }
+
+    private:
+        volatile LONGLONG m_data;
+    };
 }
 
 #else
@@ -138,6 +198,62 @@ namespace m
     private:
         volatile long m_data;
     };
+
+    //64 bits counter, for things that may overflow a long
+    class MGPCL_PREFIX Atomic64
+    {
+    public:
+        Atomic64()
+        {
+            m_data = 0;
+        }
+
+        Atomic64(int64_t val)
+        {
+            m_data = val;
+        }
+
+        //Returns the new value
+        int64_t add(int64_t val)
+        {
+            return __sync_add_and_fetch(&m_data, val);
+        }
+
+        int64_t increment()
+        {
+            return __sync_add_and_fetch(&m_data, 1);
+        }
+
+        int64_t get()
+        {
+            return __sync_add_and_fetch(&m_data, 0);
+        }
+
+        void set(int64_t val)
+        {
+            __sync_lock_test_and_set(&m_data, val);
+        }
+
+        //Returns true if the value was expected and has been replaced
+        bool compareAndSwap(int64_t expected, int64_t val)
+        {
+            return __sync_bool_compare_and_swap(&m_data, expected, val);
+        }
+
+        //Acquire load and release store; cheaper than get() and set()
+        int64_t load() const
+        {
+            return __atomic_load_n(&m_data, __ATOMIC_ACQUIRE);
+        }
+
+        void store(int64_t val)
+        {
+            __atomic_store_n(&m_data, val, __ATOMIC_RELEASE);
+        }
+
+    private:
+        volatile int64_t m_data;
+    };
 }
 
 #endif
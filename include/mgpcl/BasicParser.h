@@ -44,7 +44,8 @@ namespace m
             m_numChar = 0;
 
             //Buffer
-            m_buf = new char[8192];
+            m_alloc = new char[8192];
+            m_buf = m_alloc;
             m_bufLen = 0;
             m_bufPos = 0;
 
@@ -60,7 +61,8 @@ namespace m
             m_numChar = 0;
 
             //Buffer
-            m_buf = new char[8192];
+            m_alloc = new char[8192];
+            m_buf = m_alloc;
             m_bufLen = 0;
             m_bufPos = 0;
 
@@ -69,15 +71,43 @@ namespace m
             m_last = 0;
         }
 
+        //Parses data straight from memory (for instance a MappedFile).
+        //No copy is made; data must outlive the parser.
+        TBasicParser(const char *data, uint64_t len)
+        {
+            //Line & char counter
+            m_numLine = 1;
+            m_numChar = 0;
+
+            //Buffer
+            m_alloc = nullptr;
+            m_buf = data;
+            m_bufLen = len;
+            m_bufPos = 0;
+
+            //State
+            m_state = kBPS_Parsing;
+            m_last = 0;
+        }
+
         ~TBasicParser()
         {
-            if(m_buf != nullptr)
-                delete[] m_buf;
+            if(m_alloc != nullptr)
+                delete[] m_alloc;
         }
 
         bool refill()
         {
-            int rd = m_src->read(reinterpret_cast<uint8_t*>(m_buf), 8192);
+            if(m_src.isNull()) {
+                //Memory source (or no source at all); nothing more to read
+                m_state = kBPS_ReachedEOF;
+                return false;
+            }
+
+            if(m_alloc == nullptr)
+                m_alloc = new char[8192];
+
+            int rd = m_src->read(reinterpret_cast<uint8_t*>(m_alloc), 8192);
             if(rd == 0) {
                 m_state = kBPS_ReachedEOF;
                 return false;
@@ -86,7 +116,8 @@ namespace m
                 return false;
             }
 
-            m_bufLen = static_cast<uint32_t>(rd);
+            m_buf = m_alloc;
+            m_bufLen = static_cast<uint64_t>(rd);
             m_bufPos = 0;
             return true;
         }
@@ -177,12 +208,24 @@ namespace m
             m_state = kBPS_Parsing; //Reset state
         }
 
+        void setSource(const char *data, uint64_t len)
+        {
+            m_src.setNull();
+            m_buf = data;
+            m_bufLen = len;
+            m_bufPos = 0;
+            m_numLine = 1;
+            m_numChar = 0;
+            m_state = kBPS_Parsing;
+        }
+
     private:
         SharedPtr<InputStream, RefCnt> m_src;
 
-        char *m_buf;
-        uint32_t m_bufLen;
-        uint32_t m_bufPos;
+        char *m_alloc;
+        const char *m_buf;
+        uint64_t m_bufLen; //Memory sources may be larger than 4 GiB
+        uint64_t m_bufPos;
 
         int m_numLine;
         int m_numChar;
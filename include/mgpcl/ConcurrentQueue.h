@@ -0,0 +1,436 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+#include "Atomic.h"
+#include "Futex.h"
+#include "Mem.h"
+#include "Time.h"
+#include "Util.h"
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+#define M_CACHE_LINE_SIZE 64
+
+/* Thread-safe alternatives to m::Queue. They have a fixed capacity,
+ * which is rounded up to a power of two, and never allocate after
+ * construction. Unlike m::Queue, poll() moves the element out.
+ */
+
+namespace m
+{
+    /* Bounded multi-producer multi-consumer queue, lock-free. Each slot
+     * carries a sequence number telling whether it's ready to be written
+     * or read, so producers and consumers only contend on their own index
+     * (this is Dmitry Vyukov's bounded MPMC queue).
+     */
+    template<typename T> class ConcurrentQueue
+    {
+        M_NON_COPYABLE_T(ConcurrentQueue, T)
+
+    public:
+        ConcurrentQueue(uint32_t capacity)
+        {
+            uint32_t cap = 2;
+            while(cap < capacity)
+                cap <<= 1;
+
+            m_mask = static_cast<int64_t>(cap - 1);
+            m_cells = new Cell[cap];
+
+            for(uint32_t i = 0; i < cap; i++)
+                m_cells[i].seq.set(static_cast<int64_t>(i));
+        }
+
+        ~ConcurrentQueue()
+        {
+            while(poll());
+            delete[] m_cells;
+        }
+
+        //Returns false if the queue is full
+        bool offer(const T &o)
+        {
+            return emplace(o);
+        }
+
+        bool offer(T &&o)
+        {
+            return emplace(std::move(o));
+        }
+
+        //Returns false if the queue is empty
+        bool poll(T &dst)
+        {
+            Cell *cell = claimRead();
+            if(cell == nullptr)
+                return false;
+
+            dst = std::move(*cell->ptr());
+            release(cell);
+            return true;
+        }
+
+        //Drops the first element
+        bool poll()
+        {
+            Cell *cell = claimRead();
+            if(cell == nullptr)
+                return false;
+
+            release(cell);
+            return true;
+        }
+
+        uint32_t capacity() const
+        {
+            return static_cast<uint32_t>(m_mask + 1);
+        }
+
+        //Only a hint if other threads are using the queue
+        uint32_t size() const
+        {
+            int64_t ret = m_tail.load() - m_head.load();
+            return ret < 0 ? 0 : static_cast<uint32_t>(ret);
+        }
+
+        bool isEmpty() const
+        {
+            return size() == 0;
+        }
+
+    private:
+        class Cell
+        {
+        public:
+            T *ptr()
+            {
+                return reinterpret_cast<T*>(&data);
+            }
+
+            Atomic64 seq;
+            typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type data;
+        };
+
+        template<typename U> bool emplace(U &&o)
+        {
+            int64_t pos = m_tail.load();
+            Cell *cell;
+
+            for(;;) {
+                cell = m_cells + (pos & m_mask);
+                int64_t diff = cell->seq.load() - pos;
+
+                if(diff == 0) {
+                    if(m_tail.compareAndSwap(pos, pos + 1))
+                        break;
+                } else if(diff < 0)
+                    return false; //Full: the slot still holds the value from the previous lap
+
+                pos = m_tail.load();
+            }
+
+            new(cell->ptr()) T(std::forward<U>(o));
+            cell->seq.store(pos + 1);
+            return true;
+        }
+
+        Cell *claimRead()
+        {
+            int64_t pos = m_head.load();
+            Cell *cell;
+
+            for(;;) {
+                cell = m_cells + (pos & m_mask);
+                int64_t diff = cell->seq.load() - (pos + 1);
+
+                if(diff == 0) {
+                    if(m_head.compareAndSwap(pos, pos + 1))
+                        break;
+                } else if(diff < 0)
+                    return nullptr; //Empty
+
+                pos = m_head.load();
+            }
+
+            return cell;
+        }
+
+        //Makes the slot available to the producers of the next lap
+        void release(Cell *cell)
+        {
+            const int64_t pos = cell->seq.load() - 1;
+
+            cell->ptr()->~T();
+            cell->seq.store(pos + m_mask + 1);
+        }
+
+        Cell *m_cells;
+        int64_t m_mask;
+        char m_pad0[M_CACHE_LINE_SIZE];
+        Atomic64 m_tail; //Next slot to write
+        char m_pad1[M_CACHE_LINE_SIZE];
+        Atomic64 m_head; //Next slot to read
+        char m_pad2[M_CACHE_LINE_SIZE];
+    };
+
+    /* Single-producer single-consumer queue, wait-free. Each side keeps a
+     * copy of the other side's index and only reads the shared one when
+     * the copy says the queue is full (or empty), so most calls don't touch
+     * the other side's cache line. offer() must always be called from the
+     * same thread, and first()/poll() from another one.
+     */
+    template<typename T> class SPSCQueue
+    {
+        M_NON_COPYABLE_T(SPSCQueue, T)
+
+    public:
+        SPSCQueue(uint32_t capacity) : m_cachedHead(0), m_cachedTail(0)
+        {
+            uint32_t cap = 2;
+            while(cap < capacity)
+                cap <<= 1;
+
+            m_mask = static_cast<int64_t>(cap - 1);
+            m_data = mem::alloc<T>(cap);
+        }
+
+        ~SPSCQueue()
+        {
+            const int64_t tail = m_tail.load();
+            for(int64_t i = m_head.load(); i < tail; i++)
+                m_data[i & m_mask].~T();
+
+            mem::del<T>(m_data);
+        }
+
+        bool offer(const T &o)
+        {
+            return emplace(o);
+        }
+
+        bool offer(T &&o)
+        {
+            return emplace(std::move(o));
+        }
+
+        //Consumer side. Returns nullptr if the queue is empty
+        T *first()
+        {
+            const int64_t head = m_head.load();
+
+            if(head == m_cachedTail) {
+                m_cachedTail = m_tail.load();
+
+                if(head == m_cachedTail)
+                    return nullptr;
+            }
+
+            return m_data + (head & m_mask);
+        }
+
+        bool poll(T &dst)
+        {
+            T *ret = first();
+            if(ret == nullptr)
+                return false;
+
+            dst = std::move(*ret);
+            ret->~T();
+            m_head.store(m_head.load() + 1);
+            return true;
+        }
+
+        bool poll()
+        {
+            T *ret = first();
+            if(ret == nullptr)
+                return false;
+
+            ret->~T();
+            m_head.store(m_head.load() + 1);
+            return true;
+        }
+
+        uint32_t capacity() const
+        {
+            return static_cast<uint32_t>(m_mask + 1);
+        }
+
+        uint32_t size() const
+        {
+            return static_cast<uint32_t>(m_tail.load() - m_head.load());
+        }
+
+        bool isEmpty() const
+        {
+            return size() == 0;
+        }
+
+    private:
+        template<typename U> bool emplace(U &&o)
+        {
+            const int64_t tail = m_tail.load();
+
+            if(tail - m_cachedHead > m_mask) {
+                m_cachedHead = m_head.load();
+
+                if(tail - m_cachedHead > m_mask)
+                    return false;
+            }
+
+            new(m_data + (tail & m_mask)) T(std::forward<U>(o));
+            m_tail.store(tail + 1);
+            return true;
+        }
+
+        T *m_data;
+        int64_t m_mask;
+        char m_pad0[M_CACHE_LINE_SIZE];
+        Atomic64 m_tail; //Written by the producer
+        int64_t m_cachedHead;
+        char m_pad1[M_CACHE_LINE_SIZE];
+        Atomic64 m_head; //Written by the consumer
+        int64_t m_cachedTail;
+        char m_pad2[M_CACHE_LINE_SIZE];
+    };
+
+    /* Adds blocking calls to ConcurrentQueue or SPSCQueue. Threads sleep on
+     * a Futex, and the non-blocking paths only pay for a wake-up syscall
+     * when somebody is actually waiting on the other side.
+     */
+    template<typename T, typename Q = ConcurrentQueue<T>> class BlockingQueue
+    {
+        M_NON_COPYABLE_T(BlockingQueue, T, Q)
+
+    public:
+        BlockingQueue(uint32_t capacity) : m_queue(capacity)
+        {
+        }
+
+        bool offer(const T &o)
+        {
+            if(!m_queue.offer(o))
+                return false;
+
+            notify(m_notEmpty, m_pollWaiters);
+            return true;
+        }
+
+        bool offer(T &&o)
+        {
+            if(!m_queue.offer(std::move(o)))
+                return false;
+
+            notify(m_notEmpty, m_pollWaiters);
+            return true;
+        }
+
+        bool poll(T &dst)
+        {
+            if(!m_queue.poll(dst))
+                return false;
+
+            notify(m_notFull, m_offerWaiters);
+            return true;
+        }
+
+        //Waits until there is enough space
+        void offerWait(T &&o)
+        {
+            while(!offer(std::move(o))) {
+                const int32_t seq = m_notFull.value();
+                m_offerWaiters.increment();
+
+                //Checking after registering ensures we won't miss a notification
+                if(m_queue.size() >= m_queue.capacity())
+                    m_notFull.wait(seq);
+
+                m_offerWaiters.add(-1);
+            }
+        }
+
+        void offerWait(const T &o)
+        {
+            T copy(o);
+            offerWait(std::move(copy));
+        }
+
+        //Waits until there's something to poll, or ms milliseconds have passed
+        bool pollWait(T &dst, uint32_t ms = M_FUTEX_INFINITE)
+        {
+            const double deadline = (ms == M_FUTEX_INFINITE) ? 0.0 : time::getTimeMs() + static_cast<double>(ms);
+
+            while(!poll(dst)) {
+                uint32_t toWait = M_FUTEX_INFINITE;
+
+                if(ms != M_FUTEX_INFINITE) {
+                    double remaining = deadline - time::getTimeMs();
+                    if(remaining <= 0.0)
+                        return false;
+
+                    toWait = static_cast<uint32_t>(remaining) + 1;
+                }
+
+                const int32_t seq = m_notEmpty.value();
+                m_pollWaiters.increment();
+
+                if(m_queue.isEmpty())
+                    m_notEmpty.wait(seq, toWait);
+
+                m_pollWaiters.add(-1);
+            }
+
+            return true;
+        }
+
+        uint32_t capacity() const
+        {
+            return m_queue.capacity();
+        }
+
+        uint32_t size() const
+        {
+            return m_queue.size();
+        }
+
+        bool isEmpty() const
+        {
+            return m_queue.isEmpty();
+        }
+
+    private:
+        //The futex increment is a full barrier, so the load can't happen before the value was added
+        static void notify(Futex &f, Atomic64 &waiters)
+        {
+            f.increment();
+
+            if(waiters.load() > 0)
+                f.wakeOne();
+        }
+
+        Q m_queue;
+        Futex m_notEmpty;
+        Futex m_notFull;
+        Atomic64 m_pollWaiters;
+        Atomic64 m_offerWaiters;
+    };
+}
@@ -40,9 +40,10 @@
 #define MGPCL_PREFIX
 
 //Other settings
-/* #undef MGPCL_NO_GUI */
+#define MGPCL_NO_GUI
 /* #undef MGPCL_NO_SSL */
-/* #undef MGPCL_ENABLE_PATTERNS */
+/* #undef MGPCL_NO_ZLIB */
+#define MGPCL_ENABLE_PATTERNS
 
 //The size given to SetupComm(...) when using the SerialPort class
 //This has no effect on Linux.
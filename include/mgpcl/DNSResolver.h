@@ -0,0 +1,129 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "IPv4Address.h"
+#include "Executor.h"
+#include "Future.h"
+#include "HashMap.h"
+#include "Mutex.h"
+#include "Cond.h"
+#include <functional>
+
+#define M_DNS_RESOLVER_THREADS 4
+#define M_DNS_POSITIVE_TTL 60000
+#define M_DNS_NEGATIVE_TTL 5000
+#define M_DNS_CACHE_MAX 4096
+
+namespace m
+{
+    /* Caching resolver. Successful and failed (unknown host) lookups are
+     * kept for a fixed time, since getaddrinfo() doesn't tell the records'
+     * TTL; transient errors aren't cached. Concurrent lookups of the same
+     * host are merged into a single one. Asynchronous lookups run on a
+     * small dedicated Executor, so slow DNS servers don't hold the
+     * global one. setLookupFunction() replaces getaddrinfo(), for tests.
+     */
+    class MGPCL_PREFIX DNSResolver
+    {
+        M_NON_COPYABLE(DNSResolver)
+
+    public:
+        typedef std::function<DNSResolveError(const String &host, IPv4Address &dst)> LookupFunc;
+        typedef std::function<void(DNSResolveError err, const IPv4Address &addr)> Callback;
+
+        DNSResolver(int numThreads = M_DNS_RESOLVER_THREADS);
+        ~DNSResolver();
+
+        DNSResolveError resolve(const String &host, IPv4Address &dst, uint16_t port = 0);
+        void resolveAsync(const String &host, uint16_t port, Callback cb); //cb may be called right away, or from another thread
+        Future<IPv4Address> resolveAsync(const String &host, uint16_t port = 0); //Gives an "any" address on failure
+
+        void setLookupFunction(LookupFunc func);
+        void setTTL(uint32_t positiveMs, uint32_t negativeMs);
+        void addHost(const String &host, const IPv4Address &addr); //Never expires, like hosts file entries
+        int loadHostsFile(const String &fname); //Returns the number of IPv4 entries, or -1
+        void clearCache(); //Hosts added with addHost() stay
+        double expiry(const String &host); //When host's cache entry expires (time::getTimeMs()), 0 if never, -1 if not cached
+
+        uint64_t numHits() const
+        {
+            return m_hits;
+        }
+
+        uint64_t numMisses() const
+        {
+            return m_misses;
+        }
+
+        uint64_t numCoalesced() const
+        {
+            return m_coalesced;
+        }
+
+        uint64_t numLookups() const
+        {
+            return m_lookups;
+        }
+
+        static DNSResolver &instance(); //Shared resolver, created on first use
+
+    private:
+        class Entry
+        {
+        public:
+            IPv4Address addr;
+            DNSResolveError error;
+            double expires; //0 = never
+        };
+
+        class Pending
+        {
+        public:
+            Pending() : done(false), error(kRE_UnknownError), users(1)
+            {
+            }
+
+            List<Callback> callbacks;
+            bool done;
+            DNSResolveError error;
+            IPv4Address addr;
+            int users;
+        };
+
+        bool cached(const String &key, DNSResolveError &err, IPv4Address &dst);
+        void evict(bool expiredOnly);
+        void lookup(const String &key, Pending *p);
+        void releasePending(Pending *p);
+
+        Mutex m_lock;
+        Cond m_cond;
+        HashMap<String, Entry> m_cache;
+        HashMap<String, Pending*> m_pending;
+        LookupFunc m_lookup;
+        double m_positiveTTL;
+        double m_negativeTTL;
+        Executor m_pool;
+
+        uint64_t m_hits;
+        uint64_t m_misses;
+        uint64_t m_coalesced;
+        uint64_t m_lookups;
+    };
+}
@@ -20,14 +20,106 @@
 #pragma once
 #include "Enums.h"
 #include "String.h"
+#include "List.h"
+#include "ByteSwap.h"
+#include <type_traits>
 #include <cstdint>
 
+//Stack buffer used by bulk and struct (de)serialization
+#define M_DS_BUFFER_SIZE 4096
+
+//Longest encoding of a scalar (a 64 bits varint)
+#define M_DS_MAX_SCALAR 10
+
 namespace m
 {
 
     //I assume your system is using little endian; because well...
     //That's what MGPCL was made for!
 
+    /*
+     * Specialize this to (de)serialize your own structs with writeStruct()
+     * and readStruct(). Fields may be arithmetic types, Strings or other
+     * structs that have a DataStruct specialization.
+     *
+     * template<> class DataStruct<Vec3>
+     * {
+     * public:
+     *     template<class V> static void fields(V &v, Vec3 &obj)
+     *     {
+     *         v & obj.x & obj.y & obj.z;
+     *     }
+     * };
+     */
+    template<typename T> class DataStruct;
+
+    namespace ds
+    {
+        //Integers (except bytes and bools) are varints in IntegerEncoding::VarInt mode
+        template<typename T> class IsVarInt
+        {
+        public:
+            static const bool value = std::is_integral<T>::value && sizeof(T) >= 2 && !std::is_same<T, bool>::value;
+        };
+
+        template<typename T> inline void swap(T &val)
+        {
+            uint8_t *bytes = reinterpret_cast<uint8_t*>(&val);
+
+            for(size_t i = 0; i < sizeof(T) / 2; i++) {
+                uint8_t tmp = bytes[i];
+                bytes[i] = bytes[sizeof(T) - i - 1];
+                bytes[sizeof(T) - i - 1] = tmp;
+            }
+        }
+
+        inline uint8_t *encodeVarUInt(uint8_t *dst, uint64_t val)
+        {
+            while(val >= 0x80) {
+                *(dst++) = static_cast<uint8_t>(val | 0x80);
+                val >>= 7;
+            }
+
+            *(dst++) = static_cast<uint8_t>(val);
+            return dst;
+        }
+
+        inline uint64_t zigZag(int64_t val)
+        {
+            return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63);
+        }
+
+        inline int64_t unZigZag(uint64_t val)
+        {
+            return static_cast<int64_t>((val >> 1) ^ (~(val & 1) + 1));
+        }
+
+        //Writes val into dst, returns the end of what was written (at most M_DS_MAX_SCALAR bytes)
+        template<typename T> inline uint8_t *encode(uint8_t *dst, T val, Endianness ed, IntegerEncoding ie)
+        {
+            if(IsVarInt<T>::value && ie == IntegerEncoding::VarInt) {
+                if(std::is_signed<T>::value)
+                    return encodeVarUInt(dst, zigZag(static_cast<int64_t>(val)));
+                else
+                    return encodeVarUInt(dst, static_cast<uint64_t>(val));
+            }
+
+            if(ed == Endianness::Big)
+                swap(val);
+
+            mem::copy(dst, &val, sizeof(T));
+            return dst + sizeof(T);
+        }
+
+        template<typename T> inline T fromVarUInt(uint64_t val)
+        {
+            if(std::is_signed<T>::value)
+                return static_cast<T>(unZigZag(val));
+            else
+                return static_cast<T>(val);
+        }
+    }
+
     class DataSerializer
     {
     protected:
@@ -36,20 +128,78 @@ namespace m
     private:
         template<typename T> DataSerializer &_dsWriteT(T val)
         {
-            uint8_t *src = reinterpret_cast<uint8_t*>(&val);
+            uint8_t buf[M_DS_MAX_SCALAR];
+            uint8_t *end = ds::encode(buf, val, m_ed, m_ie);
 
-            if(m_ed == Endianness::Little)
-                dsWrite(src, sizeof(T));
-            else {
-                uint8_t dst[sizeof(T)];
-                for(uint8_t i = 0; i < sizeof(T); i++)
-                    dst[i] = src[sizeof(T) - i - 1];
+            dsWrite(buf, static_cast<int>(end - buf));
+            return *this;
+        }
 
-                dsWrite(dst, sizeof(T));
+        //Visits the fields of a DataStruct, encoding them into a buffer that
+        //is written with a single dsWrite() call whenever it gets full.
+        class StructWriter
+        {
+        public:
+            StructWriter(DataSerializer &ser) : m_ser(ser)
+            {
+                m_pos = 0;
             }
 
-            return *this;
-        }
+            template<typename U> typename std::enable_if<std::is_arithmetic<U>::value, StructWriter&>::type operator & (const U &val)
+            {
+                if(m_pos > M_DS_BUFFER_SIZE - M_DS_MAX_SCALAR)
+                    flush();
+
+                m_pos = static_cast<int>(ds::encode(m_buf + m_pos, val, m_ser.m_ed, m_ser.m_ie) - m_buf);
+                return *this;
+            }
+
+            template<typename U> typename std::enable_if<!std::is_arithmetic<U>::value, StructWriter&>::type operator & (const U &val)
+            {
+                DataStruct<U>::fields(*this, const_cast<U&>(val));
+                return *this;
+            }
+
+            StructWriter &operator & (const String &str)
+            {
+                //Short strings go into the buffer, long ones are written directly
+                if(str.length() + M_DS_MAX_SCALAR + 1 > M_DS_BUFFER_SIZE - m_pos)
+                    flush();
+
+                if(str.length() + M_DS_MAX_SCALAR + 1 > M_DS_BUFFER_SIZE)
+                    m_ser << str;
+                else {
+                    int len = str.length();
+
+                    if(m_ser.m_stringMode == StringSerialization::ByteLenAndContent) {
+                        len = len > 0xFF ? 0xFF : len;
+                        m_buf[m_pos++] = static_cast<uint8_t>(len);
+                    } else if(m_ser.m_stringMode == StringSerialization::UShortLenAndContent)
+                        m_pos = static_cast<int>(ds::encode(m_buf + m_pos, static_cast<uint16_t>(len), m_ser.m_ed, m_ser.m_ie) - m_buf);
+
+                    mem::copy(m_buf + m_pos, str.raw(), static_cast<size_t>(len));
+                    m_pos += len;
+
+                    if(m_ser.m_stringMode == StringSerialization::AppendNullByte)
+                        m_buf[m_pos++] = 0;
+                }
+
+                return *this;
+            }
+
+            void flush()
+            {
+                if(m_pos > 0) {
+                    m_ser.dsWrite(m_buf, m_pos);
+                    m_pos = 0;
+                }
+            }
+
+        private:
+            DataSerializer &m_ser;
+            uint8_t m_buf[M_DS_BUFFER_SIZE];
+            int m_pos;
+        };
 
     public:
         //Constructor
@@ -57,12 +207,14 @@ namespace m
         {
             m_ed = Endianness::Little;
             m_stringMode = StringSerialization::UShortLenAndContent;
+            m_ie = IntegerEncoding::Fixed;
         }
 
         DataSerializer(Endianness ed)
         {
             m_ed = ed;
             m_stringMode = StringSerialization::UShortLenAndContent;
+            m_ie = IntegerEncoding::Fixed;
         }
 
         virtual ~DataSerializer()
@@ -78,26 +230,12 @@ namespace m
 
         DataSerializer &operator << (int16_t data)
         {
-            if(m_ed == Endianness::Little)
-                dsWrite(reinterpret_cast<uint8_t*>(&data), 2);
-            else {
-                int16_t tmp = ((data & 0x00FF) << 8) | ((data & 0xFF00) >> 8);
-                dsWrite(reinterpret_cast<uint8_t*>(&tmp), 2);
-            }
-
-            return *this;
+            return _dsWriteT<int16_t>(data);
         }
 
         DataSerializer &operator << (int32_t data)
         {
-            if(m_ed == Endianness::Little)
-                dsWrite(reinterpret_cast<uint8_t*>(&data), 4);
-            else {
-                int32_t tmp = ((data & 0x000000FF) << 24) | ((data & 0x0000FF00) << 8) | ((data & 0x00FF0000) >> 8) | ((data & 0xFF000000) >> 24);
-                dsWrite(reinterpret_cast<uint8_t*>(&tmp), 4);
-            }
-
-            return *this;
+            return _dsWriteT<int32_t>(data);
         }
 
         DataSerializer &operator << (int64_t data)
@@ -113,12 +251,12 @@ namespace m
 
         DataSerializer &operator << (uint16_t data)
         {
-            return *this << *reinterpret_cast<int16_t*>(&data);
+            return _dsWriteT<uint16_t>(data);
         }
 
         DataSerializer &operator << (uint32_t data)
         {
-            return *this << *reinterpret_cast<int32_t*>(&data);
+            return _dsWriteT<uint32_t>(data);
         }
 
         DataSerializer &operator << (uint64_t data)
@@ -135,7 +273,7 @@ namespace m
 
         DataSerializer &operator << (float data)
         {
-            return *this << *reinterpret_cast<int32_t*>(&data);
+            return _dsWriteT<float>(data);
         }
 
         DataSerializer &operator << (double data)
@@ -229,6 +367,81 @@ namespace m
             return *this << str;
         }
 
+        //Varints, whatever the integer encoding is
+        DataSerializer &writeVarUInt(uint64_t val)
+        {
+            uint8_t buf[M_DS_MAX_SCALAR];
+            dsWrite(buf, static_cast<int>(ds::encodeVarUInt(buf, val) - buf));
+            return *this;
+        }
+
+        DataSerializer &writeVarInt(int64_t val)
+        {
+            return writeVarUInt(ds::zigZag(val));
+        }
+
+        //Bulk writes. Fixed size little endian arrays are written at once,
+        //others are converted by chunks of M_DS_BUFFER_SIZE bytes.
+        template<typename T> DataSerializer &writeArray(const T *data, int count)
+        {
+            static_assert(std::is_arithmetic<T>::value, "writeArray() only supports arithmetic types");
+
+            if(ds::IsVarInt<T>::value && m_ie == IntegerEncoding::VarInt) {
+                uint8_t buf[M_DS_BUFFER_SIZE];
+                uint8_t *pos = buf;
+
+                for(int i = 0; i < count; i++) {
+                    if(pos > buf + M_DS_BUFFER_SIZE - M_DS_MAX_SCALAR) {
+                        dsWrite(buf, static_cast<int>(pos - buf));
+                        pos = buf;
+                    }
+
+                    pos = ds::encode(pos, data[i], m_ed, m_ie);
+                }
+
+                if(pos > buf)
+                    dsWrite(buf, static_cast<int>(pos - buf));
+            } else if(sizeof(T) == 1 || m_ed == Endianness::Little) {
+                if(count > 0)
+                    dsWrite(reinterpret_cast<const uint8_t*>(data), count * static_cast<int>(sizeof(T)));
+            } else {
+                uint8_t buf[M_DS_BUFFER_SIZE];
+                const int perChunk = M_DS_BUFFER_SIZE / static_cast<int>(sizeof(T));
+
+                for(int i = 0; i < count; i += perChunk) {
+                    const int n = count - i < perChunk ? count - i : perChunk;
+
+                    mem::swapBytes(buf, data + i, static_cast<size_t>(n), sizeof(T));
+                    dsWrite(buf, n * static_cast<int>(sizeof(T)));
+                }
+            }
+
+            return *this;
+        }
+
+        //Writes the size of the list as an uint32, then its content
+        template<typename T> DataSerializer &writeList(const List<T> &lst)
+        {
+            *this << static_cast<uint32_t>(lst.size());
+            return writeArray(lst.begin(), lst.size());
+        }
+
+        //See DataStruct
+        template<typename T> DataSerializer &writeStruct(const T &obj)
+        {
+            return writeStructs(&obj, 1);
+        }
+
+        template<typename T> DataSerializer &writeStructs(const T *objs, int count)
+        {
+            StructWriter sw(*this);
+            for(int i = 0; i < count; i++)
+                DataStruct<T>::fields(sw, const_cast<T&>(objs[i]));
+
+            sw.flush();
+            return *this;
+        }
+
         //Getters & setters
         Endianness endianness() const
         {
@@ -250,9 +463,20 @@ namespace m
             m_stringMode = stringMode;
         }
 
+        IntegerEncoding integerEncoding() const
+        {
+            return m_ie;
+        }
+
+        void setIntegerEncoding(IntegerEncoding ie)
+        {
+            m_ie = ie;
+        }
+
     protected:
         Endianness m_ed;
         StringSerialization m_stringMode;
+        IntegerEncoding m_ie;
     };
 
     class DataDeserializer
@@ -263,33 +487,141 @@ namespace m
     private:
         template<typename T> T _dsReadT()
         {
-            uint8_t rd[sizeof(T)];
+            if(ds::IsVarInt<T>::value && m_ie == IntegerEncoding::VarInt)
+                return ds::fromVarUInt<T>(readVarUInt());
 
-            if(m_ed == Endianness::Little)
-                dsRead(rd, sizeof(T));
-            else {
-                uint8_t tmp[sizeof(T)];
-                dsRead(tmp, sizeof(T));
+            T ret;
+            dsRead(reinterpret_cast<uint8_t*>(&ret), sizeof(T));
 
-                for(uint8_t i = 0; i < sizeof(T); i++)
-                    rd[i] = tmp[sizeof(T) - i - 1];
-            }
+            if(m_ed == Endianness::Big)
+                ds::swap(ret);
 
-            return *reinterpret_cast<T*>(rd);
+            return ret;
         }
 
+        //Computes the encoded size of a DataStruct, if it's always the same
+        class StructMeasure
+        {
+        public:
+            StructMeasure(IntegerEncoding ie)
+            {
+                m_ie = ie;
+                size = 0;
+                fixed = true;
+            }
+
+            template<typename U> typename std::enable_if<std::is_arithmetic<U>::value, StructMeasure&>::type operator & (const U &)
+            {
+                if(ds::IsVarInt<U>::value && m_ie == IntegerEncoding::VarInt)
+                    fixed = false;
+                else
+                    size += static_cast<int>(sizeof(U));
+
+                return *this;
+            }
+
+            template<typename U> typename std::enable_if<!std::is_arithmetic<U>::value, StructMeasure&>::type operator & (U &val)
+            {
+                DataStruct<U>::fields(*this, val);
+                return *this;
+            }
+
+            StructMeasure &operator & (String &)
+            {
+                fixed = false;
+                return *this;
+            }
+
+            int size;
+            bool fixed;
+
+        private:
+            IntegerEncoding m_ie;
+        };
+
+        //Decodes a fixed size DataStruct from a buffer
+        class StructDecoder
+        {
+        public:
+            StructDecoder(const uint8_t *src, Endianness ed)
+            {
+                m_src = src;
+                m_ed = ed;
+            }
+
+            template<typename U> typename std::enable_if<std::is_arithmetic<U>::value, StructDecoder&>::type operator & (U &val)
+            {
+                mem::copy(&val, m_src, sizeof(U));
+                m_src += sizeof(U);
+
+                if(m_ed == Endianness::Big)
+                    ds::swap(val);
+
+                return *this;
+            }
+
+            template<typename U> typename std::enable_if<!std::is_arithmetic<U>::value, StructDecoder&>::type operator & (U &val)
+            {
+                DataStruct<U>::fields(*this, val);
+                return *this;
+            }
+
+            StructDecoder &operator & (String &)
+            {
+                //Structs containing strings are never fixed size
+                mAssert(false, "StructDecoder can't decode strings");
+                return *this;
+            }
+
+        private:
+            const uint8_t *m_src;
+            Endianness m_ed;
+        };
+
+        //Reads a variable size DataStruct field by field
+        class StructReader
+        {
+        public:
+            StructReader(DataDeserializer &des) : m_des(des)
+            {
+            }
+
+            template<typename U> typename std::enable_if<std::is_arithmetic<U>::value, StructReader&>::type operator & (U &val)
+            {
+                val = m_des._dsReadT<U>();
+                return *this;
+            }
+
+            template<typename U> typename std::enable_if<!std::is_arithmetic<U>::value, StructReader&>::type operator & (U &val)
+            {
+                DataStruct<U>::fields(*this, val);
+                return *this;
+            }
+
+            StructReader &operator & (String &str)
+            {
+                str = m_des.readString();
+                return *this;
+            }
+
+        private:
+            DataDeserializer &m_des;
+        };
+
     public:
         //Constructor
         DataDeserializer()
         {
             m_ed = Endianness::Little;
             m_stringMode = StringSerialization::UShortLenAndContent;
+            m_ie = IntegerEncoding::Fixed;
         }
 
         DataDeserializer(Endianness ed)
         {
             m_ed = ed;
             m_stringMode = StringSerialization::UShortLenAndContent;
+            m_ie = IntegerEncoding::Fixed;
         }
 
         virtual ~DataDeserializer()
@@ -307,24 +639,12 @@ namespace m
 
         int16_t readShort()
         {
-            int16_t ret;
-            dsRead(reinterpret_cast<uint8_t*>(&ret), 2);
-
-            if(m_ed == Endianness::Little)
-                return ret;
-            else
-                return ((ret & 0x00FF) << 8) | ((ret & 0xFF00) >> 8);
+            return _dsReadT<int16_t>();
         }
 
         int32_t readInt()
         {
-            int32_t ret;
-            dsRead(reinterpret_cast<uint8_t*>(&ret), 4);
-
-            if(m_ed == Endianness::Little)
-                return ret;
-            else
-                return ((ret & 0x000000FF) << 24) | ((ret & 0x0000FF00) << 8) | ((ret & 0x00FF0000) >> 8) | ((ret & 0xFF000000) >> 24);
+            return _dsReadT<int32_t>();
         }
 
         int64_t readInt64()
@@ -342,14 +662,12 @@ namespace m
 
         uint16_t readUShort()
         {
-            int16_t ret = readShort();
-            return *reinterpret_cast<uint16_t*>(&ret);
+            return _dsReadT<uint16_t>();
         }
 
         uint32_t readUInt()
         {
-            int32_t ret = readInt();
-            return *reinterpret_cast<uint32_t*>(&ret);
+            return _dsReadT<uint32_t>();
         }
 
         uint64_t readUInt64()
@@ -368,9 +686,7 @@ namespace m
         float readFloat()
         {
             static_assert(sizeof(float) == 4, "invalid float size");
-
-            int32_t ret = readInt();
-            return *reinterpret_cast<float*>(&ret);
+            return _dsReadT<float>();
         }
 
         double readDouble()
@@ -378,6 +694,28 @@ namespace m
             return _dsReadT<double>();
         }
 
+        //Varints, whatever the integer encoding is
+        uint64_t readVarUInt()
+        {
+            uint64_t ret = 0;
+
+            for(int shift = 0; shift < 64; shift += 7) {
+                uint8_t b;
+                dsRead(&b, 1);
+
+                ret |= static_cast<uint64_t>(b & 0x7F) << shift;
+                if((b & 0x80) == 0)
+                    break;
+            }
+
+            return ret;
+        }
+
+        int64_t readVarInt()
+        {
+            return ds::unZigZag(readVarUInt());
+        }
+
         String readString()
         {
             switch(m_stringMode) {
@@ -425,38 +763,86 @@ namespace m
             }
         }
 
-        //Read operators
-        DataDeserializer &operator >> (char &c)
+        //Bulk reads, see DataSerializer::writeArray()
+        template<typename T> DataDeserializer &readArray(T *dst, int count)
         {
-            dsRead(reinterpret_cast<uint8_t*>(&c), 1);
+            static_assert(std::is_arithmetic<T>::value, "readArray() only supports arithmetic types");
+
+            if(ds::IsVarInt<T>::value && m_ie == IntegerEncoding::VarInt) {
+                for(int i = 0; i < count; i++)
+                    dst[i] = ds::fromVarUInt<T>(readVarUInt());
+            } else if(count > 0) {
+                dsRead(reinterpret_cast<uint8_t*>(dst), count * static_cast<int>(sizeof(T)));
+
+                if(sizeof(T) > 1 && m_ed == Endianness::Big)
+                    mem::swapBytes(dst, dst, static_cast<size_t>(count), sizeof(T));
+            }
+
             return *this;
         }
 
-        DataDeserializer &operator >> (int16_t &data)
+        //Replaces the content of lst by what DataSerializer::writeList() wrote
+        template<typename T> DataDeserializer &readList(List<T> &lst)
         {
-            if(m_ed == Endianness::Little)
-                dsRead(reinterpret_cast<uint8_t*>(&data), 2);
-            else {
-                int16_t tmp;
-                dsRead(reinterpret_cast<uint8_t*>(&tmp), 2);
+            int count = static_cast<int>(readUInt());
+
+            lst.clear();
+            lst.add(T(0), count);
+            return readArray(lst.begin(), count);
+        }
+
+        //See DataStruct
+        template<typename T> DataDeserializer &readStruct(T &obj)
+        {
+            return readStructs(&obj, 1);
+        }
+
+        template<typename T> DataDeserializer &readStructs(T *objs, int count)
+        {
+            if(count <= 0)
+                return *this;
+
+            StructMeasure sm(m_ie);
+            DataStruct<T>::fields(sm, objs[0]);
 
-                data = ((tmp & 0x00FF) << 8) | ((tmp & 0xFF00) >> 8);
+            if(sm.fixed && sm.size > 0 && sm.size <= M_DS_BUFFER_SIZE) {
+                //Read as many structs as possible at once
+                uint8_t buf[M_DS_BUFFER_SIZE];
+                const int perChunk = M_DS_BUFFER_SIZE / sm.size;
+
+                for(int i = 0; i < count; i += perChunk) {
+                    const int n = count - i < perChunk ? count - i : perChunk;
+                    dsRead(buf, n * sm.size);
+
+                    StructDecoder sd(buf, m_ed);
+                    for(int j = 0; j < n; j++)
+                        DataStruct<T>::fields(sd, objs[i + j]);
+                }
+            } else {
+                StructReader sr(*this);
+                for(int i = 0; i < count; i++)
+                    DataStruct<T>::fields(sr, objs[i]);
             }
 
             return *this;
         }
 
-        DataDeserializer &operator >> (int32_t &data)
+        //Read operators
+        DataDeserializer &operator >> (char &c)
         {
-            if(m_ed == Endianness::Little)
-                dsRead(reinterpret_cast<uint8_t*>(&data), 4);
-            else {
-                int32_t tmp;
-                dsRead(reinterpret_cast<uint8_t*>(&tmp), 4);
+            dsRead(reinterpret_cast<uint8_t*>(&c), 1);
+            return *this;
+        }
 
-                data = ((tmp & 0x000000FF) << 24) | ((tmp & 0x0000FF00) << 8) | ((tmp & 0x00FF0000) >> 8) | ((tmp & 0xFF000000) >> 24);
-            }
+        DataDeserializer &operator >> (int16_t &data)
+        {
+            data = _dsReadT<int16_t>();
+            return *this;
+        }
 
+        DataDeserializer &operator >> (int32_t &data)
+        {
+            data = _dsReadT<int32_t>();
             return *this;
         }
 
@@ -474,12 +860,14 @@ namespace m
 
         DataDeserializer &operator >> (uint16_t &data)
         {
-            return *this >> *reinterpret_cast<int16_t*>(&data);
+            data = _dsReadT<uint16_t>();
+            return *this;
         }
 
         DataDeserializer &operator >> (uint32_t &data)
         {
-            return *this >> *reinterpret_cast<int32_t*>(&data);
+            data = _dsReadT<uint32_t>();
+            return *this;
         }
 
         DataDeserializer &operator >> (uint64_t &data)
@@ -507,8 +895,7 @@ namespace m
         {
             static_assert(sizeof(float) == 4, "invalid float size");
 
-            int32_t ret = readInt();
-            data = *reinterpret_cast<float*>(&ret);
+            data = _dsReadT<float>();
             return *this;
         }
 
@@ -539,10 +926,20 @@ namespace m
             m_stringMode = stringMode;
         }
 
+        IntegerEncoding integerEncoding() const
+        {
+            return m_ie;
+        }
+
+        void setIntegerEncoding(IntegerEncoding ie)
+        {
+            m_ie = ie;
+        }
+
     protected:
         Endianness m_ed;
         StringSerialization m_stringMode;
+        IntegerEncoding m_ie;
     };
 
 }
-
@@ -49,6 +49,12 @@ namespace m
         UShortLenAndContent
     };
 
+    enum class IntegerEncoding
+    {
+        Fixed,
+        VarInt //LEB128, and zigzag for signed integers
+    };
+
     enum class LineEnding
     {
         CRLF,   //Windows
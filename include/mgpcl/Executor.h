@@ -0,0 +1,287 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+#include "Thread.h"
+#include "Atomic.h"
+#include "Futex.h"
+#include "Future.h"
+#include "ConcurrentQueue.h"
+#include "List.h"
+#include "RefCounter.h"
+#include <functional>
+
+#define M_EXECUTOR_DEQUE_SIZE 4096
+#define M_EXECUTOR_QUEUE_SIZE 65536
+
+namespace m
+{
+    class Executor;
+
+    /* Chase-Lev work-stealing deque. Only the owner may push() and pop(),
+     * from the bottom; any thread may steal() from the top. Bounded:
+     * push() returns false when the deque is full.
+     */
+    class MGPCL_PREFIX WorkDeque
+    {
+        M_NON_COPYABLE(WorkDeque)
+
+    public:
+        typedef std::function<void()> Task;
+
+        WorkDeque(int capacity = M_EXECUTOR_DEQUE_SIZE);
+        ~WorkDeque();
+
+        bool push(Task *task);
+        Task *pop();
+        Task *steal();
+
+        int size() const
+        {
+            int64_t sz = m_bottom.load() - m_top.load();
+            return sz > 0 ? static_cast<int>(sz) : 0;
+        }
+
+    private:
+        Task **m_tasks;
+        int64_t m_mask;
+        Atomic64 m_top;
+        Atomic64 m_bottom;
+    };
+
+    /* Runs nodes once all of their predecessors ran. Nodes are added
+     * with add() and linked with precede(); run() returns a future
+     * which is set to false if the graph has a cycle, or to true once
+     * every node ran. The graph must not be modified nor destroyed
+     * while it runs, but can be run again once it's done.
+     */
+    class MGPCL_PREFIX TaskGraph
+    {
+        M_NON_COPYABLE(TaskGraph)
+
+    public:
+        TaskGraph();
+        ~TaskGraph();
+
+        int add(std::function<void()> func);
+        void precede(int before, int after); //after will run once before is done
+        Future<bool> run(Executor &ex);
+
+        int size() const
+        {
+            return ~m_nodes;
+        }
+
+        bool isRunning() const
+        {
+            volatile bool running = m_running;
+            return running;
+        }
+
+    private:
+        class Node
+        {
+        public:
+            std::function<void()> func;
+            List<int> successors;
+            int numDeps;
+            Atomic pending;
+        };
+
+        void runNode(int id);
+
+        List<Node*> m_nodes;
+        Executor *m_executor;
+        Promise<bool> m_promise;
+        Atomic64 m_remaining;
+        volatile bool m_running;
+    };
+
+    /* Fixed pool of workers, each with its own WorkDeque. Tasks submitted
+     * from a worker go into its deque; the others go into a shared bounded
+     * queue. Idle workers steal from each other, then sleep on a futex.
+     */
+    class MGPCL_PREFIX Executor
+    {
+        M_NON_COPYABLE(Executor)
+
+    public:
+        Executor(int count = 0, const String &name = "Executor-"_m, uint32_t queueCapacity = M_EXECUTOR_QUEUE_SIZE); //count = 0 means one per core
+        ~Executor(); //Runs the remaining tasks, then joins the workers
+
+        Executor &dispatchOnCores(uint8_t numCpus); //Call before start()
+        bool start();
+        void stop(); //Not from one of this executor's tasks
+        bool setAffinityMask(int worker, uint64_t mask); //Call after start()
+
+        /* Returns false if the executor isn't running or is stopping. If the shared
+         * queue (or the worker's deque) is full, func runs on the calling thread.
+         */
+        bool execute(std::function<void()> func);
+
+        //Like execute(), but also returns false (without running func) if the queue is full
+        bool tryExecute(std::function<void()> func);
+
+        //Runs func on the calling thread if the executor isn't running
+        template<typename T> Future<T> submit(std::function<T()> func)
+        {
+            Promise<T> promise;
+            Future<T> ret(promise.makeNewFuture());
+
+            if(!execute([promise, func] () mutable { promise.set(func()); }))
+                promise.set(func());
+
+            return ret;
+        }
+
+        /* Calls fn(i) for each i in [begin; end[, in chunks of grain
+         * indices, and returns once they're all done. The calling thread
+         * takes chunks too, so this can be called from a task.
+         */
+        template<typename F> void parallelFor(int begin, int end, int grain, F fn)
+        {
+            forEachChunk(begin, end, grain, [&fn] (int, int b, int e) {
+                for(int i = b; i < e; i++)
+                    fn(i);
+            });
+        }
+
+        /* Returns reduce(...reduce(reduce(identity, map(begin)), map(begin + 1))...)
+         * Each chunk is reduced separately, then the chunk results are
+         * reduced in order on the calling thread, so reduce must be associative.
+         */
+        template<typename T, typename Map, typename Reduce> T parallelReduce(int begin, int end, int grain, const T &identity, Map map, Reduce reduce)
+        {
+            List<T> partials;
+            int numChunks = (end > begin) ? (end - begin + grain - 1) / grain : 0;
+
+            for(int i = 0; i < numChunks; i++)
+                partials.add(identity);
+
+            forEachChunk(begin, end, grain, [&partials, &map, &reduce] (int chunk, int b, int e) {
+                T &acc = partials[chunk];
+                for(int i = b; i < e; i++)
+                    acc = reduce(acc, map(i));
+            });
+
+            T ret(identity);
+            for(int i = 0; i < numChunks; i++)
+                ret = reduce(ret, partials[i]);
+
+            return ret;
+        }
+
+        int count() const
+        {
+            return m_count;
+        }
+
+        bool isRunning() const
+        {
+            volatile bool running = m_running;
+            return running;
+        }
+
+        int currentWorker() const; //-1 if not called from a worker
+
+        //Metrics
+        int queueLength() const; //Tasks waiting in the shared queue and in the deques
+
+        uint32_t queueCapacity() const
+        {
+            return m_inject->capacity();
+        }
+
+        int64_t numSubmitted() const
+        {
+            return m_submitted.load();
+        }
+
+        int64_t numCompleted() const
+        {
+            return m_completed.load();
+        }
+
+        //Tasks ran on the submitting thread (or refused by tryExecute()) because the queue was full
+        int64_t numOverflows() const
+        {
+            return m_overflows.load();
+        }
+
+    private:
+        typedef WorkDeque::Task Task;
+
+        class Worker
+        {
+        public:
+            Worker(std::function<void()> func, const String &name) : thread(func, name)
+            {
+            }
+
+            FunctionalThread thread;
+            WorkDeque deque;
+        };
+
+        bool enqueue(std::function<void()> &&func, bool runIfFull);
+        void workerLoop(int id);
+        Task *findTask(int id);
+        void signal();
+        void runTask(Task *task);
+        void forEachChunk(int begin, int end, int grain, std::function<void(int, int, int)> body);
+
+        int m_count;
+        String m_name;
+        uint8_t m_cpus;
+        volatile bool m_running;
+        volatile bool m_stopping;
+        Atomic64 m_executing; //execute() calls that may still push a task; stop() waits for them
+        List<Worker*> m_workers;
+
+        ConcurrentQueue<Task*> *m_inject;
+
+        Futex m_signal;
+        Atomic64 m_sleepers;
+
+        Atomic64 m_submitted;
+        Atomic64 m_completed;
+        Atomic64 m_overflows;
+    };
+
+    /* Shared executor used by execAsync() and async(), created and started
+     * on first use. configureGlobalExecutor() has to be called before that,
+     * otherwise it returns false; count = 0 means one worker per core.
+     */
+    Executor &globalExecutor();
+    bool configureGlobalExecutor(int count, uint32_t queueCapacity = M_EXECUTOR_QUEUE_SIZE);
+
+    /* Like execAsync(), but returns the result of func. func only runs on
+     * the calling thread if not even a new thread could be started.
+     */
+    template<typename T> Future<T> async(std::function<T()> func)
+    {
+        Promise<T> promise;
+        Future<T> ret(promise.makeNewFuture());
+
+        if(!execAsync([promise, func] () mutable { promise.set(func()); }))
+            promise.set(func());
+
+        return ret;
+    }
+}
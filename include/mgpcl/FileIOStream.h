@@ -64,6 +64,13 @@ namespace m
 #endif
     };
 
+    //One piece of a gathered write; see FileOutputStream::writeV()
+    struct IOSlice
+    {
+        const uint8_t *data;
+        int size;
+    };
+
     class MGPCL_PREFIX FileOutputStream : public OutputStream
     {
     public:
@@ -82,19 +89,45 @@ namespace m
         int write(const uint8_t *src, int sz) override;
         uint64_t pos() override;
         bool seek(int amount, SeekPos sp = SeekPos::Beginning) override;
-        bool flush() override;
+        bool flush() override; //Writes buffered data and syncs to disk
         void close() override;
 
+        //Writes all slices in a single system call (as much as possible).
+        //Returns the total amount of bytes written, or -1 on error.
+        int writeV(const IOSlice *slices, int cnt);
+
+        //Hands buffered data over to the OS, without waiting for the disk
+        bool flushBuffer();
+
+        //Durable flush point. If dataOnly is true, metadata such as
+        //the modification time may not be synced (fdatasync).
+        bool sync(bool dataOnly = false);
+
+        //In buffered mode, small writes are accumulated and written
+        //once the buffer is full. 0 (default) disables buffering.
+        bool setBufferSize(uint32_t sz);
+
+        uint32_t bufferSize() const
+        {
+            return m_bufSz;
+        }
+
         bool seekSupported() const override
         {
             return true;
         }
 
     private:
+        int rawWrite(const uint8_t *src, int sz);
+
 #ifdef MGPCL_WIN
         HANDLE m_file;
 #else
         int m_file;
 #endif
+
+        uint8_t *m_buf;
+        uint32_t m_bufSz;
+        uint32_t m_bufLen;
     };
 }
@@ -19,9 +19,27 @@
 
 #pragma once
 #include "List.h"
+#include <type_traits>
+
+#define M_FLATMAP_LINEAR_MAX 8
 
 namespace m
 {
+    template<typename T> class TConstString;
+
+    //Keys that are cheap to compare are searched linearly in small maps
+    template<typename K> class FlatMapCheapKey
+    {
+    public:
+        static const bool value = std::is_arithmetic<K>::value || std::is_pointer<K>::value;
+    };
+
+    //Compared by hash
+    template<typename T> class FlatMapCheapKey<TConstString<T>>
+    {
+    public:
+        static const bool value = true;
+    };
 
     template<typename K, typename V> class FlatMap
     {
@@ -75,176 +93,103 @@ namespace m
 
         void put(const K &key, const V &value)
         {
-            if(m_data.isEmpty())
-                m_data.add(Pair(key, value));
-            else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key) {
-                        m_data[pos].value = value;
-                        return;
-                    } else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
-
-                m_data.insert(begin, Pair(key, value));
-            }
+            int pos = lowerBound(key);
+
+            if(pos < m_data.size() && m_data[pos].key == key)
+                m_data[pos].value = value;
+            else
+                m_data.insert(pos, Pair(key, value));
         }
 
         void put(const K &key, V &&value)
         {
-            if(m_data.isEmpty())
-                m_data.add(Pair(key, std::move(value)));
-            else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key) {
-                        m_data[pos].value = std::move(value);
-                        return;
-                    } else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
-
-                m_data.insert(begin, Pair(key, std::move(value)));
-            }
+            int pos = lowerBound(key);
+
+            if(pos < m_data.size() && m_data[pos].key == key)
+                m_data[pos].value = std::move(value);
+            else
+                m_data.insert(pos, Pair(key, std::move(value)));
         }
 
         V &operator [] (const K &key)
         {
-            if(m_data.isEmpty()) {
-                m_data.add(Pair(key));
-                return m_data.last().value;
-            } else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key)
-                        return m_data[pos].value;
-                    else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
-
-                m_data.insert(begin, Pair(key));
-                return m_data[begin].value;
-            }
+            bool isNew;
+            return get(key, isNew);
         }
 
         V &get(const K &key, bool &isNew)
         {
-            if(m_data.isEmpty()) {
-                isNew = true;
-                m_data.add(Pair(key));
-                return m_data.last().value;
-            } else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key) {
-                        isNew = false;
-                        return m_data[pos].value;
-                    } else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
-
-                isNew = true;
-                m_data.insert(begin, Pair(key));
-                return m_data[begin].value;
-            }
+            int pos = lowerBound(key);
+            isNew = pos >= m_data.size() || !(m_data[pos].key == key);
+
+            if(isNew)
+                m_data.insert(pos, Pair(key));
+
+            return m_data[pos].value;
         }
 
         bool getIfExists(const K &key, const V *&dst) const
         {
-            if(m_data.isEmpty()) {
-                dst = nullptr;
-                return false;
-            } else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key) {
-                        dst = &m_data[pos].value;
-                        return true;
-                    } else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
-
-                dst = nullptr;
-                return false;
-            }
+            int pos = indexOf(key);
+            dst = (pos < 0) ? nullptr : &m_data[pos].value;
+
+            return pos >= 0;
         }
 
         bool hasKey(const K &key) const
         {
-            if(m_data.isEmpty())
+            return indexOf(key) >= 0;
+        }
+
+        bool removeKey(const K &key)
+        {
+            int pos = indexOf(key);
+            if(pos < 0)
                 return false;
-            else {
-                int begin = 0;
-                int end = m_data.size();
 
-                do {
-                    int pos = (begin + end) / 2;
+            m_data.remove(pos);
+            return true;
+        }
 
-                    if(key == m_data[pos].key)
-                        return true;
-                    else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
+        /* For parsers and other bulk inserts: adds a pair without keeping the
+         * keys sorted, so it doesn't move anything. bulkBuild() must be called
+         * once all pairs are added, before any other method.
+         */
+        void bulkAdd(const K &key, const V &value)
+        {
+            m_data.add(Pair(key, value));
+        }
 
-                return false;
-            }
+        void bulkAdd(const K &key, V &&value)
+        {
+            m_data.add(Pair(key, std::move(value)));
         }
 
-        bool removeKey(const K &key)
+        //Sorts the keys in O(n log n). If a key was added several times, the last value wins, like put()
+        void bulkBuild()
         {
-            if(m_data.isEmpty())
-                return false;
-            else {
-                int begin = 0;
-                int end = m_data.size();
-
-                do {
-                    int pos = (begin + end) / 2;
-
-                    if(key == m_data[pos].key) {
-                        m_data.remove(pos);
-                        return true;
-                    } else if(key > m_data[pos].key)
-                        begin = pos + 1;
-                    else
-                        end = pos;
-                } while(begin != end);
+            m_data.mergeSort([] (const Pair &a, const Pair &b) -> bool {
+                return a.key > b.key;
+            });
 
-                return false;
+            //Stable sort: the last duplicate is the one to keep
+            int dst = 0;
+            for(int i = 0; i < m_data.size(); i++) {
+                if(i + 1 < m_data.size() && m_data[i].key == m_data[i + 1].key)
+                    continue;
+
+                if(dst != i)
+                    m_data[dst] = std::move(m_data[i]);
+
+                dst++;
             }
+
+            m_data.truncate(dst);
+        }
+
+        void reserve(int sz)
+        {
+            m_data.reserve(sz);
         }
 
         bool isEmpty() const
@@ -268,6 +213,41 @@ namespace m
         }
 
     private:
+        //Index of the first key not smaller than key, or size()
+        int lowerBound(const K &key) const
+        {
+            const Pair *base = m_data.begin();
+            int n = m_data.size();
+
+            if(FlatMapCheapKey<K>::value && n <= M_FLATMAP_LINEAR_MAX) {
+                int ret = 0;
+                for(int i = 0; i < n; i++)
+                    ret += (key > base[i].key) ? 1 : 0;
+
+                return ret;
+            }
+
+            if(n <= 0)
+                return 0;
+
+            //No early exit, so that the compiler can use conditional moves
+            const Pair *first = base;
+            while(n > 1) {
+                int half = n / 2;
+                base = (key > base[half - 1].key) ? base + half : base;
+                n -= half;
+            }
+
+            return static_cast<int>(base - first) + ((key > base->key) ? 1 : 0);
+        }
+
+        //Returns -1 if key isn't there
+        int indexOf(const K &key) const
+        {
+            int pos = lowerBound(key);
+            return (pos < m_data.size() && m_data[pos].key == key) ? pos : -1;
+        }
+
         List<Pair> m_data;
     };
 
@@ -0,0 +1,50 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+
+//Enough for any double formatted by m::str::formatDouble(), including the null terminator
+#define M_DOUBLE_FORMAT_MAX 32
+
+//TString<wchar_t>::toDouble() only looks at that many chars
+#define M_DOUBLE_PARSE_MAX 128
+
+//Pass this as maxPrec to TString::appendDouble()/fromDouble() to get the shortest round-trip form
+#define M_DOUBLE_SHORTEST (-1)
+
+namespace m
+{
+    //Double <-> text conversions used by TString<char>. Formatting
+    //uses Ryu and prints the shortest string that parses back to
+    //the same double. Parsing uses Clinger's fast path and then the
+    //Eisel-Lemire algorithm, and falls back to strtod() in the very
+    //rare cases where they can't decide.
+    namespace str
+    {
+        //Writes d into dst (at least M_DOUBLE_FORMAT_MAX chars), null terminated.
+        //Returns the number of chars written, not counting the terminator.
+        MGPCL_PREFIX int formatDouble(double d, char *dst);
+
+        //Parses the longest prefix of str that is a number, and stores it into out.
+        //Accepts an optional sign, "inf", "infinity" and "nan" (case insensitive).
+        //Returns the number of chars consumed, 0 if there is no number at all.
+        MGPCL_PREFIX int parseDouble(const char *str, int len, double &out);
+    }
+}
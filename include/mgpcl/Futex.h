@@ -0,0 +1,67 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+#include "Util.h"
+#include <cstdint>
+
+#define M_FUTEX_INFINITE 0xFFFFFFFF
+
+namespace m
+{
+    /* A 32 bits word threads can sleep on, without any mutex: wait()
+     * only sleeps if the value is still the expected one, so a wake()
+     * can't be missed. Uses futex() on Linux and WaitOnAddress() on
+     * Windows (8 and later).
+     */
+    class MGPCL_PREFIX Futex
+    {
+        M_NON_COPYABLE(Futex)
+
+    public:
+        Futex() : m_value(0)
+        {
+        }
+
+        int32_t value() const
+        {
+#ifdef MGPCL_WIN
+            return m_value;
+#else
+            return __atomic_load_n(&m_value, __ATOMIC_ACQUIRE);
+#endif
+        }
+
+        //Returns the new value
+        int32_t increment();
+
+        //Returns false on timeout. May return true spuriously.
+        bool wait(int32_t expected, uint32_t ms = M_FUTEX_INFINITE);
+        void wakeOne();
+        void wakeAll();
+
+    private:
+#ifdef MGPCL_WIN
+        volatile long m_value;
+#else
+        volatile int32_t m_value;
+#endif
+    };
+}
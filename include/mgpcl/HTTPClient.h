@@ -0,0 +1,221 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "HTTPCommons.h"
+#include "TCPSocket.h"
+#include "URL.h"
+#include "HashMap.h"
+#include "Future.h"
+#include "Thread.h"
+#include "Mutex.h"
+#include "Atomic.h"
+#include <functional>
+
+#define M_HTTP_CLIENT_MAX_PER_HOST 6
+#define M_HTTP_CLIENT_PIPELINE_DEPTH 4
+#define M_HTTP_CLIENT_TIMEOUT 30000
+#define M_HTTP_CLIENT_RBUF_SZ 16384
+#define M_HTTP_CLIENT_MAX_LINE 8192
+
+namespace m
+{
+    enum HTTPClientError
+    {
+        kHCE_NoError = 0,
+        kHCE_InvalidURL,
+        kHCE_UnsupportedProtocol, //Only plain HTTP is supported for now
+        kHCE_ResolveFailed,
+        kHCE_ConnectionFailed,
+        kHCE_ConnectionLost,      //The server closed the connection before the end of the response
+        kHCE_InvalidResponse,
+        kHCE_TimedOut,
+        kHCE_Cancelled            //The client was stopped before the request completed
+    };
+
+    //Called from the client's thread, so don't block in there
+    typedef std::function<void(const uint8_t*, int)> HTTPDataCallback;
+
+    class HTTPClientRequest
+    {
+    public:
+        HTTPClientRequest() : type(kHRT_Get)
+        {
+        }
+
+        HTTPClientRequest(HTTPRequestType t, const URL &u) : type(t), url(u)
+        {
+        }
+
+        HTTPRequestType type;
+        URL url;
+        HashMap<String, String, StringLowerHasher> headers;
+        String body;
+
+        //If set, the response body is streamed to it instead of
+        //being stored in HTTPClientResponse::body
+        HTTPDataCallback onData;
+    };
+
+    class HTTPClientResponse
+    {
+    public:
+        HTTPClientResponse() : error(kHCE_NoError), resolveError(kRE_NoError), code(0)
+        {
+        }
+
+        bool isOK() const
+        {
+            return error == kHCE_NoError && code >= 200 && code < 300;
+        }
+
+        HTTPClientError error;
+        DNSResolveError resolveError; //Set if error is kHCE_ResolveFailed
+        int code;
+        String status;
+        HashMap<String, String, StringLowerHasher> headers;
+        String body;
+    };
+
+    /* Asynchronous HTTP client. Requests are submitted from any thread
+     * and executed by a single event loop thread which multiplexes all
+     * connections (epoll on Linux). Each host gets at most
+     * maxConnectionsPerHost() keep-alive connections, extra requests wait
+     * in a per-host queue. When pipelining is enabled, GET and HEAD
+     * requests may also be sent on a busy connection once the server has
+     * shown it keeps connections alive.
+     *
+     * Requests that were sent but not answered when a reused connection
+     * gets closed are retried once (except POSTs).
+     */
+    class HTTPClient
+    {
+        M_NON_COPYABLE(HTTPClient)
+
+    public:
+        HTTPClient();
+        ~HTTPClient();
+
+        bool start();
+        void stop(); //Pending requests will complete with kHCE_Cancelled
+
+        bool isRunning() const
+        {
+            return m_running;
+        }
+
+        Future<HTTPClientResponse> submit(const HTTPClientRequest &req);
+        Future<HTTPClientResponse> get(const URL &url);
+        Future<HTTPClientResponse> get(const URL &url, HTTPDataCallback onData);
+
+        //Change these before start()
+        void setMaxConnectionsPerHost(int cnt)
+        {
+            m_maxPerHost = cnt;
+        }
+
+        int maxConnectionsPerHost() const
+        {
+            return m_maxPerHost;
+        }
+
+        void setPipelining(bool enabled, int depth = M_HTTP_CLIENT_PIPELINE_DEPTH)
+        {
+            m_pipelining = enabled;
+            m_pipelineDepth = depth;
+        }
+
+        bool isPipeliningEnabled() const
+        {
+            return m_pipelining;
+        }
+
+        int pipelineDepth() const
+        {
+            return m_pipelineDepth;
+        }
+
+        //In milliseconds, from submission to the end of the response
+        void setTimeout(int ms)
+        {
+            m_timeout = ms;
+        }
+
+        int timeout() const
+        {
+            return m_timeout;
+        }
+
+        //Statistics
+        uint32_t numConnects() const
+        {
+            return static_cast<uint32_t>(m_numConnects.load());
+        }
+
+        uint32_t numPipelined() const
+        {
+            return static_cast<uint32_t>(m_numPipelined.load());
+        }
+
+    private:
+        class Host;
+        class Connection;
+        class Task;
+        class Poller;
+        class ResolveSink;
+
+        void run();
+        void dispatch(Task *t);
+        Connection *pickConnection(Host *host, Task *t);
+        void schedule(Host *host);
+        Connection *openConnection(Host *host);
+        void onResolved(Host *host, DNSResolveError err, const IPv4Address &addr);
+        void applyLookup(Host *host);
+        void closeConnection(Connection *c, HTTPClientError err);
+        void finish(Task *t, HTTPClientError err);
+        bool onWritable(Connection *c);
+        bool onReadable(Connection *c);
+        bool parse(Connection *c, const uint8_t *data, int len);
+        bool parseLine(Connection *c, const String &line);
+        bool headersDone(Connection *c);
+        bool responseDone(Connection *c);
+        void updateEvents(Connection *c);
+        void checkTimeouts(double now);
+        int nextTimeout(double now);
+        void cancelAll();
+
+        volatile bool m_running;
+        ClassThread<HTTPClient> m_thread;
+        Mutex m_lock;
+        List<Task*> m_incoming;
+        List<Host*> m_resolved; //Lookups that completed, protected by m_lock
+        ResolveSink *m_resolveSink;
+        Poller *m_poller;
+
+        HashMap<String, Host*> m_hosts;
+        List<Host*> m_hostList;
+
+        int m_maxPerHost;
+        bool m_pipelining;
+        int m_pipelineDepth;
+        int m_timeout;
+        Atomic64 m_numConnects; //Updated by the loop, read from anywhere
+        Atomic64 m_numPipelined;
+    };
+}
@@ -0,0 +1,168 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "SSLSocket.h"
+#include "URL.h"
+#include "Mutex.h"
+#include "Atomic.h"
+#include "HashMap.h"
+
+#define M_HTTP_POOL_MAX_IDLE 64
+#define M_HTTP_POOL_MAX_IDLE_PER_HOST 8
+#define M_HTTP_POOL_IDLE_TIMEOUT 15000
+
+namespace m
+{
+    /* Keeps idle keep-alive connections, keyed by scheme, host and port, so
+     * that HTTPRequest doesn't have to connect (and, for HTTPS, handshake)
+     * again for each request. Idle connections are checked before being
+     * reused and HTTPS sessions are resumed when a new connection is needed.
+     * See HTTPRequest::setConnectionPool(). Connections must be released
+     * before the pool is destroyed. Thread-safe.
+     */
+    class HTTPConnectionPool
+    {
+        M_NON_COPYABLE(HTTPConnectionPool)
+
+    public:
+        HTTPConnectionPool();
+        ~HTTPConnectionPool();
+
+        //Returns an idle connection to the server of url, or connects a new one.
+        //Returns nullptr if the connection failed.
+        Socket *acquire(const URL &url);
+
+        //Gives conn back. reusable should be false unless the whole response
+        //was read. Unreusable connections (and extra ones) are deleted.
+        void release(const URL &url, Socket *conn, bool reusable);
+
+        //Closes all idle connections
+        void closeIdle();
+
+        int numIdle();
+
+        void setMaxIdle(int maxIdle)
+        {
+            m_maxIdle = maxIdle;
+        }
+
+        int maxIdle() const
+        {
+            return m_maxIdle;
+        }
+
+        void setMaxIdlePerHost(int maxIdle)
+        {
+            m_maxIdlePerHost = maxIdle;
+        }
+
+        int maxIdlePerHost() const
+        {
+            return m_maxIdlePerHost;
+        }
+
+        //In milliseconds. Servers usually close idle connections after a few seconds.
+        void setIdleTimeout(int ms)
+        {
+            m_idleTimeout = ms;
+        }
+
+        int idleTimeout() const
+        {
+            return m_idleTimeout;
+        }
+
+#ifndef MGPCL_NO_SSL
+        //Set this before acquiring any HTTPS connection
+        void setSSLContext(const SSLContext &ctx)
+        {
+            m_sslCtx = ctx;
+        }
+
+        const SSLContext &sslContext() const
+        {
+            return m_sslCtx;
+        }
+#endif
+
+        //Statistics
+        uint32_t numConnects()
+        {
+            return static_cast<uint32_t>(m_numConnects.get());
+        }
+
+        uint32_t numReuses()
+        {
+            return static_cast<uint32_t>(m_numReuses.get());
+        }
+
+        uint32_t numResumedSessions()
+        {
+            return static_cast<uint32_t>(m_numResumes.get());
+        }
+
+    private:
+        class IdleConnection
+        {
+        public:
+            IdleConnection()
+            {
+                sock = nullptr;
+                since = 0.0;
+            }
+
+            IdleConnection(Socket *s, double t)
+            {
+                sock = s;
+                since = t;
+            }
+
+            Socket *sock;
+            double since;
+        };
+
+        class Host
+        {
+        public:
+            List<IdleConnection> idle;
+        };
+
+        static String hostKey(const URL &url);
+        static bool isAlive(Socket *sock);
+        void removeExpired(Host &host, double now, List<Socket*> &dst);
+        Socket *connect(const URL &url);
+
+        Mutex m_lock;
+        HashMap<String, Host> m_hosts;
+        int m_numIdle;
+        int m_maxIdle;
+        int m_maxIdlePerHost;
+        int m_idleTimeout;
+
+#ifndef MGPCL_NO_SSL
+        SSLContext m_sslCtx;
+        SSLSessionCache m_sessions; //Keyed by host, see SSLSessionCache::hostKey()
+#endif
+
+        Atomic m_numConnects;
+        Atomic m_numReuses;
+        Atomic m_numResumes;
+    };
+}
@@ -21,6 +21,7 @@
 #include "HTTPCommons.h"
 #include "SSLSocket.h"
 #include "HTTPCookieJar.h"
+#include "HTTPConnectionPool.h"
 #include "LineReader.h"
 
 namespace m
@@ -43,7 +44,14 @@ namespace m
             m_followsLoc = false;
             m_jar = nullptr;
             m_conn = nullptr;
+            m_pool = nullptr;
+            m_reusable = false;
             m_lr.setLineEnding(LineEnding::CRLF);
+
+#ifndef MGPCL_NO_SSL
+            m_sessCache = nullptr;
+#endif
+
             m_requestHdr["Connection"_m] = "close"_m;
         }
 
@@ -58,7 +66,14 @@ namespace m
             m_followsLoc = false;
             m_jar = nullptr;
             m_conn = nullptr;
+            m_pool = nullptr;
+            m_reusable = false;
             m_lr.setLineEnding(LineEnding::CRLF);
+
+#ifndef MGPCL_NO_SSL
+            m_sessCache = nullptr;
+#endif
+
             m_requestHdr["Connection"_m] = "close"_m;
         }
 
@@ -72,7 +87,14 @@ namespace m
             m_followsLoc = false;
             m_jar = nullptr;
             m_conn = nullptr;
+            m_pool = nullptr;
+            m_reusable = false;
             m_lr.setLineEnding(LineEnding::CRLF);
+
+#ifndef MGPCL_NO_SSL
+            m_sessCache = nullptr;
+#endif
+
             m_requestHdr["Connection"_m] = "close"_m;
         }
 
@@ -181,7 +203,7 @@ namespace m
 
         inet::SocketError socketError() const
         {
-            return m_conn->lastError();
+            return m_conn == nullptr ? inet::kSE_NoError : m_conn->lastError();
         }
 
         int responseCode() const
@@ -228,6 +250,25 @@ namespace m
                 m_requestHdr["Connection"_m] = "close"_m;
         }
 
+        /* Borrows connections from pool instead of having its own. This enables
+         * keep-alive; the connection is given back as soon as the response has
+         * been entirely read (or right away if it has no content). Redirections
+         * with small bodies are skipped so that the connection can be reused.
+         */
+        void setConnectionPool(HTTPConnectionPool *pool)
+        {
+            killConnection();
+            m_pool = pool;
+
+            if(pool != nullptr)
+                m_requestHdr["Connection"_m] = "keep-alive"_m;
+        }
+
+        HTTPConnectionPool *connectionPool() const
+        {
+            return m_pool;
+        }
+
         /* Please note that followLocation won't work if doesOutput is set. */
         void setFollowsLocation(bool fl)
         {
@@ -262,10 +303,24 @@ namespace m
         {
             return m_sslCtx;
         }
+
+        //Resumes HTTPS sessions keyed by host, see SSLSessionCache. cache must outlive
+        //the request. Not used with a connection pool, which has its own.
+        void setSessionCache(SSLSessionCache *cache)
+        {
+            m_sessCache = cache;
+        }
+
+        SSLSessionCache *sessionCache() const
+        {
+            return m_sessCache;
+        }
 #endif
 
     private:
         bool receiveResponse(bool keepAlive);
+        void responseDone();
+        void discardResponse();
 
         URL m_url;
         HTTPRequestType m_type;
@@ -273,11 +328,14 @@ namespace m
         HashMap<String, String, StringLowerHasher> m_requestHdr;
         HashMap<String, String, StringLowerHasher> m_responseHdr;
         Socket *m_conn;
+        HTTPConnectionPool *m_pool;
+        bool m_reusable; //The connection can be used again once the response is read
         LineReader m_lr;
         String m_status;
 
 #ifndef MGPCL_NO_SSL
         SSLContext m_sslCtx;
+        SSLSessionCache *m_sessCache;
 #endif
 
         int m_rcode;
@@ -324,6 +382,7 @@ namespace m
         }
 
         HTTPInputStream(HTTPRequest *p);
+        void finished();
 
         HTTPRequest *m_req;
         uint32_t m_pos;
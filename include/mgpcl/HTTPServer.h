@@ -24,8 +24,14 @@
 #include "Atomic.h"
 #include "Mutex.h"
 #include "HashMap.h"
+#include "HTTPServerMetrics.h"
 
 #define M_HTTP_SERVER_RBUF_SZ 8192
+#define M_HTTP_SERVER_ZBUF_SZ 8192
+#define M_HTTP_SERVER_MIN_COMPRESS 256
+#define M_HTTP_SERVER_MAX_IDLE_COMPRESSORS 8
+#define M_HTTP_SERVER_MAX_WILDCARDS 8
+#define M_HTTP_SERVER_NUM_METHODS (kHRT_Connect + 1)
 
 namespace m
 {
@@ -36,7 +42,8 @@ namespace m
         friend class HTTPServer;
 
     public:
-        HTTPServerRequest() : m_method(kHRT_Get), m_queryLength(0), m_responseCode(500), m_responseLength(0), m_userdata(nullptr)
+        HTTPServerRequest() : m_method(kHRT_Get), m_http11(true), m_numWildcards(0), m_queryLength(0), m_responseCode(500), m_responseLength(0),
+                              m_responseStreaming(false), m_responseCompressible(true), m_userdata(nullptr)
         {
         }
 
@@ -50,14 +57,30 @@ namespace m
             return m_pathname;
         }
 
+        bool isHTTP11() const
+        {
+            return m_http11;
+        }
+
         int numWildcards() const
         {
-            return ~m_pathWildcards;
+            return m_numWildcards;
+        }
+
+        String wildcard(int idx) const
+        {
+            return m_pathname.substr(m_wildcards[idx * 2], m_wildcards[idx * 2] + m_wildcards[idx * 2 + 1]);
+        }
+
+        //Position of the wildcard in pathname(), doesn't allocate
+        int wildcardOffset(int idx) const
+        {
+            return m_wildcards[idx * 2];
         }
 
-        const String &wildcard(int idx) const
+        int wildcardLength(int idx) const
         {
-            return m_pathWildcards[idx];
+            return m_wildcards[idx * 2 + 1];
         }
 
         bool hasURLParam(const String &key) const
@@ -124,7 +147,8 @@ namespace m
         void setResponseLength(uint64_t len)
         {
             m_responseLength = len;
-            m_responseHeaders["Content-Length"_m] = String::fromUInteger(static_cast<uint32_t>(len));
+            m_responseStreaming = false;
+            m_responseHeaders["Content-Length"_m] = String::fromUInteger64(len);
         }
 
         uint64_t responseLength() const
@@ -132,6 +156,34 @@ namespace m
             return m_responseLength;
         }
 
+        /* Use this instead of setResponseLength() if the length isn't known
+         * in advance. HTTPRequestHandler::sendData() will be called until it
+         * returns 0, and the data is sent with chunked transfer encoding
+         * (or until the connection closes, for HTTP/1.0 clients).
+         */
+        void setResponseStreaming()
+        {
+            m_responseStreaming = true;
+            m_responseLength = 0;
+            m_responseHeaders.removeKey("Content-Length"_m);
+        }
+
+        bool isResponseStreaming() const
+        {
+            return m_responseStreaming;
+        }
+
+        //Set this to false if the data is already compressed (see HTTPServer::setCompression())
+        void setResponseCompressible(bool c)
+        {
+            m_responseCompressible = c;
+        }
+
+        bool isResponseCompressible() const
+        {
+            return m_responseCompressible;
+        }
+
         void setUserdata(void *ud)
         {
             m_userdata = ud;
@@ -145,8 +197,10 @@ namespace m
     private:
         //Query line data (method and path data)
         HTTPRequestType m_method;
+        bool m_http11;
         String m_pathname;
-        List<String> m_pathWildcards;
+        int m_wildcards[M_HTTP_SERVER_MAX_WILDCARDS * 2]; //Offset and length
+        int m_numWildcards;
         HashMap<String, String> m_queryParams;
 
         //Query headers
@@ -160,6 +214,8 @@ namespace m
         //Response header
         HashMap<String, String, StringLowerHasher> m_responseHeaders;
         uint64_t m_responseLength;
+        bool m_responseStreaming;
+        bool m_responseCompressible;
 
         //Misc
         void *m_userdata;
@@ -172,7 +228,7 @@ namespace m
         virtual void beginRequest(HTTPServerRequest *req) = 0; //Called when server received headers
         virtual void receiveData(HTTPServerRequest *req, uint8_t *data, int sz) = 0;
         virtual void processRequest(HTTPServerRequest *req) = 0; //Called on data end; set response here
-        virtual int sendData(HTTPServerRequest *req, uint8_t *dst, int dstSz) = 0; //Return output size
+        virtual int sendData(HTTPServerRequest *req, uint8_t *dst, int dstSz) = 0; //Return output size, 0 ends streamed responses
         virtual void finishRequest(HTTPServerRequest *req, bool success) = 0;
     };
 
@@ -192,7 +248,63 @@ namespace m
         bool start(const IPv4Address &listenAddr, int numThreads);
         void stop(bool graceful = true); //Right now graceful shutdown does nothing
         void set404Handler(HTTPRequestHandler *h);
-        void bindHandler(const String &path, HTTPRequestHandler *h);
+        void bindHandler(const String &path, HTTPRequestHandler *h); //For any method
+
+        /* Method-specific handlers take precedence over the ones bound for
+         * any method. GET handlers also answer HEAD requests. If the path
+         * matches but not the method, the request gets a 405 response.
+         * A "*" component matches any single path component.
+         * Handlers are owned by the server. Bind them before start().
+         */
+        void bindHandler(HTTPRequestType method, const String &path, HTTPRequestHandler *h);
+
+        //Returns the handler the server would use (never nullptr). Doesn't allocate.
+        //If wildcards isn't null, it receives the offset and length of each wildcard.
+        HTTPRequestHandler *route(HTTPRequestType method, const char *path, int len, int *wildcards = nullptr, int *numWildcards = nullptr) const;
+
+        /* Metrics are recorded without locks and can be read at any time.
+         * Route metrics are keyed by the path given to bindHandler(); the
+         * requests that didn't match any route go to unmatchedMetrics().
+         * Worker metrics only exist once the server is started.
+         */
+        int numWorkers() const
+        {
+            return m_threadPool.count();
+        }
+
+        HTTPWorkerMetrics &workerMetrics(int i) const
+        {
+            return worker(i)->m_metrics;
+        }
+
+        HTTPRouteMetrics *routeMetrics(const String &path) const; //nullptr if no handler was bound to path
+
+        HTTPRouteMetrics &unmatchedMetrics() const
+        {
+            return *m_404metrics;
+        }
+
+        void writeMetrics(String &dst); //Appends all metrics in Prometheus text format
+
+#ifndef MGPCL_NO_ZLIB
+        /* Compresses responses on the fly with gzip or deflate, depending
+         * on the client's Accept-Encoding header. Responses shorter than
+         * minLength aren't compressed; streamed ones always are. Compressed
+         * responses are sent with chunked transfer encoding.
+         * Call this before start().
+         */
+        void setCompression(bool enabled, int level = 6, uint32_t minLength = M_HTTP_SERVER_MIN_COMPRESS)
+        {
+            m_compress = enabled;
+            m_compressLevel = level;
+            m_compressMinLength = minLength;
+        }
+
+        bool isCompressionEnabled() const
+        {
+            return m_compress;
+        }
+#endif
 
         void setInactivityTimeout(uint32_t ia)
         {
@@ -231,6 +343,7 @@ namespace m
         };
 
         class Worker;
+        class Compressor;
 
         class Client
         {
@@ -242,7 +355,11 @@ namespace m
             void removeDueToError(const char *err);
             void onHeadersReceived();
             void startResponse();
+            void setupEncoding();
+            bool fillEncoded();
             void finish();
+            void initMetrics();
+            void endRequest(bool ok);
             void stopClient();
 
 #ifdef MGPCL_NO_SSL
@@ -294,6 +411,17 @@ namespace m
             uint64_t m_remDataLen;
             String m_responseBuffer;
             int m_sentLinePos;
+            bool m_encoded; //Chunked and/or compressed body
+            bool m_chunked;
+            bool m_bodyDone;
+            Compressor *m_compressor;
+
+            //Metrics
+            double m_acceptTime;
+            double m_sendStart;
+            HTTPRouteMetrics *m_routeMetrics;
+            uint64_t m_bytesIn;
+            uint64_t m_bytesOut;
         };
 
         class Worker
@@ -309,27 +437,51 @@ namespace m
             static void run(void *data);
             void addClient(const IPv4Address &addr, TCPSocket &&cli);
             void stopClients();
+            Compressor *acquireCompressor(bool gzip);
+            void releaseCompressor(Compressor *c);
 
             HTTPServer *m_parent;
             List<Client*> m_clients;
+            List<Compressor*> m_idleCompressors;
             List<Client*> m_selectedClients;
             Mutex m_clientLock;
             String m_accessBuf;
+            HTTPWorkerMetrics m_metrics;
         };
 
+        //Radix tree, used to build the routing table
         class Node
         {
         public:
-            Node() : m_handler(nullptr), m_fallbackChild(nullptr) {}
-            Node(const String &str) : m_match(str), m_handler(nullptr), m_fallbackChild(nullptr) {}
+            Node();
+            Node(const String &label);
             ~Node();
 
-            Node *child(const String &str);
+            bool hasHandler() const;
+            bool uses(HTTPRequestHandler *h) const;
 
-            String m_match;
-            Node *m_fallbackChild;
+            String m_label;
             List<Node*> m_children;
-            HTTPRequestHandler *m_handler;
+            Node *m_wildcard;
+            HTTPRequestHandler *m_handlers[M_HTTP_SERVER_NUM_METHODS];
+            HTTPRequestHandler *m_anyHandler;
+            HTTPRouteMetrics *m_metrics; //Owned by the server
+        };
+
+        //Flattened Node; children are contiguous and sorted by their first character
+        class Route
+        {
+        public:
+            int labelBegin; //In m_routeLabels
+            int labelLen;
+            int childBegin;
+            int childCount;
+            int wildcard;
+            bool isWildcard;
+            bool hasHandler;
+            HTTPRequestHandler *handlers[M_HTTP_SERVER_NUM_METHODS];
+            HTTPRequestHandler *anyHandler;
+            HTTPRouteMetrics *metrics;
         };
 
         Worker *worker(int i) const
@@ -338,6 +490,11 @@ namespace m
         }
 
         void dispatchClient(const IPv4Address &addr, TCPSocket &&cli);
+        void bindHandler(HTTPRequestType method, bool anyMethod, const String &path, HTTPRequestHandler *h);
+        Node *insertStatic(Node *n, const String &str);
+        void compileRoutes();
+        int matchRoute(int idx, const char *path, int len, int pos, int *wc, int &numWc) const;
+        HTTPRequestHandler *resolve(HTTPRequestType method, const char *path, int len, int *wildcards, int *numWildcards, HTTPRouteMetrics *&metrics) const;
 
         TCPSocket m_server;
         ThreadPool m_threadPool;
@@ -349,8 +506,17 @@ namespace m
 #endif
 
         uint32_t m_inactivityTimeout;
+        bool m_compress;
+        int m_compressLevel;
+        uint32_t m_compressMinLength;
         Node *m_root;
+        List<HTTPRequestHandler*> m_handlers;
+        List<Route> m_routes;
+        String m_routeLabels;
         HTTPRequestHandler *m_404handler;
+        HTTPRequestHandler *m_405handler;
+        List<HTTPRouteMetrics*> m_routeMetrics;
+        HTTPRouteMetrics *m_404metrics;
         SSharedPtr<OutputStream> m_accessLog;
         Mutex m_accessLogLock;
     };
@@ -476,4 +642,16 @@ namespace m
         String m_data;
     };
 
+    //Serves HTTPServer::writeMetrics(), e.g. bindHandler(kHRT_Get, "/metrics"_m, new HTTPMetricsHandler(&server))
+    class HTTPMetricsHandler : public SimpleHTTPRequestHandler
+    {
+    public:
+        HTTPMetricsHandler(HTTPServer *srv) : m_server(srv) {}
+
+        void processRequest(HTTPServerRequest *req) override;
+
+    private:
+        HTTPServer *m_server;
+    };
+
 }
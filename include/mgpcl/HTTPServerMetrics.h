@@ -0,0 +1,212 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Atomic.h"
+#include "String.h"
+#include "Util.h"
+
+#define M_HTTP_HISTOGRAM_SUB_BUCKETS 8
+#define M_HTTP_HISTOGRAM_BUCKETS 256
+
+namespace m
+{
+    /* Log-linear latency histogram, in microseconds (like HDR histograms).
+     * Each power of two is split into 8 buckets, so the relative error
+     * is below 12.5%, up to about 4.7 hours. Recording is lock-free and
+     * doesn't allocate: it can be called from any thread.
+     */
+    class HTTPHistogram
+    {
+        M_NON_COPYABLE(HTTPHistogram)
+
+    public:
+        HTTPHistogram()
+        {
+        }
+
+        void record(uint64_t us)
+        {
+            m_buckets[bucketOf(us)].increment();
+            m_count.increment();
+            m_sum.add(static_cast<int64_t>(us));
+        }
+
+        //Milliseconds, as returned by time::getTimeMs()
+        void recordMs(double ms)
+        {
+            record(ms <= 0.0 ? 0 : static_cast<uint64_t>(ms * 1000.0));
+        }
+
+        uint64_t count()
+        {
+            return static_cast<uint64_t>(m_count.get());
+        }
+
+        //Sum of all recorded values, in microseconds
+        uint64_t sum()
+        {
+            return static_cast<uint64_t>(m_sum.get());
+        }
+
+        uint64_t bucketCount(int idx)
+        {
+            return static_cast<uint64_t>(m_buckets[idx].get());
+        }
+
+        //Approximation of the given percentile (0-100), in microseconds
+        uint64_t percentile(double p);
+
+        /* Appends the histogram in Prometheus text format. labels is
+         * inserted as is in the braces (e.g. "route=\"/\"") and may be
+         * empty. Values are converted to seconds.
+         */
+        void writePrometheus(String &dst, const char *name, const String &labels);
+
+        static int bucketOf(uint64_t us);
+        static uint64_t bucketUpperBound(int idx); //Exclusive
+
+    private:
+        Atomic64 m_buckets[M_HTTP_HISTOGRAM_BUCKETS];
+        Atomic64 m_count;
+        Atomic64 m_sum;
+    };
+
+    //Errors are requests that ended with a 5xx code or were aborted
+    class HTTPRouteMetrics
+    {
+        M_NON_COPYABLE(HTTPRouteMetrics)
+        friend class HTTPServer;
+
+    public:
+        HTTPRouteMetrics(const String &pattern) : m_pattern(pattern)
+        {
+        }
+
+        const String &pattern() const
+        {
+            return m_pattern;
+        }
+
+        uint64_t requests()
+        {
+            return static_cast<uint64_t>(m_requests.get());
+        }
+
+        uint64_t errors()
+        {
+            return static_cast<uint64_t>(m_errors.get());
+        }
+
+        uint64_t bytesIn()
+        {
+            return static_cast<uint64_t>(m_bytesIn.get());
+        }
+
+        uint64_t bytesOut()
+        {
+            return static_cast<uint64_t>(m_bytesOut.get());
+        }
+
+        //Time spent in HTTPRequestHandler::processRequest()
+        HTTPHistogram &handlerTime()
+        {
+            return m_handlerTime;
+        }
+
+    private:
+        String m_pattern;
+        Atomic64 m_requests;
+        Atomic64 m_errors;
+        Atomic64 m_bytesIn;
+        Atomic64 m_bytesOut;
+        HTTPHistogram m_handlerTime;
+    };
+
+    //Errors are connections dropped because of an IO or protocol error
+    class HTTPWorkerMetrics
+    {
+        M_NON_COPYABLE(HTTPWorkerMetrics)
+        friend class HTTPServer;
+
+    public:
+        HTTPWorkerMetrics()
+        {
+        }
+
+        uint64_t connections()
+        {
+            return static_cast<uint64_t>(m_connections.get());
+        }
+
+        uint64_t activeConnections()
+        {
+            return static_cast<uint64_t>(m_activeConnections.get());
+        }
+
+        uint64_t requests()
+        {
+            return static_cast<uint64_t>(m_requests.get());
+        }
+
+        uint64_t errors()
+        {
+            return static_cast<uint64_t>(m_errors.get());
+        }
+
+        uint64_t bytesIn()
+        {
+            return static_cast<uint64_t>(m_bytesIn.get());
+        }
+
+        uint64_t bytesOut()
+        {
+            return static_cast<uint64_t>(m_bytesOut.get());
+        }
+
+        //From accept to the end of the headers, including the SSL handshake
+        HTTPHistogram &headersTime()
+        {
+            return m_headersTime;
+        }
+
+        HTTPHistogram &handlerTime()
+        {
+            return m_handlerTime;
+        }
+
+        //From the end of processRequest() to the last byte sent
+        HTTPHistogram &sendTime()
+        {
+            return m_sendTime;
+        }
+
+    private:
+        Atomic64 m_connections;
+        Atomic64 m_activeConnections;
+        Atomic64 m_requests;
+        Atomic64 m_errors;
+        Atomic64 m_bytesIn;
+        Atomic64 m_bytesOut;
+        HTTPHistogram m_headersTime;
+        HTTPHistogram m_handlerTime;
+        HTTPHistogram m_sendTime;
+    };
+
+}
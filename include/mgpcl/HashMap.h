@@ -369,6 +369,8 @@ namespace m
                     m_buckets[i] = nullptr;
                 }
             }
+
+            m_numElems = 0;
         }
 
         Iterator begin()
@@ -150,6 +150,22 @@ namespace m
             }
         }
 
+        /* For parsers: adds an element to an object without keeping the keys
+         * sorted. endBulkAdd() must be called before accessing the object.
+         */
+        void bulkAddElement(JSONElement &&src)
+        {
+            mAssert(m_type == kJT_Object, "not an object");
+            mAssert(!src.m_name.isEmpty(), "can't add unnamed element to object");
+            dataAs<JSONMap>().bulkAdd(ConstString(src.m_name), std::move(src));
+        }
+
+        void endBulkAdd()
+        {
+            mAssert(m_type == kJT_Object, "not an object");
+            dataAs<JSONMap>().bulkBuild();
+        }
+
         void setName(const String &name)
         {
             mAssert(m_name.isEmpty(), "can't change name after it has been set");
@@ -283,12 +299,15 @@ namespace m
 
         JSONType m_type;
         String m_name;
-        char m_data[sizeof(FlatMap<ConstString, int>)]; //Any type should do it; sizeof(FlatMap) depends of sizeof(List) which doesn't depend on the type
+        //sizeof(FlatMap) depends of sizeof(List) which doesn't depend on the type. String
+        //carries an inline buffer and may be bigger, so take whichever is largest.
+        char m_data[sizeof(String) > sizeof(FlatMap<ConstString, int>) ? sizeof(String) : sizeof(FlatMap<ConstString, int>)];
     };
 
     namespace json
     {
         bool parse(SSharedPtr<InputStream> src, JSONElement &dst, String &err);
+        bool parse(const char *data, uint64_t len, JSONElement &dst, String &err); //No copy; use it with MappedFile
         bool serializeCompact(SSharedPtr<OutputStream> out, JSONElement &src);
         bool serializeHumanReadable(SSharedPtr<OutputStream> out, JSONElement &src);
     }
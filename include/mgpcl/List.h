@@ -22,6 +22,7 @@
 #include "Mem.h"
 #include "Assert.h"
 #include "Util.h"
+#include "Sort.h"
 #include <functional>
 #include <initializer_list>
 
@@ -337,6 +338,80 @@ namespace m
             }
         }
 
+        /* Introsort: quicksort falling back to heap sort, O(n log n) but unstable.
+         * Like insertionSort(), cmpFunc must return true if and only if a > b,
+         * and the version without cmpFunc uses "operator > (const T&) const".
+         */
+        template<typename Gt> void introSort(Gt cmpFunc)
+        {
+            sort::intro(m_data, m_size, cmpFunc);
+        }
+
+        void introSort()
+        {
+            sort::Greater gt;
+            sort::intro(m_data, m_size, gt);
+        }
+
+        //Stable, but allocates size() / 2 elements
+        template<typename Gt> void mergeSort(Gt cmpFunc)
+        {
+            sort::merge(m_data, m_size, cmpFunc);
+        }
+
+        void mergeSort()
+        {
+            sort::Greater gt;
+            sort::merge(m_data, m_size, gt);
+        }
+
+        //Stable. keyFunc must return an integer or floating point key for each element
+        template<typename KeyFunc> void radixSort(KeyFunc keyFunc)
+        {
+            sort::radix(m_data, m_size, keyFunc);
+        }
+
+        //For lists of numbers
+        void radixSort()
+        {
+            sort::radix(m_data, m_size);
+        }
+
+        /* Binary searches, for sorted lists. lowerBound() returns the index of the
+         * first element not smaller than value, upperBound() the index of the first
+         * element greater than value, or size() if there is none.
+         */
+        template<typename V, typename Gt> Size lowerBound(const V &value, Gt cmpFunc) const
+        {
+            return sort::lowerBound(m_data, m_size, value, cmpFunc);
+        }
+
+        template<typename V> Size lowerBound(const V &value) const
+        {
+            sort::Greater gt;
+            return sort::lowerBound(m_data, m_size, value, gt);
+        }
+
+        template<typename V, typename Gt> Size upperBound(const V &value, Gt cmpFunc) const
+        {
+            return sort::upperBound(m_data, m_size, value, cmpFunc);
+        }
+
+        template<typename V> Size upperBound(const V &value) const
+        {
+            sort::Greater gt;
+            return sort::upperBound(m_data, m_size, value, gt);
+        }
+
+        //Returns the index of an element equal to value, or -1
+        template<typename V> Size binarySearch(const V &value) const
+        {
+            sort::Greater gt;
+            Size ret = sort::lowerBound(m_data, m_size, value, gt);
+
+            return (ret < m_size && !gt(m_data[ret], value)) ? ret : Size(-1);
+        }
+
         T &first()
         {
             mDebugAssert(m_size > Size(0), "trying to get first item of empty List");
@@ -370,6 +445,17 @@ namespace m
             m_size = Size(0);
         }
 
+        //Destroys the elements after the first sz ones, keeps the memory
+        void truncate(Size sz)
+        {
+            mDebugAssert(sz >= Size(0) && sz <= m_size, "trying to truncate List to an invalid size");
+
+            for(Size i = sz; i < m_size; ++i)
+                m_data[i].~T();
+
+            m_size = sz;
+        }
+
         List<T, Size> &pop(T &dst)
         {
             mDebugAssert(m_size > Size(0), "trying to pop item from empty List");
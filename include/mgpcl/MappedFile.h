@@ -0,0 +1,184 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+#include "String.h"
+#include "IOStream.h"
+#include "Util.h"
+
+#ifdef MGPCL_WIN
+#define WIN32_LEAN_AND_MEAN
+#include "Windows.h"
+#endif
+
+namespace m
+{
+    enum MapHint
+    {
+        kMH_Normal = 0,
+        kMH_Sequential, //Data will be read from front to back; aggressive read-ahead
+        kMH_Random,     //No read-ahead
+        kMH_WillNeed    //Start paging the data in right away
+    };
+
+    //Read-only memory view of a whole file. The content can be
+    //scanned directly through data() instead of being copied
+    //chunk by chunk into the parser's buffer.
+    class MGPCL_PREFIX MappedFile
+    {
+        M_NON_COPYABLE(MappedFile)
+
+    public:
+        enum OpenError
+        {
+            kOE_Success = 0,
+            kOE_FileNotFound,
+            kOE_Unknown
+        };
+
+        MappedFile();
+        MappedFile(const String &fname, MapHint hint = kMH_Sequential);
+        MappedFile(MappedFile &&src);
+        ~MappedFile();
+
+        OpenError open(const String &fname, MapHint hint = kMH_Sequential);
+        bool advise(MapHint hint, uint64_t offset, uint64_t len);
+        void close();
+
+        bool advise(MapHint hint)
+        {
+            return advise(hint, 0, m_size);
+        }
+
+        bool isOpen() const
+        {
+            return m_open;
+        }
+
+        //Note that data() is nullptr if the file is empty.
+        const uint8_t *data() const
+        {
+            return m_data;
+        }
+
+        const char *chars() const
+        {
+            return reinterpret_cast<const char*>(m_data);
+        }
+
+        uint64_t size() const
+        {
+            return m_size;
+        }
+
+        MappedFile &operator = (MappedFile &&src);
+
+    private:
+        uint8_t *m_data;
+        uint64_t m_size;
+        bool m_open;
+
+#ifdef MGPCL_WIN
+        HANDLE m_file;
+        HANDLE m_mapping;
+#endif
+    };
+
+    //InputStream over a MappedFile. read() is a plain memory copy, but
+    //the whole content is also available through data()/current() so
+    //parsers may skip the stream entirely.
+    class MGPCL_PREFIX MappedInputStream : public InputStream
+    {
+    public:
+        MappedInputStream()
+        {
+            m_pos = 0;
+        }
+
+        MappedInputStream(const String &fname, MapHint hint = kMH_Sequential) : m_file(fname, hint)
+        {
+            m_pos = 0;
+        }
+
+        ~MappedInputStream() override
+        {
+        }
+
+        MappedFile::OpenError open(const String &fname, MapHint hint = kMH_Sequential)
+        {
+            m_pos = 0;
+            return m_file.open(fname, hint);
+        }
+
+        int read(uint8_t *dst, int sz) override;
+        bool seek(int amount, SeekPos sp = SeekPos::Beginning) override;
+
+        uint64_t pos() override
+        {
+            return m_pos;
+        }
+
+        bool seekSupported() const override
+        {
+            return true;
+        }
+
+        void close() override
+        {
+            m_file.close();
+            m_pos = 0;
+        }
+
+        const uint8_t *data() const
+        {
+            return m_file.data();
+        }
+
+        uint64_t length() const
+        {
+            return m_file.size();
+        }
+
+        //Contiguous span starting at the current position
+        const uint8_t *current() const
+        {
+            return m_file.data() + m_pos;
+        }
+
+        uint64_t remaining() const
+        {
+            return m_file.size() - m_pos;
+        }
+
+        MappedFile &file()
+        {
+            return m_file;
+        }
+
+        const MappedFile &file() const
+        {
+            return m_file;
+        }
+
+    private:
+        MappedFile m_file;
+        uint64_t m_pos;
+    };
+}
@@ -21,6 +21,14 @@
 #include "TCPClient.h"
 #include "Logger.h"
 #include "ReadWriteLock.h"
+#include "Mutex.h"
+#include "Cond.h"
+#include "Thread.h"
+#include "FlatMap.h"
+
+#define M_NETLOGGER_PROTOCOL 2
+#define M_NETLOGGER_DEFAULT_FRAME 16384
+#define M_NETLOGGER_DEFAULT_INTERVAL 50
 
 namespace m
 {
@@ -29,30 +37,75 @@ namespace m
         M_NON_COPYABLE(NetLogger)
 
     public:
-        NetLogger()
+        NetLogger() : m_flushThread("NetLogger"_m)
         {
             m_connErr = kSCE_NoError;
             m_filter = ~uint32_t(0);
             m_attempts = 3;
+            initBatching();
 
             m_cli.setConnectionTimeout(1000);
             m_cli.onPacketAvailable.connect(this, &NetLogger::onPacketReceived);
         }
 
-        NetLogger(const String &addr)
+        NetLogger(const String &addr) : m_flushThread("NetLogger"_m)
         {
             m_attempts = 3;
             m_connErr = kSCE_NoError;
             m_filter = ~uint32_t(0);
+            initBatching();
 
             m_cli.setConnectionTimeout(1000);
             m_cli.onPacketAvailable.connect(this, &NetLogger::onPacketReceived);
             connect(addr);
         }
 
+        ~NetLogger() override;
+
         void vlog(LogLevel level, const char *fname, int line, const char *format, VAList *lst) override;
         bool connect(const String &ip);
 
+        /*
+         * In batching mode, log records are accumulated into a frame which
+         * is sent when it reaches maxFrameSize bytes, when it gets older than
+         * intervalMs milliseconds, or when an error is logged. Thread and file
+         * names are only sent once. This must be called before connect(), and
+         * requires a NetLogger receiver that speaks protocol version 2.
+         */
+        void setBatching(bool enabled, uint32_t maxFrameSize = M_NETLOGGER_DEFAULT_FRAME, uint32_t intervalMs = M_NETLOGGER_DEFAULT_INTERVAL)
+        {
+            mAssert(!m_cli.isRunning(), "batching mode must be set before connecting");
+            m_batching = enabled;
+            m_maxFrame = maxFrameSize;
+            m_interval = intervalMs;
+        }
+
+        bool isBatching() const
+        {
+            return m_batching;
+        }
+
+        //LZ4-compresses batched frames
+        void setCompression(bool enabled)
+        {
+            m_batchLock.lock();
+            m_compress = enabled;
+            m_batchLock.unlock();
+        }
+
+        bool isCompressing() const
+        {
+            return m_compress;
+        }
+
+        //Sends the current frame right away
+        void flush()
+        {
+            m_batchLock.lock();
+            flushFrame();
+            m_batchLock.unlock();
+        }
+
         bool isEnabled(LogLevel lvl)
         {
             m_lock.lockFor(RWAction::Reading);
@@ -62,10 +115,7 @@ namespace m
             return (filter & (1 << static_cast<uint32_t>(lvl))) != 0;
         }
 
-        void disconnect()
-        {
-            m_cli.stop();
-        }
+        void disconnect();
 
         bool isRunning()
         {
@@ -105,6 +155,13 @@ namespace m
         }
 
     private:
+        class ThreadName
+        {
+        public:
+            String name;
+            uint16_t id;
+        };
+
         TCPClient m_cli;
         SocketConnectionError m_connErr;
 
@@ -114,5 +171,36 @@ namespace m
         int m_attempts;
         ReadWriteLock m_lock;
         volatile uint32_t m_filter;
+
+        //Batching; everything below is protected by m_batchLock
+        void initBatching();
+        void flushThreadFunc();
+        void flushFrame();
+        uint8_t *frameSpace(uint32_t sz);
+        uint16_t defineName(const char *name, int len);
+        uint16_t threadNameID();
+        uint16_t fileNameID(const char *fname);
+
+        Mutex m_batchLock;
+        Cond m_batchCond;
+        ClassThread<NetLogger> m_flushThread;
+        bool m_flushRunning;
+        bool m_batching;
+        bool m_compress;
+        bool m_connected;
+        uint32_t m_maxFrame;
+        uint32_t m_interval;
+
+        uint8_t *m_frame;
+        uint32_t m_frameLen;
+        uint32_t m_frameAlloc;
+        uint8_t *m_compressed;
+        uint32_t m_compressedAlloc;
+        uint32_t *m_lz4Table;
+        String m_msg;
+
+        FlatMap<uint64_t, ThreadName> m_threadNames;
+        FlatMap<const char*, uint16_t> m_fileNames;
+        uint32_t m_nextNameID;
     };
 }
@@ -0,0 +1,143 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "List.h"
+#include "Thread.h"
+
+#define M_PARALLEL_SORT_THRESHOLD 65536
+
+namespace m
+{
+    namespace sort
+    {
+        template<typename T, typename Size, typename Gt> class ParallelJob
+        {
+        public:
+            static void sortRun(void *ud)
+            {
+                ParallelJob *job = static_cast<ParallelJob*>(ud);
+                intro(job->data + job->begin, job->end - job->begin, *job->gt);
+            }
+
+            static void mergeRuns(void *ud)
+            {
+                ParallelJob *job = static_cast<ParallelJob*>(ud);
+                sort::mergeRuns(job->data + job->begin, job->mid - job->begin, job->end - job->begin, *job->gt, job->buf + job->begin);
+            }
+
+            T *data;
+            T *buf;
+            Size begin;
+            Size mid;
+            Size end;
+            Gt *gt;
+        };
+    }
+
+    /* Splits the list in numThreads runs, sorts them with introSort() on a
+     * ThreadPool, then merges them pairwise, in parallel too. Lists smaller
+     * than M_PARALLEL_SORT_THRESHOLD are sorted on the calling thread.
+     * Unstable; cmpFunc must return true if and only if a > b, and must be
+     * safe to call from several threads at once.
+     */
+    template<typename T, typename Size, typename Gt> void parallelSort(List<T, Size> &lst, int numThreads, Gt cmpFunc)
+    {
+        typedef sort::ParallelJob<T, Size, Gt> Job;
+        const Size n = ~lst;
+
+        if(numThreads <= 1 || n < Size(M_PARALLEL_SORT_THRESHOLD)) {
+            lst.introSort(cmpFunc);
+            return;
+        }
+
+        List<Size> bounds(numThreads + 1);
+        for(int i = 0; i <= numThreads; i++)
+            bounds.add(static_cast<Size>(static_cast<uint64_t>(n) * static_cast<uint64_t>(i) / static_cast<uint64_t>(numThreads)));
+
+        List<Job> jobs(numThreads);
+        ThreadPool pool(numThreads, "PSort-"_m);
+        T *buf = mem::alloc<T>(static_cast<size_t>(n));
+
+        for(int i = 0; i < numThreads; i++) {
+            Job job;
+            job.data = lst.begin();
+            job.buf = buf;
+            job.begin = bounds[i];
+            job.mid = bounds[i];
+            job.end = bounds[i + 1];
+            job.gt = &cmpFunc;
+            jobs.add(job);
+        }
+
+        pool.setCallback(Job::sortRun);
+        for(int i = 0; i < numThreads; i++)
+            pool.setUserdata(i, &jobs[i]);
+
+        pool.start();
+        pool.joinAll();
+
+        while(~bounds > 2) {
+            //Odd runs are carried over to the next round as is
+            List<Size> next;
+            jobs.clear();
+
+            for(int i = 0; i + 2 < ~bounds; i += 2) {
+                Job job;
+                job.data = lst.begin();
+                job.buf = buf;
+                job.begin = bounds[i];
+                job.mid = bounds[i + 1];
+                job.end = bounds[i + 2];
+                job.gt = &cmpFunc;
+
+                jobs.add(job);
+                next.add(bounds[i]);
+            }
+
+            if((~bounds - 1) % 2 != 0)
+                next.add(bounds[~bounds - 2]);
+
+            next.add(n);
+
+            if(~jobs == 1)
+                Job::mergeRuns(&jobs[0]);
+            else {
+                pool.setCount(~jobs);
+                pool.setCallback(Job::mergeRuns);
+
+                for(int i = 0; i < ~jobs; i++)
+                    pool.setUserdata(i, &jobs[i]);
+
+                pool.start();
+                pool.joinAll();
+            }
+
+            bounds = std::move(next);
+        }
+
+        mem::del<T>(buf);
+    }
+
+    //Uses "operator > (const T&) const"
+    template<typename T, typename Size> void parallelSort(List<T, Size> &lst, int numThreads)
+    {
+        parallelSort(lst, numThreads, sort::Greater());
+    }
+}
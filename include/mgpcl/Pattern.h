@@ -19,6 +19,8 @@
 
 #pragma once
 #include "String.h"
+#include "Util.h"
+#include "Mutex.h"
 
 #ifdef MGPCL_ENABLE_PATTERNS
 
@@ -45,8 +47,12 @@ namespace m
     public:
         bool next();
 
+        //Captures that didn't participate in the match are empty
         String capture(int i = 0) const
         {
+            if(m_starts[i] < 0)
+                return String();
+
             return m_str.substr(m_starts[i], m_ends[i]);
         }
 
@@ -83,8 +89,6 @@ namespace m
         {
         }
 
-        int matches();
-
         Pattern *m_pat;
         String m_str;
         int m_strPos;
@@ -92,23 +96,27 @@ namespace m
         List<int> m_ends;
     };
 
-    class PatternNode;
+    class PatternProgram;
 
+    //Patterns are compiled into a program that is matched in linear
+    //time: a lazily built DFA finds where the match ends, then a
+    //Pike VM resolves the captures. Capture 0 is the whole match,
+    //the others follow the order of the opening parenthesis.
     class Pattern
     {
         friend class Matcher;
 
     public:
-        Pattern() : m_root(nullptr), m_flags(0), m_err(kPPE_NoError)
+        Pattern() : m_prog(nullptr), m_flags(0), m_err(kPPE_NoError)
         {
         }
 
-        explicit Pattern(const String &str) : m_root(nullptr), m_flags(0), m_err(kPPE_NoError)
+        explicit Pattern(const String &str) : m_prog(nullptr), m_flags(0), m_err(kPPE_NoError)
         {
             compile(str.raw(), str.length());
         }
 
-        explicit Pattern(const char *str, int len = -1) : m_root(nullptr), m_flags(0), m_err(kPPE_NoError)
+        explicit Pattern(const char *str, int len = -1) : m_prog(nullptr), m_flags(0), m_err(kPPE_NoError)
         {
             compile(str, len);
         }
@@ -119,56 +127,50 @@ namespace m
         
         Matcher matcher(const String &str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
+            mAssert(m_prog != nullptr, "can't make matcher out of invalid pattern");
             return Matcher(this, str);
         }
 
         Matcher matcher(String &&str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
+            mAssert(m_prog != nullptr, "can't make matcher out of invalid pattern");
             return Matcher(this, str);
         }
 
         Matcher matcher(const char *str, int len = -1)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
+            mAssert(m_prog != nullptr, "can't make matcher out of invalid pattern");
             return Matcher(this, String(str, len));
         }
 
         bool operator == (const String &str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return Matcher(this, str).next();
+            return test(str.raw(), str.length());
         }
 
         bool operator == (String &&str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return Matcher(this, str).next();
+            return test(str.raw(), str.length());
         }
 
         bool operator == (const char *str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return Matcher(this, String(str)).next();
+            return test(str, static_cast<int>(strlen(str)));
         }
 
         bool operator != (const String &str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return !Matcher(this, str).next();
+            return !test(str.raw(), str.length());
         }
 
         bool operator != (String &&str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return !Matcher(this, str).next();
+            return !test(str.raw(), str.length());
         }
 
         bool operator != (const char *str)
         {
-            mAssert(m_root != nullptr, "can't make matcher out of invalid pattern");
-            return !Matcher(this, String(str)).next();
+            return !test(str, static_cast<int>(strlen(str)));
         }
 
         bool compile(const String &str)
@@ -183,19 +185,76 @@ namespace m
 
         bool operator ! () const
         {
-            return m_root == nullptr;
+            return m_prog == nullptr;
         }
 
         bool isValid() const
         {
-            return m_root != nullptr;
+            return m_prog != nullptr;
         }
 
+        //True if the pattern is found somewhere in str
+        bool test(const char *str, int len);
+
     private:
-        PatternNode *m_root;
+        PatternProgram *m_prog;
         uint32_t m_flags;
         PatternParseError m_err;
     };
+
+    class PatternSetProgram;
+
+    //Matches many patterns in a single scan of the input. All of
+    //them are compiled into one automaton, built on the first call
+    //to matches() following an add(). Pattern IDs are given by add()
+    //and start from zero. matches() can be called from many threads
+    //at once, but not while add() or clear() are running.
+    class PatternSet
+    {
+        M_NON_COPYABLE(PatternSet)
+
+    public:
+        PatternSet() : m_prog(nullptr), m_err(kPPE_NoError)
+        {
+        }
+
+        ~PatternSet();
+
+        //Returns the pattern ID, or -1 if it couldn't be parsed
+        int add(const char *str, int len = -1);
+        void clear();
+
+        int add(const String &str)
+        {
+            return add(str.raw(), str.length());
+        }
+
+        //Appends the IDs of the patterns found in str, sorted
+        bool matches(const char *str, int len, List<int> &ids) const;
+
+        bool matches(const String &str, List<int> &ids) const
+        {
+            return matches(str.raw(), str.length(), ids);
+        }
+
+        int size() const
+        {
+            return ~m_sources;
+        }
+
+        PatternParseError parseError() const
+        {
+            return m_err;
+        }
+
+        const char *parseErrorString() const;
+
+    private:
+        List<String> m_sources;
+        mutable Mutex m_lock; //Guards the lazy build of m_prog
+        mutable PatternSetProgram *m_prog;
+        PatternParseError m_err;
+    };
 }
 
 #endif
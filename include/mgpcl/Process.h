@@ -25,7 +25,10 @@
 #include "IOStream.h"
 #include "RefCounter.h"
 #include "SharedPtr.h"
+#include "Mutex.h"
+#include "Cond.h"
 #include <initializer_list>
+#include <functional>
 
 #ifdef MGPCL_WIN
 #define WIN32_LEAN_AND_MEAN
@@ -37,6 +40,7 @@
 namespace m
 {
     class Process;
+    class ProcessGroup;
 
     class ProcessInfo
     {
@@ -80,6 +84,7 @@ namespace m
     class ProcessPipe
     {
         friend class Process;
+        friend class ProcessGroup;
         friend class PipeInputStream;
         friend class PipeOutputStream;
 
@@ -194,9 +199,16 @@ namespace m
         uint64_t m_pos;
     };
 
+    enum ProcessSpawnMethod
+    {
+        kPSM_Spawn = 0, //posix_spawn(), which doesn't copy the page tables. Falls back to fork() if needed
+        kPSM_Fork       //Always fork() + exec()
+    };
+
     class Process
     {
         M_NON_COPYABLE(Process)
+        friend class ProcessGroup;
 
 #ifdef MGPCL_LINUX
         friend void m::linux::setProcessUID(Process &p, uid_t uid);
@@ -216,6 +228,7 @@ namespace m
         Process &waitFor();
         bool isRunning() const;
         int exitCode();
+        bool kill();
 
         Process &setWorkingDirectory(const String &wd)
         {
@@ -266,6 +279,18 @@ namespace m
             return m_redirSTD;
         }
 
+        //Ignored on Windows, which always uses CreateProcess()
+        Process &setSpawnMethod(ProcessSpawnMethod psm)
+        {
+            m_spawnMethod = psm;
+            return *this;
+        }
+
+        ProcessSpawnMethod spawnMethod() const
+        {
+            return m_spawnMethod;
+        }
+
         String cenv(const String &key) const
         {
             //Child Env != (Parent) Env
@@ -341,12 +366,15 @@ namespace m
         EnvMap m_env;
         uint32_t m_pid;
         bool m_redirSTD;
+        ProcessSpawnMethod m_spawnMethod;
 
         ProcessPipes *m_handles;
 
 #ifdef MGPCL_WIN
         HANDLE m_process;
 #else
+        pid_t spawnChild(const char *wdir, const char **args, const char **env, int nullFd);
+
         bool m_started;
         bool m_finished;
         int m_retCode;
@@ -357,4 +385,131 @@ namespace m
         gid_t m_targetGID;
 #endif
     };
+
+    /* Keeps started children around, for commands that are run often and
+     * can wait for their input (on stdin, for instance). setup() is called
+     * on each new Process, before start(). take() hands over a started
+     * Process, which has to be deleted by the caller, and refills the pool
+     * in the background using execAsync().
+     */
+    class ProcessPool
+    {
+        M_NON_COPYABLE(ProcessPool)
+
+    public:
+        typedef std::function<void(Process&)> Setup;
+
+        ProcessPool(Setup setup, int warm = 4);
+        ~ProcessPool(); //Kills the children that weren't taken
+
+        int fill(); //Spawns children until there's enough of them; returns how many were spawned
+        Process *take(); //nullptr if the process couldn't start
+
+        int warmCount() const
+        {
+            return m_warm;
+        }
+
+        int readyCount();
+
+        uint64_t numHits() const
+        {
+            return m_hits;
+        }
+
+        uint64_t numMisses() const
+        {
+            return m_misses;
+        }
+
+    private:
+        Process *spawn();
+
+        Setup m_setup;
+        int m_warm;
+        List<Process*> m_ready;
+        int m_spawning;
+        bool m_refilling;
+        uint64_t m_hits;
+        uint64_t m_misses;
+
+        Mutex m_lock;
+        Cond m_cond;
+    };
+
+#ifdef MGPCL_LINUX
+    /* Watches many children from a single thread, using epoll and (if the
+     * kernel has it) pidfd_open(). Their stdout and stderr are streamed to
+     * the output callback as they come, so no pipe buffer ever fills up.
+     * The exit callback is called once a child exited and both its outputs
+     * were closed; children that run for longer than their timeout are
+     * killed, and their outputs are not waited for (their own children
+     * may still have them open). Processes must be started, are not owned by the group, and
+     * must not be read from by anything else while they're in it (their
+     * pipes are non-blocking until they leave the group).
+     */
+    class ProcessGroup
+    {
+        M_NON_COPYABLE(ProcessGroup)
+
+    public:
+        typedef std::function<void(Process &p, ProcessPipeID pipe, const uint8_t *data, int sz)> OutputCallback;
+        typedef std::function<void(Process &p, int exitCode, bool timedOut)> ExitCallback;
+
+        ProcessGroup();
+        ~ProcessGroup();
+
+        ProcessGroup &setOutputCallback(OutputCallback cb)
+        {
+            m_onOutput = cb;
+            return *this;
+        }
+
+        ProcessGroup &setExitCallback(ExitCallback cb)
+        {
+            m_onExit = cb;
+            return *this;
+        }
+
+        bool add(Process &p, uint32_t timeoutMs = 0); //timeoutMs = 0 means no timeout
+        bool poll(uint32_t ms); //Handles events for at most ms milliseconds; false once the group is empty
+        void run(); //Until every child exited
+
+        int size() const
+        {
+            return ~m_entries;
+        }
+
+    private:
+        class Entry;
+
+        class Source
+        {
+        public:
+            Entry *entry;
+            int kind; //kPPI_StdOut, kPPI_StdErr or kPPI_Count for the pidfd
+        };
+
+        class Entry
+        {
+        public:
+            Process *proc;
+            int fds[kPPI_Count + 1]; //Indexed like Source::kind, -1 once closed
+            int pipeFlags[kPPI_Count]; //Restored by unwatch(), since the pipes belong to the Process
+            Source sources[kPPI_Count + 1];
+            double deadline;
+            bool exited;
+            bool timedOut;
+        };
+
+        void handle(Source *src);
+        void reap(Entry *e);
+        void unwatch(Entry *e, int kind);
+
+        int m_epoll;
+        List<Entry*> m_entries;
+        OutputCallback m_onOutput;
+        ExitCallback m_onExit;
+    };
+#endif
 }
@@ -23,6 +23,8 @@
 #include "Config.h"
 
 #ifndef MGPCL_NO_SSL
+#define M_SSL_SESSION_CACHE_SIZE 20480
+#define M_SSL_SESSION_TIMEOUT 300 //In seconds
 
 namespace m
 {
@@ -41,6 +43,18 @@ namespace m
         kSVF_VerifyClientOnce = 4
     };
 
+    //Server side session counters, see SSLContext::sessionStats()
+    class SSLSessionStats
+    {
+    public:
+        long accepts;  //Completed handshakes, resumed or not
+        long hits;     //Resumed with the cache or a ticket
+        long misses;   //Resumption asked by the client but not possible
+        long timeouts; //Sessions that were found but had expired
+        long cacheFull;
+        long cacheSize;
+    };
+
     class SSLContext
     {
     public:
@@ -60,6 +74,15 @@ namespace m
         bool useCertificateFile(const String &file);
         bool usePrivateKeyFile(const String &file);
 
+        /* Server side resumption. The session cache keeps the sessions in
+         * memory, tickets let clients keep them (encrypted with a key of
+         * this context). Both are enabled by default in OpenSSL; tickets
+         * only help clients that keep their session, see SSLSessionCache.
+         */
+        bool enableSessionCache(bool enabled, long maxSize = M_SSL_SESSION_CACHE_SIZE, long timeoutSec = M_SSL_SESSION_TIMEOUT);
+        bool enableSessionTickets(bool enabled);
+        SSLSessionStats sessionStats() const;
+
         SSLContext &operator = (const SSLContext &src);
         SSLContext &operator = (SSLContext &&src);
 
@@ -20,6 +20,8 @@
 #pragma once
 #include "TCPSocket.h"
 #include "SSLContext.h"
+#include "HashMap.h"
+#include "Mutex.h"
 #include "Config.h"
 
 #ifndef MGPCL_NO_SSL
@@ -44,6 +46,85 @@ namespace m
         kSAE_UnknownError
     };
 
+    class SSLSocket;
+
+    //A TLS session negotiated by a client SSLSocket. Giving it to another
+    //SSLSocket (created from the same SSLContext) before connecting to the
+    //same server lets it skip the full handshake. Reference counted.
+    class SSLSession
+    {
+        friend class SSLSocket;
+
+    public:
+        SSLSession()
+        {
+            m_sess_ = nullptr;
+        }
+
+        SSLSession(const SSLSession &src);
+        SSLSession(SSLSession &&src);
+        ~SSLSession();
+
+        SSLSession &operator = (const SSLSession &src);
+        SSLSession &operator = (SSLSession &&src);
+
+        bool isValid() const
+        {
+            return m_sess_ != nullptr;
+        }
+
+        bool isResumable() const;
+
+        void *raw() const
+        {
+            return m_sess_;
+        }
+
+    private:
+        void *m_sess_;
+    };
+
+    /* Client side sessions, keyed by host (see hostKey()). Give it to
+     * SSLSockets with setSessionCache() before connect(): they'll resume
+     * the last session of the host and store theirs when they're done.
+     * Sessions must come from the same SSLContext. Thread-safe.
+     */
+    class SSLSessionCache
+    {
+        M_NON_COPYABLE(SSLSessionCache)
+        friend class SSLSocket;
+
+    public:
+        SSLSessionCache() : m_hits(0), m_misses(0)
+        {
+        }
+
+        //Lower case host name and port. Not the IP: virtual hosts sharing one must not share sessions.
+        static String hostKey(const String &host, uint16_t port);
+
+        SSLSession get(const String &key);
+        void put(const String &key, const SSLSession &sess);
+        void remove(const String &key);
+        void clear();
+
+        //Handshakes that resumed a session, or had to do everything
+        uint64_t numHits() const
+        {
+            return m_hits;
+        }
+
+        uint64_t numMisses() const
+        {
+            return m_misses;
+        }
+
+    private:
+        Mutex m_lock;
+        HashMap<String, SSLSession> m_sessions;
+        uint64_t m_hits;
+        uint64_t m_misses;
+    };
+
     class SSLSocket : public TCPSocket
     {
     public:
@@ -105,7 +186,30 @@ namespace m
             return m_lastWantedOp;
         }
 
+        /* Session resumption (client side). Call setSession() after initialize()
+         * and before connect(). session() returns an invalid SSLSession if the
+         * handshake isn't done yet.
+         */
+        bool setSession(const SSLSession &sess);
+        SSLSession session() const;
+        bool isSessionReused() const;
+
+        //Server Name Indication (client side). Call after initialize() and before connect().
+        bool setServerName(const String &host);
+
+        const String &serverName() const
+        {
+            return m_serverName;
+        }
+
+        /* cache must outlive the socket. Without a key, SSLSessionCache::hostKey()
+         * is used with the server name; if there's none either, the cache isn't used.
+         */
+        void setSessionCache(SSLSessionCache *cache, const String &key = String());
+
     private:
+        void saveSession();
+
         template<class T> int sslRW(const T &data);
         SSLAcceptError initializeAndAccept(const SSLContext &ctx, SOCKET sock);
 
@@ -113,6 +217,9 @@ namespace m
         void *m_ssl_;
         unsigned int m_lastSSLErr;
         SSLWantedOperation m_lastWantedOp;
+        SSLSessionCache *m_sessCache;
+        String m_sessKey;
+        String m_serverName;
     };
 }
 
@@ -20,6 +20,8 @@
 #pragma once
 #include "LineOStream.h"
 #include "HashMap.h"
+#include "Thread.h"
+#include <functional>
 
 namespace m
 {
@@ -35,6 +37,9 @@ namespace m
     //Simple config can read very simple INI-like configuration files.
     //The benefit from using this instead of JSON (for instance) is that
     //it does not override the user's formatting.
+    //
+    //reload() only re-parses the categories whose text changed since the
+    //last (re)load, and watch() can tell you when the file was modified.
     class SimpleConfig
     {
         M_NON_COPYABLE(SimpleConfig)
@@ -48,6 +53,11 @@ namespace m
             }
 
             virtual bool writeTo(LineOutputStream *los) = 0;
+
+            virtual bool isCategory() const
+            {
+                return false;
+            }
         };
 
         class EmptyLine : public Line
@@ -66,6 +76,11 @@ namespace m
             String suffix; //Blanks and/or comment
 
             bool writeTo(LineOutputStream *los) override;
+
+            bool isCategory() const override
+            {
+                return true;
+            }
         };
 
         class AssignLine : public Line
@@ -106,46 +121,83 @@ namespace m
                 return m_line->value.isEmpty() ? strIfEmpty : m_line->value;
             }
 
+            //Typed values are parsed once, then cached until the value changes
             int asInt(int def = 0) const
             {
-                return m_line->value.isEmpty() ? def : m_line->value.toInteger();
+                if(m_line->value.isEmpty())
+                    return def;
+
+                if((m_cached & kCV_Int) == 0) {
+                    m_int = m_line->value.toInteger();
+                    m_cached |= kCV_Int;
+                }
+
+                return m_int;
             }
 
             double asDouble(double def = 0.0) const
             {
-                return m_line->value.isEmpty() ? def : m_line->value.toDouble();
+                if(m_line->value.isEmpty())
+                    return def;
+
+                if((m_cached & kCV_Double) == 0) {
+                    m_double = m_line->value.toDouble();
+                    m_cached |= kCV_Double;
+                }
+
+                return m_double;
             }
 
-            bool asBool(bool def = false) const;
+            bool asBool(bool def = false) const
+            {
+                if(m_line->value.isEmpty())
+                    return def;
+
+                if((m_cached & kCV_Bool) == 0) {
+                    m_bool = parseBool(m_line->value);
+                    m_cached |= kCV_Bool;
+                }
+
+                return m_bool;
+            }
 
             void setValue(const String &val)
             {
                 m_line->value = val;
+                changed();
             }
 
             void setIntValue(int val)
             {
                 m_line->value = String::fromInteger(val);
+                changed();
+
+                m_int = val;
+                m_cached = kCV_Int;
             }
 
             void setDoubleValue(double val)
             {
                 m_line->value = String::fromDouble(val, 8);
+                changed();
             }
 
             void setBool10(bool val)
             {
                 m_line->value = val ? "1" : "0";
+                changed();
             }
 
             void setBoolTF(bool val)
             {
                 m_line->value = val ? "true" : "false";
+                changed();
             }
 
             void setBoolOO(bool val)
             {
                 m_line->value = val ? "on" : "off";
+                changed();
             }
 
             bool isEmpty() const
@@ -159,14 +211,30 @@ namespace m
             }
 
         private:
+            enum CachedValue
+            {
+                kCV_Int = 1,
+                kCV_Double = 2,
+                kCV_Bool = 4
+            };
+
             Property()
             {
                 m_parent = nullptr;
                 m_line = nullptr;
+                m_cached = 0;
             }
 
+            static bool parseBool(const String &val);
+            void changed();
+
             Category *m_parent;
             AssignLine *m_line;
+
+            mutable int m_cached; //CachedValue flags
+            mutable int m_int;
+            mutable double m_double;
+            mutable bool m_bool;
         };
 
         //Do not keep a Category outside the scope of its corresponding SimpleConfig.
@@ -191,9 +259,22 @@ namespace m
         private:
             Category();
 
+            //The map moves categories when it grows, so their properties have to follow
+            Category(const Category &src);
+            Category(Category &&src);
+            Category &operator = (const Category &src);
+            Category &operator = (Category &&src);
+            void adoptProperties();
+
             SimpleConfig *m_parent;
             CategoryLine *m_line;
             HashMap<String, Property> m_data;
+
+            //Used by reload() to skip unchanged categories
+            uint32_t m_size;
+            uint32_t m_checksum;
+            uint32_t m_gen;
+            bool m_dirty; //Modified since the last (re)load, or defined more than once
         };
 
         SimpleConfig();
@@ -203,6 +284,22 @@ namespace m
         bool save();
         ConfigLoadError load();
 
+        //Like load(), but categories whose text didn't change are kept as they are
+        //(along with their cached values). Categories modified through this object
+        //are always re-parsed, discarding the modifications.
+        ConfigLoadError reload();
+
+        //Calls func from another thread each time the file gets written or replaced
+        //(this includes save()). It won't reload() by itself; that's up to you,
+        //along with the synchronization. Uses inotify on Linux.
+        bool watch(std::function<void()> func);
+        void unwatch();
+
+        bool isWatching() const
+        {
+            return m_watching;
+        }
+
         ConfigLoadError lastError() const
         {
             return m_lastErr;
@@ -228,12 +325,28 @@ namespace m
         Category &operator[](const String &cat);
 
     private:
-        bool parseLine(const String &line, String &ccat);
+        bool parseLine(const String &line, String &ccat, List<Line*> &dst);
+        void watchThread();
 
         String m_fname;
         int m_errLine;
         List<Line*> m_lines;
         HashMap<String, Category> m_data;
         ConfigLoadError m_lastErr;
+        uint32_t m_gen;
+
+        ClassThread<SimpleConfig> m_watchThread;
+        std::function<void()> m_watchFunc;
+        String m_watchName;
+        volatile bool m_watching;
+
+#ifdef MGPCL_WIN
+        HANDLE m_watchChange;
+        HANDLE m_watchStop;
+        FILETIME m_watchTime;
+#else
+        int m_watchFd;
+        int m_watchPipe[2];
+#endif
     };
 }
@@ -0,0 +1,388 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "Config.h"
+#include "Mem.h"
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+#define M_SORT_INSERTION_THRESHOLD 16
+
+/* Sorting algorithms working on raw arrays, used by m::List.
+ * Like List::insertionSort(), comparators must return true
+ * if and only if a > b. All of these sort in ascending order.
+ */
+
+namespace m
+{
+    namespace sort
+    {
+        //Stable
+        template<typename T, typename Size, typename Gt> void insertion(T *data, Size n, Gt &gt)
+        {
+            for(Size i = Size(1); i < n; ++i) {
+                if(!gt(data[i - 1], data[i]))
+                    continue;
+
+                T tmp(std::move(data[i]));
+                Size j = i;
+
+                do {
+                    data[j] = std::move(data[j - 1]);
+                    --j;
+                } while(j > Size(0) && gt(data[j - 1], tmp));
+
+                data[j] = std::move(tmp);
+            }
+        }
+
+        template<typename T, typename Size, typename Gt> void siftDown(T *data, Size root, Size n, Gt &gt)
+        {
+            for(;;) {
+                Size child = root * Size(2) + Size(1);
+                if(child >= n)
+                    break;
+
+                if(child + Size(1) < n && gt(data[child + Size(1)], data[child]))
+                    ++child;
+
+                if(!gt(data[child], data[root]))
+                    break;
+
+                std::swap(data[root], data[child]);
+                root = child;
+            }
+        }
+
+        template<typename T, typename Size, typename Gt> void heap(T *data, Size n, Gt &gt)
+        {
+            for(Size i = n / Size(2); i > Size(0); --i)
+                siftDown(data, i - Size(1), n, gt);
+
+            for(Size i = n - Size(1); i > Size(0); --i) {
+                std::swap(data[0], data[i]);
+                siftDown(data, Size(0), i, gt);
+            }
+        }
+
+        template<typename T, typename Size, typename Gt> void introRecursive(T *data, Size n, Gt &gt, int depth)
+        {
+            while(n > Size(M_SORT_INSERTION_THRESHOLD)) {
+                if(depth-- <= 0) {
+                    //Quicksort is going quadratic, fall back to heap sort
+                    heap(data, n, gt);
+                    return;
+                }
+
+                //Median of three, which also gives us sentinels for the partition loops
+                const Size mid = n / Size(2);
+                const Size last = n - Size(1);
+
+                if(gt(data[0], data[mid]))
+                    std::swap(data[0], data[mid]);
+
+                if(gt(data[mid], data[last]))
+                    std::swap(data[mid], data[last]);
+
+                if(gt(data[0], data[mid]))
+                    std::swap(data[0], data[mid]);
+
+                const Size pv = last - Size(1);
+                std::swap(data[mid], data[pv]);
+
+                Size i = Size(0);
+                Size j = pv;
+
+                for(;;) {
+                    while(gt(data[pv], data[++i]));
+                    while(gt(data[--j], data[pv]));
+
+                    if(i >= j)
+                        break;
+
+                    std::swap(data[i], data[j]);
+                }
+
+                std::swap(data[i], data[pv]);
+
+                //Recurse on the smaller part, so that the stack depth stays in O(log n)
+                const Size right = n - i - Size(1);
+                if(i < right) {
+                    introRecursive(data, i, gt, depth);
+                    data += i + Size(1);
+                    n = right;
+                } else {
+                    introRecursive(data + i + Size(1), right, gt, depth);
+                    n = i;
+                }
+            }
+
+            insertion(data, n, gt);
+        }
+
+        //Unstable, in place, O(n log n) worst case
+        template<typename T, typename Size, typename Gt> void intro(T *data, Size n, Gt &gt)
+        {
+            int depth = 0;
+            for(Size i = n; i > Size(1); i /= Size(2))
+                depth += 2;
+
+            introRecursive(data, n, gt, depth);
+        }
+
+        /* Merges the sorted runs [0, mid) and [mid, n). buf is uninitialized
+         * memory for at least mid elements. Stable.
+         */
+        template<typename T, typename Size, typename Gt> void mergeRuns(T *data, Size mid, Size n, Gt &gt, T *buf)
+        {
+            if(mid <= Size(0) || mid >= n || !gt(data[mid - Size(1)], data[mid]))
+                return; //Already in order
+
+            for(Size i = Size(0); i < mid; ++i)
+                new(buf + i) T(std::move(data[i]));
+
+            Size i = Size(0);
+            Size j = mid;
+            Size k = Size(0);
+
+            while(i < mid && j < n) {
+                if(gt(buf[i], data[j]))
+                    data[k++] = std::move(data[j++]);
+                else
+                    data[k++] = std::move(buf[i++]);
+            }
+
+            while(i < mid)
+                data[k++] = std::move(buf[i++]);
+
+            for(Size l = Size(0); l < mid; ++l)
+                buf[l].~T();
+        }
+
+        template<typename T, typename Size, typename Gt> void mergeRecursive(T *data, Size n, Gt &gt, T *buf)
+        {
+            if(n <= Size(M_SORT_INSERTION_THRESHOLD)) {
+                insertion(data, n, gt);
+                return;
+            }
+
+            const Size mid = n / Size(2);
+            mergeRecursive(data, mid, gt, buf);
+            mergeRecursive(data + mid, n - mid, gt, buf);
+            mergeRuns(data, mid, n, gt, buf);
+        }
+
+        //Stable, needs n/2 elements of temporary memory
+        template<typename T, typename Size, typename Gt> void merge(T *data, Size n, Gt &gt)
+        {
+            if(n <= Size(M_SORT_INSERTION_THRESHOLD)) {
+                insertion(data, n, gt);
+                return;
+            }
+
+            T *buf = mem::alloc<T>(static_cast<size_t>(n / Size(2) + Size(1)));
+            mergeRecursive(data, n, gt, buf);
+            mem::del<T>(buf);
+        }
+
+        //Maps a key to an unsigned integer with the same ordering
+        template<typename K> typename std::enable_if<std::is_integral<K>::value && std::is_unsigned<K>::value, uint64_t>::type radixKey(K k)
+        {
+            return static_cast<uint64_t>(k);
+        }
+
+        template<typename K> typename std::enable_if<std::is_integral<K>::value && std::is_signed<K>::value, uint64_t>::type radixKey(K k)
+        {
+            typedef typename std::make_unsigned<K>::type U;
+            return static_cast<uint64_t>(static_cast<U>(k) ^ (static_cast<U>(1) << (sizeof(K) * 8 - 1)));
+        }
+
+        //Negative floats have their bits reversed; NaNs end up on both sides
+        template<typename K> typename std::enable_if<std::is_same<K, float>::value, uint64_t>::type radixKey(K k)
+        {
+            uint32_t bits;
+            mem::copy(&bits, &k, sizeof(uint32_t));
+
+            return static_cast<uint64_t>((bits & 0x80000000U) ? ~bits : (bits | 0x80000000U));
+        }
+
+        template<typename K> typename std::enable_if<std::is_same<K, double>::value, uint64_t>::type radixKey(K k)
+        {
+            uint64_t bits;
+            mem::copy(&bits, &k, sizeof(uint64_t));
+
+            return (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+        }
+
+        /* LSD radix sort on the bytes of keyOf(data[i]), which must be an
+         * integer, a float or a double. Stable. Passes where all the keys
+         * share the same byte are skipped.
+         */
+        template<typename T, typename Size, typename KeyOf> void radix(T *data, Size n, KeyOf &keyOf)
+        {
+            typedef decltype(keyOf(*data)) KeyType;
+            typedef typename std::remove_cv<typename std::remove_reference<KeyType>::type>::type K;
+            static_assert(std::is_arithmetic<K>::value, "radix sort keys must be integers or floating point numbers");
+
+            if(n <= Size(1))
+                return;
+
+            //Sort the keys with their indices, then move the elements once
+            struct Entry
+            {
+                uint64_t key;
+                Size idx;
+            };
+
+            Entry *entries = new Entry[static_cast<size_t>(n) * 2];
+            Entry *src = entries;
+            Entry *dst = entries + n;
+            Size counts[256];
+
+            for(Size i = Size(0); i < n; ++i) {
+                src[i].key = radixKey<K>(keyOf(data[i]));
+                src[i].idx = i;
+            }
+
+            for(int shift = 0; shift < static_cast<int>(sizeof(K) * 8); shift += 8) {
+                mem::zero(counts, sizeof(counts));
+
+                for(Size i = Size(0); i < n; ++i)
+                    ++counts[(src[i].key >> shift) & 0xFF];
+
+                if(counts[(src[0].key >> shift) & 0xFF] == n)
+                    continue;
+
+                Size total = Size(0);
+                for(int b = 0; b < 256; b++) {
+                    Size c = counts[b];
+                    counts[b] = total;
+                    total += c;
+                }
+
+                for(Size i = Size(0); i < n; ++i)
+                    dst[counts[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+                std::swap(src, dst);
+            }
+
+            T *sorted = mem::alloc<T>(static_cast<size_t>(n));
+            for(Size i = Size(0); i < n; ++i)
+                new(sorted + i) T(std::move(data[src[i].idx]));
+
+            for(Size i = Size(0); i < n; ++i) {
+                data[i] = std::move(sorted[i]);
+                sorted[i].~T();
+            }
+
+            mem::del<T>(sorted);
+            delete[] entries;
+        }
+
+        //Specialized version for arithmetic arrays, sorting the values directly
+        template<typename T, typename Size> void radix(T *data, Size n)
+        {
+            static_assert(std::is_arithmetic<T>::value, "use the keyed version of radix sort for non-arithmetic types");
+
+            if(n <= Size(1))
+                return;
+
+            T *buf = mem::alloc<T>(static_cast<size_t>(n));
+            T *src = data;
+            T *dst = buf;
+            Size counts[256];
+
+            for(int shift = 0; shift < static_cast<int>(sizeof(T) * 8); shift += 8) {
+                mem::zero(counts, sizeof(counts));
+
+                for(Size i = Size(0); i < n; ++i)
+                    ++counts[(radixKey<T>(src[i]) >> shift) & 0xFF];
+
+                if(counts[(radixKey<T>(src[0]) >> shift) & 0xFF] == n)
+                    continue;
+
+                Size total = Size(0);
+                for(int b = 0; b < 256; b++) {
+                    Size c = counts[b];
+                    counts[b] = total;
+                    total += c;
+                }
+
+                for(Size i = Size(0); i < n; ++i)
+                    dst[counts[(radixKey<T>(src[i]) >> shift) & 0xFF]++] = src[i];
+
+                std::swap(src, dst);
+            }
+
+            if(src != data)
+                mem::copy(data, src, static_cast<size_t>(n) * sizeof(T));
+
+            mem::del<T>(buf);
+        }
+
+        //First index i such that !(value > data[i]), or n
+        template<typename T, typename V, typename Size, typename Gt> Size lowerBound(const T *data, Size n, const V &value, Gt &gt)
+        {
+            Size lo = Size(0);
+
+            while(n > Size(0)) {
+                Size half = n / Size(2);
+
+                if(gt(value, data[lo + half])) {
+                    lo += half + Size(1);
+                    n -= half + Size(1);
+                } else
+                    n = half;
+            }
+
+            return lo;
+        }
+
+        //First index i such that data[i] > value, or n
+        template<typename T, typename V, typename Size, typename Gt> Size upperBound(const T *data, Size n, const V &value, Gt &gt)
+        {
+            Size lo = Size(0);
+
+            while(n > Size(0)) {
+                Size half = n / Size(2);
+
+                if(gt(data[lo + half], value))
+                    n = half;
+                else {
+                    lo += half + Size(1);
+                    n -= half + Size(1);
+                }
+            }
+
+            return lo;
+        }
+
+        //Default comparator, uses operator >
+        class Greater
+        {
+        public:
+            template<typename A, typename B> bool operator () (const A &a, const B &b) const
+            {
+                return a > b;
+            }
+        };
+    }
+}
@@ -23,6 +23,8 @@
 #include "Util.h"
 #include "Assert.h"
 #include "VAList.h"
+#include "StringSearch.h"
+#include "FloatConv.h"
 #include <functional>
 #include <cstdlib>
 #include <cctype>
@@ -30,8 +32,89 @@
 #include <limits>
 #include <cmath>
 
+//Short strings are stored inside the TString object itself
+#define M_STR_INLINE_BYTES 24
+
 namespace m
 {
+    template<typename T> class TString;
+
+    //Non-owning view on a part of a string. It is NOT null-terminated,
+    //and only valid as long as the string it points to.
+    template<typename T> class TStringView
+    {
+    public:
+        TStringView() : m_data(nullptr), m_len(0)
+        {
+        }
+
+        TStringView(const T *data, int len) : m_data(data), m_len(len)
+        {
+        }
+
+        const T *raw() const
+        {
+            return m_data;
+        }
+
+        int length() const
+        {
+            return m_len;
+        }
+
+        bool isEmpty() const
+        {
+            return m_len <= 0;
+        }
+
+        T operator[] (int idx) const
+        {
+            return m_data[idx];
+        }
+
+        bool equals(const T *str, int len) const
+        {
+            return m_len == len && mem::cmp(m_data, str, m_len * sizeof(T)) == 0;
+        }
+
+        bool operator == (const TString<T> &str) const
+        {
+            return equals(str.raw(), str.length());
+        }
+
+        bool operator != (const TString<T> &str) const
+        {
+            return !equals(str.raw(), str.length());
+        }
+
+        bool operator == (const T *str) const
+        {
+            for(int i = 0; i < m_len; i++) {
+                if(m_data[i] != str[i])
+                    return false;
+            }
+
+            return str[m_len] == 0;
+        }
+
+        bool operator != (const T *str) const
+        {
+            return !(*this == str);
+        }
+
+        TString<T> toString() const
+        {
+            TString<T> ret(m_len);
+            ret.append(m_data, m_len);
+
+            return ret;
+        }
+
+    private:
+        const T *m_data;
+        int m_len;
+    };
+
     template<typename T> class MGPCL_PREFIX TString
     {
     public:
@@ -50,9 +133,8 @@ namespace m
                 m_len   = 0;
                 m_alloc = -1;
             } else {
-                m_data  = new T[1];
+                m_data  = allocate(1);
                 m_len   = 0;
-                m_alloc = 1;
 
                 m_data[0] = T(0);
             }
@@ -60,22 +142,28 @@ namespace m
 
         TString(const TString<T> &src)
         {
-            m_len   = src.m_len;
-            m_alloc = src.m_alloc;
+            m_len = src.m_len;
 
-            if(src.isLiteral())
-                m_data = src.m_data;
-            else {
-                m_data = new T[m_alloc];
+            if(src.isLiteral()) {
+                m_data  = src.m_data;
+                m_alloc = -1;
+            } else {
+                m_data = allocate(m_len + 1);
                 mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
             }
         }
 
         TString(TString<T> &&src)
         {
-            m_len   = src.m_len;
-            m_alloc = src.m_alloc;
-            m_data  = src.m_data;
+            m_len = src.m_len;
+
+            if(src.isInline()) {
+                m_data = allocate(m_len + 1);
+                mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
+            } else {
+                m_alloc = src.m_alloc;
+                m_data  = src.m_data;
+            }
 
             src.m_data = nullptr;
         }
@@ -88,8 +176,7 @@ namespace m
             while(str[m_len] != 0)
                 m_len++;
 
-            m_alloc = m_len + 1;
-            m_data = new T[m_alloc];
+            m_data = allocate(m_len + 1);
             mem::copy(m_data, str, (m_len + 1) * sizeof(T));
         }
 
@@ -104,8 +191,7 @@ namespace m
             } else
                 m_len = len;
 
-            m_alloc = m_len + 1;
-            m_data  = new T[m_alloc];
+            m_data = allocate(m_len + 1);
             mem::copy(m_data, str, m_len * sizeof(T));
             m_data[m_len] = 0;
         }
@@ -113,17 +199,15 @@ namespace m
 
         TString(int sz)
         {
-            m_alloc   = sz + 1;
             m_len     = 0;
-            m_data    = new T[m_alloc];
+            m_data    = allocate(sz + 1);
             m_data[0] = 0;
         }
 
         TString(T chr, int cnt)
         {
-            m_alloc = cnt + 1;
             m_len = cnt;
-            m_data = new T[m_alloc];
+            m_data = allocate(cnt + 1);
 
             for(int i = 0; i < m_len; i++)
                 m_data[i] = chr;
@@ -133,8 +217,7 @@ namespace m
 
         ~TString()
         {
-            if(m_data != nullptr && !isLiteral())
-                delete[] m_data;
+            release();
         }
 
         bool isLiteral() const
@@ -142,6 +225,12 @@ namespace m
             return m_alloc < 0;
         }
 
+        //True if the string is short enough to be stored in the object itself
+        bool isInline() const
+        {
+            return m_data == m_inline;
+        }
+
         void clear()
         {
             if(m_len != 0) {
@@ -150,13 +239,10 @@ namespace m
                     m_len   = 0;
                     m_alloc = -1;
                 } else {
-                    if(!isLiteral() && m_data != nullptr)
-                        delete[] m_data;
+                    release();
 
-                    m_data = new T[1];
+                    m_data = allocate(1);
                     m_data[0] = T(0);
-
-                    m_alloc = 1;
                     m_len = 0;
                 }
             }
@@ -168,9 +254,8 @@ namespace m
                 if(sizeof(T) == 1)
                     m_data = const_cast<T*>("");
                 else {
-                    m_data    = new T[1];
+                    m_data    = allocate(1);
                     m_data[0] = T(0);
-                    m_alloc   = 1;
                 }
             } else
                 m_data[0] = T(0);
@@ -266,43 +351,25 @@ namespace m
 
         TString<T> &operator = (const TString<T> &src)
         {
-            //So, this is complicated...
-            //Case 1:  this->isLiteral() and  src.isLiteral() => just copy all values
-            //Case 2:  this->isLiteral() and !src.isLiteral() => allocate m_data and copy src content
-            //Case 3: !this->isLiteral() and  src.isLiteral() => eventually free m_data, and then copy values
-            //Case 4: !this->isLiteral() and !src.isLiteral() => eventually free m_data, eventually allocate a new m_data, and copy src content
+            if(this == &src)
+                return *this;
 
-            if(isLiteral()) {
-                if(src.isLiteral()) {
-                    m_data = src.m_data;
-                    m_len  = src.m_len; //m_alloc is already -1
-                } else {
-                    m_len   = src.m_len;
-                    m_alloc = m_len + 1;
-                    m_data  = new T[m_alloc];
+            if(src.isLiteral()) {
+                //Literals can be shared
+                release();
 
-                    mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
-                }
+                m_data  = src.m_data;
+                m_len   = src.m_len;
+                m_alloc = -1;
             } else {
-                if(src.isLiteral()) {
-                    if(m_data != nullptr)
-                        delete[] m_data;
-
-                    m_data  = src.m_data;
-                    m_len   = src.m_len;
-                    m_alloc = -1;
-                } else {
-                    if(m_len != src.m_len) {
-                        if(m_data != nullptr)
-                            delete[] m_data;
-
-                        m_len   = src.m_len;
-                        m_alloc = m_len + 1;
-                        m_data  = new T[m_alloc];
-                    }
-
-                    mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
+                //Reuse our buffer if it's big enough
+                if(isLiteral() || m_data == nullptr || m_alloc < src.m_len + 1) {
+                    release();
+                    m_data = allocate(src.m_len + 1);
                 }
+
+                m_len = src.m_len;
+                mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
             }
 
             return *this;
@@ -310,12 +377,20 @@ namespace m
 
         TString<T> &operator = (TString<T> &&src)
         {
-            if(m_data != nullptr && !isLiteral())
-                delete[] m_data;
+            if(this == &src)
+                return *this;
+
+            release();
+            m_len = src.m_len;
+
+            if(src.isInline()) {
+                m_data = allocate(m_len + 1);
+                mem::copy(m_data, src.m_data, (m_len + 1) * sizeof(T));
+            } else {
+                m_alloc = src.m_alloc;
+                m_data  = src.m_data;
+            }
 
-            m_alloc    = src.m_alloc;
-            m_len      = src.m_len;
-            m_data     = src.m_data;
             src.m_data = nullptr;
             return *this;
         }
@@ -327,12 +402,9 @@ namespace m
             while(str[len] != 0)
                 len++;
         
-            if(m_alloc != len) {
-                if(m_data != nullptr && !isLiteral())
-                    delete[] m_data;
-
-                m_alloc = len + 1;
-                m_data = new T[m_alloc];
+            if(isLiteral() || m_data == nullptr || m_alloc < len + 1) {
+                release();
+                m_data = allocate(len + 1);
             }
 
             m_len = len;
@@ -560,6 +632,14 @@ namespace m
         int indexOf(T chr, int beg = 0) const
         {
             if(beg >= 0) {
+                if /*constexpr*/ (sizeof(T) == 1) {
+                    if(beg >= m_len)
+                        return -1;
+
+                    int ret = str::findChar(reinterpret_cast<const char*>(m_data) + beg, m_len - beg, static_cast<char>(chr));
+                    return (ret < 0) ? -1 : ret + beg;
+                }
+
                 for(int i = beg; i < m_len; i++) {
                     if(m_data[i] == chr)
                         return i;
@@ -587,6 +667,14 @@ namespace m
                 return -1;
 
             if(beg >= 0) {
+                if /*constexpr*/ (sizeof(T) == 1) {
+                    if(beg >= m_len)
+                        return -1;
+
+                    int ret = str::findAnyOf(reinterpret_cast<const char*>(m_data) + beg, m_len - beg, reinterpret_cast<const char*>(str), len);
+                    return (ret < 0) ? -1 : ret + beg;
+                }
+
                 for(int i = beg; i < m_len; i++) {
                     for(int j = 0; j < len; j++) {
                         if(m_data[i] == str[j])
@@ -623,25 +711,22 @@ namespace m
                 return -1;
 
             if(beg >= 0) {
-                int match = 0;
+                if(beg + len > m_len)
+                    return -1;
 
-                for(int i = beg; i < m_len; i++) {
-                    if(m_data[i] == str[match]) {
-                        if(++match >= len) //Bingo!
-                            return i - len + 1;
-                    } else if(match > 0)
-                        match = 0; //Doesn't match, reset
+                if /*constexpr*/ (sizeof(T) == 1) {
+                    int ret = str::find(reinterpret_cast<const char*>(m_data) + beg, m_len - beg, reinterpret_cast<const char*>(str), len);
+                    return (ret < 0) ? -1 : ret + beg;
                 }
-            } else {
-                len--; //len becomes end
-                int match = len;
 
-                for(int i = m_len + beg; i >= 0; i--) {
-                    if(m_data[i] == str[match]) {
-                        if(--match < 0) //Bingo!
-                            return i;
-                    } else if(match < len)
-                        match = len; //Doesn't match, reset
+                for(int i = beg; i <= m_len - len; i++) {
+                    if(m_data[i] == str[0] && mem::cmp(m_data + i, str, len * sizeof(T)) == 0)
+                        return i;
+                }
+            } else { //Reverse search, the match ends at m_len + beg at most
+                for(int i = m_len + beg - len + 1; i >= 0; i--) {
+                    if(m_data[i] == str[0] && mem::cmp(m_data + i, str, len * sizeof(T)) == 0)
+                        return i;
                 }
             }
 
@@ -890,62 +975,27 @@ namespace m
             return (hasSign && m_data[0] == '-') ? -ret : ret;
         }
 
+        //Parses the longest prefix that is a number, see str::parseDouble()
         double toDouble() const
         {
-            bool hasSign = (m_data[0] == '-' || m_data[0] == '+');
-            int intPart = 0;
-            double fracMult = 1.0, dexp = 1.0;
-            int i;
-            char chr;
-
-            //Parse integral part
-            for(i = hasSign ? 1 : 0; m_data[i] != '.' && m_data[i] != 'e' && m_data[i] != 'E' && i < m_len; i++) {
-                chr = m_data[i];
-                if(chr < '0' || chr > '9')
-                    return static_cast<double>((hasSign && m_data[0] == '-') ? -intPart : intPart);
-
-                intPart = intPart * 10 + static_cast<int>(chr - '0');
-            }
-
-            double val = static_cast<double>(intPart);
-            if(m_data[i] == '.') {
-                //Parse fractional part
-                i++;
+            double ret = 0.0;
 
-                for(; m_data[i] != 'e' && m_data[i] != 'E' && i < m_len; i++) {
-                    chr = m_data[i];
-                    if(chr < '0' || chr > '9')
-                        return (hasSign && m_data[0] == '-') ? -val : val;
-
-                    fracMult *= 0.1;
-                    val += static_cast<double>(chr - '0') * fracMult;
-                }
-            }
-
-            if(m_data[i] == 'e' || m_data[i] == 'E') {
-                //Parse exponent
-                i++;
-                bool expNeg = (m_data[i] == '-');
-                int expVal = 0;
-
-                if(expNeg || m_data[i] == '+')
-                    i++;
-
-                for(; i < m_len; i++) {
-                    chr = m_data[i];
-                    if(chr < '0' || chr > '9')
-                        break;
+            if(sizeof(T) == 1)
+                str::parseDouble(reinterpret_cast<const char*>(m_data), m_len, ret);
+            else {
+                //Non-ASCII chars can't be part of a number anyway
+                char buf[M_DOUBLE_PARSE_MAX];
+                int len = 0;
 
-                    expVal = expVal * 10 + static_cast<int>(chr - '0');
+                while(len < m_len && len < M_DOUBLE_PARSE_MAX && m_data[len] > 0 && m_data[len] < 128) {
+                    buf[len] = static_cast<char>(m_data[len]);
+                    len++;
                 }
 
-                dexp = pow(10.0, static_cast<double>(expNeg ? -expVal : expVal));
+                str::parseDouble(buf, len, ret);
             }
 
-            if(hasSign && m_data[0] == '-') //Negative
-                return -val * dexp;
-            else
-                return val * dexp;
+            return ret;
         }
 
         TString<T> trimmedLeft() const
@@ -1031,17 +1081,11 @@ namespace m
 
             if(chrLen > 0) {
                 int prev = 0;
+                int i;
 
-                for(int i = 0; i < m_len; i++) {
-                    for(int j = 0; j < chrLen; j++) {
-                        if(m_data[i] == chars[j]) {
-                            //We need to split here
-                            dst.add(substr(prev, i)); //Does not include the separator
-                            prev = i + 1; //Exclude the separator from next match
-
-                            break;
-                        }
-                    }
+                while((i = indexOfAnyOf(chars, prev, chrLen)) >= 0) {
+                    dst.add(substr(prev, i)); //Does not include the separator
+                    prev = i + 1; //Exclude the separator from next match
                 }
 
                 //Append the last match
@@ -1052,11 +1096,11 @@ namespace m
         void splitOn(T match, List<TString<T>> &dst) const
         {
             int prev = 0;
-            for(int i = 0; i < m_len; i++) {
-                if(m_data[i] == match) {
-                    dst.add(substr(prev, i));
-                    prev = i + 1;
-                }
+            int i;
+
+            while((i = indexOf(match, prev)) >= 0) {
+                dst.add(substr(prev, i));
+                prev = i + 1;
             }
 
             dst.add(substr(prev));
@@ -1072,24 +1116,11 @@ namespace m
 
             if(strLen > 0) {
                 int prev = 0;
-                int begin = 0;
-                int matches = 0;
-
-                for(int i = 0; i < m_len; i++) {
-                    if(m_data[i] == str[matches]) {
-                        if(matches == 0)
-                            begin = i; //Match beginning
+                int i;
 
-                        if(++matches >= strLen) {
-                            //We need to split here
-                            dst.add(substr(prev, begin));
-                            prev = i + 1; //End
-
-                            //Reset
-                            matches = 0;
-                        }
-                    } else if(matches > 0)
-                        matches = 0; //Almost, but does not match, so reset...
+                while((i = indexOf(str, prev, strLen)) >= 0) {
+                    dst.add(substr(prev, i));
+                    prev = i + strLen;
                 }
 
                 //Add last one
@@ -1097,6 +1128,78 @@ namespace m
             }
         }
 
+        //Same as above, but without copying anything
+        void splitOnOneOf(const T *chars, List<TStringView<T>> &dst, int chrLen = -1) const
+        {
+            if(chrLen < 0) {
+                chrLen = 0;
+                while(chars[chrLen] != 0)
+                    chrLen++;
+            }
+
+            if(chrLen > 0) {
+                int prev = 0;
+                int i;
+
+                while((i = indexOfAnyOf(chars, prev, chrLen)) >= 0) {
+                    dst.add(TStringView<T>(m_data + prev, i - prev));
+                    prev = i + 1;
+                }
+
+                dst.add(TStringView<T>(m_data + prev, m_len - prev));
+            }
+        }
+
+        void splitOn(T match, List<TStringView<T>> &dst) const
+        {
+            int prev = 0;
+            int i;
+
+            while((i = indexOf(match, prev)) >= 0) {
+                dst.add(TStringView<T>(m_data + prev, i - prev));
+                prev = i + 1;
+            }
+
+            dst.add(TStringView<T>(m_data + prev, m_len - prev));
+        }
+
+        void splitOn(const T *str, List<TStringView<T>> &dst, int strLen = -1) const
+        {
+            if(strLen < 0) {
+                strLen = 0;
+                while(str[strLen] != 0)
+                    strLen++;
+            }
+
+            if(strLen > 0) {
+                int prev = 0;
+                int i;
+
+                while((i = indexOf(str, prev, strLen)) >= 0) {
+                    dst.add(TStringView<T>(m_data + prev, i - prev));
+                    prev = i + strLen;
+                }
+
+                dst.add(TStringView<T>(m_data + prev, m_len - prev));
+            }
+        }
+
+        TStringView<T> view(int beg = 0, int end = -1) const
+        {
+            if(end < 0)
+                end = m_len + end + 1;
+            else if(end > m_len)
+                end = m_len;
+
+            if(beg < 0)
+                beg = 0;
+
+            if(end <= beg)
+                return TStringView<T>(m_data, 0);
+
+            return TStringView<T>(m_data + beg, end - beg);
+        }
+
         TString<T> &replace(T src, T dst)
         {
             ensureMutable();
@@ -1147,120 +1250,112 @@ namespace m
         void ensureMutable()
         {
             if(isLiteral()) {
-                m_alloc = m_len + 1;
+                const T *lit = m_data;
 
-                T *data = new T[m_alloc];
-                mem::copy(data, m_data, m_alloc * sizeof(T));
-
-                m_data = data; //This used to be a literal, so don't delete[] the old data...
+                m_data = allocate(m_len + 1);
+                mem::copy(m_data, lit, (m_len + 1) * sizeof(T)); //This used to be a literal, so don't delete[] the old data...
             }
         }
 
-        static TString<T> fromPointer(const void *ptr)
+        TString<T> &appendPointer(const void *ptr)
         {
-            TString<T> ret(2 + sizeof(void*) * 2);
-            ret.m_data[0] = static_cast<T>('0');
-            ret.m_data[1] = static_cast<T>('x');
+            reserve(m_len + 2 + static_cast<int>(sizeof(void*)) * 2);
+            m_data[m_len] = static_cast<T>('0');
+            m_data[m_len + 1] = static_cast<T>('x');
 
             uint8_t *bytes = reinterpret_cast<uint8_t*>(&ptr);
             for(int i = 0; i < sizeof(void*); i++) {
                 uint8_t l = (bytes[sizeof(void*) - i - 1] & 0xF0) >> 4;
                 uint8_t r = bytes[sizeof(void*) - i - 1] & 0x0F;
 
-                ret.m_data[2 + i * 2] = hexChar<T>(static_cast<char>(l));
-                ret.m_data[3 + i * 2] = hexChar<T>(static_cast<char>(r));
+                m_data[m_len + 2 + i * 2] = hexChar<T>(static_cast<char>(l));
+                m_data[m_len + 3 + i * 2] = hexChar<T>(static_cast<char>(r));
             }
 
-            ret.m_len = 2 + sizeof(void*) * 2;
-            ret.m_data[ret.m_len] = 0;
-            return ret;
+            m_len += 2 + sizeof(void*) * 2;
+            m_data[m_len] = 0;
+            return *this;
         }
 
-        static TString<T> fromUInteger(uint32_t iintg, uint8_t base = 10)
+        TString<T> &appendUInteger64(uint64_t iintg, uint8_t base = 10)
         {
             int numLen = intLen(iintg, base);
             if(numLen <= 0)
                 numLen = 1;
 
-            TString<T> ret(numLen);
+            reserve(m_len + numLen);
             for(int i = numLen - 1; i >= 0; i--) {
                 char c = static_cast<char>(iintg % base);
-                ret.m_data[ret.m_len + i] = hexChar<T>(c);
+                m_data[m_len + i] = hexChar<T>(c);
 
                 iintg /= base;
             }
 
-            ret.m_len += numLen;
-            ret.m_data[ret.m_len] = 0;
-            return ret;
+            m_len += numLen;
+            m_data[m_len] = 0;
+            return *this;
         }
 
-        static TString<T> fromInteger(int iintg, uint8_t base = 10)
+        TString<T> &appendInteger64(int64_t iintg, uint8_t base = 10)
         {
-            TString<T> ret;
             if(iintg < 0) {
-                ret += '-';
-                iintg = -iintg;
+                *this += static_cast<T>('-');
+                return appendUInteger64(static_cast<uint64_t>(0) - static_cast<uint64_t>(iintg), base);
             }
 
-            return ret + fromUInteger(static_cast<uint32_t>(iintg), base);
+            return appendUInteger64(static_cast<uint64_t>(iintg), base);
         }
 
-        static TString<T> fromUInteger64(uint64_t iintg, uint8_t base = 10)
+        TString<T> &appendUInteger(uint32_t iintg, uint8_t base = 10)
         {
-            int numLen = intLen(iintg, base);
-            if(numLen <= 0)
-                numLen = 1;
-
-            TString<T> ret(numLen);
-            for(int i = numLen - 1; i >= 0; i--) {
-                char c = static_cast<char>(iintg % base);
-                ret.m_data[ret.m_len + i] = hexChar<T>(c);
-
-                iintg /= base;
-            }
-
-            ret.m_len += numLen;
-            ret.m_data[ret.m_len] = 0;
-            return ret;
+            return appendUInteger64(iintg, base);
         }
 
-        static TString<T> fromInteger64(int64_t iintg, uint8_t base = 10)
+        TString<T> &appendInteger(int iintg, uint8_t base = 10)
         {
-            TString<T> ret;
-            if(iintg < 0) {
-                ret += '-';
-                iintg = -iintg;
-            }
-
-            return ret + fromUInteger64(static_cast<uint32_t>(iintg), base);
+            return appendInteger64(iintg, base);
         }
 
-        static TString<T> fromDouble(double f, int maxPrec = 6)
+        //Appends f in fixed notation with maxPrec decimals. With a negative maxPrec
+        //(see M_DOUBLE_SHORTEST), appends the shortest string that toDouble() turns back into f.
+        TString<T> &appendDouble(double f, int maxPrec = 6)
         {
-            TString<T> ret(4);
+            ensureMutable();
+
+            if(maxPrec < 0) {
+                char buf[M_DOUBLE_FORMAT_MAX];
+                const int len = str::formatDouble(f, buf);
+
+                reserve(m_len + len);
+                for(int i = 0; i <= len; i++)
+                    m_data[m_len + i] = static_cast<T>(buf[i]);
+
+                m_len += len;
+                return *this;
+            }
+
             uint64_t asULL = *reinterpret_cast<uint64_t*>(&f);
             uint16_t exponent = static_cast<uint16_t>((asULL & (2047ULL << 52)) >> 52);
 
             if(exponent == 0) {
-                ret.append("0.0", 3);
-                return ret;
+                append("0.0", 3);
+                return *this;
             }
 
             if(exponent == 0x7FF && (asULL & 0x000FFFFFFFFFFFFFULL) != 0) {
-                ret.append("NaN", 3);
-                return ret;
+                append("NaN", 3);
+                return *this;
             }
 
             if((asULL & (1ULL << 63)) != 0) {
-                ret += '-';
+                *this += '-';
                 f = -f;
             }
 
             if(exponent == 0x7FF) {
                 //Infinity
-                ret.append("inf", 3);
-                return ret;
+                append("inf", 3);
+                return *this;
             }
 
             int64_t intPart = static_cast<int64_t>(f);
@@ -1270,37 +1365,85 @@ namespace m
 
             if(intPart > 0) {
                 int intSz = static_cast<int>(log10(f)) + 1; //log10 is better than intLen, especially if intPart >= 1000
-                ret.reserve(ret.m_len + intSz);
+                reserve(m_len + intSz);
 
                 for(int i = intSz - 1; i >= 0; i--) {
-                    ret.m_data[ret.m_len + i] = static_cast<T>('0' + intPart % 10);
+                    m_data[m_len + i] = static_cast<T>('0' + intPart % 10);
                     intPart /= 10;
                 }
 
-                ret.m_len += intSz;
+                m_len += intSz;
             } else {
-                ret.reserve(ret.m_len + 1);
-                ret.m_data[ret.m_len++] = '0';
+                reserve(m_len + 1);
+                m_data[m_len++] = '0';
             }
 
             if(fracPart > 0) {
-                ret.reserve(ret.m_len + maxPrec + 1);
-                ret.m_data[ret.m_len++] = '.';
+                reserve(m_len + maxPrec + 1);
+                m_data[m_len++] = '.';
 
                 for(int i = maxPrec - 1; i >= 0; i--) {
-                    ret.m_data[ret.m_len + i] = static_cast<T>('0' + fracPart % 10);
+                    m_data[m_len + i] = static_cast<T>('0' + fracPart % 10);
                     fracPart /= 10;
                 }
 
-                ret.m_len += maxPrec;
+                m_len += maxPrec;
             } else {
-                ret.reserve(ret.m_len + 2);
-                ret.m_data[ret.m_len + 0] = '.';
-                ret.m_data[ret.m_len + 1] = '0';
-                ret.m_len += 2;
+                reserve(m_len + 2);
+                m_data[m_len + 0] = '.';
+                m_data[m_len + 1] = '0';
+                m_len += 2;
             }
 
-            ret.m_data[ret.m_len] = 0;
+            m_data[m_len] = 0;
+            return *this;
+        }
+
+        static TString<T> fromPointer(const void *ptr)
+        {
+            TString<T> ret;
+            ret.appendPointer(ptr);
+
+            return ret;
+        }
+
+        static TString<T> fromUInteger(uint32_t iintg, uint8_t base = 10)
+        {
+            TString<T> ret;
+            ret.appendUInteger(iintg, base);
+
+            return ret;
+        }
+
+        static TString<T> fromInteger(int iintg, uint8_t base = 10)
+        {
+            TString<T> ret;
+            ret.appendInteger(iintg, base);
+
+            return ret;
+        }
+
+        static TString<T> fromUInteger64(uint64_t iintg, uint8_t base = 10)
+        {
+            TString<T> ret;
+            ret.appendUInteger64(iintg, base);
+
+            return ret;
+        }
+
+        static TString<T> fromInteger64(int64_t iintg, uint8_t base = 10)
+        {
+            TString<T> ret;
+            ret.appendInteger64(iintg, base);
+
+            return ret;
+        }
+
+        static TString<T> fromDouble(double f, int maxPrec = 6)
+        {
+            TString<T> ret;
+            ret.appendDouble(f, maxPrec);
+
             return ret;
         }
 
@@ -1330,35 +1473,37 @@ namespace m
             return ret;
         }
 
-        static TString<T> vformat(const T *frmt, VAList *lst)
+        //Formats directly at the end of this string
+        TString<T> &appendVFormat(const T *frmt, VAList *lst)
         {
             //Can't use std::function for that. It's too slow!!
             //I'd rather do this dirty little copy/paste than 
             //using vformat() with a lambda.
 
-            TString<T> ret;
             int start = 0;
             T lastChr = 0;
 
             for(int i = 0; frmt[i] != 0; i++) {
                 if(lastChr == '%') {
-                    ret.append(frmt + start, i - start - 1);
+                    append(frmt + start, i - start - 1);
                     start = i + 1;
 
                     if(frmt[i] == '%') {
                         start--;
                         lastChr = 0; //Whatever but not %
                     } else {
+                        const int begin = m_len;
+
                         switch(static_cast<char>(frmt[i])) {
                         case 'i':
-                        case 'd': ret += fromInteger(va_arg(lst->list, int)); break;
-                        case 'h': ret += fromInteger(va_arg(lst->list, int), 16); break;
-                        case 'H': ret += fromInteger(va_arg(lst->list, int), 16).toUpper(); break;
-                        case 'p': ret += fromPointer(va_arg(lst->list, void*)); break;
-                        case 'P': ret += fromPointer(va_arg(lst->list, void*)).toUpper(); break;
-                        case 'f': ret += fromDouble(va_arg(lst->list, double)); break;
-                        case 's': ret += TString<T>(va_arg(lst->list, const T*)); break;
-                        case 'c': ret += TString<T>(static_cast<T>(va_arg(lst->list, int)), 1); break;
+                        case 'd': appendInteger(va_arg(lst->list, int)); break;
+                        case 'h': appendInteger(va_arg(lst->list, int), 16); break;
+                        case 'H': appendInteger(va_arg(lst->list, int), 16); upperFrom(begin); break;
+                        case 'p': appendPointer(va_arg(lst->list, void*)); break;
+                        case 'P': appendPointer(va_arg(lst->list, void*)); upperFrom(begin); break;
+                        case 'f': appendDouble(va_arg(lst->list, double)); break;
+                        case 's': append(va_arg(lst->list, const T*)); break;
+                        case 'c': *this += static_cast<T>(va_arg(lst->list, int)); break;
                         default:  break;
                         }
 
@@ -1368,7 +1513,25 @@ namespace m
                     lastChr = frmt[i];
             }
 
-            ret += frmt + start;
+            append(frmt + start);
+            return *this;
+        }
+
+        TString<T> &appendFormat(const T *frmt, ...)
+        {
+            VAList lst;
+            va_start(lst.list, frmt);
+            appendVFormat(frmt, &lst);
+            va_end(lst.list);
+
+            return *this;
+        }
+
+        static TString<T> vformat(const T *frmt, VAList *lst)
+        {
+            TString<T> ret;
+            ret.appendVFormat(frmt, lst);
+
             return ret;
         }
 
@@ -1414,21 +1577,48 @@ namespace m
         T *m_data;
         int m_len;
         int m_alloc;
+        T m_inline[M_STR_INLINE_BYTES / sizeof(T)];
+
+        void upperFrom(int begin)
+        {
+            for(int i = begin; i < m_len; i++)
+                m_data[i] = static_cast<T>(toupper(static_cast<char>(m_data[i])));
+        }
+
+        //Sets m_alloc, doesn't touch m_data
+        T *allocate(int sz)
+        {
+            if(sz <= static_cast<int>(M_STR_INLINE_BYTES / sizeof(T))) {
+                m_alloc = static_cast<int>(M_STR_INLINE_BYTES / sizeof(T));
+                return m_inline;
+            }
+
+            m_alloc = sz;
+            return new T[sz];
+        }
+
+        void release()
+        {
+            if(m_data != nullptr && !isLiteral() && m_data != m_inline)
+                delete[] m_data;
+        }
 
         void grow(int targetSz)
         {
             ensureMutable();
+            if(m_alloc >= targetSz)
+                return;
 
             int add = m_alloc + (m_alloc >> 1);
             if(add < targetSz)
-                m_alloc = targetSz;
-            else
-                m_alloc = add;
+                add = targetSz;
 
-            T *ndata = new T[m_alloc];
+            T *ndata = new T[add];
             mem::copy(ndata, m_data, (m_len + 1) * sizeof(T));
-            delete[] m_data;
+            release();
+
             m_data = ndata;
+            m_alloc = add;
         }
     };
 
@@ -1518,6 +1708,8 @@ namespace m
     typedef TString<wchar_t> WString;
     typedef TConstString<char> ConstString;
     typedef TConstString<wchar_t> WConstString;
+    typedef TStringView<char> StringView;
+    typedef TStringView<wchar_t> WStringView;
 
     class StringLowerHasher
     {
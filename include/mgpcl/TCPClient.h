@@ -23,6 +23,7 @@
 #include "Packet.h"
 #include "Thread.h"
 #include "Mutex.h"
+#include "Cond.h"
 #include "Atomic.h"
 #include "SignalSlot.h"
 
@@ -46,9 +47,21 @@ namespace m
             volatile bool ret = m_sQueue.offer(pkt);
             m_sLock.unlock();
 
+            if(ret)
+                m_pending.increment();
+
             return ret;
         }
 
+        //Number of packets that are queued or partially sent
+        int pendingPackets()
+        {
+            return static_cast<int>(m_pending.get());
+        }
+
+        //Waits until every queued packet has been sent. Returns false on timeout or disconnection.
+        bool waitUntilSent(int timeoutMs);
+
         FPacket nextPacket()
         {
             FPacket pkt;
@@ -104,6 +117,7 @@ namespace m
 
     private:
         void threadFunc();
+        void wakeSentWaiters();
 
         TCPSocket m_sock;
         Atomic m_running;
@@ -119,6 +133,8 @@ namespace m
         Queue<FPacket> m_sQueue;
         FPacket m_sPkt;
         uint32_t m_sPos;
+        Atomic m_pending;
+        Cond m_sentCond; //Signaled with m_sLock when m_pending reaches 0 or the thread stops
 
         //Ingoing
         Mutex m_rLock;
@@ -41,13 +41,13 @@ namespace m
         TextSerializer()
         {
             m_le = M_OS_LINEENDING;
-            m_prec = 2;
+            m_prec = M_DOUBLE_SHORTEST;
         }
 
         TextSerializer(LineEnding le)
         {
             m_le = le;
-            m_prec = 2;
+            m_prec = M_DOUBLE_SHORTEST;
         }
 
         virtual ~TextSerializer()
@@ -169,6 +169,9 @@ namespace m
             return *this;
         }
 
+        //Number of decimals written for floating point values. With
+        //a negative precision (the default), the shortest string that
+        //reads back to the same value is written.
         void setPrecision(int prec)
         {
             m_prec = prec;
@@ -332,100 +335,44 @@ namespace m
             if(m_skipWS)
                 skipWS();
 
-            dst = 0.0;
-            int chr2 = tsReadChr();
-            bool neg;
-            char chr;
-
-            if(chr2 < 0)
-                return *this;
-
-            chr = static_cast<char>(chr2);
-
-            if(dst == '-') {
-                neg = true;
-
-                chr2 = tsReadChr();
-                if(chr2 < 0)
-                    return *this;
-
-                chr = static_cast<char>(chr2);
-            } else
-                neg = false;
-
-            while(chr >= '0' && chr <= '9') {
-                dst = dst * 10.0 + static_cast<double>(chr - '0');
-                chr2 = tsReadChr();
-
-                if(chr2 < 0)
-                    return *this;
-
-                chr = static_cast<char>(chr2);
-            }
-
-            if(chr == '.') {
-                double div = 0.1;
-                chr2 = tsReadChr();
-
-                if(chr2 < 0)
-                    return *this;
-
-                chr = static_cast<char>(chr2);
-                while(chr >= '0' && chr <= '9') {
-                    dst = dst + static_cast<double>(chr - '0') * div;
-                    div *= 0.1;
-                    chr2 = tsReadChr();
-
-                    if(chr2 < 0)
-                        return *this;
-
-                    chr = static_cast<char>(chr2);
-                }
-            }
-
-            if(chr == 'e' || chr == 'E') {
-                //Exponent?
-                bool negExp;
-                uint32_t exp = 0;
-                chr2 = tsReadChr();
+            //Gather whatever looks like a number, and let str::parseDouble() do the job
+            char buf[M_DOUBLE_PARSE_MAX];
+            int len = 0;
+            bool hasDot = false;
+            bool hasExp = false;
 
+            while(len < M_DOUBLE_PARSE_MAX) {
+                int chr2 = tsReadChr();
                 if(chr2 < 0)
-                    return *this;
-
-                chr = static_cast<char>(chr2);
-
-                if(chr == '-') {
-                    negExp = true;
-                    chr2 = tsReadChr();
-
-                    if(chr2 < 0)
-                        return *this;
-
-                    chr = static_cast<char>(chr2);
-                } else
-                    negExp = false;
-
-                while(chr >= '0' && chr <= '9') {
-                    exp = exp * 10 + static_cast<uint32_t>(chr - '0');
-                    chr2 = tsReadChr();
-
-                    if(chr2 < 0)
-                        return *this;
+                    break;
+
+                char chr = static_cast<char>(chr2);
+                bool accept;
+
+                if(chr >= '0' && chr <= '9')
+                    accept = true;
+                else if(chr == '-' || chr == '+')
+                    accept = len == 0 || buf[len - 1] == 'e' || buf[len - 1] == 'E';
+                else if(chr == '.')
+                    accept = !hasDot && !hasExp;
+                else if(chr == 'e' || chr == 'E')
+                    accept = !hasExp && len > 0;
+                else
+                    accept = false;
 
-                    chr = static_cast<char>(chr2);
+                if(!accept) {
+                    m_hasUndo = true;
+                    m_undo = chr;
+                    break;
                 }
 
-                if(negExp)
-                    dst /= math::pow(10.0, static_cast<double>(exp));
-                else
-                    dst *= math::pow(10.0, static_cast<double>(exp));
+                hasDot |= chr == '.';
+                hasExp |= chr == 'e' || chr == 'E';
+                buf[len++] = chr;
             }
 
-            if(neg)
-                dst = -dst;
-
-            m_hasUndo = true;
-            m_undo = chr;
+            dst = 0.0;
+            str::parseDouble(buf, len, dst);
             return *this;
         }
 
@@ -584,4 +531,53 @@ namespace m
         bool m_reachedEOF;
     };
 
+    //Deserializes text straight from memory (for instance a MappedFile)
+    //No copy is made; data must outlive the deserializer.
+    class MemoryTextDeserializer : public TextDeserializer
+    {
+    public:
+        MemoryTextDeserializer()
+        {
+            m_data = nullptr;
+            m_end = nullptr;
+        }
+
+        MemoryTextDeserializer(const char *data, uint64_t len)
+        {
+            m_data = data;
+            m_end = data + len;
+        }
+
+        void setData(const char *data, uint64_t len)
+        {
+            m_data = data;
+            m_end = data + len;
+        }
+
+        const char *current() const
+        {
+            return m_data;
+        }
+
+        uint64_t remaining() const
+        {
+            return static_cast<uint64_t>(m_end - m_data);
+        }
+
+    protected:
+        bool tsRead(char *dst, int len) override
+        {
+            if(m_end - m_data < len)
+                return false;
+
+            mem::copy(dst, m_data, static_cast<size_t>(len));
+            m_data += len;
+            return true;
+        }
+
+    private:
+        const char *m_data;
+        const char *m_end;
+    };
+
 }
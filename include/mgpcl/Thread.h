@@ -64,6 +64,7 @@ namespace m
         }
 
         bool join();
+        bool detach(); //The thread will free its resources by itself; it can't be joined anymore
         bool start();
         bool setAffinityMask(uint64_t mask); //Use this after .start()!
 
@@ -289,6 +290,12 @@ namespace m
         uint8_t m_cpus;
     };
 
+    /* Runs func on globalExecutor() (see Executor.h), a bounded pool
+     * created on first use. func should not wait for other async
+     * functions: there may be a single worker. func never runs on the
+     * calling thread: if the pool's queue is full, it gets a thread
+     * of its own. Returns false if that fails too.
+     */
     MGPCL_THREAD_EXT bool execAsync(std::function<void()> func);
 
 }
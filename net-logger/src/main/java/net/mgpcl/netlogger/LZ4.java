@@ -0,0 +1,70 @@
+package net.mgpcl.netlogger;
+
+import java.io.IOException;
+
+//Decoder for LZ4 blocks, as sent by the C++ NetLogger in batching mode
+public final class LZ4 {
+
+    private LZ4()
+    {
+    }
+
+    public static byte[] decompress(byte[] src, int offset, int len, int rawSize) throws IOException
+    {
+        byte[] dst = new byte[rawSize];
+        int ip = offset;
+        int end = offset + len;
+        int op = 0;
+
+        try {
+            while(ip < end) {
+                int token = src[ip++] & 0xFF;
+                int lit = token >>> 4;
+
+                if(lit == 15) {
+                    int b;
+                    do {
+                        b = src[ip++] & 0xFF;
+                        lit += b;
+                    } while(b == 255);
+                }
+
+                System.arraycopy(src, ip, dst, op, lit);
+                ip += lit;
+                op += lit;
+
+                if(ip >= end)
+                    break; //Last sequence has no match
+
+                int matchOffset = (src[ip] & 0xFF) | ((src[ip + 1] & 0xFF) << 8);
+                ip += 2;
+
+                int mlen = token & 15;
+                if(mlen == 15) {
+                    int b;
+                    do {
+                        b = src[ip++] & 0xFF;
+                        mlen += b;
+                    } while(b == 255);
+                }
+
+                mlen += 4;
+                int ref = op - matchOffset;
+                if(matchOffset == 0 || ref < 0)
+                    throw new IOException("Invalid LZ4 match offset");
+
+                //Matches can overlap, so copy byte by byte
+                for(int i = 0; i < mlen; i++)
+                    dst[op++] = dst[ref++];
+            }
+        } catch(ArrayIndexOutOfBoundsException ex) {
+            throw new IOException("Corrupted LZ4 block");
+        }
+
+        if(op != rawSize)
+            throw new IOException("LZ4 block size mismatch");
+
+        return dst;
+    }
+
+}
@@ -13,6 +13,20 @@ public class LogTableModel extends AbstractTableModel {
         public byte level;
         public String cols[] = new String[5];
 
+        private static String levelName(byte level)
+        {
+            if(level == 0)
+                return "Debug";
+            else if(level == 1)
+                return "Info";
+            else if(level == 2)
+                return "Warning";
+            else if(level == 3)
+                return "Error";
+            else
+                return "???";
+        }
+
         private static String readString(DataInputStream dis) throws IOException
         {
             byte[] data = new byte[dis.readShort()];
@@ -24,16 +38,7 @@ public class LogTableModel extends AbstractTableModel {
         public LogRow(DataInputStream dis) throws IOException
         {
             level = dis.readByte();
-            if(level == 0)
-                cols[0] = "Debug";
-            else if(level == 1)
-                cols[0] = "Info";
-            else if(level == 2)
-                cols[0] = "Warning";
-            else if(level == 3)
-                cols[0] = "Error";
-            else
-                cols[0] = "???";
+            cols[0] = levelName(level);
 
             cols[1] = readString(dis);
             cols[2] = readString(dis);
@@ -41,6 +46,16 @@ public class LogTableModel extends AbstractTableModel {
             cols[4] = readString(dis);
         }
 
+        public LogRow(byte level, String thread, String file, int line, String msg)
+        {
+            this.level = level;
+            cols[0] = levelName(level);
+            cols[1] = thread;
+            cols[2] = file;
+            cols[3] = "" + line;
+            cols[4] = msg;
+        }
+
         public LogRow()
         {
             level = -1;
@@ -61,6 +76,12 @@ public class LogTableModel extends AbstractTableModel {
         fireTableDataChanged();
     }
 
+    public void addLines(ArrayList<LogRow> r)
+    {
+        rows.addAll(r);
+        fireTableDataChanged();
+    }
+
     public void clear()
     {
         rows.clear();
@@ -10,10 +10,18 @@ import java.io.*;
 import java.net.InetAddress;
 import java.net.ServerSocket;
 import java.net.Socket;
+import java.util.ArrayList;
 import java.util.concurrent.atomic.AtomicBoolean;
 
 public class NetLogger implements WindowListener, ActionListener {
 
+    private static final int PROTOCOL_VERSION = 2;
+    private static final int HANDSHAKE = 0xB0;
+    private static final int DEFINE_NAME = 0xF0;
+    private static final int FLAG_COMPRESSED = 0x01;
+    private static final int MAX_LEGACY_PACKET = 8192;
+    private static final int MAX_FRAME = 16 * 1024 * 1024;
+
     public static NetLogger INSTANCE;
 
     private Thread thread;
@@ -364,29 +372,33 @@ public class NetLogger implements WindowListener, ActionListener {
 
     private boolean handlePackets(InputStream sockIn)
     {
+        int protocol = 1;
+        String[] names = new String[65536];
+
         try {
             DataInputStream dis = new DataInputStream(sockIn);
 
             while(running.get()) {
                 int pktSize = dis.readInt();
+                int maxSize = protocol >= 2 ? MAX_FRAME : MAX_LEGACY_PACKET;
 
-                if(pktSize < 4 || pktSize > 8192)
+                if(pktSize < 4 || pktSize > maxSize)
                     System.out.println("Spotted invalid packet with size " + pktSize);
                 else {
                     pktSize -= 4;
                     byte[] pkt = new byte[pktSize];
-                    int offset = 0;
-
-                    while(pktSize > 0) {
-                        int rd = dis.read(pkt, offset, pktSize);
-                        if(rd == 0)
-                            throw new EOFException();
-
-                        offset += rd;
-                        pktSize -= rd;
-                    }
-
-                    handlePacket(new DataInputStream(new ByteArrayInputStream(pkt)));
+                    dis.readFully(pkt);
+
+                    if(pktSize == 2 && (pkt[0] & 0xFF) == HANDSHAKE) {
+                        protocol = pkt[1] & 0xFF;
+                        System.out.println("Client speaks protocol version " + protocol);
+
+                        if(protocol > PROTOCOL_VERSION)
+                            System.out.println("!!! -> Unsupported protocol version, expect garbage...");
+                    } else if(protocol >= 2)
+                        handleFrame(pkt, names);
+                    else
+                        handlePacket(new DataInputStream(new ByteArrayInputStream(pkt)));
                 }
             }
         } catch(EOFException ex) {
@@ -416,6 +428,57 @@ public class NetLogger implements WindowListener, ActionListener {
         });
     }
 
+    private static String readName(DataInputStream dis) throws IOException
+    {
+        byte[] data = new byte[dis.readUnsignedShort()];
+        dis.readFully(data);
+
+        return new String(data, "UTF-8");
+    }
+
+    private void handleFrame(byte[] pkt, String[] names) throws IOException
+    {
+        if(pkt.length < 1)
+            return;
+
+        byte[] frame;
+        if((pkt[0] & FLAG_COMPRESSED) != 0) {
+            if(pkt.length < 5)
+                throw new IOException("Truncated compressed frame");
+
+            int rawSize = ((pkt[1] & 0xFF) << 24) | ((pkt[2] & 0xFF) << 16) | ((pkt[3] & 0xFF) << 8) | (pkt[4] & 0xFF);
+            if(rawSize < 0 || rawSize > MAX_FRAME)
+                throw new IOException("Invalid uncompressed frame size " + rawSize);
+
+            frame = LZ4.decompress(pkt, 5, pkt.length - 5, rawSize);
+        } else {
+            frame = new byte[pkt.length - 1];
+            System.arraycopy(pkt, 1, frame, 0, frame.length);
+        }
+
+        DataInputStream dis = new DataInputStream(new ByteArrayInputStream(frame));
+        ArrayList<LogTableModel.LogRow> rows = new ArrayList<>();
+
+        while(dis.available() > 0) {
+            int tag = dis.readUnsignedByte();
+
+            if(tag == DEFINE_NAME) {
+                int id = dis.readUnsignedShort();
+                names[id] = readName(dis);
+            } else {
+                String thread = names[dis.readUnsignedShort()];
+                String file = names[dis.readUnsignedShort()];
+                int line = dis.readUnsignedShort();
+                String msg = readName(dis);
+
+                rows.add(new LogTableModel.LogRow((byte) tag, thread == null ? "???" : thread, file == null ? "???" : file, line, msg));
+            }
+        }
+
+        if(!rows.isEmpty())
+            SwingUtilities.invokeLater(() -> tableContent.addLines(rows));
+    }
+
     public void sendPacket(byte[] data)
     {
         byte[] pkt = new byte[data.length + 4];
@@ -0,0 +1,287 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/AsyncFileOStream.h"
+#include "mgpcl/Mem.h"
+#include "mgpcl/Math.h"
+
+#define M_AFOS_DEFAULT_CHUNK 65536
+#define M_AFOS_DEFAULT_INFLIGHT (4 * 1024 * 1024)
+
+m::AsyncFileOutputStream::AsyncFileOutputStream() : m_thread("AsyncFile"_m)
+{
+    m_open = false;
+    m_pos = 0;
+    m_cur = nullptr;
+    m_curLen = 0;
+    m_chunkSz = M_AFOS_DEFAULT_CHUNK;
+    m_inFlight = 0;
+    m_maxInFlight = M_AFOS_DEFAULT_INFLIGHT;
+    m_lastTicket = 0;
+    m_syncedTicket = 0;
+    m_failed = false;
+    m_stop = false;
+}
+
+m::AsyncFileOutputStream::AsyncFileOutputStream(const String &fname, FileOutputStream::OpenMode mode) : m_thread("AsyncFile"_m)
+{
+    m_open = false;
+    m_pos = 0;
+    m_cur = nullptr;
+    m_curLen = 0;
+    m_chunkSz = M_AFOS_DEFAULT_CHUNK;
+    m_inFlight = 0;
+    m_maxInFlight = M_AFOS_DEFAULT_INFLIGHT;
+    m_lastTicket = 0;
+    m_syncedTicket = 0;
+    m_failed = false;
+    m_stop = false;
+
+    open(fname, mode);
+}
+
+m::AsyncFileOutputStream::~AsyncFileOutputStream()
+{
+    close();
+    freeChunks();
+}
+
+void m::AsyncFileOutputStream::setChunkSize(uint32_t sz)
+{
+    mDebugAssert(!m_open, "cannot change chunk size while open");
+
+    if(sz != m_chunkSz) {
+        //Chunks kept from the last open() have the old size
+        freeChunks();
+        m_chunkSz = sz;
+    }
+}
+
+void m::AsyncFileOutputStream::freeChunks()
+{
+    for(uint8_t *chunk : m_freeChunks)
+        delete[] chunk;
+
+    m_freeChunks.cleanup();
+
+    if(m_cur != nullptr) {
+        delete[] m_cur;
+        m_cur = nullptr;
+    }
+}
+
+bool m::AsyncFileOutputStream::open(const String &fname, FileOutputStream::OpenMode mode)
+{
+    close();
+
+    if(!m_file.open(fname, mode))
+        return false;
+
+    m_pos = 0;
+    m_curLen = 0;
+    m_inFlight = 0;
+    m_lastTicket = 0;
+    m_syncedTicket = 0;
+    m_failed = false;
+    m_stop = false;
+
+    if(m_cur == nullptr)
+        m_cur = new uint8_t[m_chunkSz];
+
+    m_thread.setFunc(this, &AsyncFileOutputStream::threadFunc);
+    if(!m_thread.start()) {
+        m_file.close();
+        return false;
+    }
+
+    m_open = true;
+    return true;
+}
+
+int m::AsyncFileOutputStream::write(const uint8_t *src, int sz)
+{
+    mDebugAssert(m_open, "file was not opened");
+    mDebugAssert(sz >= 0, "cannot write a negative amount of bytes");
+
+    int ret = sz;
+    while(sz > 0) {
+        uint32_t toCopy = math::minimum(static_cast<uint32_t>(sz), m_chunkSz - m_curLen);
+        mem::copy(m_cur + m_curLen, src, toCopy);
+        m_curLen += toCopy;
+        src += toCopy;
+        sz -= static_cast<int>(toCopy);
+
+        if(m_curLen >= m_chunkSz && !submit(0))
+            return -1;
+    }
+
+    m_pos += static_cast<uint64_t>(ret);
+    return ret;
+}
+
+bool m::AsyncFileOutputStream::submit(uint64_t ticket)
+{
+    m_lock.lock();
+
+    //Back-pressure: wait for the worker if too many bytes are pending.
+    //A single chunk is always accepted so that we can't deadlock.
+    while(!m_failed && m_inFlight > 0 && m_inFlight + m_curLen > m_maxInFlight)
+        m_doneCond.wait(m_lock);
+
+    if(m_failed) {
+        m_lock.unlock();
+        return false;
+    }
+
+    if(m_curLen > 0) {
+        m_queue.add(Chunk(m_cur, m_curLen, ticket));
+        m_inFlight += m_curLen;
+
+        if(m_freeChunks.isEmpty())
+            m_cur = nullptr;
+        else
+            m_freeChunks.pop(m_cur);
+    } else
+        m_queue.add(Chunk(nullptr, 0, ticket)); //Sync request only
+
+    m_workCond.signal();
+    m_lock.unlock();
+
+    if(m_cur == nullptr)
+        m_cur = new uint8_t[m_chunkSz];
+
+    m_curLen = 0;
+    return true;
+}
+
+uint64_t m::AsyncFileOutputStream::requestSync()
+{
+    mDebugAssert(m_open, "file was not opened");
+
+    //Only the writing thread submits, so the ticket can be computed here
+    m_lock.lock();
+    uint64_t ticket = ++m_lastTicket;
+    m_lock.unlock();
+
+    return submit(ticket) ? ticket : 0;
+}
+
+bool m::AsyncFileOutputStream::waitSync(uint64_t ticket)
+{
+    if(ticket == 0)
+        return false;
+
+    m_lock.lock();
+    while(!m_failed && m_syncedTicket < ticket)
+        m_doneCond.wait(m_lock);
+
+    volatile bool ret = !m_failed;
+    m_lock.unlock();
+
+    return ret;
+}
+
+bool m::AsyncFileOutputStream::flush()
+{
+    return waitSync(requestSync());
+}
+
+void m::AsyncFileOutputStream::close()
+{
+    if(!m_open)
+        return;
+
+    if(m_curLen > 0)
+        submit(0);
+
+    m_lock.lock();
+    m_stop = true;
+    m_workCond.signal();
+    m_lock.unlock();
+
+    m_thread.join();
+    m_file.close();
+    m_open = false;
+
+    //Chunks left behind after a failure
+    for(Chunk &c : m_queue) {
+        if(c.data != nullptr)
+            m_freeChunks.add(c.data);
+    }
+
+    m_queue.cleanup();
+    m_inFlight = 0;
+}
+
+void m::AsyncFileOutputStream::threadFunc()
+{
+    List<Chunk> batch;
+    List<IOSlice> slices;
+
+    m_lock.lock();
+    while(true) {
+        while(m_queue.isEmpty() && !m_stop)
+            m_workCond.wait(m_lock);
+
+        if(m_queue.isEmpty() || m_failed)
+            break; //Stopped, and everything has been written
+
+        //Take everything that piled up while we were writing
+        batch.addAll(m_queue);
+        m_queue.cleanup();
+        m_lock.unlock();
+
+        uint32_t bytes = 0;
+        uint64_t ticket = 0;
+
+        for(Chunk &c : batch) {
+            if(c.len > 0) {
+                IOSlice slice = { c.data, static_cast<int>(c.len) };
+                slices.add(slice);
+                bytes += c.len;
+            }
+
+            if(c.ticket > ticket)
+                ticket = c.ticket;
+        }
+
+        bool ok = (slices.isEmpty() || m_file.writeV(slices.begin(), slices.size()) >= 0);
+        slices.cleanup();
+        if(ok && ticket != 0)
+            ok = m_file.sync(true); //One fdatasync() for all the requests in this batch
+
+        m_lock.lock();
+        for(Chunk &c : batch) {
+            if(c.data != nullptr)
+                m_freeChunks.add(c.data);
+        }
+
+        batch.cleanup();
+        m_inFlight -= bytes;
+
+        if(!ok)
+            m_failed = true;
+        else if(ticket != 0)
+            m_syncedTicket = ticket;
+
+        m_doneCond.signalAll();
+    }
+
+    m_lock.unlock();
+}
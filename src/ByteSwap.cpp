@@ -0,0 +1,115 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/ByteSwap.h"
+#include "mgpcl/Assert.h"
+#include <cstring>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define M_BSWAP_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef M_BSWAP_SIMD
+static bool g_m_bswap_hasSSSE3()
+{
+    static const bool ret = (__builtin_cpu_init(), __builtin_cpu_supports("ssse3") != 0);
+    return ret;
+}
+
+static bool g_m_bswap_hasAVX2()
+{
+    static const bool ret = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return ret;
+}
+
+//Shuffle masks reversing each 2, 4 or 8 bytes element of a 16 bytes lane
+static const int8_t g_m_bswap_masks[3][16] = {
+    { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+    { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+    { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 }
+};
+
+__attribute__((target("ssse3"))) static size_t g_m_bswap_ssse3(uint8_t *dst, const uint8_t *src, size_t len, const int8_t *mask)
+{
+    const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+    size_t i = 0;
+
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, m));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t g_m_bswap_avx2(uint8_t *dst, const uint8_t *src, size_t len, const int8_t *mask)
+{
+    //vpshufb works on each 16 bytes lane separately, so the same mask goes in both lanes
+    const __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+    const __m256i m = _mm256_broadcastsi128_si256(half);
+    size_t i = 0;
+
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, m));
+    }
+
+    return i;
+}
+#endif
+
+void m::mem::swapBytes(void *vdst, const void *vsrc, size_t count, size_t elemSize)
+{
+    mDebugAssert(elemSize == 1 || elemSize == 2 || elemSize == 4 || elemSize == 8, "unsupported element size");
+
+    uint8_t *dst = static_cast<uint8_t*>(vdst);
+    const uint8_t *src = static_cast<const uint8_t*>(vsrc);
+    const size_t len = count * elemSize;
+    size_t i = 0;
+
+    if(elemSize <= 1) {
+        if(dst != src)
+            memmove(dst, src, len);
+
+        return;
+    }
+
+#ifdef M_BSWAP_SIMD
+    const int8_t *mask = g_m_bswap_masks[elemSize == 2 ? 0 : (elemSize == 4 ? 1 : 2)];
+
+    if(g_m_bswap_hasAVX2())
+        i = g_m_bswap_avx2(dst, src, len, mask);
+
+    if(g_m_bswap_hasSSSE3())
+        i += g_m_bswap_ssse3(dst + i, src + i, len - i, mask);
+#endif
+
+    //Scalar tail (or everything, without SIMD)
+    for(; i < len; i += elemSize) {
+        for(size_t j = 0; j < elemSize / 2; j++) {
+            uint8_t a = src[i + j];
+            uint8_t b = src[i + elemSize - j - 1];
+
+            dst[i + j] = b;
+            dst[i + elemSize - j - 1] = a;
+        }
+    }
+}
@@ -0,0 +1,316 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/DNSResolver.h"
+#include "mgpcl/FileIOStream.h"
+#include "mgpcl/StringIOStream.h"
+#include "mgpcl/Time.h"
+
+m::DNSResolver::DNSResolver(int numThreads) : m_pool(numThreads, "DNS-"_m)
+{
+    m_lookup = [] (const String &host, IPv4Address &dst) { return dst.resolve(host); };
+    m_positiveTTL = static_cast<double>(M_DNS_POSITIVE_TTL);
+    m_negativeTTL = static_cast<double>(M_DNS_NEGATIVE_TTL);
+    m_hits = 0;
+    m_misses = 0;
+    m_coalesced = 0;
+    m_lookups = 0;
+}
+
+m::DNSResolver::~DNSResolver()
+{
+    //Runs the queued lookups, so every callback gets called
+    m_pool.stop();
+}
+
+void m::DNSResolver::setLookupFunction(LookupFunc func)
+{
+    m_lock.lock();
+    m_lookup = func;
+    m_lock.unlock();
+}
+
+void m::DNSResolver::setTTL(uint32_t positiveMs, uint32_t negativeMs)
+{
+    m_lock.lock();
+    m_positiveTTL = static_cast<double>(positiveMs);
+    m_negativeTTL = static_cast<double>(negativeMs);
+    m_lock.unlock();
+}
+
+void m::DNSResolver::addHost(const String &host, const IPv4Address &addr)
+{
+    Entry e;
+    e.addr = addr;
+    e.addr.setPort(0);
+    e.error = kRE_NoError;
+    e.expires = 0.0;
+
+    m_lock.lock();
+    m_cache[host.lower()] = e;
+    m_lock.unlock();
+}
+
+int m::DNSResolver::loadHostsFile(const String &fname)
+{
+    FileInputStream fis;
+    if(fis.open(fname) != FileInputStream::kOE_Success)
+        return -1;
+
+    StringOStream sos;
+    if(!IO::transfer(&sos, &fis, 4096))
+        return -1;
+
+    List<String> lines;
+    sos.data().splitOnOneOf("\r\n", lines);
+    int ret = 0;
+
+    for(const String &line : lines) {
+        //Format is "address name [aliases...] [# comment]"
+        int comment = line.indexOf('#');
+        String data((comment >= 0) ? line.substr(0, comment) : line);
+        List<String> fields;
+        data.splitOnOneOf(" \t", fields);
+
+        List<String> words;
+        for(const String &f : fields) {
+            if(!f.isEmpty())
+                words.add(f);
+        }
+
+        IPv4Address addr;
+        if(words.size() < 2 || words[0].indexOf(':') >= 0 || addr.parse(words[0], 0) != kAFE_NoError)
+            continue; //IPv6, or garbage
+
+        for(int i = 1; i < words.size(); i++)
+            addHost(words[i], addr);
+
+        ret++;
+    }
+
+    return ret;
+}
+
+void m::DNSResolver::clearCache()
+{
+    m_lock.lock();
+    evict(false);
+    m_lock.unlock();
+}
+
+double m::DNSResolver::expiry(const String &host)
+{
+    const String key(host.lower());
+    double ret = -1.0;
+    m_lock.lock();
+
+    if(m_cache.hasKey(key))
+        ret = m_cache[key].expires;
+
+    m_lock.unlock();
+    return ret;
+}
+
+//m_lock must be held. Permanent entries (hosts) are always kept.
+void m::DNSResolver::evict(bool expiredOnly)
+{
+    List<String> expiring;
+    double now = time::getTimeMs();
+
+    for(HashMap<String, Entry>::Pair &p : m_cache) {
+        if(p.value.expires != 0.0 && (!expiredOnly || p.value.expires <= now))
+            expiring.add(p.key);
+    }
+
+    for(const String &key : expiring)
+        m_cache.removeKey(key);
+}
+
+//m_lock must be held
+bool m::DNSResolver::cached(const String &key, DNSResolveError &err, IPv4Address &dst)
+{
+    if(!m_cache.hasKey(key))
+        return false;
+
+    Entry &e = m_cache[key];
+    if(e.expires != 0.0 && e.expires <= time::getTimeMs()) {
+        m_cache.removeKey(key);
+        return false;
+    }
+
+    err = e.error;
+    dst = e.addr;
+    m_hits++;
+    return true;
+}
+
+//m_lock must be held
+void m::DNSResolver::releasePending(Pending *p)
+{
+    if(--p->users == 0)
+        delete p;
+}
+
+void m::DNSResolver::lookup(const String &key, Pending *p)
+{
+    m_lock.lock();
+    LookupFunc func(m_lookup);
+    m_lookups++;
+    m_lock.unlock();
+
+    IPv4Address addr;
+    DNSResolveError err = func(key, addr);
+    addr.setPort(0);
+
+    m_lock.lock();
+    bool cache = (err == kRE_NoError || err == kRE_UnknownHost || err == kRE_NonIPv4Host);
+
+    if(cache) {
+        if(m_cache.size() >= M_DNS_CACHE_MAX) {
+            //Drop the expired entries, or everything but the hosts if that's not enough
+            evict(true);
+
+            if(m_cache.size() >= M_DNS_CACHE_MAX)
+                evict(false);
+        }
+
+        Entry e;
+        e.addr = addr;
+        e.error = err;
+        e.expires = time::getTimeMs() + (err == kRE_NoError ? m_positiveTTL : m_negativeTTL);
+        m_cache[key] = e;
+    }
+
+    m_pending.removeKey(key);
+    p->done = true;
+    p->error = err;
+    p->addr = addr;
+
+    List<Callback> callbacks(std::move(p->callbacks));
+    releasePending(p);
+    m_cond.signalAll();
+    m_lock.unlock();
+
+    for(Callback &cb : callbacks)
+        cb(err, addr);
+}
+
+m::DNSResolveError m::DNSResolver::resolve(const String &host, IPv4Address &dst, uint16_t port)
+{
+    const String key(host.lower());
+    DNSResolveError err;
+    m_lock.lock();
+
+    if(cached(key, err, dst)) {
+        m_lock.unlock();
+        dst.setPort(port);
+        return err;
+    }
+
+    m_misses++;
+    if(m_pending.hasKey(key)) {
+        //Someone's already looking it up; wait for them
+        Pending *p = m_pending[key];
+        p->users++;
+        m_coalesced++;
+
+        while(!p->done)
+            m_cond.wait(m_lock);
+
+        err = p->error;
+        dst = p->addr;
+        releasePending(p);
+        m_lock.unlock();
+    } else {
+        Pending *p = new Pending;
+        p->users++; //Keep it until we read the result
+        m_pending[key] = p;
+        m_lock.unlock();
+
+        lookup(key, p);
+
+        m_lock.lock();
+        err = p->error;
+        dst = p->addr;
+        releasePending(p);
+        m_lock.unlock();
+    }
+
+    dst.setPort(port);
+    return err;
+}
+
+void m::DNSResolver::resolveAsync(const String &host, uint16_t port, Callback cb)
+{
+    const String key(host.lower());
+    auto withPort = [cb, port] (DNSResolveError err, const IPv4Address &addr) {
+        IPv4Address cpy(addr);
+        cpy.setPort(port);
+        cb(err, cpy);
+    };
+
+    DNSResolveError err;
+    IPv4Address addr;
+    m_lock.lock();
+
+    if(cached(key, err, addr)) {
+        m_lock.unlock();
+        withPort(err, addr);
+        return;
+    }
+
+    m_misses++;
+    if(m_pending.hasKey(key)) {
+        m_pending[key]->callbacks.add(withPort);
+        m_coalesced++;
+        m_lock.unlock();
+        return;
+    }
+
+    Pending *p = new Pending;
+    p->callbacks.add(withPort);
+    m_pending[key] = p;
+
+    if(!m_pool.isRunning())
+        m_pool.start();
+
+    m_lock.unlock();
+
+    if(!m_pool.execute([this, key, p] () { lookup(key, p); }))
+        lookup(key, p);
+}
+
+m::Future<m::IPv4Address> m::DNSResolver::resolveAsync(const String &host, uint16_t port)
+{
+    Promise<IPv4Address> promise;
+    Future<IPv4Address> ret(promise.makeNewFuture());
+
+    resolveAsync(host, port, [promise, port] (DNSResolveError err, const IPv4Address &addr) mutable {
+        promise.set(err == kRE_NoError ? addr : IPv4Address(port));
+    });
+
+    return ret;
+}
+
+m::DNSResolver &m::DNSResolver::instance()
+{
+    //Never destroyed, lookups may still be running at exit
+    static DNSResolver *ret = new DNSResolver;
+    return *ret;
+}
@@ -0,0 +1,585 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/Executor.h"
+#include "mgpcl/CPUInfo.h"
+#include "mgpcl/Assert.h"
+#include "mgpcl/Mutex.h"
+
+#ifdef MGPCL_WIN
+static inline void g_m_fence()
+{
+    MemoryBarrier();
+}
+
+static inline m::WorkDeque::Task *g_m_loadTask(m::WorkDeque::Task **slot)
+{
+    return *static_cast<m::WorkDeque::Task * volatile*>(slot);
+}
+
+static inline void g_m_storeTask(m::WorkDeque::Task **slot, m::WorkDeque::Task *task)
+{
+    *static_cast<m::WorkDeque::Task * volatile*>(slot) = task;
+}
+
+#define M_EXECUTOR_TLS __declspec(thread)
+#else
+static inline void g_m_fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline m::WorkDeque::Task *g_m_loadTask(m::WorkDeque::Task **slot)
+{
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+static inline void g_m_storeTask(m::WorkDeque::Task **slot, m::WorkDeque::Task *task)
+{
+    __atomic_store_n(slot, task, __ATOMIC_RELAXED);
+}
+
+#define M_EXECUTOR_TLS __thread
+#endif
+
+//Set by each worker, so currentWorker() doesn't have to look for the calling thread
+static M_EXECUTOR_TLS const m::Executor *g_m_tlsExecutor = nullptr;
+static M_EXECUTOR_TLS int g_m_tlsWorker = -1;
+
+//Spins a bit before sleeping, tasks often come in bursts
+#define M_EXECUTOR_SPINS 64
+
+m::WorkDeque::WorkDeque(int capacity)
+{
+    int cap = 1;
+    while(cap < capacity)
+        cap <<= 1;
+
+    m_tasks = new Task*[cap];
+    m_mask = static_cast<int64_t>(cap - 1);
+
+    for(int i = 0; i < cap; i++)
+        m_tasks[i] = nullptr;
+}
+
+m::WorkDeque::~WorkDeque()
+{
+    delete[] m_tasks;
+}
+
+bool m::WorkDeque::push(Task *task)
+{
+    int64_t b = m_bottom.load();
+    int64_t t = m_top.load();
+
+    if(b - t > m_mask)
+        return false;
+
+    g_m_storeTask(m_tasks + (b & m_mask), task);
+    m_bottom.store(b + 1);
+    return true;
+}
+
+m::WorkDeque::Task *m::WorkDeque::pop()
+{
+    int64_t b = m_bottom.load() - 1;
+    m_bottom.store(b);
+    g_m_fence();
+
+    int64_t t = m_top.load();
+    if(t > b) {
+        //Empty
+        m_bottom.store(b + 1);
+        return nullptr;
+    }
+
+    Task *ret = g_m_loadTask(m_tasks + (b & m_mask));
+    if(t == b) {
+        //Last task, race against the thieves
+        if(!m_top.compareAndSwap(t, t + 1))
+            ret = nullptr;
+
+        m_bottom.store(b + 1);
+    }
+
+    return ret;
+}
+
+m::WorkDeque::Task *m::WorkDeque::steal()
+{
+    int64_t t = m_top.load();
+    g_m_fence();
+    int64_t b = m_bottom.load();
+
+    if(t >= b)
+        return nullptr;
+
+    Task *ret = g_m_loadTask(m_tasks + (t & m_mask));
+    return m_top.compareAndSwap(t, t + 1) ? ret : nullptr;
+}
+
+
+m::Executor::Executor(int count, const String &name, uint32_t queueCapacity) : m_name(name)
+{
+    if(count <= 0)
+        count = static_cast<int>(CPUInfo::fetch().numCores());
+
+    m_count = count > 0 ? count : 1;
+    m_cpus = 0;
+    m_inject = new ConcurrentQueue<Task*>(queueCapacity);
+    m_running = false;
+    m_stopping = false;
+}
+
+m::Executor::~Executor()
+{
+    stop();
+    delete m_inject;
+}
+
+m::Executor &m::Executor::dispatchOnCores(uint8_t numCpus)
+{
+    m_cpus = numCpus;
+    return *this;
+}
+
+bool m::Executor::start()
+{
+    mAssert(!m_running, "executor already started");
+    m_stopping = false;
+
+    for(int i = 0; i < m_count; i++)
+        m_workers.add(new Worker([this, i] () { workerLoop(i); }, m_name + String::fromUInteger(static_cast<uint32_t>(i))));
+
+    m_running = true;
+    for(int i = 0; i < m_count; i++) {
+        if(!m_workers[i]->thread.start()) {
+            //Don't leave tasks to workers that will never run
+            const int count = m_count;
+            m_count = i;
+            stop();
+            m_count = count;
+            return false;
+        }
+
+        if(m_cpus != 0) {
+            int core = i % static_cast<int>(m_cpus);
+            m_workers[i]->thread.setAffinityMask(1ULL << static_cast<uint64_t>(core));
+        }
+    }
+
+    return true;
+}
+
+void m::Executor::stop()
+{
+    if(!m_running)
+        return;
+
+    mAssert(currentWorker() < 0, "executor stopped from one of its own workers"); //It would join itself
+
+    m_stopping = true;
+    g_m_fence();
+    m_signal.increment();
+    m_signal.wakeAll();
+
+    for(int i = 0; i < m_count; i++)
+        m_workers[i]->thread.join();
+
+    //execute() calls that saw m_stopping == false are about to push their
+    //task; it has to land before the drain below and the deques are gone.
+    while(m_executing.load() > 0)
+        g_m_fence();
+
+    //Tasks that raced with stop(), or left by a failed start()
+    Task *task;
+    while((task = findTask(-1)) != nullptr)
+        runTask(task);
+
+    for(Worker *w : m_workers)
+        delete w;
+
+    m_workers.clear();
+    m_running = false;
+}
+
+bool m::Executor::setAffinityMask(int worker, uint64_t mask)
+{
+    mDebugAssert(worker >= 0 && worker < ~m_workers, "invalid worker index");
+    return m_workers[worker]->thread.setAffinityMask(mask);
+}
+
+int m::Executor::currentWorker() const
+{
+    return g_m_tlsExecutor == this ? g_m_tlsWorker : -1;
+}
+
+bool m::Executor::execute(std::function<void()> func)
+{
+    return enqueue(std::move(func), true);
+}
+
+bool m::Executor::tryExecute(std::function<void()> func)
+{
+    return enqueue(std::move(func), false);
+}
+
+bool m::Executor::enqueue(std::function<void()> &&func, bool runIfFull)
+{
+    //Announce the call before checking m_stopping, stop() sets it before waiting for m_executing
+    m_executing.increment();
+    volatile bool running = m_running && !m_stopping;
+
+    if(!running) {
+        m_executing.add(-1);
+        return false;
+    }
+
+    Task *task = new Task(std::move(func));
+    int id = currentWorker();
+
+    if((id < 0 || !m_workers[id]->deque.push(task)) && !m_inject->offer(task)) {
+        m_executing.add(-1);
+        m_overflows.increment();
+
+        if(!runIfFull) {
+            delete task;
+            return false;
+        }
+
+        //Overloaded: the caller pays for it, which slows down the producers
+        m_submitted.increment();
+        runTask(task);
+        return true;
+    }
+
+    m_submitted.increment();
+    m_executing.add(-1);
+    signal();
+    return true;
+}
+
+void m::Executor::runTask(Task *task)
+{
+    (*task)();
+    delete task;
+    m_completed.increment();
+}
+
+int m::Executor::queueLength() const
+{
+    int ret = static_cast<int>(m_inject->size());
+    for(int i = 0; i < ~m_workers; i++)
+        ret += m_workers[i]->deque.size();
+
+    return ret;
+}
+
+void m::Executor::signal()
+{
+    m_signal.increment();
+    if(m_sleepers.load() > 0)
+        m_signal.wakeOne();
+}
+
+m::Executor::Task *m::Executor::findTask(int id)
+{
+    Task *ret;
+    if(id >= 0 && (ret = m_workers[id]->deque.pop()) != nullptr)
+        return ret;
+
+    if(m_inject->poll(ret))
+        return ret;
+
+    //Start at a different victim for each worker so they don't all hit the same deque
+    const int n = ~m_workers;
+    for(int i = 1; i <= n; i++) {
+        int victim = (id + i) % n;
+        if(victim != id && (ret = m_workers[victim]->deque.steal()) != nullptr)
+            return ret;
+    }
+
+    return nullptr;
+}
+
+void m::Executor::workerLoop(int id)
+{
+    g_m_tlsExecutor = this;
+    g_m_tlsWorker = id;
+    int spins = 0;
+
+    while(true) {
+        Task *task = findTask(id);
+
+        if(task == nullptr && spins < M_EXECUTOR_SPINS) {
+            spins++;
+            continue;
+        }
+
+        if(task == nullptr) {
+            //Check again once registered as a sleeper, so signal() can't be missed
+            int32_t val = m_signal.value();
+            m_sleepers.increment();
+            task = findTask(id);
+
+            if(task == nullptr) {
+                volatile bool stopping = m_stopping;
+                if(stopping) {
+                    m_sleepers.add(-1);
+                    break;
+                }
+
+                m_signal.wait(val);
+            }
+
+            m_sleepers.add(-1);
+            if(task == nullptr)
+                continue;
+        }
+
+        spins = 0;
+        runTask(task);
+    }
+}
+
+namespace m
+{
+    class ChunkedJob
+    {
+    public:
+        ChunkedJob(int b, int e, int g, std::function<void(int, int, int)> &&bd) : begin(b), end(e), grain(g), body(bd), refs(1)
+        {
+            numChunks = (end - begin + grain - 1) / grain;
+        }
+
+        void releaseRef()
+        {
+            if(refs.releaseRef())
+                delete this;
+        }
+
+        //Takes chunks until there are none left
+        void run()
+        {
+            while(true) {
+                int64_t chunk = next.increment() - 1;
+                if(chunk >= numChunks)
+                    break;
+
+                int b = begin + static_cast<int>(chunk) * grain;
+                int e = (end - b > grain) ? b + grain : end;
+                body(static_cast<int>(chunk), b, e);
+
+                if(done.increment() == numChunks) {
+                    finished.increment();
+                    finished.wakeAll();
+                }
+            }
+        }
+
+        int begin;
+        int end;
+        int grain;
+        int64_t numChunks;
+        std::function<void(int, int, int)> body;
+
+        Atomic64 next;
+        Atomic64 done;
+        Futex finished;
+        AtomicRefCounter refs;
+    };
+}
+
+void m::Executor::forEachChunk(int begin, int end, int grain, std::function<void(int, int, int)> body)
+{
+    if(end <= begin)
+        return;
+
+    if(grain < 1)
+        grain = 1;
+
+    //Helpers that start late find no chunk left and return, so the job is refcounted
+    ChunkedJob *job = new ChunkedJob(begin, end, grain, std::move(body));
+    int64_t helpers = job->numChunks - 1;
+    if(helpers > static_cast<int64_t>(m_count))
+        helpers = static_cast<int64_t>(m_count);
+
+    for(int64_t i = 0; i < helpers; i++) {
+        job->refs.addRef();
+
+        if(!execute([job] () { job->run(); job->releaseRef(); })) {
+            job->refs.releaseRef();
+            break;
+        }
+    }
+
+    job->run();
+    while(job->done.load() < job->numChunks) {
+        int32_t val = job->finished.value();
+        if(job->done.load() >= job->numChunks)
+            break;
+
+        job->finished.wait(val);
+    }
+
+    job->releaseRef();
+}
+
+
+m::TaskGraph::TaskGraph() : m_executor(nullptr), m_running(false)
+{
+}
+
+m::TaskGraph::~TaskGraph()
+{
+    mAssert(!m_running, "graph destroyed while running");
+    for(Node *n : m_nodes)
+        delete n;
+}
+
+int m::TaskGraph::add(std::function<void()> func)
+{
+    mAssert(!m_running, "can't modify a running graph");
+
+    Node *node = new Node;
+    node->func = std::move(func);
+    node->numDeps = 0;
+    m_nodes.add(node);
+
+    return ~m_nodes - 1;
+}
+
+void m::TaskGraph::precede(int before, int after)
+{
+    mAssert(!m_running, "can't modify a running graph");
+    mDebugAssert(before >= 0 && before < ~m_nodes && after >= 0 && after < ~m_nodes, "invalid node index");
+
+    m_nodes[before]->successors.add(after);
+    m_nodes[after]->numDeps++;
+}
+
+m::Future<bool> m::TaskGraph::run(Executor &ex)
+{
+    mAssert(!m_running, "graph is already running");
+
+    Promise<bool> promise;
+    Future<bool> ret(promise.makeNewFuture());
+
+    //Kahn's algorithm, only to reject cycles before anything runs
+    List<int> deps(~m_nodes);
+    List<int> ready;
+
+    for(int i = 0; i < ~m_nodes; i++) {
+        deps.add(m_nodes[i]->numDeps);
+        if(m_nodes[i]->numDeps == 0)
+            ready.add(i);
+    }
+
+    const int numRoots = ~ready;
+    for(int i = 0; i < ~ready; i++) {
+        for(int s : m_nodes[ready[i]]->successors) {
+            if(--deps[s] == 0)
+                ready.add(s);
+        }
+    }
+
+    if(~ready != ~m_nodes) {
+        promise.set(false);
+        return ret;
+    }
+
+    if(m_nodes.isEmpty()) {
+        promise.set(true);
+        return ret;
+    }
+
+    for(Node *n : m_nodes)
+        n->pending.set(n->numDeps);
+
+    m_executor = &ex;
+    m_promise = promise;
+    m_remaining.set(~m_nodes);
+    m_running = true;
+
+    for(int i = 0; i < numRoots; i++) {
+        int id = ready[i];
+        if(!ex.execute([this, id] () { runNode(id); }))
+            runNode(id);
+    }
+
+    return ret;
+}
+
+void m::TaskGraph::runNode(int id)
+{
+    Node *node = m_nodes[id];
+    node->func();
+
+    for(int s : node->successors) {
+        if(m_nodes[s]->pending.decrement() == 0) {
+            if(!m_executor->execute([this, s] () { runNode(s); }))
+                runNode(s);
+        }
+    }
+
+    if(m_remaining.add(-1) == 0) {
+        //The graph may be destroyed as soon as the promise is set
+        Promise<bool> promise(m_promise);
+        m_running = false;
+        promise.set(true);
+    }
+}
+
+
+static m::Mutex g_m_globalLock;
+static m::Executor *g_m_globalExecutor = nullptr;
+static int g_m_globalCount = 0;
+static uint32_t g_m_globalQueueCapacity = M_EXECUTOR_QUEUE_SIZE;
+
+static m::Executor *g_m_createGlobalExecutor()
+{
+    g_m_globalLock.lock();
+    g_m_globalExecutor = new m::Executor(g_m_globalCount, "Async-"_m, g_m_globalQueueCapacity);
+    g_m_globalExecutor->start();
+    g_m_globalLock.unlock();
+
+    //Never destroyed: tasks may still be running while statics are destroyed
+    return g_m_globalExecutor;
+}
+
+m::Executor &m::globalExecutor()
+{
+    //Function-local statics are initialized once, even with several threads
+    static Executor *ex = g_m_createGlobalExecutor();
+    return *ex;
+}
+
+bool m::configureGlobalExecutor(int count, uint32_t queueCapacity)
+{
+    g_m_globalLock.lock();
+    bool ret = (g_m_globalExecutor == nullptr);
+
+    if(ret) {
+        g_m_globalCount = count;
+        g_m_globalQueueCapacity = queueCapacity;
+    }
+
+    g_m_globalLock.unlock();
+    return ret;
+}
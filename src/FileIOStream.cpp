@@ -19,13 +19,22 @@
 
 #include "mgpcl/FileIOStream.h"
 #include "mgpcl/Assert.h"
+#include "mgpcl/Mem.h"
 
 #ifdef MGPCL_LINUX
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+
+#ifdef IOV_MAX
+#define M_FOS_MAX_IOV (IOV_MAX < 64 ? IOV_MAX : 64)
+#else
+#define M_FOS_MAX_IOV 16
+#endif
 #endif
 
 m::FileInputStream::FileInputStream()
@@ -209,6 +218,10 @@ m::FileOutputStream::FileOutputStream()
 #else
     m_file = -1;
 #endif
+
+    m_buf = nullptr;
+    m_bufSz = 0;
+    m_bufLen = 0;
 }
 
 m::FileOutputStream::FileOutputStream(const String &fname, OpenMode m)
@@ -219,26 +232,25 @@ m::FileOutputStream::FileOutputStream(const String &fname, OpenMode m)
     m_file = -1;
 #endif
 
+    m_buf = nullptr;
+    m_bufSz = 0;
+    m_bufLen = 0;
     open(fname, m);
 }
 
 m::FileOutputStream::~FileOutputStream()
 {
-#ifdef MGPCL_WIN
-    if(m_file != INVALID_HANDLE_VALUE)
-        CloseHandle(m_file);
-#else
-    if(m_file != -1)
-        ::close(m_file);
-#endif
+    close();
+
+    if(m_buf != nullptr)
+        delete[] m_buf;
 }
 
 bool m::FileOutputStream::open(const String &fname, OpenMode mode)
 {
-#ifdef MGPCL_WIN
-    if(m_file != INVALID_HANDLE_VALUE)
-        CloseHandle(m_file);
+    close();
 
+#ifdef MGPCL_WIN
     DWORD disposition;
     if(mode == kOM_Truncate)
         disposition = CREATE_ALWAYS;
@@ -269,9 +281,6 @@ bool m::FileOutputStream::open(const String &fname, OpenMode mode)
         return true;
     }
 #else
-    if(m_file != -1)
-        ::close(m_file);
-
     int flags = O_WRONLY | O_CREAT;
     if(mode == kOM_Truncate)
         flags |= O_TRUNC;
@@ -292,25 +301,181 @@ bool m::FileOutputStream::open(const String &fname, OpenMode mode)
 #endif
 }
 
-int m::FileOutputStream::write(const uint8_t *src, int sz)
+int m::FileOutputStream::rawWrite(const uint8_t *src, int sz)
 {
 #ifdef MGPCL_WIN
-    mDebugAssert(m_file != INVALID_HANDLE_VALUE, "file was not opened");
-    mDebugAssert(sz >= 0, "cannot write a negative amount of bytes");
-
     DWORD written;
     if(WriteFile(m_file, src, static_cast<DWORD>(sz), &written, nullptr) == FALSE)
         return -1;
     else
         return static_cast<int>(written);
+#else
+    return static_cast<int>(::write(m_file, src, static_cast<size_t>(sz)));
+#endif
+}
+
+int m::FileOutputStream::write(const uint8_t *src, int sz)
+{
+#ifdef MGPCL_WIN
+    mDebugAssert(m_file != INVALID_HANDLE_VALUE, "file was not opened");
 #else
     mDebugAssert(m_file != -1, "file was not opened");
+#endif
     mDebugAssert(sz >= 0, "cannot write a negative amount of bytes");
 
-    return static_cast<int>(::write(m_file, src, static_cast<size_t>(sz)));
+    if(m_bufSz == 0)
+        return rawWrite(src, sz);
+
+    if(static_cast<uint32_t>(sz) <= m_bufSz - m_bufLen) {
+        mem::copy(m_buf + m_bufLen, src, static_cast<size_t>(sz));
+        m_bufLen += static_cast<uint32_t>(sz);
+        return sz;
+    }
+
+    //Doesn't fit: send what we have along with the new data
+    IOSlice slice = { src, sz };
+    return writeV(&slice, 1);
+}
+
+int m::FileOutputStream::writeV(const IOSlice *slices, int cnt)
+{
+#ifdef MGPCL_WIN
+    mDebugAssert(m_file != INVALID_HANDLE_VALUE, "file was not opened");
+
+    //No gather write for regular (non-overlapped) files on Windows
+    if(!flushBuffer())
+        return -1;
+
+    int total = 0;
+    for(int i = 0; i < cnt; i++) {
+        const uint8_t *src = slices[i].data;
+        int left = slices[i].size;
+
+        while(left > 0) {
+            int ret = rawWrite(src, left);
+            if(ret <= 0)
+                return -1;
+
+            src += ret;
+            left -= ret;
+        }
+
+        total += slices[i].size;
+    }
+
+    return total;
+#else
+    mDebugAssert(m_file != -1, "file was not opened");
+
+    struct iovec iov[M_FOS_MAX_IOV];
+    int total = 0;
+
+    //Pending buffer goes first, in the same system call
+    int pending = static_cast<int>(m_bufLen);
+    int s = 0;
+
+    while(s < cnt || pending > 0) {
+        int n = 0;
+        ssize_t expected = 0;
+
+        if(pending > 0) {
+            iov[0].iov_base = m_buf;
+            iov[0].iov_len = static_cast<size_t>(pending);
+            expected += pending;
+            n++;
+        }
+
+        for(int i = s; i < cnt && n < M_FOS_MAX_IOV; i++) {
+            iov[n].iov_base = const_cast<uint8_t*>(slices[i].data);
+            iov[n].iov_len = static_cast<size_t>(slices[i].size);
+            expected += slices[i].size;
+            n++;
+        }
+
+        ssize_t ret = ::writev(m_file, iov, n);
+        if(ret < 0 || (ret == 0 && expected > 0))
+            return -1;
+
+        //Consume what was written, possibly stopping in the middle of a slice
+        if(pending > 0) {
+            if(ret < pending) {
+                m_bufLen -= static_cast<uint32_t>(ret);
+                mem::move(m_buf, m_buf + ret, m_bufLen);
+                pending = static_cast<int>(m_bufLen);
+                continue;
+            }
+
+            ret -= pending;
+            pending = 0;
+            m_bufLen = 0;
+        }
+
+        while(s < cnt && ret >= slices[s].size) {
+            ret -= slices[s].size;
+            total += slices[s].size;
+            s++;
+        }
+
+        if(ret > 0) {
+            //Partial slice; write the rest of it on its own
+            const uint8_t *src = slices[s].data + ret;
+            int left = slices[s].size - static_cast<int>(ret);
+
+            while(left > 0) {
+                int wr = rawWrite(src, left);
+                if(wr <= 0)
+                    return -1;
+
+                src += wr;
+                left -= wr;
+            }
+
+            total += slices[s].size;
+            s++;
+        }
+    }
+
+    m_bufLen = 0;
+    return total;
 #endif
 }
 
+bool m::FileOutputStream::flushBuffer()
+{
+    uint8_t *ptr = m_buf;
+    while(m_bufLen > 0) {
+        int written = rawWrite(ptr, static_cast<int>(m_bufLen));
+        if(written <= 0) {
+            //Keep what's left at the beginning of the buffer
+            if(ptr != m_buf)
+                mem::move(m_buf, ptr, m_bufLen);
+
+            return false;
+        }
+
+        ptr += written;
+        m_bufLen -= static_cast<uint32_t>(written);
+    }
+
+    return true;
+}
+
+bool m::FileOutputStream::setBufferSize(uint32_t sz)
+{
+    if(sz == m_bufSz)
+        return true;
+
+    if(!flushBuffer())
+        return false;
+
+    if(m_buf != nullptr)
+        delete[] m_buf;
+
+    m_buf = (sz == 0) ? nullptr : new uint8_t[sz];
+    m_bufSz = sz;
+    return true;
+}
+
 uint64_t m::FileOutputStream::pos()
 {
 #ifdef MGPCL_WIN
@@ -319,15 +484,18 @@ uint64_t m::FileOutputStream::pos()
     LONG h = 0;
     LONG l = SetFilePointer(m_file, 0, &h, FILE_CURRENT);
 
-    return (static_cast<uint64_t>(h) << 32) | static_cast<uint64_t>(l);
+    return ((static_cast<uint64_t>(h) << 32) | static_cast<uint64_t>(l)) + static_cast<uint64_t>(m_bufLen);
 #else
     mDebugAssert(m_file != -1, "file was not opened");
-    return static_cast<uint64_t>(lseek(m_file, 0, SEEK_CUR));
+    return static_cast<uint64_t>(lseek(m_file, 0, SEEK_CUR)) + static_cast<uint64_t>(m_bufLen);
 #endif
 }
 
 bool m::FileOutputStream::seek(int amount, SeekPos sp)
 {
+    if(!flushBuffer())
+        return false;
+
 #ifdef MGPCL_WIN
     mDebugAssert(m_file != INVALID_HANDLE_VALUE, "file was not opened");
 
@@ -382,12 +550,26 @@ bool m::FileOutputStream::seek(int amount, SeekPos sp)
 }
 
 bool m::FileOutputStream::flush()
+{
+    return sync(false);
+}
+
+bool m::FileOutputStream::sync(bool dataOnly)
 {
 #ifdef MGPCL_WIN
     mDebugAssert(m_file != INVALID_HANDLE_VALUE, "file was not opened");
-    return FlushFileBuffers(m_file) == TRUE;
+    return flushBuffer() && FlushFileBuffers(m_file) == TRUE;
 #else
     mDebugAssert(m_file != -1, "file was not opened");
+
+    if(!flushBuffer())
+        return false;
+
+#ifdef _POSIX_SYNCHRONIZED_IO
+    if(dataOnly)
+        return fdatasync(m_file) == 0;
+#endif
+
     return fsync(m_file) == 0;
 #endif
 }
@@ -396,13 +578,17 @@ void m::FileOutputStream::close()
 {
 #ifdef MGPCL_WIN
     if(m_file != INVALID_HANDLE_VALUE) {
+        flushBuffer();
         CloseHandle(m_file);
         m_file = INVALID_HANDLE_VALUE;
     }
 #else
     if(m_file != -1) {
+        flushBuffer();
         ::close(m_file);
         m_file = -1;
     }
 #endif
+
+    m_bufLen = 0;
 }
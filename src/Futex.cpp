@@ -0,0 +1,87 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/Futex.h"
+
+#ifdef MGPCL_WIN
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "Synchronization.lib")
+#endif
+#else
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#endif
+
+int32_t m::Futex::increment()
+{
+#ifdef MGPCL_WIN
+    return static_cast<int32_t>(InterlockedIncrement(&m_value));
+#else
+    return __sync_add_and_fetch(&m_value, 1);
+#endif
+}
+
+bool m::Futex::wait(int32_t expected, uint32_t ms)
+{
+#ifdef MGPCL_WIN
+    LONG cmp = static_cast<LONG>(expected);
+    if(WaitOnAddress(&m_value, &cmp, sizeof(LONG), ms == M_FUTEX_INFINITE ? INFINITE : static_cast<DWORD>(ms)))
+        return true;
+
+    return GetLastError() != ERROR_TIMEOUT;
+#else
+    struct timespec ts;
+    struct timespec *tsp = nullptr;
+
+    if(ms != M_FUTEX_INFINITE) {
+        ts.tv_sec = static_cast<time_t>(ms / 1000);
+        ts.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+
+    if(syscall(SYS_futex, &m_value, FUTEX_WAIT_PRIVATE, expected, tsp, nullptr, 0) == 0)
+        return true;
+
+    return errno != ETIMEDOUT;
+#endif
+}
+
+void m::Futex::wakeOne()
+{
+#ifdef MGPCL_WIN
+    WakeByAddressSingle(const_cast<LONG*>(&m_value));
+#else
+    syscall(SYS_futex, &m_value, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+void m::Futex::wakeAll()
+{
+#ifdef MGPCL_WIN
+    WakeByAddressAll(const_cast<LONG*>(&m_value));
+#else
+    syscall(SYS_futex, &m_value, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, nullptr, nullptr, 0);
+#endif
+}
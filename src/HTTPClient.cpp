@@ -0,0 +1,1164 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/HTTPClient.h"
+#include "mgpcl/Time.h"
+#include "mgpcl/DNSResolver.h"
+#include "mgpcl/RefCounter.h"
+#include <cstring>
+
+#ifndef MGPCL_WIN
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define M_HTTP_CLIENT_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define M_HTTP_CLIENT_SEND_FLAGS 0
+#endif
+
+#define M_HTTP_CLIENT_MAX_EVENTS 64
+
+enum HTTPClientPhase
+{
+    kHCP_Status = 0,
+    kHCP_Headers,
+    kHCP_Body,
+    kHCP_ChunkSize,
+    kHCP_ChunkData,
+    kHCP_ChunkEnd,
+    kHCP_Trailers
+};
+
+class m::HTTPClient::Task
+{
+public:
+    Task(const HTTPClientRequest &r, double dl) : req(r), deadline(dl), retries(0), started(false)
+    {
+    }
+
+    HTTPClientRequest req;
+    Promise<HTTPClientResponse> promise;
+    HTTPClientResponse resp;
+    double deadline;
+    int retries;
+    bool started; //Received the status line; can't be retried anymore
+};
+
+class m::HTTPClient::Host
+{
+public:
+    Host() : port(0), expires(0.0), resolved(false), resolving(false), resolveError(kRE_NoError)
+    {
+    }
+
+    String name;
+    uint16_t port;
+    IPv4Address addr;
+    double expires; //Same as the resolver's cache entry; 0 = never
+    bool resolved;
+    bool resolving; //Lookups don't block the loop
+
+    //Lookup result, written by onResolved() under m_lock
+    DNSResolveError resolveError;
+    IPv4Address resolvedAddr;
+
+    List<Task*> queue;
+    List<Connection*> conns;
+};
+
+class m::HTTPClient::Connection
+{
+public:
+    Connection(Host *h) : host(h), connecting(true), persistent(false), wantsWrite(false), outPos(0),
+                          phase(kHCP_Status), remaining(0), http11(false), untilClose(false), closeAfter(false)
+    {
+    }
+
+    TCPSocket sock;
+    Host *host;
+    bool connecting;
+    bool persistent; //The server answered with a keep-alive HTTP/1.1 response
+    bool wantsWrite;
+
+    List<Task*> inFlight; //In the order they were sent
+    String out;
+    int outPos;
+
+    //Response parser
+    HTTPClientPhase phase;
+    String line;
+    uint64_t remaining;
+    bool http11;
+    bool untilClose;
+    bool closeAfter;
+};
+
+//DNS callbacks may run after the client stopped; they go through
+//this instead of the client, which detaches it in cancelAll().
+class m::HTTPClient::ResolveSink
+{
+public:
+    ResolveSink(HTTPClient *c) : client(c), refs(1)
+    {
+    }
+
+    void release()
+    {
+        if(refs.releaseRef())
+            delete this;
+    }
+
+    Mutex lock;
+    HTTPClient *client;
+    AtomicRefCounter refs;
+};
+
+#ifndef MGPCL_WIN
+class m::HTTPClient::Poller
+{
+public:
+    class Event
+    {
+    public:
+        Connection *conn;
+        bool readable;
+        bool writable;
+    };
+
+    Poller()
+    {
+        m_wake[0] = -1;
+        m_wake[1] = -1;
+        m_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        if(m_fd >= 0 && pipe(m_wake) == 0) {
+            fcntl(m_wake[0], F_SETFL, O_NONBLOCK);
+            fcntl(m_wake[1], F_SETFL, O_NONBLOCK);
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            epoll_ctl(m_fd, EPOLL_CTL_ADD, m_wake[0], &ev);
+        }
+    }
+
+    ~Poller()
+    {
+        if(m_fd >= 0)
+            ::close(m_fd);
+
+        if(m_wake[0] >= 0) {
+            ::close(m_wake[0]);
+            ::close(m_wake[1]);
+        }
+    }
+
+    bool isValid() const
+    {
+        return m_fd >= 0 && m_wake[0] >= 0;
+    }
+
+    bool add(Connection *c, bool wr)
+    {
+        return ctl(EPOLL_CTL_ADD, c, wr);
+    }
+
+    void modify(Connection *c, bool wr)
+    {
+        ctl(EPOLL_CTL_MOD, c, wr);
+    }
+
+    void remove(Connection *c)
+    {
+        struct epoll_event ev; //Pre-2.6.9 kernels want a non-null pointer
+        epoll_ctl(m_fd, EPOLL_CTL_DEL, c->sock.raw(), &ev);
+    }
+
+    int wait(Event *dst, int timeout)
+    {
+        struct epoll_event evs[M_HTTP_CLIENT_MAX_EVENTS];
+        int cnt = epoll_wait(m_fd, evs, M_HTTP_CLIENT_MAX_EVENTS, timeout);
+        int ret = 0;
+
+        for(int i = 0; i < cnt; i++) {
+            if(evs[i].data.ptr == nullptr) {
+                char buf[64];
+                while(read(m_wake[0], buf, sizeof(buf)) > 0) {
+                }
+            } else {
+                dst[ret].conn = static_cast<Connection*>(evs[i].data.ptr);
+                dst[ret].readable = (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+                dst[ret].writable = (evs[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0;
+                ret++;
+            }
+        }
+
+        return ret;
+    }
+
+    void wake()
+    {
+        char c = 0;
+        if(write(m_wake[1], &c, 1) < 0) {
+            //Pipe full: the loop is going to wake up anyway
+        }
+    }
+
+private:
+    bool ctl(int op, Connection *c, bool wr)
+    {
+        struct epoll_event ev;
+        ev.events = wr ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.ptr = c;
+
+        return epoll_ctl(m_fd, op, c->sock.raw(), &ev) == 0;
+    }
+
+    int m_fd;
+    int m_wake[2];
+};
+#else
+//No pipe to wake WSAPoll up, so the loop polls submissions every 10ms
+class m::HTTPClient::Poller
+{
+public:
+    class Event
+    {
+    public:
+        Connection *conn;
+        bool readable;
+        bool writable;
+    };
+
+    bool isValid() const
+    {
+        return true;
+    }
+
+    bool add(Connection *c, bool wr)
+    {
+        m_conns.add(c);
+        return true;
+    }
+
+    void modify(Connection *c, bool wr)
+    {
+    }
+
+    void remove(Connection *c)
+    {
+        for(int i = 0; i < m_conns.size(); i++) {
+            if(m_conns[i] == c) {
+                m_conns.remove(i);
+                break;
+            }
+        }
+    }
+
+    int wait(Event *dst, int timeout)
+    {
+        if(timeout < 0 || timeout > 10)
+            timeout = 10;
+
+        if(m_conns.isEmpty()) {
+            Sleep(static_cast<DWORD>(timeout));
+            return 0;
+        }
+
+        int cnt = m_conns.size();
+        if(cnt > M_HTTP_CLIENT_MAX_EVENTS)
+            cnt = M_HTTP_CLIENT_MAX_EVENTS; //The others will be polled next time
+
+        WSAPOLLFD fds[M_HTTP_CLIENT_MAX_EVENTS];
+        for(int i = 0; i < cnt; i++) {
+            fds[i].fd = m_conns[i]->sock.raw();
+            fds[i].events = m_conns[i]->wantsWrite ? (POLLRDNORM | POLLWRNORM) : POLLRDNORM;
+            fds[i].revents = 0;
+        }
+
+        if(WSAPoll(fds, static_cast<ULONG>(cnt), timeout) <= 0)
+            return 0;
+
+        int ret = 0;
+        for(int i = 0; i < cnt; i++) {
+            if(fds[i].revents != 0) {
+                dst[ret].conn = m_conns[i];
+                dst[ret].readable = (fds[i].revents & (POLLRDNORM | POLLHUP | POLLERR)) != 0;
+                dst[ret].writable = (fds[i].revents & (POLLWRNORM | POLLHUP | POLLERR)) != 0;
+                ret++;
+            }
+        }
+
+        //Round robin so that no connection starves
+        if(m_conns.size() > M_HTTP_CLIENT_MAX_EVENTS) {
+            Connection *first = m_conns.first();
+            m_conns.remove(0);
+            m_conns.add(first);
+        }
+
+        return ret;
+    }
+
+    void wake()
+    {
+    }
+
+private:
+    List<Connection*> m_conns;
+};
+#endif
+
+static const char *g_m_methodName(m::HTTPRequestType type)
+{
+    switch(type) {
+    case m::kHRT_Get:
+        return "GET";
+
+    case m::kHRT_Post:
+        return "POST";
+
+    case m::kHRT_Put:
+        return "PUT";
+
+    case m::kHRT_Head:
+        return "HEAD";
+
+    case m::kHRT_Delete:
+        return "DELETE";
+
+    case m::kHRT_Trace:
+        return "TRACE";
+
+    case m::kHRT_Connect:
+        return "CONNECT";
+
+    default:
+        return nullptr;
+    }
+}
+
+//Only requests without side effects (and without body) can be pipelined
+static bool g_m_canPipeline(const m::HTTPClientRequest &req)
+{
+    return (req.type == m::kHRT_Get || req.type == m::kHRT_Head) && req.body.isEmpty();
+}
+
+static void g_m_writeRequest(m::HTTPClientRequest &req, m::String &dst)
+{
+    dst += g_m_methodName(req.type);
+    dst += ' ';
+
+    if(req.url.location().isEmpty())
+        dst += '/';
+    else
+        dst += req.url.location();
+
+    dst += " HTTP/1.1\r\nHost: "_m;
+    dst += req.url.host();
+
+    if(req.url.port() != 80) {
+        dst += ':';
+        dst.appendUInteger(req.url.port());
+    }
+
+    dst += "\r\n"_m;
+
+    if(!req.headers.hasKey("User-Agent"_m))
+        dst += "User-Agent: MGPCL v" MGPCL_VERSION_STRING "\r\n";
+
+    for(m::HashMap<m::String, m::String, m::StringLowerHasher>::Pair &p : req.headers) {
+        dst += p.key;
+        dst += ": "_m;
+        dst += p.value;
+        dst += "\r\n"_m;
+    }
+
+    if((!req.body.isEmpty() || req.type == m::kHRT_Post || req.type == m::kHRT_Put) && !req.headers.hasKey("Content-Length"_m)) {
+        dst += "Content-Length: "_m;
+        dst.appendUInteger(static_cast<uint32_t>(req.body.length()));
+        dst += "\r\n"_m;
+    }
+
+    dst += "\r\n"_m;
+    dst += req.body;
+}
+
+m::HTTPClient::HTTPClient() : m_running(false), m_thread("HTTPClient"), m_resolveSink(nullptr), m_poller(nullptr), m_hosts(16)
+{
+    m_maxPerHost = M_HTTP_CLIENT_MAX_PER_HOST;
+    m_pipelining = false;
+    m_pipelineDepth = M_HTTP_CLIENT_PIPELINE_DEPTH;
+    m_timeout = M_HTTP_CLIENT_TIMEOUT;
+}
+
+m::HTTPClient::~HTTPClient()
+{
+    stop();
+}
+
+bool m::HTTPClient::start()
+{
+    if(m_running)
+        return true;
+
+    m_poller = new Poller;
+    if(!m_poller->isValid()) {
+        delete m_poller;
+        m_poller = nullptr;
+        return false;
+    }
+
+    m_resolveSink = new ResolveSink(this);
+    m_running = true;
+    m_thread.setFunc(this, &HTTPClient::run);
+
+    if(!m_thread.start()) {
+        m_running = false;
+        m_resolveSink->release();
+        m_resolveSink = nullptr;
+        delete m_poller;
+        m_poller = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void m::HTTPClient::stop()
+{
+    m_lock.lock();
+    if(!m_running) {
+        m_lock.unlock();
+        return;
+    }
+
+    m_running = false;
+    m_poller->wake();
+    m_lock.unlock();
+
+    m_thread.join();
+    delete m_poller;
+    m_poller = nullptr;
+}
+
+m::Future<m::HTTPClientResponse> m::HTTPClient::submit(const HTTPClientRequest &req)
+{
+    Task *t = new Task(req, time::getTimeMs() + static_cast<double>(m_timeout));
+    Future<HTTPClientResponse> ret(t->promise.makeNewFuture());
+
+    m_lock.lock();
+    if(!m_running) {
+        m_lock.unlock();
+        finish(t, kHCE_Cancelled);
+        return ret;
+    }
+
+    m_incoming.add(t);
+    m_poller->wake();
+    m_lock.unlock();
+
+    return ret;
+}
+
+m::Future<m::HTTPClientResponse> m::HTTPClient::get(const URL &url)
+{
+    return submit(HTTPClientRequest(kHRT_Get, url));
+}
+
+m::Future<m::HTTPClientResponse> m::HTTPClient::get(const URL &url, HTTPDataCallback onData)
+{
+    HTTPClientRequest req(kHRT_Get, url);
+    req.onData = onData;
+
+    return submit(req);
+}
+
+void m::HTTPClient::finish(Task *t, HTTPClientError err)
+{
+    t->resp.error = err;
+    t->promise.set(std::move(t->resp));
+    delete t;
+}
+
+void m::HTTPClient::run()
+{
+    Poller::Event events[M_HTTP_CLIENT_MAX_EVENTS];
+    List<Task*> incoming;
+    List<Host*> lookups;
+
+    while(true) {
+        m_lock.lock();
+        if(!m_running) {
+            m_lock.unlock();
+            break;
+        }
+
+        for(Task *t : m_incoming)
+            incoming.add(t);
+
+        for(Host *h : m_resolved)
+            lookups.add(h);
+
+        m_incoming.clear();
+        m_resolved.clear();
+        m_lock.unlock();
+
+        for(Task *t : incoming)
+            dispatch(t);
+
+        for(Host *h : lookups)
+            applyLookup(h);
+
+        incoming.clear();
+        lookups.clear();
+
+        for(int i = 0; i < m_hostList.size(); i++) {
+            if(!m_hostList[i]->queue.isEmpty())
+                schedule(m_hostList[i]);
+        }
+
+        double now = time::getTimeMs();
+        checkTimeouts(now);
+
+        int cnt = m_poller->wait(events, nextTimeout(now));
+        for(int i = 0; i < cnt; i++) {
+            //Each connection appears once, and handlers only close their own
+            Connection *c = events[i].conn;
+
+            if(events[i].writable && !onWritable(c))
+                continue;
+
+            if(events[i].readable)
+                onReadable(c);
+        }
+    }
+
+    cancelAll();
+}
+
+void m::HTTPClient::dispatch(Task *t)
+{
+    const URL &url = t->req.url;
+    if(!url.isValid() || g_m_methodName(t->req.type) == nullptr) {
+        finish(t, kHCE_InvalidURL);
+        return;
+    }
+
+    if(!url.protocol().equalsIgnoreCase("http"_m)) {
+        finish(t, kHCE_UnsupportedProtocol);
+        return;
+    }
+
+    String key(url.host().lower());
+    key += ':';
+    key.appendUInteger(url.port());
+
+    Host *host;
+    if(m_hosts.hasKey(key))
+        host = m_hosts[key];
+    else {
+        host = new Host;
+        host->name = url.host();
+        host->port = url.port();
+
+        m_hosts[key] = host;
+        m_hostList.add(host);
+    }
+
+    host->queue.add(t);
+}
+
+m::HTTPClient::Connection *m::HTTPClient::pickConnection(Host *host, Task *t)
+{
+    for(Connection *c : host->conns) {
+        if(c->inFlight.isEmpty())
+            return c;
+    }
+
+    if(host->conns.size() < m_maxPerHost)
+        return openConnection(host);
+
+    if(!m_pipelining || !g_m_canPipeline(t->req))
+        return nullptr;
+
+    //Least busy connection that's known to stay open
+    Connection *ret = nullptr;
+    for(Connection *c : host->conns) {
+        if(!c->persistent || c->closeAfter || c->inFlight.size() >= m_pipelineDepth)
+            continue;
+
+        if(ret != nullptr && c->inFlight.size() >= ret->inFlight.size())
+            continue;
+
+        bool ok = true;
+        for(Task *other : c->inFlight) {
+            if(!g_m_canPipeline(other->req)) {
+                ok = false;
+                break;
+            }
+        }
+
+        if(ok)
+            ret = c;
+    }
+
+    if(ret != nullptr)
+        m_numPipelined.increment();
+
+    return ret;
+}
+
+void m::HTTPClient::schedule(Host *host)
+{
+    while(!host->queue.isEmpty()) {
+        Task *t = host->queue.first();
+        Connection *c = pickConnection(host, t);
+
+        if(c == nullptr) {
+            if(host->queue.isEmpty() || !host->conns.isEmpty() || host->resolving)
+                break; //Resolve failed or pending, or wait for a connection to be available
+
+            //Couldn't open the first connection
+            host->queue.remove(0);
+            finish(t, kHCE_ConnectionFailed);
+            continue;
+        }
+
+        host->queue.remove(0);
+        g_m_writeRequest(t->req, c->out);
+        c->inFlight.add(t);
+        updateEvents(c);
+    }
+}
+
+m::HTTPClient::Connection *m::HTTPClient::openConnection(Host *host)
+{
+    if(host->resolved && host->expires != 0.0 && host->expires <= time::getTimeMs())
+        host->resolved = false; //Ask the resolver again; open connections keep the old address
+
+    if(!host->resolved) {
+        if(!host->resolving) {
+            ResolveSink *sink = m_resolveSink;
+            sink->refs.addRef();
+            host->resolving = true;
+
+            //May complete right away; the result is picked up by the next loop iteration either way
+            DNSResolver::instance().resolveAsync(host->name, host->port, [sink, host] (DNSResolveError err, const IPv4Address &addr) {
+                sink->lock.lock();
+                if(sink->client != nullptr)
+                    sink->client->onResolved(host, err, addr);
+
+                sink->lock.unlock();
+                sink->release();
+            });
+        }
+
+        return nullptr;
+    }
+
+    Connection *c = new Connection(host);
+    if(!c->sock.initialize()) {
+        delete c;
+        return nullptr;
+    }
+
+    //TCPSocket::connect() blocks until the connection is established, so do it ourselves
+    c->sock.setReadAndWriteTimeouts(0);
+    if(::connect(c->sock.raw(), reinterpret_cast<const struct sockaddr*>(host->addr.raw()), IPv4Address::rawSize()) == 0)
+        c->connecting = false;
+    else if(inet::socketError() != inet::kSE_WouldBlock) {
+        delete c;
+        return nullptr;
+    }
+
+    c->wantsWrite = true;
+    if(!m_poller->add(c, true)) {
+        delete c;
+        return nullptr;
+    }
+
+    host->conns.add(c);
+    m_numConnects.increment();
+    return c;
+}
+
+//Called from any thread
+void m::HTTPClient::onResolved(Host *host, DNSResolveError err, const IPv4Address &addr)
+{
+    m_lock.lock();
+    host->resolveError = err;
+    host->resolvedAddr = addr;
+    m_resolved.add(host);
+    m_poller->wake();
+    m_lock.unlock();
+}
+
+void m::HTTPClient::applyLookup(Host *host)
+{
+    host->resolving = false;
+
+    if(host->resolveError != kRE_NoError) {
+        for(Task *t : host->queue) {
+            t->resp.resolveError = host->resolveError;
+            finish(t, kHCE_ResolveFailed);
+        }
+
+        host->queue.clear();
+        return;
+    }
+
+    host->addr = host->resolvedAddr;
+    host->expires = DNSResolver::instance().expiry(host->name);
+    host->resolved = true;
+
+    if(host->expires < 0.0)
+        host->expires = time::getTimeMs(); //Already evicted, so the next connection resolves it again
+}
+
+void m::HTTPClient::closeConnection(Connection *c, HTTPClientError err)
+{
+    Host *host = c->host;
+    m_poller->remove(c);
+
+    for(int i = 0; i < host->conns.size(); i++) {
+        if(host->conns[i] == c) {
+            host->conns.remove(i);
+            break;
+        }
+    }
+
+    //kHCE_NoError means we closed it on purpose: whatever's left was never answered.
+    //Otherwise, the server probably dropped an idle keep-alive connection.
+    List<Task*> retry;
+    for(Task *t : c->inFlight) {
+        if(err == kHCE_NoError)
+            retry.add(t);
+        else if(c->persistent && !t->started && t->retries <= 0 && t->req.type != kHRT_Post) {
+            t->retries++;
+            retry.add(t);
+        } else
+            finish(t, err);
+    }
+
+    if(!retry.isEmpty()) {
+        for(Task *t : retry)
+            t->resp = HTTPClientResponse();
+
+        host->queue.insertAll(0, retry);
+    }
+
+    delete c;
+}
+
+void m::HTTPClient::updateEvents(Connection *c)
+{
+    bool wr = c->connecting || c->outPos < c->out.length();
+
+    if(wr != c->wantsWrite) {
+        c->wantsWrite = wr;
+        m_poller->modify(c, wr);
+    }
+}
+
+bool m::HTTPClient::onWritable(Connection *c)
+{
+    if(c->connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if(getsockopt(c->sock.raw(), SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len) != 0 || err != 0) {
+            closeConnection(c, kHCE_ConnectionFailed);
+            return false;
+        }
+
+        c->connecting = false;
+    }
+
+    while(c->outPos < c->out.length()) {
+        int sent = ::send(c->sock.raw(), c->out.raw() + c->outPos, c->out.length() - c->outPos, M_HTTP_CLIENT_SEND_FLAGS);
+
+        if(sent < 0) {
+            if(inet::socketError() == inet::kSE_WouldBlock)
+                break;
+
+            closeConnection(c, kHCE_ConnectionLost);
+            return false;
+        }
+
+        c->outPos += sent;
+    }
+
+    if(c->outPos >= c->out.length()) {
+        c->out.clear();
+        c->outPos = 0;
+    }
+
+    updateEvents(c);
+    return true;
+}
+
+bool m::HTTPClient::onReadable(Connection *c)
+{
+    uint8_t buf[M_HTTP_CLIENT_RBUF_SZ];
+
+    while(true) {
+        int rd = c->sock.receive(buf, M_HTTP_CLIENT_RBUF_SZ);
+
+        if(rd > 0) {
+            if(!parse(c, buf, rd))
+                return false;
+        } else if(rd == 0) {
+            if(!c->inFlight.isEmpty() && c->phase == kHCP_Body && c->untilClose)
+                responseDone(c); //Will close the connection
+            else
+                closeConnection(c, c->inFlight.isEmpty() ? kHCE_NoError : kHCE_ConnectionLost);
+
+            return false;
+        } else if(c->sock.lastError() == inet::kSE_NoError)
+            return true; //Would block
+        else {
+            closeConnection(c, kHCE_ConnectionLost);
+            return false;
+        }
+    }
+}
+
+bool m::HTTPClient::parse(Connection *c, const uint8_t *data, int len)
+{
+    while(len > 0) {
+        if(c->inFlight.isEmpty()) {
+            //Nobody asked for that
+            closeConnection(c, kHCE_NoError);
+            return false;
+        }
+
+        if(c->phase == kHCP_Body || c->phase == kHCP_ChunkData) {
+            Task *t = c->inFlight.first();
+            int n = len;
+
+            if(!c->untilClose && static_cast<uint64_t>(n) > c->remaining)
+                n = static_cast<int>(c->remaining);
+
+            if(t->req.onData)
+                t->req.onData(data, n);
+            else
+                t->resp.body.append(reinterpret_cast<const char*>(data), n);
+
+            data += n;
+            len -= n;
+
+            if(!c->untilClose) {
+                c->remaining -= static_cast<uint64_t>(n);
+
+                if(c->remaining == 0) {
+                    if(c->phase == kHCP_ChunkData)
+                        c->phase = kHCP_ChunkEnd;
+                    else if(!responseDone(c))
+                        return false;
+                }
+            }
+        } else {
+            const uint8_t *nl = static_cast<const uint8_t*>(std::memchr(data, '\n', static_cast<size_t>(len)));
+            int n = (nl == nullptr) ? len : static_cast<int>(nl - data);
+
+            if(c->line.length() + n > M_HTTP_CLIENT_MAX_LINE) {
+                closeConnection(c, kHCE_InvalidResponse);
+                return false;
+            }
+
+            c->line.append(reinterpret_cast<const char*>(data), n);
+            if(nl == nullptr)
+                return true;
+
+            data += n + 1;
+            len -= n + 1;
+
+            String line(c->line.trimmed());
+            c->line.clear();
+
+            if(!parseLine(c, line))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool m::HTTPClient::parseLine(Connection *c, const String &line)
+{
+    Task *t = c->inFlight.first();
+    HTTPClientResponse &resp = t->resp;
+
+    switch(c->phase) {
+    case kHCP_Status:
+    {
+        if(line.isEmpty())
+            return true; //Tolerate stray CRLFs between responses
+
+        int s1 = line.indexOf(' ') + 1;
+        if(!line.startsWith("HTTP/1."_m) || s1 <= 0) {
+            closeConnection(c, kHCE_InvalidResponse);
+            return false;
+        }
+
+        int s2 = line.indexOf(' ', s1);
+        if(s2 < 0) {
+            resp.code = line.substr(s1).toInteger();
+            resp.status.clear();
+        } else {
+            resp.code = line.substr(s1, s2).toInteger();
+            resp.status = line.substr(s2 + 1);
+        }
+
+        resp.headers.clear();
+        t->started = true;
+        c->http11 = line.startsWith("HTTP/1.1"_m);
+        c->phase = kHCP_Headers;
+        return true;
+    }
+
+    case kHCP_Headers:
+    {
+        if(line.isEmpty())
+            return headersDone(c);
+
+        int sep = line.indexOf(':');
+        if(sep <= 0) {
+            closeConnection(c, kHCE_InvalidResponse);
+            return false;
+        }
+
+        resp.headers[line.substr(0, sep).trimmed()] = line.substr(sep + 1).trimmed();
+        return true;
+    }
+
+    case kHCP_ChunkSize:
+    {
+        //Chunk extensions are ignored
+        int end = line.indexOf(';');
+        if(end < 0)
+            end = line.length();
+
+        uint64_t sz = 0;
+        for(int i = 0; i < end; i++) {
+            char chr = line[i];
+            uint64_t digit;
+
+            if(chr >= '0' && chr <= '9')
+                digit = static_cast<uint64_t>(chr - '0');
+            else if(chr >= 'a' && chr <= 'f')
+                digit = static_cast<uint64_t>(chr - 'a') + 10;
+            else if(chr >= 'A' && chr <= 'F')
+                digit = static_cast<uint64_t>(chr - 'A') + 10;
+            else if(chr == ' ' || chr == '\t')
+                break;
+            else {
+                closeConnection(c, kHCE_InvalidResponse);
+                return false;
+            }
+
+            sz = (sz << 4) | digit;
+        }
+
+        if(end <= 0 || sz >= (static_cast<uint64_t>(1) << 48)) {
+            closeConnection(c, kHCE_InvalidResponse);
+            return false;
+        }
+
+        c->remaining = sz;
+        c->phase = (sz == 0) ? kHCP_Trailers : kHCP_ChunkData;
+        return true;
+    }
+
+    case kHCP_ChunkEnd:
+        if(!line.isEmpty()) {
+            closeConnection(c, kHCE_InvalidResponse);
+            return false;
+        }
+
+        c->phase = kHCP_ChunkSize;
+        return true;
+
+    case kHCP_Trailers:
+        if(line.isEmpty())
+            return responseDone(c);
+
+        return true;
+
+    default:
+        return true;
+    }
+}
+
+bool m::HTTPClient::headersDone(Connection *c)
+{
+    Task *t = c->inFlight.first();
+    HTTPClientResponse &resp = t->resp;
+
+    if(resp.code >= 100 && resp.code < 200) {
+        //Interim response (100 Continue), the real one follows
+        c->phase = kHCP_Status;
+        return true;
+    }
+
+    bool keepAlive;
+    if(resp.headers.hasKey("Connection"_m)) {
+        const String &conn = resp.headers["Connection"_m];
+        keepAlive = c->http11 ? !conn.equalsIgnoreCase("close"_m) : conn.equalsIgnoreCase("keep-alive"_m);
+    } else
+        keepAlive = c->http11;
+
+    c->closeAfter = !keepAlive;
+    c->untilClose = false;
+
+    if(t->req.type == kHRT_Head || resp.code == 204 || resp.code == 304)
+        return responseDone(c);
+
+    if(resp.headers.hasKey("Transfer-Encoding"_m) && resp.headers["Transfer-Encoding"_m].lower().indexOf("chunked") >= 0) {
+        c->phase = kHCP_ChunkSize;
+        return true;
+    }
+
+    if(resp.headers.hasKey("Content-Length"_m)) {
+        c->remaining = static_cast<uint64_t>(resp.headers["Content-Length"_m].toUInteger());
+        if(c->remaining == 0)
+            return responseDone(c);
+
+        c->phase = kHCP_Body;
+        return true;
+    }
+
+    //Without a length, the end of the content is the end of the connection
+    c->untilClose = true;
+    c->closeAfter = true;
+    c->phase = kHCP_Body;
+    return true;
+}
+
+bool m::HTTPClient::responseDone(Connection *c)
+{
+    Task *t = c->inFlight.first();
+    c->inFlight.remove(0);
+
+    c->phase = kHCP_Status;
+    c->remaining = 0;
+    c->untilClose = false;
+
+    if(!c->closeAfter && c->http11)
+        c->persistent = true;
+
+    finish(t, kHCE_NoError);
+
+    if(c->closeAfter) {
+        closeConnection(c, kHCE_NoError);
+        return false;
+    }
+
+    return true;
+}
+
+void m::HTTPClient::checkTimeouts(double now)
+{
+    for(Host *host : m_hostList) {
+        for(int i = 0; i < host->queue.size();) {
+            if(now >= host->queue[i]->deadline) {
+                finish(host->queue[i], kHCE_TimedOut);
+                host->queue.remove(i);
+            } else
+                i++;
+        }
+
+        for(int i = 0; i < host->conns.size();) {
+            Connection *c = host->conns[i];
+
+            if(!c->inFlight.isEmpty() && now >= c->inFlight.first()->deadline) {
+                Task *t = c->inFlight.first();
+                c->inFlight.remove(0);
+                finish(t, kHCE_TimedOut);
+
+                //The rest is requeued on another connection
+                closeConnection(c, kHCE_NoError);
+            } else
+                i++;
+        }
+    }
+}
+
+int m::HTTPClient::nextTimeout(double now)
+{
+    double next = -1.0;
+
+    for(Host *host : m_hostList) {
+        for(Task *t : host->queue) {
+            if(next < 0.0 || t->deadline < next)
+                next = t->deadline;
+        }
+
+        for(Connection *c : host->conns) {
+            if(!c->inFlight.isEmpty() && (next < 0.0 || c->inFlight.first()->deadline < next))
+                next = c->inFlight.first()->deadline;
+        }
+    }
+
+    if(next < 0.0)
+        return -1;
+
+    if(next <= now)
+        return 0;
+
+    return static_cast<int>(next - now) + 1;
+}
+
+void m::HTTPClient::cancelAll()
+{
+    //Pending lookups must not touch the hosts anymore
+    m_resolveSink->lock.lock();
+    m_resolveSink->client = nullptr;
+    m_resolveSink->lock.unlock();
+    m_resolveSink->release();
+    m_resolveSink = nullptr;
+
+    m_lock.lock();
+    List<Task*> incoming(m_incoming);
+    m_incoming.clear();
+    m_resolved.clear();
+    m_lock.unlock();
+
+    for(Task *t : incoming)
+        finish(t, kHCE_Cancelled);
+
+    for(Host *host : m_hostList) {
+        for(Connection *c : host->conns) {
+            for(Task *t : c->inFlight)
+                finish(t, kHCE_Cancelled);
+
+            m_poller->remove(c);
+            delete c;
+        }
+
+        for(Task *t : host->queue)
+            finish(t, kHCE_Cancelled);
+
+        delete host;
+    }
+
+    m_hosts.clear();
+    m_hostList.clear();
+}
@@ -0,0 +1,233 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/HTTPConnectionPool.h"
+#include "mgpcl/Time.h"
+#include "mgpcl/DNSResolver.h"
+
+m::HTTPConnectionPool::HTTPConnectionPool() : m_hosts(16)
+{
+    m_numIdle = 0;
+    m_maxIdle = M_HTTP_POOL_MAX_IDLE;
+    m_maxIdlePerHost = M_HTTP_POOL_MAX_IDLE_PER_HOST;
+    m_idleTimeout = M_HTTP_POOL_IDLE_TIMEOUT;
+}
+
+m::HTTPConnectionPool::~HTTPConnectionPool()
+{
+    closeIdle();
+}
+
+m::String m::HTTPConnectionPool::hostKey(const URL &url)
+{
+    String ret(url.protocol().lower());
+    ret += "://"_m;
+    ret += url.host().lower();
+    ret += ':';
+    ret.appendUInteger(url.port());
+
+    return ret;
+}
+
+bool m::HTTPConnectionPool::isAlive(Socket *sock)
+{
+    TCPSocket *tcp = static_cast<TCPSocket*>(sock);
+    if(!tcp->isValid())
+        return false;
+
+    //An idle connection shouldn't have anything to read. If it does,
+    //the server either closed it or sent garbage.
+    TCPSocketSet set;
+    set.add(*tcp);
+
+    return TCPSocketSet::waitForSets(&set, nullptr, nullptr, 0) == 0;
+}
+
+void m::HTTPConnectionPool::removeExpired(Host &host, double now, List<Socket*> &dst)
+{
+    //Oldest connections come first
+    while(!host.idle.isEmpty() && now - host.idle[0].since >= static_cast<double>(m_idleTimeout)) {
+        dst.add(host.idle[0].sock);
+        host.idle.remove(0);
+        m_numIdle--;
+    }
+}
+
+m::Socket *m::HTTPConnectionPool::acquire(const URL &url)
+{
+    const String key(hostKey(url));
+    const double now = time::getTimeMs();
+    List<Socket*> dead;
+    Socket *ret = nullptr;
+
+    m_lock.lock();
+    if(m_hosts.hasKey(key)) {
+        Host &host = m_hosts[key];
+        removeExpired(host, now, dead);
+
+        //Most recently used first, it's more likely to be alive
+        while(!host.idle.isEmpty()) {
+            Socket *sock = host.idle.last().sock;
+            host.idle.remove(host.idle.size() - 1);
+            m_numIdle--;
+
+            if(isAlive(sock)) {
+                ret = sock;
+                break;
+            }
+
+            dead.add(sock);
+        }
+    }
+
+    m_lock.unlock();
+
+    for(Socket *sock : dead)
+        delete sock;
+
+    if(ret != nullptr) {
+        m_numReuses.increment();
+        return ret;
+    }
+
+    return connect(url);
+}
+
+m::Socket *m::HTTPConnectionPool::connect(const URL &url)
+{
+    IPv4Address addr;
+    if(DNSResolver::instance().resolve(url.host(), addr, url.port()) != kRE_NoError)
+        return nullptr;
+
+    Socket *ret;
+    if(url.protocol().equalsIgnoreCase("https"_m)) {
+#ifndef MGPCL_NO_SSL
+        m_lock.lock();
+        if(!m_sslCtx.isValid()) {
+            m_sslCtx.initialize(kSCM_v23Client);
+            m_sslCtx.loadOSVerify();
+            m_sslCtx.setVerifyFlags(kSVF_VerifyPeer);
+            m_sslCtx.setVerifyDepth(16);
+        }
+
+        SSLContext ctx(m_sslCtx);
+        m_lock.unlock();
+
+        SSLSocket *ssl = new SSLSocket;
+        if(!ssl->initialize(ctx)) {
+            delete ssl;
+            return nullptr;
+        }
+
+        //The cache key is derived from the server name, so virtual hosts don't share sessions
+        ssl->setServerName(url.host());
+        ssl->setSessionCache(&m_sessions);
+
+        if(ssl->connect(addr) != kSCE_NoError) {
+            delete ssl;
+            return nullptr;
+        }
+
+        if(ssl->isSessionReused())
+            m_numResumes.increment();
+
+        ret = ssl;
+#else
+        return nullptr;
+#endif
+    } else {
+        ret = new TCPSocket;
+
+        if(!ret->initialize() || ret->connect(addr) != kSCE_NoError) {
+            delete ret;
+            return nullptr;
+        }
+    }
+
+    m_numConnects.increment();
+    return ret;
+}
+
+void m::HTTPConnectionPool::release(const URL &url, Socket *conn, bool reusable)
+{
+    if(conn == nullptr)
+        return;
+
+    if(!reusable || !conn->isValid()) {
+        delete conn;
+        return;
+    }
+
+    const String key(hostKey(url));
+    const double now = time::getTimeMs();
+    List<Socket*> dead;
+
+#ifndef MGPCL_NO_SSL
+    //Sessions are only complete once some data has been read (TLS 1.3
+    //sends them after the handshake), so now is a good time to save it.
+    if(url.protocol().equalsIgnoreCase("https"_m)) {
+        SSLSession sess(static_cast<SSLSocket*>(conn)->session());
+        if(sess.isResumable())
+            m_sessions.put(SSLSessionCache::hostKey(url.host(), url.port()), sess);
+    }
+#endif
+
+    m_lock.lock();
+    Host &host = m_hosts[key];
+    removeExpired(host, now, dead);
+
+    if(host.idle.size() < m_maxIdlePerHost && m_numIdle < m_maxIdle) {
+        host.idle.add(IdleConnection(conn, now));
+        m_numIdle++;
+    } else
+        dead.add(conn);
+
+    m_lock.unlock();
+
+    for(Socket *sock : dead)
+        delete sock;
+}
+
+void m::HTTPConnectionPool::closeIdle()
+{
+    List<Socket*> dead;
+
+    m_lock.lock();
+    for(HashMap<String, Host>::Pair &p : m_hosts) {
+        for(IdleConnection &ic : p.value.idle)
+            dead.add(ic.sock);
+
+        p.value.idle.clear();
+    }
+
+    m_numIdle = 0;
+    m_lock.unlock();
+
+    for(Socket *sock : dead)
+        delete sock;
+}
+
+int m::HTTPConnectionPool::numIdle()
+{
+    m_lock.lock();
+    int ret = m_numIdle;
+    m_lock.unlock();
+
+    return ret;
+}
@@ -18,6 +18,10 @@
  */
 
 #include "mgpcl/HTTPRequest.h"
+#include "mgpcl/DNSResolver.h"
+
+//Redirection bodies larger than this aren't worth skipping to keep the connection
+#define M_HTTP_MAX_DISCARD 65536
 
 void m::HTTPRequest::setURL(const URL &url)
 {
@@ -37,7 +41,17 @@ bool m::HTTPRequest::perform()
     const bool keepAlive = m_requestHdr["Connection"_m].equalsIgnoreCase("keep-alive"_m);
 
     for(uint8_t maxRedir = 0; maxRedir < 16; maxRedir++) {
-        if(!keepAlive || m_conn == nullptr) {
+        if(m_pool != nullptr) {
+            //If we still have one, its previous response wasn't read
+            killConnection();
+
+            if(!m_url.isValid() || (m_url.protocol() != "http"_m && m_url.protocol() != "https"_m))
+                return false;
+
+            m_conn = m_pool->acquire(m_url);
+            if(m_conn == nullptr)
+                return false;
+        } else if(!keepAlive || m_conn == nullptr) {
             if(m_conn != nullptr) {
                 delete m_conn;
                 m_conn = nullptr;
@@ -47,7 +61,7 @@ bool m::HTTPRequest::perform()
                 return false;
 
             IPv4Address addr;
-            if(addr.resolve(m_url.host(), m_url.port()) != kRE_NoError)
+            if(DNSResolver::instance().resolve(m_url.host(), addr, m_url.port()) != kRE_NoError)
                 return false;
 
             if(m_url.protocol() == "https"_m) {
@@ -59,9 +73,15 @@ bool m::HTTPRequest::perform()
                     m_sslCtx.setVerifyDepth(16); //Is that a good value?
                 }
 
-                m_conn = new SSLSocket;
-                if(!static_cast<SSLSocket*>(m_conn)->initialize(m_sslCtx))
+                SSLSocket *ssl = new SSLSocket;
+                m_conn = ssl;
+
+                if(!ssl->initialize(m_sslCtx))
                     return false;
+
+                ssl->setServerName(m_url.host());
+                if(m_sessCache != nullptr)
+                    ssl->setSessionCache(m_sessCache); //Keyed by server name
 #else
                 return false;
 #endif
@@ -200,6 +220,7 @@ bool m::HTTPRequest::perform()
             return false; //Couldn't parse redirection URL
 
         //URL has changed to the new location, start over...
+        discardResponse();
         setURL(redir); //Use setURL to close connection if keep-alive is enabled and server changed
     }
 
@@ -247,6 +268,9 @@ bool m::HTTPRequest::receiveResponse(bool keepAlive)
     m_rcode = rline.substr(s1, s2).toInteger();
     m_status = rline.substr(s2 + 1);
 
+    const bool http11 = rline.startsWith("HTTP/1.1"_m);
+    const bool noContent = m_type == kHRT_Head || m_rcode == 204 || m_rcode == 304 || (m_rcode >= 100 && m_rcode < 200);
+
     int hdrCnt = 0;
     while(hdrCnt < 256) {
         if(m_lr.next() <= 0) {
@@ -271,13 +295,70 @@ bool m::HTTPRequest::receiveResponse(bool keepAlive)
         hdrCnt++;
     }
 
+    //Without a length, the end of the content is the end of the connection
+    m_reusable = keepAlive && http11 && (noContent || hasContentLength());
+    if(m_reusable && m_responseHdr.hasKey("Connection"_m) && m_responseHdr["Connection"_m].equalsIgnoreCase("close"_m))
+        m_reusable = false;
+
     m_gotResponse = true;
-    if(!keepAlive && !m_doesIn) //The server won't return any data, close stream now
+    if(m_pool != nullptr) {
+        if(noContent || (m_reusable && contentLength() == 0))
+            responseDone();
+        else if(!m_doesIn) {
+            //Nobody's gonna read the content
+            m_reusable = false;
+            responseDone();
+        }
+    } else if(!keepAlive && !m_doesIn) //The server won't return any data, close stream now
         m_conn->close();
 
     return true;
 }
 
+void m::HTTPRequest::responseDone()
+{
+    if(m_pool != nullptr && m_conn != nullptr) {
+        m_pool->release(m_url, m_conn, m_reusable);
+        m_conn = nullptr;
+    }
+}
+
+void m::HTTPRequest::discardResponse()
+{
+    if(m_conn == nullptr)
+        return;
+
+    if(m_reusable && hasContentLength()) {
+        uint32_t remaining = contentLength();
+        uint32_t buffered = m_lr.remainingDataLength();
+        remaining = buffered >= remaining ? 0 : remaining - buffered;
+
+        if(remaining <= M_HTTP_MAX_DISCARD) {
+            uint8_t buf[4096];
+
+            while(remaining > 0) {
+                int rd = m_conn->receive(buf, remaining > sizeof(buf) ? static_cast<int>(sizeof(buf)) : static_cast<int>(remaining));
+                if(rd <= 0)
+                    break;
+
+                remaining -= static_cast<uint32_t>(rd);
+            }
+
+            if(remaining == 0) {
+                responseDone();
+                return;
+            }
+        }
+    }
+
+    //Can't be reused
+    m_reusable = false;
+    if(m_pool != nullptr)
+        responseDone();
+    else
+        killConnection();
+}
+
 int m::HTTPInputStream::read(uint8_t *dst, int sz)
 {
     //TODO: Wrap chunked encoding in here
@@ -299,18 +380,19 @@ int m::HTTPInputStream::read(uint8_t *dst, int sz)
         ret += static_cast<int>(rd);
     }
 
-    if(usz > 0) {
-        if(m_hasLen && m_pos >= m_len) {
-            if(!m_keepAlive)
-                m_req->m_conn->close();
-
-            return ret;
-        }
+    if(m_hasLen && m_pos >= m_len) {
+        finished();
+        return ret;
+    }
 
+    if(usz > 0 && m_req->m_conn != nullptr) {
         int rd = m_req->m_conn->receive(dst, static_cast<int>(usz));
         if(rd > 0) {
             m_pos += static_cast<uint32_t>(rd);
             ret += rd;
+
+            if(m_hasLen && m_pos >= m_len)
+                finished();
         } else if(rd < 0)
             return rd;
     }
@@ -318,6 +400,14 @@ int m::HTTPInputStream::read(uint8_t *dst, int sz)
     return ret;
 }
 
+void m::HTTPInputStream::finished()
+{
+    if(m_req->m_pool != nullptr)
+        m_req->responseDone();
+    else if(!m_keepAlive && m_req->m_conn != nullptr)
+        m_req->m_conn->close();
+}
+
 m::HTTPInputStream::HTTPInputStream(HTTPRequest *p)
 {
     m_req = p;
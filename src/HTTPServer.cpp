@@ -23,6 +23,10 @@
 #include "mgpcl/Date.h"
 #include <iostream>
 
+#ifndef MGPCL_NO_ZLIB
+#include <zlib.h>
+#endif
+
 //#define M_TRACE_HTTPSERVER
 
 #if defined(_DEBUG) && defined(M_TRACE_HTTPSERVER)
@@ -31,8 +35,127 @@
 #define M_TRACE(msg)
 #endif
 
+static const m::String g_405data("<!DOCTYPE html><html lang=\"en\"><head><title>Error 405</title></head><body><h1>405 Method Not Allowed</h1></body></html>"_m);
 static const m::String g_404data("<!DOCTYPE html><html lang=\"en\"><head><title>Error 404</title></head><body><h1>404 Not Found</h1></body></html>"_m);
 
+//Checks whether enc appears in an Accept-Encoding header, without q=0
+static bool g_m_acceptsEncoding(const m::String &hdr, const char *enc)
+{
+    m::List<m::String> parts;
+    hdr.splitOn(',', parts);
+
+    for(const m::String &p: parts) {
+        int semi = p.indexOf(';');
+        m::String name(p.substr(0, semi).trimmed());
+
+        if(name.equalsIgnoreCase(m::String(enc))) {
+            if(semi < 0)
+                return true;
+
+            m::String q(p.substr(semi + 1).trimmed().lower());
+            return !q.startsWith("q=0"_m) || q.indexOfAnyOf("123456789", 3) >= 0;
+        }
+    }
+
+    return false;
+}
+
+#ifndef MGPCL_NO_ZLIB
+class m::HTTPServer::Compressor
+{
+public:
+    Compressor(bool gzip, int level) : m_gzip(gzip), m_inEnded(false), m_consumed(0)
+    {
+        mem::zero(&m_zs, sizeof(z_stream));
+        m_ok = deflateInit2(&m_zs, level, Z_DEFLATED, gzip ? 31 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Compressor()
+    {
+        if(m_ok)
+            deflateEnd(&m_zs);
+    }
+
+    bool reset()
+    {
+        m_inEnded = false;
+        m_consumed = 0;
+        return deflateReset(&m_zs) == Z_OK;
+    }
+
+    //Pulls data from the handler until dst is full or the stream ends.
+    //Non-streamed responses are read up to their length, like when
+    //they're sent uncompressed. Returns the amount of compressed bytes,
+    //or -1 on error.
+    int compress(HTTPRequestHandler *h, HTTPServerRequest *req, uint8_t *dst, int sz, bool &done)
+    {
+        m_zs.next_out = dst;
+        m_zs.avail_out = static_cast<uInt>(sz);
+
+        while(m_zs.avail_out > 0) {
+            if(m_zs.avail_in == 0 && !m_inEnded) {
+                int rd = M_HTTP_SERVER_ZBUF_SZ;
+                if(!req->m_responseStreaming && req->m_responseLength - m_consumed < static_cast<uint64_t>(rd))
+                    rd = static_cast<int>(req->m_responseLength - m_consumed);
+
+                if(rd > 0)
+                    rd = h->sendData(req, m_in, rd);
+
+                if(rd <= 0)
+                    m_inEnded = true;
+                else {
+                    m_consumed += static_cast<uint64_t>(rd);
+                    m_zs.next_in = m_in;
+                    m_zs.avail_in = static_cast<uInt>(rd);
+                }
+            }
+
+            int ret = deflate(&m_zs, m_inEnded ? Z_FINISH : Z_NO_FLUSH);
+            if(ret == Z_STREAM_END) {
+                done = true;
+                break;
+            }
+
+            if(ret != Z_OK && ret != Z_BUF_ERROR)
+                return -1;
+        }
+
+        return sz - static_cast<int>(m_zs.avail_out);
+    }
+
+    bool m_gzip;
+    bool m_ok;
+    bool m_inEnded;
+    uint64_t m_consumed; //Uncompressed bytes read from the handler
+    z_stream m_zs;
+    uint8_t m_in[M_HTTP_SERVER_ZBUF_SZ];
+};
+#else
+class m::HTTPServer::Compressor
+{
+public:
+    int compress(HTTPRequestHandler *, HTTPServerRequest *, uint8_t *, int, bool &)
+    {
+        return -1;
+    }
+};
+#endif
+
+//Prometheus label values escape backslashes, quotes and line feeds
+static void appendLabelValue(m::String &dst, const m::String &val)
+{
+    for(int i = 0; i < val.length(); i++) {
+        if(val[i] == '\\' || val[i] == '"')
+            dst += '\\';
+        else if(val[i] == '\n') {
+            dst += "\\n";
+            continue;
+        }
+
+        dst += val[i];
+    }
+}
+
 static void splitPathname(const m::String &str, m::List<m::String> &dst)
 {
     int last = 1;
@@ -50,12 +173,18 @@ static void splitPathname(const m::String &str, m::List<m::String> &dst)
         dst.add(str.substr(last));
 }
 
-m::HTTPServer::HTTPServer() : m_running(1), m_inactivityTimeout(5000), m_root(nullptr)
+m::HTTPServer::HTTPServer() : m_running(1), m_inactivityTimeout(5000), m_compress(false), m_compressLevel(6),
+                               m_compressMinLength(M_HTTP_SERVER_MIN_COMPRESS), m_root(nullptr)
 {
     StaticHTTPRequestHandler *shrh = new StaticHTTPRequestHandler(g_404data);
     shrh->setResponseCode(404, "Not Found"_m);
     m_404handler = shrh;
 
+    shrh = new StaticHTTPRequestHandler(g_405data);
+    shrh->setResponseCode(405, "Method Not Allowed"_m);
+    m_405handler = shrh;
+    m_404metrics = new HTTPRouteMetrics("<unmatched>"_m);
+
     m_server.setConnectionTimeout(0); //Non-blocking accept
     m_server.setReadAndWriteTimeouts(0);
 }
@@ -69,6 +198,16 @@ m::HTTPServer::~HTTPServer()
 
     if(m_root != nullptr)
         delete m_root;
+
+    for(HTTPRequestHandler *h : m_handlers)
+        delete h;
+
+    for(HTTPRouteMetrics *m : m_routeMetrics)
+        delete m;
+
+    delete m_404handler;
+    delete m_405handler;
+    delete m_404metrics;
 }
 
 #ifndef MGPCL_NO_SSL
@@ -79,6 +218,8 @@ bool m::HTTPServer::enableSSL(const String &certFile, const String &keyFile)
         return false;
 
     m_sslCtx.enableAutoECDH(true);
+    m_sslCtx.enableSessionCache(true);
+    m_sslCtx.enableSessionTickets(true);
     return m_sslCtx.useCertificateFile(certFile) && m_sslCtx.usePrivateKeyFile(keyFile);
 }
 
@@ -151,8 +292,19 @@ void m::HTTPServer::set404Handler(HTTPRequestHandler *h)
 }
 
 void m::HTTPServer::bindHandler(const String &path, HTTPRequestHandler *h)
+{
+    bindHandler(kHRT_Get, true, path, h);
+}
+
+void m::HTTPServer::bindHandler(HTTPRequestType method, const String &path, HTTPRequestHandler *h)
+{
+    bindHandler(method, false, path, h);
+}
+
+void m::HTTPServer::bindHandler(HTTPRequestType method, bool anyMethod, const String &path, HTTPRequestHandler *h)
 {
     mAssert(path.startsWith("/"_m), "path should start with a slash");
+    mAssert(method >= 0 && method < M_HTTP_SERVER_NUM_METHODS, "invalid method");
 
     List<String> components;
     String fixedPath(http::smartEncodePathname(path));
@@ -161,29 +313,345 @@ void m::HTTPServer::bindHandler(const String &path, HTTPRequestHandler *h)
     if(m_root == nullptr)
         m_root = new Node;
 
+    //Static parts are merged, so that "/a/b/*/c" becomes "/a/b/", *, "/c"
     Node *n = m_root;
+    String part;
+    int numWildcards = 0;
+
     for(const String &component: components) {
-        bool isMatchAll = component == "*"_m;
-        Node *child = isMatchAll ? n->m_fallbackChild : n->child(component);
+        part += '/';
+
+        if(component == "*"_m) {
+            n = insertStatic(n, part);
+            part.clear();
+
+            if(n->m_wildcard == nullptr)
+                n->m_wildcard = new Node;
+
+            n = n->m_wildcard;
+            numWildcards++;
+        } else
+            part += component;
+    }
+
+    mAssert(numWildcards <= M_HTTP_SERVER_MAX_WILDCARDS, "too many wildcards");
+
+    if(!part.isEmpty())
+        n = insertStatic(n, part);
+    else if(n == m_root)
+        n = insertStatic(n, "/"_m);
+
+    HTTPRequestHandler *&slot = anyMethod ? n->m_anyHandler : n->m_handlers[method];
+    HTTPRequestHandler *old = slot;
+    slot = h;
+
+    if(old != h && old != nullptr && !m_root->uses(old)) {
+        for(int i = 0; i < ~m_handlers; i++) {
+            if(m_handlers[i] == old) {
+                m_handlers.remove(i);
+                break;
+            }
+        }
+
+        delete old;
+    }
+
+    if(h != nullptr && n->m_metrics == nullptr) {
+        n->m_metrics = new HTTPRouteMetrics(path);
+        m_routeMetrics.add(n->m_metrics);
+    }
+
+    if(h != nullptr) {
+        bool known = false;
+        for(HTTPRequestHandler *other : m_handlers) {
+            if(other == h) {
+                known = true;
+                break;
+            }
+        }
+
+        if(!known)
+            m_handlers.add(h);
+    }
 
-        if(child == nullptr) {
-            child = new Node(component);
+    compileRoutes();
+}
+
+m::HTTPServer::Node *m::HTTPServer::insertStatic(Node *n, const String &str)
+{
+    if(str.isEmpty())
+        return n;
+
+    for(int i = 0; i < ~n->m_children; i++) {
+        Node *child = n->m_children[i];
+        const int max = math::minimum(child->m_label.length(), str.length());
+        int common = 0;
+
+        while(common < max && child->m_label[common] == str[common])
+            common++;
+
+        if(common <= 0)
+            continue;
+
+        if(common < child->m_label.length()) {
+            //Split the child
+            Node *mid = new Node(child->m_label.substr(0, common));
+            child->m_label = child->m_label.substr(common);
+            mid->m_children.add(child);
+            n->m_children[i] = mid;
+            child = mid;
+        }
+
+        return insertStatic(child, str.substr(common));
+    }
+
+    Node *ret = new Node(str);
+    n->m_children.add(ret);
+    return ret;
+}
+
+void m::HTTPServer::compileRoutes()
+{
+    m_routes.clear();
+    m_routeLabels.clear();
+
+    List<Node*> nodes;
+    nodes.add(m_root);
+
+    //Breadth first, so that siblings are contiguous
+    for(int i = 0; i < ~nodes; i++) {
+        Node *n = nodes[i];
+        Route r;
+
+        r.labelBegin = m_routeLabels.length();
+        r.labelLen = n->m_label.length();
+        r.isWildcard = i > 0 && n->m_label.isEmpty();
+        r.hasHandler = n->hasHandler();
+        r.anyHandler = n->m_anyHandler;
+        r.metrics = n->m_metrics;
+
+        for(int j = 0; j < M_HTTP_SERVER_NUM_METHODS; j++)
+            r.handlers[j] = n->m_handlers[j];
+
+        n->m_children.insertionSort([] (Node* const &a, Node* const &b) -> bool {
+            return a->m_label[0] > b->m_label[0]; //insertionSort() wants "greater than"
+        });
+
+        r.childBegin = ~nodes;
+        r.childCount = ~n->m_children;
+        nodes.addAll(n->m_children);
+
+        if(n->m_wildcard == nullptr)
+            r.wildcard = -1;
+        else {
+            r.wildcard = ~nodes;
+            nodes.add(n->m_wildcard);
+        }
 
-            if(isMatchAll)
-                n->m_fallbackChild = child;
+        m_routeLabels += n->m_label;
+        m_routes.add(r);
+    }
+}
+
+int m::HTTPServer::matchRoute(int idx, const char *path, int len, int pos, int *wc, int &numWc) const
+{
+    const Route &r = m_routes[idx];
+    const char *label = m_routeLabels.raw() + r.labelBegin;
+
+    //Slashes in the label match any number of slashes
+    for(int i = 0; i < r.labelLen; i++) {
+        if(pos >= len || path[pos] != label[i])
+            return -1;
+
+        pos++;
+        if(label[i] == '/') {
+            while(pos < len && path[pos] == '/')
+                pos++;
+        }
+    }
+
+    if(r.isWildcard) {
+        if(pos >= len || path[pos] == '/')
+            return -1;
+
+        wc[numWc * 2] = pos;
+        while(pos < len && path[pos] != '/')
+            pos++;
+
+        wc[numWc * 2 + 1] = pos - wc[numWc * 2];
+        numWc++;
+    }
+
+    //Trailing slashes are ignored
+    int end = pos;
+    while(end < len && path[end] == '/')
+        end++;
+
+    if(end >= len && (r.hasHandler || pos >= len))
+        return r.hasHandler ? idx : -1;
+
+    const int saved = numWc;
+    if(r.childCount > 0) {
+        //Binary search on the first character
+        int lo = r.childBegin;
+        int hi = r.childBegin + r.childCount - 1;
+
+        while(lo <= hi) {
+            int mid = (lo + hi) / 2;
+            char c = m_routeLabels[m_routes[mid].labelBegin];
+
+            if(c == path[pos]) {
+                int ret = matchRoute(mid, path, len, pos, wc, numWc);
+                if(ret >= 0)
+                    return ret;
+
+                numWc = saved;
+                break;
+            } else if(c < path[pos])
+                lo = mid + 1;
             else
-                n->m_children.add(child);
+                hi = mid - 1;
         }
+    }
+
+    //Static routes come first, then try the wildcard
+    if(r.wildcard >= 0) {
+        int ret = matchRoute(r.wildcard, path, len, pos, wc, numWc);
+        if(ret >= 0)
+            return ret;
+
+        numWc = saved;
+    }
+
+    return -1;
+}
+
+m::HTTPRequestHandler *m::HTTPServer::route(HTTPRequestType method, const char *path, int len, int *wildcards, int *numWildcards) const
+{
+    HTTPRouteMetrics *unused;
+    return resolve(method, path, len, wildcards, numWildcards, unused);
+}
+
+m::HTTPRequestHandler *m::HTTPServer::resolve(HTTPRequestType method, const char *path, int len, int *wildcards, int *numWildcards, HTTPRouteMetrics *&metrics) const
+{
+    int wc[M_HTTP_SERVER_MAX_WILDCARDS * 2];
+    int numWc = 0;
+    int idx = m_routes.isEmpty() ? -1 : matchRoute(0, path, len, 0, wildcards == nullptr ? wc : wildcards, numWc);
+
+    if(numWildcards != nullptr)
+        *numWildcards = (idx < 0) ? 0 : numWc;
+
+    if(idx < 0) {
+        metrics = m_404metrics;
+        return m_404handler;
+    }
+
+    const Route &r = m_routes[idx];
+    metrics = r.metrics;
+    HTTPRequestHandler *ret = nullptr;
 
-        n = child;
+    if(method >= 0 && method < M_HTTP_SERVER_NUM_METHODS) {
+        ret = r.handlers[method];
+
+        if(ret == nullptr && method == kHRT_Head)
+            ret = r.handlers[kHRT_Get];
     }
 
-    if(h != n->m_handler) {
-        if(n->m_handler != nullptr)
-            delete n->m_handler;
+    if(ret == nullptr)
+        ret = r.anyHandler;
+
+    return (ret == nullptr) ? m_405handler : ret;
+}
 
-        n->m_handler = h;
+m::HTTPRouteMetrics *m::HTTPServer::routeMetrics(const String &path) const
+{
+    for(HTTPRouteMetrics *rm : m_routeMetrics) {
+        if(rm->m_pattern == path)
+            return rm;
     }
+
+    return nullptr;
+}
+
+void m::HTTPServer::writeMetrics(String &dst)
+{
+    List<HTTPRouteMetrics*> routes(m_routeMetrics);
+    routes.add(m_404metrics);
+
+    auto header = [&dst] (const char *name, const char *type, const char *help) {
+        dst += "# HELP "_m;
+        dst += name;
+        dst += ' ';
+        dst += help;
+        dst += "\n# TYPE "_m;
+        dst += name;
+        dst += ' ';
+        dst += type;
+        dst += '\n';
+    };
+
+    auto routeLabel = [] (HTTPRouteMetrics *rm) -> String {
+        String ret("route=\""_m);
+        appendLabelValue(ret, rm->m_pattern);
+        ret += '"';
+        return ret;
+    };
+
+    auto workerLabel = [] (int i) -> String {
+        String ret("worker=\""_m);
+        ret += String::fromInteger(i);
+        ret += '"';
+        return ret;
+    };
+
+    auto value = [&dst] (const char *name, const String &labels, uint64_t val) {
+        dst += name;
+        dst += '{';
+        dst += labels;
+        dst += "} "_m;
+        dst.appendUInteger64(val);
+        dst += '\n';
+    };
+
+    auto routeCounter = [&] (const char *name, const char *help, Atomic64 HTTPRouteMetrics::*field) {
+        header(name, "counter", help);
+
+        for(HTTPRouteMetrics *rm : routes)
+            value(name, routeLabel(rm), static_cast<uint64_t>((rm->*field).get()));
+    };
+
+    auto workerValue = [&] (const char *name, const char *type, const char *help, Atomic64 HTTPWorkerMetrics::*field) {
+        header(name, type, help);
+
+        for(int i = 0; i < m_threadPool.count(); i++)
+            value(name, workerLabel(i), static_cast<uint64_t>((worker(i)->m_metrics.*field).get()));
+    };
+
+    auto workerHistogram = [&] (const char *name, const char *help, HTTPHistogram HTTPWorkerMetrics::*field) {
+        header(name, "histogram", help);
+
+        for(int i = 0; i < m_threadPool.count(); i++)
+            (worker(i)->m_metrics.*field).writePrometheus(dst, name, workerLabel(i));
+    };
+
+    routeCounter("mgpcl_http_route_requests_total", "Requests received, by route.", &HTTPRouteMetrics::m_requests);
+    routeCounter("mgpcl_http_route_errors_total", "Requests that failed with a 5xx code or were aborted, by route.", &HTTPRouteMetrics::m_errors);
+    routeCounter("mgpcl_http_route_received_bytes_total", "Bytes received, by route.", &HTTPRouteMetrics::m_bytesIn);
+    routeCounter("mgpcl_http_route_sent_bytes_total", "Bytes sent, by route.", &HTTPRouteMetrics::m_bytesOut);
+
+    header("mgpcl_http_route_handler_seconds", "histogram", "Time spent processing requests, by route.");
+    for(HTTPRouteMetrics *rm : routes)
+        rm->m_handlerTime.writePrometheus(dst, "mgpcl_http_route_handler_seconds", routeLabel(rm));
+
+    workerValue("mgpcl_http_worker_connections_total", "counter", "Connections accepted, by worker.", &HTTPWorkerMetrics::m_connections);
+    workerValue("mgpcl_http_worker_active_connections", "gauge", "Connections currently open, by worker.", &HTTPWorkerMetrics::m_activeConnections);
+    workerValue("mgpcl_http_worker_requests_total", "counter", "Requests received, by worker.", &HTTPWorkerMetrics::m_requests);
+    workerValue("mgpcl_http_worker_errors_total", "counter", "Connections dropped because of an error, by worker.", &HTTPWorkerMetrics::m_errors);
+    workerValue("mgpcl_http_worker_received_bytes_total", "counter", "Bytes received, by worker.", &HTTPWorkerMetrics::m_bytesIn);
+    workerValue("mgpcl_http_worker_sent_bytes_total", "counter", "Bytes sent, by worker.", &HTTPWorkerMetrics::m_bytesOut);
+    workerHistogram("mgpcl_http_worker_headers_seconds", "Time from accept to the end of the request headers, by worker.", &HTTPWorkerMetrics::m_headersTime);
+    workerHistogram("mgpcl_http_worker_handler_seconds", "Time spent processing requests, by worker.", &HTTPWorkerMetrics::m_handlerTime);
+    workerHistogram("mgpcl_http_worker_send_seconds", "Time spent sending responses, by worker.", &HTTPWorkerMetrics::m_sendTime);
 }
 
 void m::HTTPServer::dispatchClient(const IPv4Address &addr, TCPSocket &&cli)
@@ -195,6 +663,47 @@ m::HTTPServer::Worker::~Worker()
 {
     for(Client *cli : m_clients)
         delete cli;
+
+    for(Compressor *c : m_idleCompressors)
+        delete c;
+}
+
+m::HTTPServer::Compressor *m::HTTPServer::Worker::acquireCompressor(bool gzip)
+{
+#ifdef MGPCL_NO_ZLIB
+    return nullptr;
+#else
+    for(int i = 0; i < ~m_idleCompressors; i++) {
+        Compressor *c = m_idleCompressors[i];
+
+        if(c->m_gzip == gzip) {
+            m_idleCompressors.remove(i);
+
+            if(c->reset())
+                return c;
+
+            delete c;
+            break;
+        }
+    }
+
+    Compressor *ret = new Compressor(gzip, m_parent->m_compressLevel);
+    if(!ret->m_ok) {
+        delete ret;
+        return nullptr;
+    }
+
+    return ret;
+#endif
+}
+
+void m::HTTPServer::Worker::releaseCompressor(Compressor *c)
+{
+    //Keep a few of them, deflateInit allocates about 256 KiB
+    if(~m_idleCompressors < M_HTTP_SERVER_MAX_IDLE_COMPRESSORS)
+        m_idleCompressors.add(c);
+    else
+        delete c;
 }
 
 void m::HTTPServer::Worker::run()
@@ -303,41 +812,66 @@ m::HTTPServer::Client::Client(Worker *p, const IPv4Address &addr, TCPSocket *soc
                                                                                                m_socket(sock), m_phase(kHRP_Read),
                                                                                                m_shouldRemove(false), m_lineLength(0), m_readPhase(kHRRP_QueryLine),
                                                                                                m_writingHeaders(true), m_handler(nullptr), m_remDataLen(0),
-                                                                                               m_sentLinePos(0)
+                                                                                               m_sentLinePos(0), m_encoded(false), m_chunked(false),
+                                                                                               m_bodyDone(false), m_compressor(nullptr)
 {
     m_time = time::getTimeMsUInt();
     m_req = new HTTPServerRequest;
+    initMetrics();
 }
 #else
 m::HTTPServer::Client::Client(Worker *p, const IPv4Address &addr, TCPSocket *sock, bool ssl) : m_parent(p), m_isSSL(ssl), m_addr(addr),
                                                                                                m_socket(sock), m_sslOP(kSWO_WantRead), m_phase(kHRP_Read),
                                                                                                m_shouldRemove(false), m_lineLength(0), m_readPhase(kHRRP_QueryLine),
                                                                                                m_writingHeaders(true), m_handler(nullptr), m_remDataLen(0),
-                                                                                               m_sentLinePos(0)
+                                                                                               m_sentLinePos(0), m_encoded(false), m_chunked(false),
+                                                                                               m_bodyDone(false), m_compressor(nullptr)
 {
     m_time = time::getTimeMsUInt();
     m_req = new HTTPServerRequest;
+    initMetrics();
 }
 
 m::HTTPServer::Client::Client(Worker *p, const IPv4Address &addr, SSLSocket *sock, SSLWantedOperation handshakeOp) : m_parent(p), m_isSSL(true), m_addr(addr),
                                                                                                                      m_socket(sock), m_sslOP(handshakeOp), m_phase(kHRP_Handshake),
                                                                                                                      m_shouldRemove(false), m_lineLength(0), m_readPhase(kHRRP_QueryLine),
                                                                                                                      m_writingHeaders(true), m_req(nullptr), m_handler(nullptr),
-                                                                                                                     m_remDataLen(0), m_sentLinePos(0)
+                                                                                                                     m_remDataLen(0), m_sentLinePos(0), m_encoded(false),
+                                                                                                                     m_chunked(false), m_bodyDone(false), m_compressor(nullptr)
 {
     m_time = time::getTimeMsUInt();
+    initMetrics();
 }
 #endif
 
+void m::HTTPServer::Client::initMetrics()
+{
+    m_acceptTime = time::getTimeMs();
+    m_sendStart = 0.0;
+    m_routeMetrics = nullptr;
+    m_bytesIn = 0;
+    m_bytesOut = 0;
+
+    m_parent->m_metrics.m_connections.increment();
+    m_parent->m_metrics.m_activeConnections.increment();
+}
+
 m::HTTPServer::Client::~Client()
 {
     if(m_req != nullptr) {
-        if(m_handler != nullptr)
+        if(m_handler != nullptr) {
             m_handler->finishRequest(m_req, false);
+            endRequest(false);
+        }
 
         delete m_req;
     }
 
+    m_parent->m_metrics.m_activeConnections.add(-1);
+
+    if(m_compressor != nullptr)
+        m_parent->releaseCompressor(m_compressor);
+
     stopClient();
     delete m_socket;
     M_TRACE("destroyed client");
@@ -362,6 +896,11 @@ void m::HTTPServer::Client::comReady()
         int diff = M_HTTP_SERVER_RBUF_SZ - m_lineLength;
         int rd = m_socket->receive(m_recvBuf, diff);
 
+        if(rd > 0) {
+            m_bytesIn += static_cast<uint64_t>(rd);
+            m_parent->m_metrics.m_bytesIn.add(rd);
+        }
+
         if(rd < 0) {
             if(m_socket->lastError() == inet::kSE_NoError) {
 #ifndef MGPCL_NO_SSL
@@ -437,6 +976,7 @@ void m::HTTPServer::Client::comReady()
                                     removeDueToError("unsupported request method");
                                 else {
                                     m_req->m_method = method;
+                                    m_req->m_http11 = upperLine.endsWith(" HTTP/1.1"_m);
                                     m_req->m_pathname = String(buf + methodLen, lineEnd - methodLen - 9);
                                     m_req->m_pathname = m_req->m_pathname.trimmed();
 
@@ -497,8 +1037,21 @@ void m::HTTPServer::Client::comReady()
             written = m_socket->send(reinterpret_cast<const uint8_t*>(m_responseBuffer.raw()) + delta, static_cast<int>(m_remDataLen));
         } else {
             if(m_lineLength <= 0) {
-                m_lineLength = m_handler->sendData(m_req, m_recvBuf, M_HTTP_SERVER_RBUF_SZ);
-                m_sentLinePos = 0;
+                if(m_encoded) {
+                    if(!fillEncoded()) {
+                        removeDueToError("compression failure");
+                        return;
+                    }
+
+                    if(m_lineLength <= 0) {
+                        //HTTP/1.0 and compressor had nothing left
+                        finish();
+                        return;
+                    }
+                } else {
+                    m_lineLength = m_handler->sendData(m_req, m_recvBuf, M_HTTP_SERVER_RBUF_SZ);
+                    m_sentLinePos = 0;
+                }
             }
 
             written = m_socket->send(m_recvBuf + m_sentLinePos, m_lineLength);
@@ -521,20 +1074,28 @@ void m::HTTPServer::Client::comReady()
             removeDueToError("client connection closed unexpectedly");
         else {
             m_time = time::getTimeMsUInt();
-            m_remDataLen -= static_cast<uint64_t>(written);
+            m_bytesOut += static_cast<uint64_t>(written);
+            m_parent->m_metrics.m_bytesOut.add(written);
 
-            if(m_remDataLen <= 0) {
-                if(m_writingHeaders) {
-                    m_writingHeaders = false;
-                    m_responseBuffer.clear();
+            if(m_encoded && !m_writingHeaders) {
+                if(m_lineLength <= 0 && m_bodyDone)
+                    finish();
+            } else {
+                m_remDataLen -= static_cast<uint64_t>(written);
+
+                if(m_remDataLen <= 0) {
+                    if(m_writingHeaders) {
+                        m_writingHeaders = false;
+                        m_responseBuffer.clear();
 
-                    m_remDataLen = m_req->m_responseLength;
-                    m_lineLength = 0;
+                        m_remDataLen = m_req->m_responseLength;
+                        m_lineLength = 0;
 
-                    if(m_remDataLen <= 0)
+                        if(!m_encoded && m_remDataLen <= 0)
+                            finish();
+                    } else
                         finish();
-                } else
-                    finish();
+                }
             }
         }
     } else if(m_phase == kHRP_Shutdown) {
@@ -556,6 +1117,9 @@ void m::HTTPServer::Client::removeDueToError(const char *err)
     std::cerr << "HTTPServer: " << err << std::endl;
 #endif
 
+    if(!m_shouldRemove)
+        m_parent->m_metrics.m_errors.increment();
+
     m_shouldRemove = true;
 }
 
@@ -583,22 +1147,10 @@ void m::HTTPServer::Client::onHeadersReceived()
         }
     }
 
-    List<String> components;
-    splitPathname(m_req->m_pathname, components);
-
-    Node *n = m_parent->m_parent->m_root;
-    for(const String &component: components) {
-        Node *child = n->child(component);
-
-        if(child == nullptr) {
-            n = n->m_fallbackChild;
-            if(n == nullptr)
-                break;
-
-            m_req->m_pathWildcards.add(component);
-        } else
-            n = child;
-    }
+    m_handler = m_parent->m_parent->resolve(m_req->m_method, m_req->m_pathname.raw(), m_req->m_pathname.length(), m_req->m_wildcards, &m_req->m_numWildcards, m_routeMetrics);
+    m_routeMetrics->m_requests.increment();
+    m_parent->m_metrics.m_requests.increment();
+    m_parent->m_metrics.m_headersTime.recordMs(time::getTimeMs() - m_acceptTime);
 
     const String clKey("Content-Length"_m);
     if(m_req->m_queryHeaders.hasKey(clKey)) {
@@ -606,7 +1158,6 @@ void m::HTTPServer::Client::onHeadersReceived()
         m_req->m_queryLength = m_remDataLen;
     }
 
-    m_handler = (n == nullptr || n->m_handler == nullptr) ? m_parent->m_parent->m_404handler : n->m_handler;
     m_handler->beginRequest(m_req);
 
 #ifndef MGPCL_NO_SSL
@@ -623,6 +1174,8 @@ void m::HTTPServer::Client::startResponse()
     double took = m::time::getTimeMs();
     m_handler->processRequest(m_req);
     took = m::time::getTimeMs() - took;
+    m_parent->m_metrics.m_handlerTime.recordMs(took);
+    m_routeMetrics->m_handlerTime.recordMs(took);
 
     if(!m_parent->m_parent->m_accessLog.isNull()) {
         m::String &buf = m_parent->m_accessBuf;
@@ -636,7 +1189,12 @@ void m::HTTPServer::Client::startResponse()
         buf += "\" "_m;
         buf += m::String::fromInteger(m_req->m_responseCode);
         buf.append(' ', 1);
-        buf += m::String::fromUInteger(static_cast<uint32_t>(m_req->m_responseLength));
+
+        if(m_req->m_responseStreaming)
+            buf += '-';
+        else
+            buf.appendUInteger64(m_req->m_responseLength);
+
         buf.append(' ', 1);
         buf += m::String::fromDouble(took, 4);
         buf += M_OS_LINEEND;
@@ -646,6 +1204,8 @@ void m::HTTPServer::Client::startResponse()
         m_parent->m_parent->m_accessLogLock.unlock();
     }
 
+    setupEncoding();
+
     m_responseBuffer.cleanup();
     m_responseBuffer += "HTTP/1.1 "_m;
     m_responseBuffer += String::fromInteger(m_req->m_responseCode);
@@ -662,6 +1222,91 @@ void m::HTTPServer::Client::startResponse()
 
     m_responseBuffer += "\r\n"_m;
     m_remDataLen = m_responseBuffer.length();
+    m_sendStart = time::getTimeMs();
+}
+
+void m::HTTPServer::Client::setupEncoding()
+{
+    HTTPServerRequest *req = m_req;
+    const int code = req->m_responseCode;
+    const bool hasBody = req->m_method != kHRT_Head && code != 204 && code != 304 && (req->m_responseStreaming || req->m_responseLength > 0);
+
+    if(!hasBody)
+        return;
+
+    HTTPServer *srv = m_parent->m_parent;
+    if(srv->m_compress && req->m_responseCompressible && !req->m_responseHeaders.hasKey("Content-Encoding"_m) &&
+       (req->m_responseStreaming || req->m_responseLength >= static_cast<uint64_t>(srv->m_compressMinLength)) && req->m_queryHeaders.hasKey("Accept-Encoding"_m)) {
+        const String &accept = req->m_queryHeaders["Accept-Encoding"_m];
+        bool gzip = g_m_acceptsEncoding(accept, "gzip");
+
+        if(gzip || g_m_acceptsEncoding(accept, "deflate")) {
+            m_compressor = m_parent->acquireCompressor(gzip);
+
+            if(m_compressor != nullptr) {
+                req->m_responseHeaders["Content-Encoding"_m] = gzip ? "gzip"_m : "deflate"_m;
+                req->m_responseHeaders["Vary"_m] = "Accept-Encoding"_m;
+            }
+        }
+    }
+
+    if(req->m_responseStreaming || m_compressor != nullptr) {
+        //The length is unknown: chunked for HTTP/1.1, until the connection closes otherwise
+        req->m_responseHeaders.removeKey("Content-Length"_m);
+        m_encoded = true;
+        m_chunked = req->m_http11;
+
+        if(m_chunked)
+            req->m_responseHeaders["Transfer-Encoding"_m] = "chunked"_m;
+    }
+}
+
+bool m::HTTPServer::Client::fillEncoded()
+{
+    //Room for the chunk size before the data, and for its CRLF and the last chunk after it
+    const int hdrRoom = 10;
+    const int maxData = M_HTTP_SERVER_RBUF_SZ - hdrRoom - 7;
+    int len;
+
+    if(m_compressor == nullptr) {
+        len = m_handler->sendData(m_req, m_recvBuf + hdrRoom, maxData);
+        if(len <= 0) {
+            len = 0;
+            m_bodyDone = true;
+        }
+    } else {
+        len = m_compressor->compress(m_handler, m_req, m_recvBuf + hdrRoom, maxData, m_bodyDone);
+        if(len < 0)
+            return false;
+    }
+
+    int begin = hdrRoom;
+    int end = hdrRoom + len;
+
+    if(m_chunked) {
+        if(len > 0) {
+            m_recvBuf[--begin] = '\n';
+            m_recvBuf[--begin] = '\r';
+
+            uint32_t sz = static_cast<uint32_t>(len);
+            do {
+                m_recvBuf[--begin] = static_cast<uint8_t>("0123456789abcdef"[sz & 15]);
+                sz >>= 4;
+            } while(sz != 0);
+
+            m_recvBuf[end++] = '\r';
+            m_recvBuf[end++] = '\n';
+        }
+
+        if(m_bodyDone) {
+            mem::copy(m_recvBuf + end, "0\r\n\r\n", 5);
+            end += 5;
+        }
+    }
+
+    m_sentLinePos = begin;
+    m_lineLength = end - begin;
+    return true;
 }
 
 void m::HTTPServer::Client::finish()
@@ -669,9 +1314,17 @@ void m::HTTPServer::Client::finish()
     M_TRACE("query finished");
 
     m_handler->finishRequest(m_req, true);
+    m_parent->m_metrics.m_sendTime.recordMs(time::getTimeMs() - m_sendStart);
+    endRequest(m_req->m_responseCode < 500);
+
     delete m_req;
     m_req = nullptr;
 
+    if(m_compressor != nullptr) {
+        m_parent->releaseCompressor(m_compressor);
+        m_compressor = nullptr;
+    }
+
 #ifdef MGPCL_NO_SSL
     m_shouldRemove = true;
 #else
@@ -682,6 +1335,18 @@ void m::HTTPServer::Client::finish()
 #endif
 }
 
+void m::HTTPServer::Client::endRequest(bool ok)
+{
+    if(m_routeMetrics != nullptr) {
+        if(!ok)
+            m_routeMetrics->m_errors.increment();
+
+        m_routeMetrics->m_bytesIn.add(static_cast<int64_t>(m_bytesIn));
+        m_routeMetrics->m_bytesOut.add(static_cast<int64_t>(m_bytesOut));
+        m_routeMetrics = nullptr;
+    }
+}
+
 void m::HTTPServer::Client::stopClient()
 {
 #ifdef MGPCL_NO_SSL
@@ -696,23 +1361,56 @@ void m::HTTPServer::Client::stopClient()
     m_shouldRemove = true;
 }
 
-m::HTTPServer::Node::~Node()
+m::HTTPServer::Node::Node() : m_wildcard(nullptr), m_anyHandler(nullptr), m_metrics(nullptr)
 {
-    if(m_handler != nullptr)
-        delete m_handler;
+    for(int i = 0; i < M_HTTP_SERVER_NUM_METHODS; i++)
+        m_handlers[i] = nullptr;
+}
 
+m::HTTPServer::Node::Node(const String &label) : m_label(label), m_wildcard(nullptr), m_anyHandler(nullptr), m_metrics(nullptr)
+{
+    for(int i = 0; i < M_HTTP_SERVER_NUM_METHODS; i++)
+        m_handlers[i] = nullptr;
+}
+
+m::HTTPServer::Node::~Node()
+{
     for(Node *c: m_children)
         delete c;
+
+    if(m_wildcard != nullptr)
+        delete m_wildcard;
 }
 
-m::HTTPServer::Node *m::HTTPServer::Node::child(const String &str)
+bool m::HTTPServer::Node::hasHandler() const
 {
-    for(Node *n: m_children) {
-        if(n->m_match == str)
-            return n;
+    if(m_anyHandler != nullptr)
+        return true;
+
+    for(int i = 0; i < M_HTTP_SERVER_NUM_METHODS; i++) {
+        if(m_handlers[i] != nullptr)
+            return true;
     }
 
-    return nullptr;
+    return false;
+}
+
+bool m::HTTPServer::Node::uses(HTTPRequestHandler *h) const
+{
+    if(m_anyHandler == h)
+        return true;
+
+    for(int i = 0; i < M_HTTP_SERVER_NUM_METHODS; i++) {
+        if(m_handlers[i] == h)
+            return true;
+    }
+
+    for(Node *c: m_children) {
+        if(c->uses(h))
+            return true;
+    }
+
+    return m_wildcard != nullptr && m_wildcard->uses(h);
 }
 
 void m::SimpleHTTPRequestHandler::beginRequest(HTTPServerRequest *req)
@@ -796,3 +1494,14 @@ void m::StaticHTTPRequestHandler::finishRequest(HTTPServerRequest *req, bool suc
     if(req->userdata() != nullptr)
         delete static_cast<int*>(req->userdata());
 }
+
+void m::HTTPMetricsHandler::processRequest(HTTPServerRequest *req)
+{
+    String metrics;
+    m_server->writeMetrics(metrics);
+
+    static_cast<SimpleUserdata*>(req->userdata())->setResponse(metrics);
+    req->setResponse(200, "OK"_m);
+    req->setResponseHeader("Content-Type"_m, "text/plain; version=0.0.4"_m);
+    SimpleHTTPRequestHandler::processRequest(req);
+}
@@ -0,0 +1,174 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/HTTPServerMetrics.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int g_m_msb64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanReverse64(&idx, x);
+    return static_cast<int>(idx);
+#else
+    int ret = 0;
+    while(x >>= 1)
+        ret++;
+
+    return ret;
+#endif
+}
+
+//Microseconds to seconds, without going through doubles
+static void g_m_appendSeconds(m::String &dst, uint64_t us)
+{
+    char frac[7];
+    uint64_t f = us % 1000000;
+
+    for(int i = 5; i >= 0; i--) {
+        frac[i] = static_cast<char>('0' + f % 10);
+        f /= 10;
+    }
+
+    frac[6] = 0;
+    dst.appendUInteger64(us / 1000000);
+    dst += '.';
+    dst.append(frac, 6);
+}
+
+int m::HTTPHistogram::bucketOf(uint64_t us)
+{
+    if(us < M_HTTP_HISTOGRAM_SUB_BUCKETS)
+        return static_cast<int>(us);
+
+    const int msb = g_m_msb64(us);
+    if(msb > 33)
+        return M_HTTP_HISTOGRAM_BUCKETS - 1;
+
+    //The 3 bits after the most significant one select the sub-bucket
+    return (msb - 2) * M_HTTP_HISTOGRAM_SUB_BUCKETS + static_cast<int>((us >> (msb - 3)) & 7);
+}
+
+uint64_t m::HTTPHistogram::bucketUpperBound(int idx)
+{
+    if(idx < M_HTTP_HISTOGRAM_SUB_BUCKETS)
+        return static_cast<uint64_t>(idx + 1);
+
+    const int msb = idx / M_HTTP_HISTOGRAM_SUB_BUCKETS + 2;
+    const uint64_t sub = static_cast<uint64_t>(idx % M_HTTP_HISTOGRAM_SUB_BUCKETS);
+
+    return (sub + 9) << (msb - 3);
+}
+
+uint64_t m::HTTPHistogram::percentile(double p)
+{
+    uint64_t counts[M_HTTP_HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+
+    //Take a snapshot first, the total may change while we're iterating
+    for(int i = 0; i < M_HTTP_HISTOGRAM_BUCKETS; i++) {
+        counts[i] = static_cast<uint64_t>(m_buckets[i].get());
+        total += counts[i];
+    }
+
+    if(total == 0)
+        return 0;
+
+    uint64_t target = static_cast<uint64_t>(static_cast<double>(total) * p / 100.0 + 0.5);
+    if(target < 1)
+        target = 1;
+
+    uint64_t acc = 0;
+    for(int i = 0; i < M_HTTP_HISTOGRAM_BUCKETS; i++) {
+        acc += counts[i];
+
+        if(acc >= target)
+            return bucketUpperBound(i) - 1;
+    }
+
+    return bucketUpperBound(M_HTTP_HISTOGRAM_BUCKETS - 1) - 1;
+}
+
+void m::HTTPHistogram::writePrometheus(String &dst, const char *name, const String &labels)
+{
+    //Prometheus buckets are cumulative. Every other power of two, from 64us to 16s
+    uint64_t acc = 0;
+    int idx = 0;
+
+    for(int msb = 6; msb <= 24; msb += 2) {
+        const uint64_t bound = static_cast<uint64_t>(1) << msb;
+
+        for(; idx < M_HTTP_HISTOGRAM_BUCKETS && bucketUpperBound(idx) <= bound; idx++)
+            acc += static_cast<uint64_t>(m_buckets[idx].get());
+
+        dst += name;
+        dst += "_bucket{"_m;
+        if(!labels.isEmpty()) {
+            dst += labels;
+            dst += ',';
+        }
+
+        dst += "le=\""_m;
+        g_m_appendSeconds(dst, bound);
+        dst += "\"} "_m;
+        dst.appendUInteger64(acc);
+        dst += '\n';
+    }
+
+    for(; idx < M_HTTP_HISTOGRAM_BUCKETS; idx++)
+        acc += static_cast<uint64_t>(m_buckets[idx].get());
+
+    String braces;
+    if(!labels.isEmpty()) {
+        braces += '{';
+        braces += labels;
+        braces += '}';
+    }
+
+    dst += name;
+    dst += "_bucket{"_m;
+    if(!labels.isEmpty()) {
+        dst += labels;
+        dst += ',';
+    }
+
+    dst += "le=\"+Inf\"} "_m;
+    dst.appendUInteger64(acc);
+    dst += '\n';
+
+    dst += name;
+    dst += "_sum"_m;
+    dst += braces;
+    dst += ' ';
+    g_m_appendSeconds(dst, sum());
+    dst += '\n';
+
+    //Use the bucket total so that _count matches the +Inf bucket
+    dst += name;
+    dst += "_count"_m;
+    dst += braces;
+    dst += ' ';
+    dst.appendUInteger64(acc);
+    dst += '\n';
+}
@@ -300,96 +300,106 @@ static bool g_m_json_parseString(m::BasicParser &src, m::String &val, m::String
 
 #define G_M_JSON_ISKEYCHAR(chr) ((chr >= 'A' && chr <= 'Z') || (chr >= 'a' && chr <= 'z') || chr == '_')
 
-static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &err)
+static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &err);
+
+//Parses the members of an object, up to the closing brace. Elements
+//are bulk-added: the caller must call endBulkAdd(), even on failure.
+static bool g_m_json_parseMembers(m::BasicParser &src, m::JSONElement &dst, m::String &err)
 {
-    char c;
-    {
+    bool first = true;
+
+    while(true) {
         int ic = src.nextNonBlankChar();
         if(ic < 0) {
             err = "couldn't read from input"_m;
             return false;
         }
 
-        c = static_cast<char>(ic);
-    }
+        if(ic == '}')
+            return true;
 
-    if(c == '{') {
-        //Object
-        bool first = true;
-        dst = m::JSONElement(m::kJT_Object);
+        if(first)
+            first = false;
+        else {
+            if(ic != ',') {
+                err = "expected comma before next object element"_m;
+                return false;
+            }
 
-        while(true) {
-            int ic = src.nextNonBlankChar();
+            ic = src.nextNonBlankChar();
             if(ic < 0) {
                 err = "couldn't read from input"_m;
                 return false;
             }
 
             if(ic == '}')
-                break;
-
-            if(first)
-                first = false;
-            else {
-                if(ic != ',') {
-                    err = "expected comma before next object element"_m;
-                    return false;
-                }
+                return true;
+        }
 
-                ic = src.nextNonBlankChar();
+        m::String key(2);
+        if(ic == '\'' || ic == '\"') {
+            if(!g_m_json_parseString(src, key, err, static_cast<char>(ic)))
+                return false;
+        } else if(G_M_JSON_ISKEYCHAR(ic)) {
+            do {
+                key += static_cast<char>(ic);
+                ic = src.nextCharRaw();
                 if(ic < 0) {
                     err = "couldn't read from input"_m;
                     return false;
                 }
+            } while(G_M_JSON_ISKEYCHAR(ic));
 
-                if(ic == '}')
-                    break;
-            }
-
-            m::String key(2);
-            if(ic == '\'' || ic == '\"') {
-                if(!g_m_json_parseString(src, key, err, static_cast<char>(ic)))
-                    return false;
-            } else if(G_M_JSON_ISKEYCHAR(ic)) {
-                do {
-                    key += static_cast<char>(ic);
-                    ic = src.nextCharRaw();
-                    if(ic < 0) {
-                        err = "couldn't read from input"_m;
-                        return false;
-                    }
-                } while(G_M_JSON_ISKEYCHAR(ic));
+            src.undo();
+        } else {
+            if(ic == ':')
+                err = "expected key before value"_m;
+            else
+                err = "unexpected character before key"_m;
 
-                src.undo();
-            } else {
-                if(ic == ':')
-                    err = "expected key before value"_m;
-                else
-                    err = "unexpected character before key"_m;
+            return false;
+        }
 
-                return false;
-            }
+        ic = src.nextNonBlankChar();
+        if(ic < 0) {
+            err = "couldn't read from input"_m;
+            return false;
+        }
 
-            ic = src.nextNonBlankChar();
-            if(ic < 0) {
-                err = "couldn't read from input"_m;
-                return false;
-            }
+        if(ic != ':') {
+            err = "missing ':' before value"_m;
+            return false;
+        }
 
-            if(ic != ':') {
-                err = "missing ':' before value"_m;
-                return false;
-            }
+        m::JSONElement elem;
+        if(!g_m_json_parse(src, elem, err))
+            return false;
 
-            m::JSONElement elem;
-            if(!g_m_json_parse(src, elem, err))
-                return false;
+        elem.setName(key);
+        dst.bulkAddElement(std::move(elem));
+    }
+}
 
-            elem.setName(key);
-            dst.addElement(elem);
+static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &err)
+{
+    char c;
+    {
+        int ic = src.nextNonBlankChar();
+        if(ic < 0) {
+            err = "couldn't read from input"_m;
+            return false;
         }
 
-        return true;
+        c = static_cast<char>(ic);
+    }
+
+    if(c == '{') {
+        //Object
+        dst = m::JSONElement(m::kJT_Object);
+
+        bool ok = g_m_json_parseMembers(src, dst, err);
+        dst.endBulkAdd(); //Keeps what was parsed searchable on errors
+        return ok;
     } else if(c == '[') {
         //Array
         bool first = true;
@@ -442,10 +452,12 @@ static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &
         dst = m::JSONElement(val);
         return true;
     } else if((c >= '0' && c <= '9') || c == '.' || c == '-') {
-        //Number (FIXME: could be faster if parsed directly instead of using a string)
+        //Number
+        char buf[M_DOUBLE_PARSE_MAX];
         bool hasDot = c == '.';
-        m::String tmp(2);
-        tmp += c;
+        bool hasExp = false;
+        int len = 1;
+        buf[0] = c;
 
         while(true) {
             int ic = src.nextCharRaw();
@@ -456,26 +468,41 @@ static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &
 
             c = static_cast<char>(ic);
             if(c == '.') {
-                if(hasDot) {
+                if(hasDot || hasExp) {
                     err = "invalid number format"_m;
                     return false;
                 }
 
                 hasDot = true;
-                tmp += c;
-            } else if(c >= '0' && c <= '9')
-                tmp += c;
-            else {
+            } else if(c == 'e' || c == 'E') {
+                if(hasExp) {
+                    err = "invalid number format"_m;
+                    return false;
+                }
+
+                hasExp = true;
+            } else if((c == '-' || c == '+') && (buf[len - 1] == 'e' || buf[len - 1] == 'E')) {
+                //Exponent sign
+            } else if(c < '0' || c > '9') {
                 src.undo();
                 break;
             }
+
+            if(len >= M_DOUBLE_PARSE_MAX) {
+                err = "number is too long"_m;
+                return false;
+            }
+
+            buf[len++] = c;
         }
 
-        if(hasDot)
-            dst = m::JSONElement(tmp.toDouble());
-        else
-            dst = m::JSONElement(tmp.toInteger());
+        double val;
+        if(m::str::parseDouble(buf, len, val) != len) {
+            err = "invalid number format"_m;
+            return false;
+        }
 
+        dst = m::JSONElement(val);
         return true;
     } else if(c == 't') {
         //True
@@ -501,25 +528,36 @@ static bool g_m_json_parse(m::BasicParser &src, m::JSONElement &dst, m::String &
     return false;
 }
 
-bool m::json::parse(SSharedPtr<InputStream> src, JSONElement &dst, String &err)
+static bool g_m_json_parseRoot(m::BasicParser &bp, m::JSONElement &dst, m::String &err)
 {
-    if(src.isNull())
-        return false;
-
-    BasicParser bp(src);
-    String err2;
+    m::String err2;
     if(g_m_json_parse(bp, dst, err2))
         return true;
 
     err += "line "_m;
-    err += String::fromInteger(bp.line());
+    err += m::String::fromInteger(bp.line());
     err += ", column "_m;
-    err += String::fromInteger(bp.column());
+    err += m::String::fromInteger(bp.column());
     err += ": "_m;
     err += err2;
     return false;
 }
 
+bool m::json::parse(SSharedPtr<InputStream> src, JSONElement &dst, String &err)
+{
+    if(src.isNull())
+        return false;
+
+    BasicParser bp(src);
+    return g_m_json_parseRoot(bp, dst, err);
+}
+
+bool m::json::parse(const char *data, uint64_t len, JSONElement &dst, String &err)
+{
+    BasicParser bp(data, len);
+    return g_m_json_parseRoot(bp, dst, err);
+}
+
 #define G_M_JSON_WRITECHR(out, chr) (out->write(reinterpret_cast<const uint8_t*>(chr), 1) == 1)
 
 static bool g_m_json_writeStr(m::OutputStream *out, const char *str, int len)
@@ -560,6 +598,24 @@ static bool g_m_json_serializeStr(m::OutputStream *out, const m::String &str)
     return G_M_JSON_WRITECHR(out, "\"");
 }
 
+static bool g_m_json_serializeNumber(m::OutputStream *out, double val)
+{
+    char buf[M_DOUBLE_FORMAT_MAX];
+    int len;
+
+    if(val == std::floor(val) && std::fabs(val) < 9007199254740992.0) {
+        //Integers that fit in 53 bits are written as such
+        m::String nbr(m::String::fromInteger64(static_cast<int64_t>(val)));
+        return g_m_json_writeStr(out, nbr.raw(), nbr.length());
+    }
+
+    if(std::isnan(val) || std::isinf(val))
+        return g_m_json_writeStr(out, "null", 4); //JSON has no representation for these
+
+    len = m::str::formatDouble(val, buf);
+    return g_m_json_writeStr(out, buf, len);
+}
+
 bool g_m_json_serializeCompact(m::OutputStream *out, m::JSONElement &src)
 {
     bool status;
@@ -573,13 +629,7 @@ bool g_m_json_serializeCompact(m::OutputStream *out, m::JSONElement &src)
         break;
 
     case m::kJT_Number:
-        if(src.asDouble() == std::floor(src.asDouble())) {
-            m::String nbr(m::String::fromInteger64(static_cast<int64_t>(src.asDouble())));
-            status = g_m_json_writeStr(out, nbr.raw(), nbr.length());
-        } else {
-            m::String nbr(m::String::fromDouble(src.asDouble(), 8));
-            status = g_m_json_writeStr(out, nbr.raw(), nbr.length());
-        }
+        status = g_m_json_serializeNumber(out, src.asDouble());
         break;
 
     case m::kJT_String:
@@ -668,13 +718,7 @@ bool g_m_json_serializeHumanReadable(m::OutputStream *out, m::JSONElement &src,
         break;
 
     case m::kJT_Number:
-        if(src.asDouble() == std::floor(src.asDouble())) {
-            m::String nbr(m::String::fromInteger64(static_cast<int64_t>(src.asDouble())));
-            status = g_m_json_writeStr(out, nbr.raw(), nbr.length());
-        } else {
-            m::String nbr(m::String::fromDouble(src.asDouble(), 8));
-            status = g_m_json_writeStr(out, nbr.raw(), nbr.length());
-        }
+        status = g_m_json_serializeNumber(out, src.asDouble());
         break;
 
     case m::kJT_String:
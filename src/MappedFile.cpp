@@ -0,0 +1,300 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/MappedFile.h"
+#include "mgpcl/Assert.h"
+#include "mgpcl/Mem.h"
+
+#ifdef MGPCL_LINUX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+m::MappedFile::MappedFile()
+{
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+
+#ifdef MGPCL_WIN
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = nullptr;
+#endif
+}
+
+m::MappedFile::MappedFile(const String &fname, MapHint hint)
+{
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+
+#ifdef MGPCL_WIN
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = nullptr;
+#endif
+
+    open(fname, hint);
+}
+
+m::MappedFile::MappedFile(MappedFile &&src)
+{
+    m_data = src.m_data;
+    m_size = src.m_size;
+    m_open = src.m_open;
+
+#ifdef MGPCL_WIN
+    m_file = src.m_file;
+    m_mapping = src.m_mapping;
+    src.m_file = INVALID_HANDLE_VALUE;
+    src.m_mapping = nullptr;
+#endif
+
+    src.m_data = nullptr;
+    src.m_size = 0;
+    src.m_open = false;
+}
+
+m::MappedFile::~MappedFile()
+{
+    close();
+}
+
+m::MappedFile &m::MappedFile::operator = (MappedFile &&src)
+{
+    close();
+
+    m_data = src.m_data;
+    m_size = src.m_size;
+    m_open = src.m_open;
+
+#ifdef MGPCL_WIN
+    m_file = src.m_file;
+    m_mapping = src.m_mapping;
+    src.m_file = INVALID_HANDLE_VALUE;
+    src.m_mapping = nullptr;
+#endif
+
+    src.m_data = nullptr;
+    src.m_size = 0;
+    src.m_open = false;
+    return *this;
+}
+
+m::MappedFile::OpenError m::MappedFile::open(const String &fname, MapHint hint)
+{
+    close();
+
+#ifdef MGPCL_WIN
+    if(fname.length() > MAX_PATH) {
+        wchar_t *tmp = new wchar_t[fname.length() + 5];
+        size_t sz;
+
+        mbstowcs_s(&sz, tmp, 5, "\\\\?\\", _TRUNCATE);
+        mbstowcs_s(&sz, tmp + 4, fname.length() + 1, fname.raw(), _TRUNCATE);
+        m_file = CreateFileW(tmp, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, hint == kMH_Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, nullptr);
+        delete[] tmp;
+    } else
+        m_file = CreateFileA(fname.raw(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, hint == kMH_Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(m_file == INVALID_HANDLE_VALUE)
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? kOE_FileNotFound : kOE_Unknown;
+
+    LARGE_INTEGER fsize;
+    if(GetFileSizeEx(m_file, &fsize) == FALSE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+        return kOE_Unknown;
+    }
+
+    m_size = static_cast<uint64_t>(fsize.QuadPart);
+    if(m_size > 0) {
+        //Windows can't map empty files
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(m_mapping == nullptr) {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+            m_size = 0;
+            return kOE_Unknown;
+        }
+
+        m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if(m_data == nullptr) {
+            CloseHandle(m_mapping);
+            CloseHandle(m_file);
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+            m_size = 0;
+            return kOE_Unknown;
+        }
+    }
+#else
+    int fd = ::open(fname.raw(), O_RDONLY);
+    if(fd == -1)
+        return errno == ENOENT ? kOE_FileNotFound : kOE_Unknown;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return kOE_Unknown;
+    }
+
+    m_size = static_cast<uint64_t>(st.st_size);
+    if(m_size > 0) {
+        //mmap() fails on empty files; m_data stays nullptr in that case
+        void *ptr = mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED) {
+            ::close(fd);
+            m_size = 0;
+            return kOE_Unknown;
+        }
+
+        m_data = static_cast<uint8_t*>(ptr);
+    }
+
+    //The mapping remains valid once the descriptor is closed
+    ::close(fd);
+#endif
+
+    m_open = true;
+    if(hint != kMH_Normal)
+        advise(hint);
+
+    return kOE_Success;
+}
+
+bool m::MappedFile::advise(MapHint hint, uint64_t offset, uint64_t len)
+{
+    mDebugAssert(m_open, "file was not opened");
+
+    if(m_data == nullptr || offset >= m_size)
+        return m_data == nullptr;
+
+    if(len > m_size - offset)
+        len = m_size - offset;
+
+#ifdef MGPCL_WIN
+    //FILE_FLAG_SEQUENTIAL_SCAN is passed at open() time; Windows has nothing else for views
+    return true;
+#else
+    int advice;
+    switch(hint) {
+    case kMH_Sequential:
+        advice = MADV_SEQUENTIAL;
+        break;
+
+    case kMH_Random:
+        advice = MADV_RANDOM;
+        break;
+
+    case kMH_WillNeed:
+        advice = MADV_WILLNEED;
+        break;
+
+    default:
+        advice = MADV_NORMAL;
+        break;
+    }
+
+    //madvise() wants a page-aligned address
+    static const uint64_t pageSz = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t pad = offset % pageSz;
+
+    return madvise(m_data + offset - pad, static_cast<size_t>(len + pad), advice) == 0;
+#endif
+}
+
+void m::MappedFile::close()
+{
+#ifdef MGPCL_WIN
+    if(m_data != nullptr)
+        UnmapViewOfFile(m_data);
+
+    if(m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+
+    if(m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if(m_data != nullptr)
+        munmap(m_data, static_cast<size_t>(m_size));
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+//*******************************************************************  MAPPED INPUT STREAM *******************************************************************
+
+int m::MappedInputStream::read(uint8_t *dst, int sz)
+{
+    mDebugAssert(m_file.isOpen(), "file was not opened");
+    mDebugAssert(sz >= 0, "cannot read a negative amount of bytes");
+
+    uint64_t left = m_file.size() - m_pos;
+    if(static_cast<uint64_t>(sz) > left)
+        sz = static_cast<int>(left);
+
+    if(sz > 0) {
+        mem::copy(dst, m_file.data() + m_pos, static_cast<size_t>(sz));
+        m_pos += static_cast<uint64_t>(sz);
+    }
+
+    return sz;
+}
+
+bool m::MappedInputStream::seek(int amount, SeekPos sp)
+{
+    mDebugAssert(m_file.isOpen(), "file was not opened");
+    int64_t target;
+
+    switch(sp) {
+    case SeekPos::Beginning:
+        mDebugAssert(amount >= 0, "cannot seek backward from beginning");
+        target = static_cast<int64_t>(amount);
+        break;
+
+    case SeekPos::Relative:
+        target = static_cast<int64_t>(m_pos) + static_cast<int64_t>(amount);
+        break;
+
+    case SeekPos::End:
+        mDebugAssert(amount < 0, "cannot seek forward from the end");
+        target = static_cast<int64_t>(m_file.size()) + static_cast<int64_t>(amount);
+        break;
+
+    default:
+        //Should never happen.
+        return false;
+    }
+
+    if(target < 0 || static_cast<uint64_t>(target) > m_file.size())
+        return false;
+
+    m_pos = static_cast<uint64_t>(target);
+    return true;
+}
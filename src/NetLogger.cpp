@@ -22,9 +22,332 @@
 #include "mgpcl/File.h"
 #include "mgpcl/Time.h"
 
+/*
+ * Protocol version 2 (batching mode)
+ *
+ * The first packet is a handshake: 0xB0, followed by the protocol version.
+ * Every other packet is a frame: a flags byte (bit 0 means LZ4-compressed;
+ * the uncompressed size follows as a uint32) and then a list of entries:
+ *  - 0xF0, uint16 id, uint16 len, name: defines a thread or file name
+ *  - level, uint16 thread id, uint16 file id, uint16 line, uint16 len, message
+ *
+ * Everything is big endian, except LZ4 match offsets.
+ */
+
+#define M_NETLOGGER_HANDSHAKE 0xB0
+#define M_NETLOGGER_DEFINE 0xF0
+#define M_NETLOGGER_COMPRESSED 0x01
+#define M_NETLOGGER_MAX_NAMES 65536
+
+#define M_LZ4_HASH_BITS 12
+#define M_LZ4_MIN_MATCH 4
+#define M_LZ4_LAST_LITERALS 5
+#define M_LZ4_MF_LIMIT 12
+
+static inline void g_m_nl_writeU16(uint8_t *dst, uint32_t val)
+{
+    dst[0] = static_cast<uint8_t>(val >> 8);
+    dst[1] = static_cast<uint8_t>(val);
+}
+
+static inline uint32_t g_m_lz4_read32(const uint8_t *src)
+{
+    uint32_t ret;
+    m::mem::copy(&ret, src, sizeof(uint32_t));
+    return ret;
+}
+
+static inline uint32_t g_m_lz4_bound(uint32_t len)
+{
+    return len + len / 255 + 16;
+}
+
+static uint8_t *g_m_lz4_writeLength(uint8_t *dst, uint32_t len)
+{
+    while(len >= 255) {
+        *(dst++) = 255;
+        len -= 255;
+    }
+
+    *(dst++) = static_cast<uint8_t>(len);
+    return dst;
+}
+
+//Greedy compressor producing a standard LZ4 block. dst must hold g_m_lz4_bound(len) bytes.
+static uint32_t g_m_lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t *table)
+{
+    uint8_t *out = dst;
+    uint32_t anchor = 0;
+
+    if(len > M_LZ4_MF_LIMIT) {
+        const uint32_t limit = len - M_LZ4_MF_LIMIT;
+        const uint32_t matchLimit = len - M_LZ4_LAST_LITERALS;
+        uint32_t ip = 0;
+
+        m::mem::zero(table, sizeof(uint32_t) << M_LZ4_HASH_BITS);
+
+        while(ip < limit) {
+            const uint32_t seq = g_m_lz4_read32(src + ip);
+            const uint32_t h = (seq * 2654435761U) >> (32 - M_LZ4_HASH_BITS);
+            const uint32_t ref = table[h]; //Position + 1, so that zero means empty
+            table[h] = ip + 1;
+
+            if(ref == 0 || ip - (ref - 1) > 65535 || g_m_lz4_read32(src + ref - 1) != seq) {
+                ip++;
+                continue;
+            }
+
+            const uint32_t match = ref - 1;
+            uint32_t mlen = M_LZ4_MIN_MATCH;
+            while(ip + mlen < matchLimit && src[match + mlen] == src[ip + mlen])
+                mlen++;
+
+            const uint32_t litLen = ip - anchor;
+            const uint32_t extra = mlen - M_LZ4_MIN_MATCH;
+            uint8_t *token = out++;
+
+            *token = static_cast<uint8_t>(((litLen >= 15 ? 15 : litLen) << 4) | (extra >= 15 ? 15 : extra));
+            if(litLen >= 15)
+                out = g_m_lz4_writeLength(out, litLen - 15);
+
+            m::mem::copy(out, src + anchor, litLen);
+            out += litLen;
+
+            const uint32_t offset = ip - match;
+            *(out++) = static_cast<uint8_t>(offset);
+            *(out++) = static_cast<uint8_t>(offset >> 8);
+
+            if(extra >= 15)
+                out = g_m_lz4_writeLength(out, extra - 15);
+
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    //Last literals
+    const uint32_t litLen = len - anchor;
+    *(out++) = static_cast<uint8_t>((litLen >= 15 ? 15 : litLen) << 4);
+    if(litLen >= 15)
+        out = g_m_lz4_writeLength(out, litLen - 15);
+
+    m::mem::copy(out, src + anchor, litLen);
+    out += litLen;
+
+    return static_cast<uint32_t>(out - dst);
+}
+
+void m::NetLogger::initBatching()
+{
+    m_flushRunning = false;
+    m_batching = false;
+    m_compress = false;
+    m_connected = false;
+    m_maxFrame = M_NETLOGGER_DEFAULT_FRAME;
+    m_interval = M_NETLOGGER_DEFAULT_INTERVAL;
+
+    m_frame = nullptr;
+    m_frameLen = 0;
+    m_frameAlloc = 0;
+    m_compressed = nullptr;
+    m_compressedAlloc = 0;
+    m_lz4Table = nullptr;
+    m_nextNameID = 0;
+}
+
+m::NetLogger::~NetLogger()
+{
+    if(m_flushRunning)
+        disconnect();
+
+    delete[] m_frame;
+    delete[] m_compressed;
+    delete[] m_lz4Table;
+}
+
+uint8_t *m::NetLogger::frameSpace(uint32_t sz)
+{
+    if(m_frameLen + sz > m_frameAlloc) {
+        uint32_t nalloc = m_frameAlloc + (m_frameAlloc >> 1);
+        if(nalloc < m_frameLen + sz)
+            nalloc = m_frameLen + sz;
+
+        uint8_t *nframe = new uint8_t[nalloc];
+        if(m_frameLen > 0)
+            mem::copy(nframe, m_frame, m_frameLen);
+
+        delete[] m_frame;
+        m_frame = nframe;
+        m_frameAlloc = nalloc;
+    }
+
+    uint8_t *ret = m_frame + m_frameLen;
+    m_frameLen += sz;
+    return ret;
+}
+
+uint16_t m::NetLogger::defineName(const char *name, int len)
+{
+    if(m_nextNameID >= M_NETLOGGER_MAX_NAMES) {
+        //Start over; the receiver simply overwrites the old definitions
+        m_threadNames.clear();
+        m_fileNames.clear();
+        m_nextNameID = 0;
+    }
+
+    if(len > 0xFFFF)
+        len = 0xFFFF;
+
+    const uint16_t id = static_cast<uint16_t>(m_nextNameID++);
+    uint8_t *dst = frameSpace(5 + static_cast<uint32_t>(len));
+
+    dst[0] = M_NETLOGGER_DEFINE;
+    g_m_nl_writeU16(dst + 1, id);
+    g_m_nl_writeU16(dst + 3, static_cast<uint32_t>(len));
+    mem::copy(dst + 5, name, static_cast<size_t>(len));
+    return id;
+}
+
+uint16_t m::NetLogger::threadNameID()
+{
+    //Thread IDs can be reused by threads with another name, so check it
+    String name(Thread::currentThreadName());
+    bool isNew;
+    ThreadName &tn = m_threadNames.get(Thread::currentThreadID(), isNew);
+
+    if(isNew || tn.name != name) {
+        const uint32_t before = m_nextNameID;
+        const uint16_t id = defineName(name.raw(), name.length());
+
+        if(m_nextNameID < before) {
+            //Tables were reset, tn is gone
+            ThreadName &tn2 = m_threadNames[Thread::currentThreadID()];
+            tn2.name = std::move(name);
+            tn2.id = id;
+        } else {
+            tn.name = std::move(name);
+            tn.id = id;
+        }
+
+        return id;
+    }
+
+    return tn.id;
+}
+
+uint16_t m::NetLogger::fileNameID(const char *fname)
+{
+    //Keyed by pointer: __FILE__ is a literal, so we don't even look at the string twice
+    const uint16_t *found;
+    if(m_fileNames.getIfExists(fname, found))
+        return *found;
+
+    int fnameLen = 0;
+    int slashPos = 0;
+
+    while(fname[fnameLen] != 0) {
+        if(fname[fnameLen] == '/' || fname[fnameLen] == '\\')
+            slashPos = fnameLen + 1;
+
+        fnameLen++;
+    }
+
+    const uint16_t id = defineName(fname + slashPos, fnameLen - slashPos);
+    m_fileNames[fname] = id;
+    return id;
+}
+
+void m::NetLogger::flushFrame()
+{
+    if(m_frameLen == 0)
+        return;
+
+    if(!m_connected) {
+        //Nobody to send it to. Keep it until it gets too big...
+        if(m_frameLen >= m_maxFrame) {
+            m_frameLen = 0;
+            m_threadNames.clear();
+            m_fileNames.clear();
+            m_nextNameID = 0;
+        }
+
+        return;
+    }
+
+    if(m_compress) {
+        const uint32_t bound = g_m_lz4_bound(m_frameLen);
+        if(m_compressedAlloc < bound) {
+            delete[] m_compressed;
+            m_compressed = new uint8_t[bound];
+            m_compressedAlloc = bound;
+        }
+
+        if(m_lz4Table == nullptr)
+            m_lz4Table = new uint32_t[1 << M_LZ4_HASH_BITS];
+
+        const uint32_t clen = g_m_lz4_compress(m_frame, m_frameLen, m_compressed, m_lz4Table);
+        if(clen + sizeof(uint32_t) < m_frameLen) {
+            Packet pkt(sizeof(uint8_t) + sizeof(uint32_t) + clen);
+            pkt << static_cast<uint8_t>(M_NETLOGGER_COMPRESSED) << m_frameLen;
+            pkt.write(m_compressed, clen);
+
+            m_cli.send(pkt.finalize());
+            m_frameLen = 0;
+            return;
+        }
+    }
+
+    Packet pkt(sizeof(uint8_t) + m_frameLen);
+    pkt << static_cast<uint8_t>(0);
+    pkt.write(m_frame, m_frameLen);
+
+    m_cli.send(pkt.finalize());
+    m_frameLen = 0;
+}
+
+void m::NetLogger::flushThreadFunc()
+{
+    m_batchLock.lock();
+
+    while(m_flushRunning) {
+        m_batchCond.waitFor(m_batchLock, m_interval);
+        flushFrame();
+    }
+
+    m_batchLock.unlock();
+}
+
 void m::NetLogger::vlog(LogLevel level, const char *fname, int line, const char *format, VAList *lst)
 {
-    if(isEnabled(level)) {
+    if(!isEnabled(level))
+        return;
+
+    if(m_batching) {
+        m_batchLock.lock();
+
+        const uint16_t tid = threadNameID();
+        const uint16_t fid = fileNameID(fname);
+
+        m_msg.cleanup();
+        m_msg.appendVFormat(format, lst);
+
+        const uint32_t msgLen = m_msg.length() > 0xFFFF ? 0xFFFF : static_cast<uint32_t>(m_msg.length());
+        if(m_frameLen > 0 && m_frameLen + 9 + msgLen > m_maxFrame)
+            flushFrame();
+
+        uint8_t *dst = frameSpace(9 + msgLen);
+        dst[0] = static_cast<uint8_t>(level);
+        g_m_nl_writeU16(dst + 1, tid);
+        g_m_nl_writeU16(dst + 3, fid);
+        g_m_nl_writeU16(dst + 5, static_cast<uint32_t>(line));
+        g_m_nl_writeU16(dst + 7, msgLen);
+        mem::copy(dst + 9, m_msg.raw(), msgLen);
+
+        if(level == LogLevel::Error || m_frameLen >= m_maxFrame)
+            flushFrame(); //Don't keep errors waiting, the program might be about to crash
+
+        m_batchLock.unlock();
+    } else {
         int fnameLen = 0;
         int slashPos = 0;
 
@@ -62,7 +385,48 @@ bool m::NetLogger::connect(const String &ip)
         m_connErr = m_cli.connect(addr);
     }
 
-    return m_connErr == kSCE_NoError;
+    if(m_connErr != kSCE_NoError)
+        return false;
+
+    if(m_batching) {
+        m_batchLock.lock();
+
+        Packet pkt(2 * sizeof(uint8_t));
+        pkt << static_cast<uint8_t>(M_NETLOGGER_HANDSHAKE) << static_cast<uint8_t>(M_NETLOGGER_PROTOCOL);
+        m_cli.send(pkt.finalize());
+
+        m_connected = true;
+        flushFrame(); //Whatever was logged before connecting
+        m_batchLock.unlock();
+
+        m_flushRunning = true;
+        m_flushThread.setFunc(this, &NetLogger::flushThreadFunc);
+        m_flushThread.start();
+    }
+
+    return true;
+}
+
+void m::NetLogger::disconnect()
+{
+    if(m_flushRunning) {
+        m_batchLock.lock();
+        flushFrame();
+        m_flushRunning = false;
+        m_connected = false;
+
+        //The next connection starts with empty name tables
+        m_threadNames.clear();
+        m_fileNames.clear();
+        m_nextNameID = 0;
+
+        m_batchCond.signal();
+        m_batchLock.unlock();
+        m_flushThread.join();
+    }
+
+    m_cli.waitUntilSent(m_cli.connectionTimeout());
+    m_cli.stop();
 }
 
 bool m::NetLogger::onPacketReceived(TCPClient *cli)
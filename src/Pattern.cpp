@@ -20,6 +20,14 @@
 #include "mgpcl/Pattern.h"
 
 #ifdef MGPCL_ENABLE_PATTERNS
+#include "mgpcl/Mutex.h"
+#include "mgpcl/Util.h"
+#include <cstring>
+#include <algorithm>
+
+#define M_PAT_DFA_MAX_STATES 2048
+#define M_PAT_DFA_BUCKETS 1024
+#define M_PAT_MAX_PREFIX 32
 //#define M_PAT_TEST_MEMLEAK
 
 #ifdef M_PAT_TEST_MEMLEAK
@@ -34,7 +42,8 @@ namespace m
     {
         kSNT_None = 0,
         kSNT_Char,
-        kSNT_End
+        kSNT_End,
+        kSNT_Save
     };
 
     enum PatternFlag
@@ -52,7 +61,7 @@ namespace m
     class PatternNode
     {
     public:
-        PatternNode() : m_marks(0), m_invert(false)
+        PatternNode() : m_marks(0), m_index(0), m_invert(false)
         {
 #ifdef M_PAT_TEST_MEMLEAK
             g_nodeCount++;
@@ -101,6 +110,11 @@ namespace m
             return kSNT_None;
         }
 
+        virtual int saveSlot() const
+        {
+            return -1;
+        }
+
         void invert()
         {
             m_invert = true;
@@ -111,9 +125,21 @@ namespace m
             return m_invert;
         }
 
+        //Position in the compiled program
+        void setIndex(int idx)
+        {
+            m_index = idx;
+        }
+
+        int index() const
+        {
+            return m_index;
+        }
+
     private:
         List<PatternNode*> m_next;
         uint8_t m_marks;
+        int m_index;
 
     protected:
         bool m_invert;
@@ -265,16 +291,29 @@ namespace m
         }
     };
 
-    class StackEntry
+    //Records the current position in a capture slot
+    class PatternNodeSave : public PatternNode
     {
     public:
-        StackEntry() {}
-        StackEntry(PatternNode *n, CStringIterator cit, int remLen) : node(n), it(cit), remainingLen(remLen), childId(0) {}
+        PatternNodeSave(int slot) : m_slot(slot) {}
+
+        virtual bool matches(CStringIterator &it, int &len) override
+        {
+            return true;
+        }
+
+        virtual SpecialNodeType specialType() const override
+        {
+            return kSNT_Save;
+        }
+
+        virtual int saveSlot() const override
+        {
+            return m_slot;
+        }
 
-        PatternNode *node;
-        CStringIterator it;
-        int remainingLen;
-        int childId;
+    private:
+        int m_slot;
     };
 
     static bool isInternalChar(char chr)
@@ -487,11 +526,11 @@ namespace m
         }
     }
 
-    static PatternParseError parsePat(CStringIterator it, int len, PatternNode *&head, PatternNode *&tail)
+    static PatternParseError parsePat(CStringIterator it, int len, PatternNode *&head, PatternNode *&tail, int &groups)
     {
         head = nullptr;
         tail = nullptr;
-        PatternNode *addChildToThis = nullptr;
+        List<PatternNode*> skip; //Nodes that can skip optional elements
 
         while(len > 0) {
             PatternNode *newHead, *newTail;
@@ -506,7 +545,8 @@ namespace m
                     return (pLen < 0) ? kPPE_UnclosedParenthesis : kPPE_EmptyCapture;
                 }
 
-                PatternParseError ret = parsePat(++it, pLen, newHead, newTail);
+                const int group = ++groups;
+                PatternParseError ret = parsePat(++it, pLen, newHead, newTail, groups);
                 if(ret != kPPE_NoError) {
                     destroyPat(head);
                     head = nullptr;
@@ -514,6 +554,15 @@ namespace m
                     return (ret == kPPE_EmptyPattern) ? kPPE_EmptyCapture : ret;
                 }
 
+                //Surround the capture with save nodes
+                PatternNode *save = new PatternNodeSave(group * 2);
+                save->addChild(newHead);
+                newHead = save;
+
+                save = new PatternNodeSave(group * 2 + 1);
+                newTail->addChild(save);
+                newTail = save;
+
                 it += pLen + 1;
                 len -= pLen + 2;
             } else {
@@ -528,14 +577,13 @@ namespace m
                 newTail = newHead;
             }
 
-            if(addChildToThis != nullptr) {
-                addChildToThis->addChild(newHead);
-                addChildToThis = nullptr;
-            }
+            for(PatternNode *pn : skip)
+                pn->addChild(newHead);
+
+            uint8_t flags = 0; //1 = add skip edge, 2 = start over
 
             if(len > 0) {
                 char chr = *it;
-                uint8_t flags; //1 = add skip edge, 2 = start over
 
                 if(chr == '?')
                     flags = 1;
@@ -546,15 +594,6 @@ namespace m
                 else
                     flags = 0;
 
-                if(flags & 1) { //Add skip edge
-                    if(tail == nullptr) { //then head is null too
-                        head = new PatternNodeEnd;
-                        tail = head;
-                    }
-
-                    addChildToThis = tail;
-                }
-
                 if(flags & 2) //Add start over edge
                     newTail->addChild(newHead);
 
@@ -564,6 +603,16 @@ namespace m
                 }
             }
 
+            if(flags & 1) { //Add skip edge
+                if(tail == nullptr) { //then head is null too
+                    head = new PatternNodeEnd;
+                    tail = head;
+                }
+
+                skip.add(tail); //Previous optional elements can still be skipped
+            } else
+                skip.clear();
+
             if(head == nullptr) { //then tail is null too
                 head = newHead;
                 tail = newTail;
@@ -576,13 +625,435 @@ namespace m
         if(head == nullptr)
             return kPPE_EmptyPattern;
 
-        if(addChildToThis != nullptr) {
+        if(!skip.isEmpty()) {
             PatternNode *end = new PatternNodeEnd; //This should be optimized out
             tail->addChild(end);
-            addChildToThis->addChild(end);
+
+            for(PatternNode *pn : skip)
+                pn->addChild(end);
+
             tail = end;
         }
 
+        return kPPE_NoError;
+    }
+    enum ProgramStateKind
+    {
+        kPSK_Consume = 0,
+        kPSK_Epsilon,
+        kPSK_Save
+    };
+
+    //Flattened PatternNode. Consuming states test the input
+    //byte against a 256 bits set, the others don't consume
+    //anything. A state without successors accepts.
+    class ProgramState
+    {
+    public:
+        ProgramState() : kind(kPSK_Consume), slot(-1), owner(0)
+        {
+            memset(bits, 0, sizeof(bits));
+        }
+
+        bool accepts(uint8_t c) const
+        {
+            return (bits[c >> 5] & (1U << (c & 31))) != 0;
+        }
+
+        int singleByte() const
+        {
+            int ret = -1;
+
+            for(int i = 0; i < 256; i++) {
+                if(accepts(static_cast<uint8_t>(i))) {
+                    if(ret >= 0)
+                        return -1;
+
+                    ret = i;
+                }
+            }
+
+            return ret;
+        }
+
+        uint8_t kind;
+        int slot;
+        int owner; //Pattern ID, for PatternSet
+        uint32_t bits[8];
+        List<int> next;
+    };
+
+    class SparseSet
+    {
+        M_NON_COPYABLE(SparseSet)
+
+    public:
+        SparseSet() : m_dense(nullptr), m_sparse(nullptr), m_count(0)
+        {
+        }
+
+        SparseSet(int cap) : m_dense(nullptr), m_sparse(nullptr), m_count(0)
+        {
+            allocate(cap);
+        }
+
+        ~SparseSet()
+        {
+            delete[] m_dense;
+            delete[] m_sparse;
+        }
+
+        void allocate(int cap)
+        {
+            delete[] m_dense;
+            delete[] m_sparse;
+
+            m_dense = new int[cap]();
+            m_sparse = new int[cap]();
+            m_count = 0;
+        }
+
+        bool contains(int i) const
+        {
+            const int j = m_sparse[i];
+            return j < m_count && m_dense[j] == i;
+        }
+
+        void insert(int i)
+        {
+            m_sparse[i] = m_count;
+            m_dense[m_count++] = i;
+        }
+
+        void clear()
+        {
+            m_count = 0;
+        }
+
+    private:
+        int *m_dense;
+        int *m_sparse;
+        int m_count;
+    };
+
+    //Pike VM thread list. Threads are ordered by priority.
+    class PikeList
+    {
+        M_NON_COPYABLE(PikeList)
+
+    public:
+        PikeList(int n, int slots) : set(n), ids(new int[n]), caps(new int[n * slots]), count(0), m_slots(slots)
+        {
+        }
+
+        ~PikeList()
+        {
+            delete[] ids;
+            delete[] caps;
+        }
+
+        void clear()
+        {
+            set.clear();
+            count = 0;
+        }
+
+        void push(int s, const int *c)
+        {
+            ids[count] = s;
+            memcpy(caps + count * m_slots, c, m_slots * sizeof(int));
+            count++;
+        }
+
+        SparseSet set;
+        int *ids;
+        int *caps;
+        int count;
+
+    private:
+        int m_slots;
+    };
+
+    //Lazily built DFA state: an ordered list of NFA threads.
+    //m_count is used as a pseudo-thread meaning "accepts if
+    //the input ends here", for patterns ending with '$'.
+    class DFAState
+    {
+        M_NON_COPYABLE(DFAState)
+
+    public:
+        DFAState(int numClasses) : matched(false), accept(false), fresh(false), acceptAtEnd(false), hash(0), chain(-1)
+        {
+            trans = new int[numClasses];
+            for(int i = 0; i < numClasses; i++)
+                trans[i] = -1;
+        }
+
+        ~DFAState()
+        {
+            delete[] trans;
+        }
+
+        List<int> threads;
+        bool matched;     //A match was found before: stop starting new threads
+        bool accept;      //A match ends here
+        bool fresh;       //All threads were started here
+        bool acceptAtEnd;
+        uint32_t hash;
+        int chain;
+        int *trans;       //Indexed by byte class, -1 if not computed yet
+    };
+
+    class PatternProgram
+    {
+        M_NON_COPYABLE(PatternProgram)
+
+    public:
+        PatternProgram(PatternNode *root, int numGroups, uint32_t flags);
+        ~PatternProgram();
+
+        bool test(const char *str, int len);
+        bool find(const char *str, int len, int from, List<int> &starts, List<int> &ends);
+
+    private:
+        void computePrefix();
+        int nextCandidate(const char *str, int len, int pos) const;
+
+        //Lazy DFA, first pass. Needs m_dfaLock.
+        bool closure(int s, List<int> &dst);
+        int dfaFind(const List<int> &threads, bool matched, bool accept, bool fresh, uint32_t hash) const;
+        int dfaAdd(const List<int> &threads, bool matched, bool accept, bool fresh);
+        int dfaStartState();
+        int dfaStep(int cur, uint8_t c);
+        void dfaFlush();
+        int dfaSearch(const char *str, int len, int from, bool earliest, int &idle);
+
+        //Pike VM, second pass. Linear, resolves the captures.
+        bool addThread(PikeList &lst, int s, int pos, int len, int *caps, int *out) const;
+        bool pike(const char *str, int len, int from, int stopAt, int *out) const;
+
+        ProgramState *m_states;
+        int m_count;
+        int m_slots;
+        bool m_anchored;
+        bool m_endAnchored;
+        uint8_t m_classes[256];
+        int m_numClasses;
+        String m_prefix;
+
+        Mutex m_dfaLock;
+        List<DFAState*> m_dfa;
+        int m_buckets[M_PAT_DFA_BUCKETS];
+        int m_dfaStart;
+        SparseSet m_seen;
+        List<int> m_stack;
+        List<int> m_scratch;
+    };
+
+    class SetDFAState
+    {
+        M_NON_COPYABLE(SetDFAState)
+
+    public:
+        SetDFAState(int numClasses) : hash(0), chain(-1)
+        {
+            trans = new int[numClasses];
+            for(int i = 0; i < numClasses; i++)
+                trans[i] = -1;
+        }
+
+        ~SetDFAState()
+        {
+            delete[] trans;
+        }
+
+        List<int> threads; //Sorted. IDs >= count are '$' pseudo-threads
+        List<int> accepts; //Patterns matching up to here
+        uint32_t hash;
+        int chain;
+        int *trans;
+    };
+
+    //Union of several patterns. There are no priorities here:
+    //threads are plain sets and every pattern is reported.
+    class PatternSetProgram
+    {
+        M_NON_COPYABLE(PatternSetProgram)
+
+    public:
+        PatternSetProgram(List<PatternNode*> &roots, const List<uint32_t> &flags);
+        ~PatternSetProgram();
+
+        void matches(const char *str, int len, List<int> &ids);
+
+    private:
+        void closure(int s, List<int> &dst, List<int> &accepts);
+        void accept(int owner, List<int> &dst, List<int> &accepts);
+        int dfaAdd(List<int> &threads, List<int> &accepts);
+        int dfaStartState();
+        int dfaStep(int cur, uint8_t c);
+        void dfaFlush();
+
+        ProgramState *m_states;
+        int m_count;
+        int m_numPatterns;
+        uint8_t m_classes[256];
+        int m_numClasses;
+        List<int> m_roots;         //All of them, for the first position
+        List<int> m_floatingRoots; //Patterns not starting with '^'
+        List<bool> m_endAnchored;
+
+        Mutex m_lock;
+        List<SetDFAState*> m_dfa;
+        int m_buckets[M_PAT_DFA_BUCKETS];
+        int m_dfaStart;
+        SparseSet m_seen;
+        List<int> m_stack;
+        List<int> m_scratch;
+        List<int> m_accepts;
+        List<bool> m_found;
+    };
+
+    static uint32_t hashThreads(const List<int> &threads, bool matched, bool accept, bool fresh)
+    {
+        uint32_t ret = 2166136261U;
+
+        for(int t : threads)
+            ret = (ret ^ static_cast<uint32_t>(t)) * 16777619U;
+
+        ret = (ret ^ (matched ? 1U : 0U)) * 16777619U;
+        ret = (ret ^ (accept ? 2U : 0U)) * 16777619U;
+        return (ret ^ (fresh ? 4U : 0U)) * 16777619U;
+    }
+
+    //Flattens the graphs of 'roots' into 'dst'. Node indices are global.
+    static ProgramState *flattenGraphs(PatternNode **roots, int numRoots, int &count, List<int> &rootIds)
+    {
+        List<PatternNode*> nodes;
+
+        for(int r = 0; r < numRoots; r++) {
+            rootIds.add(~nodes);
+            roots[r]->dfs(nodes);
+        }
+
+        count = ~nodes;
+        ProgramState *ret = new ProgramState[count];
+
+        for(int i = 0; i < count; i++)
+            nodes[i]->setIndex(i);
+
+        int owner = 0;
+        for(int i = 0; i < count; i++) {
+            PatternNode *n = nodes[i];
+            ProgramState &st = ret[i];
+            SpecialNodeType type = n->specialType();
+
+            while(owner + 1 < numRoots && rootIds[owner + 1] <= i)
+                owner++;
+
+            st.owner = owner;
+
+            if(type == kSNT_End)
+                st.kind = kPSK_Epsilon;
+            else if(type == kSNT_Save) {
+                st.kind = kPSK_Save;
+                st.slot = n->saveSlot();
+            } else {
+                st.kind = kPSK_Consume;
+
+                for(int b = 0; b < 256; b++) {
+                    char chr = static_cast<char>(b);
+                    CStringIterator it = &chr;
+                    int len = 1;
+
+                    if(n->matches(it, len))
+                        st.bits[b >> 5] |= 1U << (b & 31);
+                }
+            }
+
+            for(int j = 0; j < n->numChildren(); j++)
+                st.next.add(n->child(j)->index());
+        }
+
+        return ret;
+    }
+
+    //Two bytes are in the same class if no state can tell them apart
+    static int computeClasses(const ProgramState *states, int count, uint8_t *classes)
+    {
+        int remap[512];
+        int numClasses = 1;
+        memset(classes, 0, 256);
+
+        for(int i = 0; i < count; i++) {
+            if(states[i].kind != kPSK_Consume)
+                continue;
+
+            for(int j = 0; j < numClasses * 2; j++)
+                remap[j] = -1;
+
+            int cnt = 0;
+            for(int b = 0; b < 256; b++) {
+                int k = classes[b] * 2 + (states[i].accepts(static_cast<uint8_t>(b)) ? 1 : 0);
+                if(remap[k] < 0)
+                    remap[k] = cnt++;
+
+                classes[b] = static_cast<uint8_t>(remap[k]);
+            }
+
+            numClasses = cnt;
+        }
+
+        return numClasses;
+    }
+
+    static const char *errorString(PatternParseError err)
+    {
+        switch(err) {
+        case kPPE_NoError:             return "no error";
+        case kPPE_UnclosedParenthesis: return "found opening parenthesis, but the closing one is missing";
+        case kPPE_UnclosedBracket:     return "found opening bracket, but the closing one is missing";
+        case kPPE_InvalidRange:        return "found invalid range";
+        case kPPE_MisplacedEscape:     return "found misplaced character";
+        case kPPE_EmptyCapture:        return "found empty capture";
+        case kPPE_MisplacedCtrlChar:   return "found an unexpected control character";
+        case kPPE_EmptyPattern:        return "pattern is empty";
+        default:                       return "unknown error";
+        }
+    }
+
+    static PatternParseError parseRoot(const char *sIt, int sLen, PatternNode *&root, uint32_t &flags, int &groups)
+    {
+        if(sLen < 0) {
+            sLen = 0;
+
+            while(sIt[sLen] != 0)
+                sLen++;
+        }
+
+        flags = 0;
+        groups = 0;
+
+        if(sLen > 0 && *sIt == '^') {
+            flags |= kPF_Start;
+            sIt++;
+            sLen--;
+        }
+
+        if(sLen > 0 && sIt[sLen - 1] == '$') {
+            flags |= kPF_End;
+            sLen--;
+        }
+
+        PatternNode *tail;
+        PatternParseError ret = parsePat(sIt, sLen, root, tail, groups);
+        if(ret != kPPE_NoError)
+            return ret;
+
+        //root->optimize();
+        if(tail->numChildren() > 0)
+            tail->addChild(new PatternNodeEnd);
+
         return kPPE_NoError;
     }
 }
@@ -616,143 +1087,779 @@ void m::PatternNode::optimize()
     }
 }
 
-m::Pattern::~Pattern()
+m::PatternProgram::PatternProgram(PatternNode *root, int numGroups, uint32_t flags)
 {
-    destroyPat(m_root);
+    List<int> rootIds;
+    m_states = flattenGraphs(&root, 1, m_count, rootIds);
+    m_slots = (numGroups + 1) * 2;
+    m_anchored = (flags & kPF_Start) != 0;
+    m_endAnchored = (flags & kPF_End) != 0;
+    m_numClasses = computeClasses(m_states, m_count, m_classes);
+    computePrefix();
 
-#ifdef M_PAT_TEST_MEMLEAK
-    mAssert(g_nodeCount == 0, "node memory leak detected!!");
-#endif
+    //One more slot for the '$' pseudo-thread
+    m_seen.allocate(m_count + 1);
+
+    for(int i = 0; i < M_PAT_DFA_BUCKETS; i++)
+        m_buckets[i] = -1;
+
+    m_dfaStart = -1;
 }
 
-bool m::Pattern::compile(const char *sIt, int sLen)
+m::PatternProgram::~PatternProgram()
+{
+    dfaFlush();
+    delete[] m_states;
+}
+
+void m::PatternProgram::computePrefix()
 {
-    if(m_root != nullptr) {
-        List<PatternNode*> toDelete;
-        m_root->dfs(toDelete);
+    //Follow the path every match has to take, if any
+    int s = 0;
+
+    for(int guard = 0; guard < m_count; guard++) {
+        const ProgramState &st = m_states[s];
+
+        if(st.kind == kPSK_Consume) {
+            int b = st.singleByte();
+            if(b < 0 || m_prefix.length() >= M_PAT_MAX_PREFIX)
+                break;
 
-        for(PatternNode *pn: toDelete)
-            delete pn;
+            m_prefix += static_cast<char>(b);
+        }
+
+        if(~st.next != 1)
+            break;
+
+        s = st.next[0];
     }
+}
 
-    if(sLen < 0) {
-        sLen = 0;
+int m::PatternProgram::nextCandidate(const char *str, int len, int pos) const
+{
+    const int plen = m_prefix.length();
+
+    while(len - pos >= plen) {
+        const char *p = static_cast<const char*>(memchr(str + pos, m_prefix[0], len - pos - plen + 1));
+        if(p == nullptr)
+            return -1;
 
-        while(sIt[sLen] != 0)
-            sLen++;
+        pos = static_cast<int>(p - str);
+        if(memcmp(p + 1, m_prefix.raw() + 1, plen - 1) == 0)
+            return pos;
+
+        pos++;
     }
 
-    m_flags = 0;
+    return -1;
+}
 
-    if(sLen > 0 && *sIt == '^') {
-        m_flags |= kPF_Start;
-        sIt++;
-        sLen--;
+bool m::PatternProgram::closure(int s, List<int> &dst)
+{
+    m_stack.cleanup();
+    m_stack.add(s);
+
+    while(!m_stack.isEmpty()) {
+        int cur;
+        m_stack.pop(cur);
+
+        if(m_seen.contains(cur))
+            continue;
+
+        m_seen.insert(cur);
+        const ProgramState &st = m_states[cur];
+
+        if(st.kind == kPSK_Consume)
+            dst.add(cur);
+        else if(st.next.isEmpty()) {
+            if(!m_endAnchored)
+                return true; //Lower priority threads are cut
+
+            if(!m_seen.contains(m_count)) {
+                m_seen.insert(m_count);
+                dst.add(m_count);
+            }
+        } else {
+            for(int i = ~st.next - 1; i >= 0; i--)
+                m_stack.add(st.next[i]);
+        }
     }
 
-    if(sLen > 0 && sIt[sLen - 1] == '$') {
-        m_flags |= kPF_End;
-        sLen--;
+    return false;
+}
+
+int m::PatternProgram::dfaFind(const List<int> &threads, bool matched, bool accept, bool fresh, uint32_t hash) const
+{
+    for(int i = m_buckets[hash % M_PAT_DFA_BUCKETS]; i >= 0; i = m_dfa[i]->chain) {
+        const DFAState *st = m_dfa[i];
+
+        if(st->hash == hash && st->matched == matched && st->accept == accept && st->fresh == fresh && ~st->threads == ~threads &&
+           memcmp(st->threads.begin(), threads.begin(), ~threads * sizeof(int)) == 0)
+            return i;
     }
 
-    PatternNode *tail;
-    m_err = parsePat(sIt, sLen, m_root, tail);
-    if(m_err != kPPE_NoError)
-        return false;
+    return -1;
+}
 
-    //m_root->optimize();
-    if(tail->numChildren() > 0)
-        tail->addChild(new PatternNodeEnd);
+int m::PatternProgram::dfaAdd(const List<int> &threads, bool matched, bool accept, bool fresh)
+{
+    const uint32_t hash = hashThreads(threads, matched, accept, fresh);
+    int ret = dfaFind(threads, matched, accept, fresh, hash);
+    if(ret >= 0)
+        return ret;
 
-    return true;
+    DFAState *st = new DFAState(m_numClasses);
+    st->threads.addAll(threads);
+    st->matched = matched;
+    st->accept = accept;
+    st->fresh = fresh;
+    st->acceptAtEnd = m_endAnchored && threads.indexOf(m_count) >= 0;
+    st->hash = hash;
+    st->chain = m_buckets[hash % M_PAT_DFA_BUCKETS];
+
+    ret = ~m_dfa;
+    m_buckets[hash % M_PAT_DFA_BUCKETS] = ret;
+    m_dfa.add(st);
+    return ret;
 }
 
-const char *m::Pattern::parseErrorString() const
+int m::PatternProgram::dfaStartState()
+{
+    if(m_dfaStart < 0) {
+        m_scratch.cleanup();
+        m_seen.clear();
+
+        bool acc = closure(0, m_scratch);
+        m_dfaStart = dfaAdd(m_scratch, acc, acc, true);
+    }
+
+    return m_dfaStart;
+}
+
+int m::PatternProgram::dfaStep(int cur, uint8_t c)
 {
-    switch(m_err) {
-    case kPPE_NoError:             return "no error";
-    case kPPE_UnclosedParenthesis: return "found opening parenthesis, but the closing one is missing";
-    case kPPE_UnclosedBracket:     return "found opening bracket, but the closing one is missing";
-    case kPPE_InvalidRange:        return "found invalid range";
-    case kPPE_MisplacedEscape:     return "found misplaced character";
-    case kPPE_EmptyCapture:        return "found empty capture";
-    case kPPE_MisplacedCtrlChar:   return "found an unexpected control character";
-    case kPPE_EmptyPattern:        return "pattern is empty";
-    default:                       return "unknown error";
+    const DFAState *st = m_dfa[cur];
+    bool matched = st->matched;
+    bool accept = false;
+
+    m_scratch.cleanup();
+    m_seen.clear();
+
+    for(int t : st->threads) {
+        if(t == m_count || !m_states[t].accepts(c))
+            continue;
+
+        const List<int> &next = m_states[t].next;
+        if(next.isEmpty()) {
+            if(!m_endAnchored) {
+                accept = true;
+                break;
+            }
+
+            if(!m_seen.contains(m_count)) {
+                m_seen.insert(m_count);
+                m_scratch.add(m_count);
+            }
+
+            continue;
+        }
+
+        for(int n : next) {
+            if(closure(n, m_scratch)) {
+                accept = true;
+                break;
+            }
+        }
+
+        if(accept)
+            break;
     }
+
+    const bool fresh = m_scratch.isEmpty() && !accept;
+
+    if(accept)
+        matched = true;
+    else if(!matched && !m_anchored && closure(0, m_scratch))
+        accept = matched = true; //Start a new thread at the lowest priority
+
+    if(~m_dfa >= M_PAT_DFA_MAX_STATES) {
+        //Cache is full; start over. Still linear, just slower.
+        dfaFlush();
+
+        int ret = dfaAdd(m_scratch, matched, accept, fresh);
+        dfaStartState();
+        return ret;
+    }
+
+    int ret = dfaAdd(m_scratch, matched, accept, fresh);
+    m_dfa[cur]->trans[m_classes[c]] = ret;
+    return ret;
 }
 
-int m::Matcher::matches()
+void m::PatternProgram::dfaFlush()
 {
-    List<StackEntry> stack(4);
-    PatternNode *node = m_pat->m_root;
-    CStringIterator it = m_str.raw() + m_strPos;
-    int remLen = m_str.length() - m_strPos;
+    for(DFAState *st : m_dfa)
+        delete st;
+
+    m_dfa.clear();
+    m_dfaStart = -1;
+
+    for(int i = 0; i < M_PAT_DFA_BUCKETS; i++)
+        m_buckets[i] = -1;
+}
+
+int m::PatternProgram::dfaSearch(const char *str, int len, int from, bool earliest, int &idle)
+{
+    //Returns the end of the leftmost-first match, or -1. 'idle' is
+    //set to a position before which no match can start.
+    int cur = dfaStartState();
+    int end = -1;
+    int pos = from;
+    idle = from;
 
     while(true) {
-        if(node->matches(it, remLen)) {
-            //Check children
-            if(node->numChildren() <= 0)
-                break; //End of pattern, and it seems to match!
+        const DFAState *st = m_dfa[cur];
 
-            if(node->numChildren() > 1)
-                stack.add(StackEntry(node, it, remLen));
+        if(st->accept) {
+            end = pos;
+            if(earliest)
+                break;
+        }
 
-            node = node->child(0);
-        } else {
-            //Roll back
-            if(stack.isEmpty())
-                return -1; //No more arrows :(
+        if(pos >= len) {
+            if(st->acceptAtEnd)
+                end = len;
 
-            node = stack.last().node;
-            it = stack.last().it;
-            remLen = stack.last().remainingLen;
-            int cid = ++stack.last().childId; //At least one child to go, ALWAYS!
+            break;
+        }
+
+        if(st->threads.isEmpty() && (st->matched || m_anchored))
+            break;
 
-            if(cid + 1 >= node->numChildren())
-                stack.remove(~stack - 1); //It's the last child to check...
+        if(st->fresh && !st->matched && !m_anchored) {
+            //Nothing is running, skip to the next possible start
+            if(!m_prefix.isEmpty()) {
+                pos = nextCandidate(str, len, pos);
+                if(pos < 0)
+                    break;
+            }
 
-            node = node->child(cid);
+            idle = pos;
         }
+
+        const uint8_t c = static_cast<uint8_t>(str[pos]);
+        int next = st->trans[m_classes[c]];
+        if(next < 0)
+            next = dfaStep(cur, c);
+
+        cur = next;
+        pos++;
     }
 
-    return static_cast<int>(it - m_str.raw()) - m_strPos;
+    return end;
 }
 
-bool m::Matcher::next()
+bool m::PatternProgram::addThread(PikeList &lst, int s, int pos, int len, int *caps, int *out) const
 {
-    m_starts.cleanup();
-    m_ends.cleanup();
+    if(lst.set.contains(s))
+        return false;
 
-    int l;
+    lst.set.insert(s);
+    const ProgramState &st = m_states[s];
 
-    if(m_pat->m_flags & kPF_Start) {
-        if(m_strPos > 0)
-            return false;
+    if(st.kind == kPSK_Consume) {
+        lst.push(s, caps);
+        return false;
+    }
+
+    int old = 0;
+    if(st.kind == kPSK_Save) {
+        old = caps[st.slot];
+        caps[st.slot] = pos;
+    }
 
-        l = matches();
+    bool ret = false;
+    if(st.next.isEmpty()) {
+        if(!m_endAnchored || pos == len) {
+            memcpy(out, caps, m_slots * sizeof(int));
+            out[1] = pos;
+            ret = true;
+        }
     } else {
-        l = -1; //Just in case m_strPos >= m_str.length()
+        for(int n : st.next) {
+            if(addThread(lst, n, pos, len, caps, out)) {
+                ret = true;
+                break;
+            }
+        }
+    }
+
+    if(st.kind == kPSK_Save)
+        caps[st.slot] = old;
+
+    return ret;
+}
+
+bool m::PatternProgram::pike(const char *str, int len, int from, int stopAt, int *out) const
+{
+    PikeList l1(m_count, m_slots);
+    PikeList l2(m_count, m_slots);
+    PikeList *clist = &l1;
+    PikeList *nlist = &l2;
+    int *scratch = new int[m_slots];
+    bool matched = false;
+
+    for(int pos = from; ; pos++) {
+        if(!matched && (!m_anchored || pos == 0)) {
+            if(clist->count == 0 && !m_anchored && !m_prefix.isEmpty()) {
+                pos = nextCandidate(str, len, pos);
+                if(pos < 0)
+                    break;
+            }
+
+            for(int i = 0; i < m_slots; i++)
+                scratch[i] = -1;
+
+            scratch[0] = pos;
+            if(addThread(*clist, 0, pos, len, scratch, out))
+                matched = true;
+        }
+
+        if(clist->count == 0 || pos >= len || (matched && pos >= stopAt))
+            break;
+
+        const uint8_t c = static_cast<uint8_t>(str[pos]);
+        nlist->clear();
+
+        for(int i = 0; i < clist->count; i++) {
+            const ProgramState &st = m_states[clist->ids[i]];
+            if(!st.accepts(c))
+                continue;
+
+            const int *tcaps = clist->caps + i * m_slots;
+            if(st.next.isEmpty()) {
+                if(!m_endAnchored || pos + 1 == len) {
+                    memcpy(out, tcaps, m_slots * sizeof(int));
+                    out[1] = pos + 1;
+                    matched = true;
+                    break; //Lower priority threads are cut
+                }
+
+                continue;
+            }
+
+            memcpy(scratch, tcaps, m_slots * sizeof(int));
+            bool cut = false;
+
+            for(int n : st.next) {
+                if(addThread(*nlist, n, pos + 1, len, scratch, out)) {
+                    cut = true;
+                    break;
+                }
+            }
 
-        while(m_strPos < m_str.length()) {
-            l = matches(); //We could pre-check m_pat->m_root to avoid useless expensive calls
-            if(l >= 0)
+            if(cut) {
+                matched = true;
                 break;
+            }
+        }
+
+        PikeList *tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+    }
+
+    delete[] scratch;
+    return matched;
+}
+
+bool m::PatternProgram::test(const char *str, int len)
+{
+    if(m_dfaLock.tryLock()) {
+        int idle;
+        bool ret = dfaSearch(str, len, 0, true, idle) >= 0;
+
+        m_dfaLock.unlock();
+        return ret;
+    }
+
+    //Someone else is using the DFA, don't wait for it
+    int *caps = new int[m_slots];
+    bool ret = pike(str, len, 0, len, caps);
+
+    delete[] caps;
+    return ret;
+}
+
+bool m::PatternProgram::find(const char *str, int len, int from, List<int> &starts, List<int> &ends)
+{
+    if(from > len || (m_anchored && from > 0))
+        return false;
+
+    int begin = from;
+    int stopAt = len;
+
+    if(m_dfaLock.tryLock()) {
+        int idle;
+        int end = dfaSearch(str, len, from, false, idle);
+        m_dfaLock.unlock();
+
+        if(end < 0)
+            return false;
+
+        begin = idle;
+        stopAt = end;
+    }
+
+    int *caps = new int[m_slots];
+    bool ret = pike(str, len, begin, stopAt, caps);
+
+    if(ret) {
+        for(int i = 0; i < m_slots; i += 2) {
+            starts.add(caps[i]);
+            ends.add(caps[i + 1]);
+        }
+    }
+
+    delete[] caps;
+    return ret;
+}
+
+m::Pattern::~Pattern()
+{
+    delete m_prog;
+
+#ifdef M_PAT_TEST_MEMLEAK
+    mAssert(g_nodeCount == 0, "node memory leak detected!!");
+#endif
+}
+
+bool m::Pattern::compile(const char *sIt, int sLen)
+{
+    if(m_prog != nullptr) {
+        delete m_prog;
+        m_prog = nullptr;
+    }
+
+    PatternNode *root;
+    int groups;
 
-            m_strPos++;
+    m_err = parseRoot(sIt, sLen, root, m_flags, groups);
+    if(m_err != kPPE_NoError)
+        return false;
+
+    //The node graph is only used to build the program
+    m_prog = new PatternProgram(root, groups, m_flags);
+    destroyPat(root);
+    return true;
+}
+
+bool m::Pattern::test(const char *str, int len)
+{
+    mAssert(m_prog != nullptr, "can't match invalid pattern");
+    return m_prog->test(str, len);
+}
+
+m::PatternSetProgram::PatternSetProgram(List<PatternNode*> &roots, const List<uint32_t> &flags)
+{
+    m_numPatterns = ~roots;
+    m_states = flattenGraphs(roots.begin(), m_numPatterns, m_count, m_roots);
+    m_numClasses = computeClasses(m_states, m_count, m_classes);
+
+    for(int i = 0; i < m_numPatterns; i++) {
+        if((flags[i] & kPF_Start) == 0)
+            m_floatingRoots.add(m_roots[i]);
+
+        m_endAnchored.add((flags[i] & kPF_End) != 0);
+        m_found.add(false);
+    }
+
+    //One pseudo-thread per pattern, see accept()
+    m_seen.allocate(m_count + m_numPatterns);
+
+    for(int i = 0; i < M_PAT_DFA_BUCKETS; i++)
+        m_buckets[i] = -1;
+
+    m_dfaStart = -1;
+}
+
+m::PatternSetProgram::~PatternSetProgram()
+{
+    dfaFlush();
+    delete[] m_states;
+}
+
+void m::PatternSetProgram::accept(int owner, List<int> &dst, List<int> &accepts)
+{
+    const int pseudo = m_count + owner;
+    if(m_seen.contains(pseudo))
+        return;
+
+    m_seen.insert(pseudo);
+
+    if(m_endAnchored[owner])
+        dst.add(pseudo); //Only if the input ends here
+    else
+        accepts.add(owner);
+}
+
+void m::PatternSetProgram::closure(int s, List<int> &dst, List<int> &accepts)
+{
+    m_stack.cleanup();
+    m_stack.add(s);
+
+    while(!m_stack.isEmpty()) {
+        int cur;
+        m_stack.pop(cur);
+
+        if(m_seen.contains(cur))
+            continue;
+
+        m_seen.insert(cur);
+        const ProgramState &st = m_states[cur];
+
+        if(st.kind == kPSK_Consume)
+            dst.add(cur);
+        else if(st.next.isEmpty())
+            accept(st.owner, dst, accepts);
+        else {
+            for(int n : st.next)
+                m_stack.add(n);
+        }
+    }
+}
+
+int m::PatternSetProgram::dfaAdd(List<int> &threads, List<int> &accepts)
+{
+    //Order doesn't matter here, so make the key canonical
+    std::sort(threads.begin(), threads.begin() + ~threads);
+    std::sort(accepts.begin(), accepts.begin() + ~accepts);
+
+    uint32_t hash = hashThreads(threads, false, false, false);
+    for(int a : accepts)
+        hash = (hash ^ static_cast<uint32_t>(a)) * 16777619U;
+
+    for(int i = m_buckets[hash % M_PAT_DFA_BUCKETS]; i >= 0; i = m_dfa[i]->chain) {
+        const SetDFAState *st = m_dfa[i];
+
+        if(st->hash == hash && ~st->threads == ~threads && ~st->accepts == ~accepts &&
+           memcmp(st->threads.begin(), threads.begin(), ~threads * sizeof(int)) == 0 &&
+           memcmp(st->accepts.begin(), accepts.begin(), ~accepts * sizeof(int)) == 0)
+            return i;
+    }
+
+    SetDFAState *st = new SetDFAState(m_numClasses);
+    st->threads.addAll(threads);
+    st->accepts.addAll(accepts);
+    st->hash = hash;
+    st->chain = m_buckets[hash % M_PAT_DFA_BUCKETS];
+
+    int ret = ~m_dfa;
+    m_buckets[hash % M_PAT_DFA_BUCKETS] = ret;
+    m_dfa.add(st);
+    return ret;
+}
+
+int m::PatternSetProgram::dfaStartState()
+{
+    if(m_dfaStart < 0) {
+        m_scratch.cleanup();
+        m_accepts.cleanup();
+        m_seen.clear();
+
+        for(int r : m_roots)
+            closure(r, m_scratch, m_accepts);
+
+        m_dfaStart = dfaAdd(m_scratch, m_accepts);
+    }
+
+    return m_dfaStart;
+}
+
+int m::PatternSetProgram::dfaStep(int cur, uint8_t c)
+{
+    const SetDFAState *st = m_dfa[cur];
+
+    m_scratch.cleanup();
+    m_accepts.cleanup();
+    m_seen.clear();
+
+    for(int t : st->threads) {
+        if(t >= m_count || !m_states[t].accepts(c))
+            continue;
+
+        const ProgramState &ps = m_states[t];
+        if(ps.next.isEmpty())
+            accept(ps.owner, m_scratch, m_accepts);
+        else {
+            for(int n : ps.next)
+                closure(n, m_scratch, m_accepts);
+        }
+    }
+
+    for(int r : m_floatingRoots)
+        closure(r, m_scratch, m_accepts);
+
+    if(~m_dfa >= M_PAT_DFA_MAX_STATES) {
+        dfaFlush();
+
+        int ret = dfaAdd(m_scratch, m_accepts);
+        dfaStartState();
+        return ret;
+    }
+
+    int ret = dfaAdd(m_scratch, m_accepts);
+    m_dfa[cur]->trans[m_classes[c]] = ret;
+    return ret;
+}
+
+void m::PatternSetProgram::dfaFlush()
+{
+    for(SetDFAState *st : m_dfa)
+        delete st;
+
+    m_dfa.clear();
+    m_dfaStart = -1;
+
+    for(int i = 0; i < M_PAT_DFA_BUCKETS; i++)
+        m_buckets[i] = -1;
+}
+
+void m::PatternSetProgram::matches(const char *str, int len, List<int> &ids)
+{
+    m_lock.lock();
+
+    for(int i = 0; i < m_numPatterns; i++)
+        m_found[i] = false;
+
+    int numFound = 0;
+    int cur = dfaStartState();
+
+    for(int pos = 0; ; pos++) {
+        const SetDFAState *st = m_dfa[cur];
+
+        for(int a : st->accepts) {
+            if(!m_found[a]) {
+                m_found[a] = true;
+                numFound++;
+            }
+        }
+
+        if(pos >= len) {
+            for(int t : st->threads) {
+                if(t >= m_count && !m_found[t - m_count]) {
+                    m_found[t - m_count] = true;
+                    numFound++;
+                }
+            }
+
+            break;
         }
+
+        if(numFound >= m_numPatterns || (st->threads.isEmpty() && m_floatingRoots.isEmpty()))
+            break;
+
+        const uint8_t c = static_cast<uint8_t>(str[pos]);
+        int next = st->trans[m_classes[c]];
+        if(next < 0)
+            next = dfaStep(cur, c);
+
+        cur = next;
+    }
+
+    for(int i = 0; i < m_numPatterns; i++) {
+        if(m_found[i])
+            ids.add(i);
     }
 
-    if(l < 0)
+    m_lock.unlock();
+}
+
+m::PatternSet::~PatternSet()
+{
+    delete m_prog;
+}
+
+int m::PatternSet::add(const char *str, int len)
+{
+    PatternNode *root;
+    uint32_t flags;
+    int groups;
+
+    m_err = parseRoot(str, len, root, flags, groups);
+    if(m_err != kPPE_NoError)
+        return -1;
+
+    destroyPat(root);
+    delete m_prog;
+    m_prog = nullptr;
+
+    m_sources.add(String(str, len));
+    return ~m_sources - 1;
+}
+
+void m::PatternSet::clear()
+{
+    delete m_prog;
+    m_prog = nullptr;
+    m_sources.clear();
+    m_err = kPPE_NoError;
+}
+
+bool m::PatternSet::matches(const char *str, int len, List<int> &ids) const
+{
+    if(m_sources.isEmpty())
         return false;
 
-    if((m_pat->m_flags & kPF_End) != 0 && m_strPos + l < m_str.length())
+    m_lock.lock();
+    if(m_prog == nullptr) {
+        List<PatternNode*> roots(~m_sources);
+        List<uint32_t> flags(~m_sources);
+
+        for(const String &src : m_sources) {
+            PatternNode *root;
+            uint32_t f;
+            int groups;
+
+            parseRoot(src.raw(), src.length(), root, f, groups); //Already checked by add()
+            roots.add(root);
+            flags.add(f);
+        }
+
+        m_prog = new PatternSetProgram(roots, flags);
+
+        for(PatternNode *root : roots)
+            destroyPat(root);
+    }
+
+    PatternSetProgram *prog = m_prog;
+    m_lock.unlock();
+
+    const int before = ~ids;
+    prog->matches(str, len, ids);
+    return ~ids > before;
+}
+
+const char *m::PatternSet::parseErrorString() const
+{
+    return errorString(m_err);
+}
+
+const char *m::Pattern::parseErrorString() const
+{
+    return errorString(m_err);
+}
+
+bool m::Matcher::next()
+{
+    m_starts.cleanup();
+    m_ends.cleanup();
+
+    if(!m_pat->m_prog->find(m_str.raw(), m_str.length(), m_strPos, m_starts, m_ends))
         return false;
 
-    m_starts.add(m_strPos);
-    m_strPos += l;
-    m_ends.add(m_strPos);
-    //TODO: Add other captures
+    //Don't find the same empty match again
+    m_strPos = (m_ends[0] == m_starts[0]) ? m_ends[0] + 1 : m_ends[0];
     return true;
 }
 
@@ -18,6 +18,7 @@
  */
 
 #include "mgpcl/Process.h"
+#include "mgpcl/Thread.h"
 
 #ifdef MGPCL_WIN
 #include "mgpcl/WinCmdLine.h"
@@ -30,6 +31,26 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "mgpcl/Time.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434 //Same number on every architecture
+#endif
+
+//How often children are checked with waitpid() if pidfd_open() isn't supported
+#define M_PROCESS_GROUP_TICK 50
+
+//posix_spawn_file_actions_addchdir_np() appeared in glibc 2.29
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define M_SPAWN_HAS_CHDIR
+#endif
+
+extern char **environ;
 #endif
 
 /************************************************************** ProcessInfo ***********************************************************************/
@@ -431,6 +452,7 @@ m::Process::Process()
 {
     m_pid = 0;
     m_redirSTD = false;
+    m_spawnMethod = kPSM_Spawn;
     m_handles = new ProcessPipes;
 
 #ifdef MGPCL_WIN
@@ -578,11 +600,21 @@ m::Process &m::Process::start()
         env[envl.size()] = nullptr;
     }
 
-    pid_t pid = fork();
+    //posix_spawn() can't change the user nor the group
+    bool useSpawn = (m_spawnMethod == kPSM_Spawn && !m_setUID && !m_setGID);
+#ifndef M_SPAWN_HAS_CHDIR
+    useSpawn = useSpawn && wdir == nullptr;
+#endif
+
+    pid_t pid = useSpawn ? spawnChild(wdir, args, env, nullFd) : fork();
     if(pid < 0) { //Failed
         if(nullFd >= 0)
             close(nullFd);
 
+        if(env != nullptr)
+            delete[] env;
+
+        delete[] args;
         return *this;
     }
 
@@ -646,6 +678,47 @@ m::Process &m::Process::start()
     return *this;
 }
 
+#ifndef MGPCL_WIN
+/* glibc implements posix_spawn() with clone(CLONE_VM | CLONE_VFORK), so the
+ * page tables aren't copied, which makes a big difference for large
+ * processes. It also reports exec() failures, unlike fork().
+ */
+pid_t m::Process::spawnChild(const char *wdir, const char **args, const char **env, int nullFd)
+{
+    posix_spawn_file_actions_t actions;
+    if(posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+
+    if(m_redirSTD) {
+        posix_spawn_file_actions_adddup2(&actions, (*m_handles)[kPPI_StdIn].m_fds[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, (*m_handles)[kPPI_StdOut].m_fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, (*m_handles)[kPPI_StdErr].m_fds[1], STDERR_FILENO);
+
+        for(int i = 0; i < kPPI_Count; i++) {
+            posix_spawn_file_actions_addclose(&actions, (*m_handles)[static_cast<ProcessPipeID>(i)].m_fds[0]);
+            posix_spawn_file_actions_addclose(&actions, (*m_handles)[static_cast<ProcessPipeID>(i)].m_fds[1]);
+        }
+    } else {
+        posix_spawn_file_actions_adddup2(&actions, nullFd, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, nullFd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, nullFd, STDERR_FILENO);
+        posix_spawn_file_actions_addclose(&actions, nullFd);
+    }
+
+#ifdef M_SPAWN_HAS_CHDIR
+    if(wdir != nullptr)
+        posix_spawn_file_actions_addchdir_np(&actions, wdir);
+#endif
+
+    pid_t pid;
+    char * const *envp = (env == nullptr) ? environ : const_cast<char * const *>(env);
+    int err = posix_spawnp(&pid, args[0], &actions, nullptr, const_cast<char * const *>(args), envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    return err == 0 ? pid : -1;
+}
+#endif
+
 m::Process &m::Process::waitFor()
 {
 #ifdef MGPCL_WIN
@@ -697,6 +770,18 @@ int m::Process::exitCode()
 #endif
 }
 
+bool m::Process::kill()
+{
+#ifdef MGPCL_WIN
+    return m_process != INVALID_HANDLE_VALUE && TerminateProcess(m_process, 1) != FALSE;
+#else
+    if(!m_started || m_finished)
+        return false;
+
+    return ::kill(static_cast<pid_t>(m_pid), SIGKILL) == 0;
+#endif
+}
+
 bool m::Process::isRunning() const
 {
 #ifdef MGPCL_WIN
@@ -847,3 +932,328 @@ uint32_t m::Process::getCurrentProcessID()
     return static_cast<uint32_t>(getpid());
 #endif
 }
+
+/************************************************************** ProcessPool ***********************************************************************/
+
+m::ProcessPool::ProcessPool(Setup setup, int warm) : m_setup(setup), m_warm(warm)
+{
+    m_spawning = 0;
+    m_refilling = false;
+    m_hits = 0;
+    m_misses = 0;
+}
+
+m::ProcessPool::~ProcessPool()
+{
+    m_lock.lock();
+    while(m_refilling)
+        m_cond.wait(m_lock);
+
+    m_lock.unlock();
+
+    for(Process *p : m_ready) {
+        p->kill();
+        p->waitFor();
+        delete p;
+    }
+}
+
+m::Process *m::ProcessPool::spawn()
+{
+    Process *ret = new Process;
+    m_setup(*ret);
+    ret->start();
+
+    if(!ret->hasStarted()) {
+        delete ret;
+        return nullptr;
+    }
+
+    return ret;
+}
+
+int m::ProcessPool::fill()
+{
+    int ret = 0;
+
+    while(true) {
+        m_lock.lock();
+        if(~m_ready + m_spawning >= m_warm) {
+            m_lock.unlock();
+            break;
+        }
+
+        m_spawning++;
+        m_lock.unlock();
+
+        Process *p = spawn();
+        m_lock.lock();
+        m_spawning--;
+
+        if(p != nullptr)
+            m_ready.add(p);
+
+        m_lock.unlock();
+        if(p == nullptr)
+            break; //Don't insist
+
+        ret++;
+    }
+
+    return ret;
+}
+
+m::Process *m::ProcessPool::take()
+{
+    Process *ret = nullptr;
+    bool refill = false;
+
+    m_lock.lock();
+    if(m_ready.isEmpty())
+        m_misses++;
+    else {
+        m_ready.pop(ret);
+        m_hits++;
+    }
+
+    if(!m_refilling) {
+        m_refilling = true;
+        refill = true;
+    }
+
+    m_lock.unlock();
+
+    if(refill) {
+        auto job = [this] () {
+            fill();
+
+            m_lock.lock();
+            m_refilling = false;
+            m_cond.signalAll();
+            m_lock.unlock();
+        };
+
+        if(!execAsync(job))
+            job();
+    }
+
+    return ret == nullptr ? spawn() : ret;
+}
+
+int m::ProcessPool::readyCount()
+{
+    m_lock.lock();
+    int ret = ~m_ready;
+    m_lock.unlock();
+
+    return ret;
+}
+
+/************************************************************** ProcessGroup ***********************************************************************/
+
+#ifdef MGPCL_LINUX
+
+m::ProcessGroup::ProcessGroup()
+{
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+}
+
+m::ProcessGroup::~ProcessGroup()
+{
+    for(Entry *e : m_entries) {
+        for(int i = kPPI_StdOut; i <= kPPI_Count; i++)
+            unwatch(e, i);
+
+        delete e;
+    }
+
+    if(m_epoll >= 0)
+        close(m_epoll);
+}
+
+bool m::ProcessGroup::add(Process &p, uint32_t timeoutMs)
+{
+    if(m_epoll < 0 || !p.hasStarted() || p.m_finished)
+        return false;
+
+    Entry *e = new Entry;
+    e->proc = &p;
+    e->deadline = (timeoutMs == 0) ? 0.0 : time::getTimeMs() + static_cast<double>(timeoutMs);
+    e->exited = false;
+    e->timedOut = false;
+
+    for(int i = 0; i <= kPPI_Count; i++) {
+        e->fds[i] = -1;
+        e->sources[i].entry = e;
+        e->sources[i].kind = i;
+    }
+
+    if(p.m_redirSTD) {
+        e->fds[kPPI_StdOut] = (*p.m_handles)[kPPI_StdOut].m_fds[0];
+        e->fds[kPPI_StdErr] = (*p.m_handles)[kPPI_StdErr].m_fds[0];
+    }
+
+    for(int i = kPPI_StdOut; i < kPPI_Count; i++)
+        e->pipeFlags[i] = (e->fds[i] < 0) ? 0 : fcntl(e->fds[i], F_GETFL);
+
+    //Without pidfd, poll() falls back to waitpid(WNOHANG) every M_PROCESS_GROUP_TICK ms
+    e->fds[kPPI_Count] = static_cast<int>(syscall(SYS_pidfd_open, static_cast<pid_t>(p.m_pid), 0));
+
+    for(int i = kPPI_StdOut; i <= kPPI_Count; i++) {
+        if(e->fds[i] < 0)
+            continue;
+
+        if(i != kPPI_Count)
+            fcntl(e->fds[i], F_SETFL, e->pipeFlags[i] | O_NONBLOCK);
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = e->sources + i;
+
+        if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, e->fds[i], &ev) != 0) {
+            //Also restores the flags of this pipe and closes the pidfd
+            for(int j = kPPI_StdOut; j <= kPPI_Count; j++)
+                unwatch(e, j);
+
+            delete e;
+            return false;
+        }
+    }
+
+    m_entries.add(e);
+    return true;
+}
+
+void m::ProcessGroup::unwatch(Entry *e, int kind)
+{
+    if(e->fds[kind] < 0)
+        return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, e->fds[kind], nullptr);
+
+    //Pipes belong to the Process, but the pidfd is ours
+    if(kind == kPPI_Count)
+        close(e->fds[kind]);
+    else
+        fcntl(e->fds[kind], F_SETFL, e->pipeFlags[kind]);
+
+    e->fds[kind] = -1;
+}
+
+void m::ProcessGroup::reap(Entry *e)
+{
+    int status;
+    pid_t ret = waitpid(static_cast<pid_t>(e->proc->m_pid), &status, WNOHANG);
+
+    if(ret == 0 || (ret < 0 && errno == EINTR))
+        return;
+
+    //ECHILD: someone else reaped it, or SIGCHLD is ignored. Either way it's gone
+    //and the pidfd would stay readable forever, so it must be unwatched too.
+    e->proc->m_finished = true;
+    e->proc->m_retCode = (ret > 0 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1; //-1 if killed or unknown
+    e->exited = true;
+    unwatch(e, kPPI_Count);
+}
+
+void m::ProcessGroup::handle(Source *src)
+{
+    Entry *e = src->entry;
+    if(e->fds[src->kind] < 0)
+        return; //Closed by an earlier event of the same batch
+
+    if(src->kind == kPPI_Count) {
+        reap(e);
+        return;
+    }
+
+    uint8_t buf[4096];
+    while(true) {
+        ssize_t rd = read(e->fds[src->kind], buf, sizeof(buf));
+
+        if(rd > 0) {
+            if(m_onOutput)
+                m_onOutput(*e->proc, static_cast<ProcessPipeID>(src->kind), buf, static_cast<int>(rd));
+        } else if(rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else if(rd < 0 && errno == EINTR)
+            continue;
+        else {
+            //EOF or error
+            unwatch(e, src->kind);
+            break;
+        }
+    }
+}
+
+bool m::ProcessGroup::poll(uint32_t ms)
+{
+    if(m_entries.isEmpty())
+        return false;
+
+    //Wake up for the nearest deadline, or to check children without pidfd
+    double now = time::getTimeMs();
+    double wakeUp = now + static_cast<double>(ms);
+
+    for(Entry *e : m_entries) {
+        if(e->exited)
+            continue;
+
+        if(e->deadline > 0.0 && !e->timedOut && e->deadline < wakeUp)
+            wakeUp = e->deadline;
+
+        if(e->fds[kPPI_Count] < 0 && now + M_PROCESS_GROUP_TICK < wakeUp)
+            wakeUp = now + M_PROCESS_GROUP_TICK;
+    }
+
+    int timeout = (wakeUp > now) ? static_cast<int>(wakeUp - now + 0.999) : 0;
+    epoll_event events[32];
+    int cnt = epoll_wait(m_epoll, events, 32, timeout);
+
+    for(int i = 0; i < cnt; i++)
+        handle(static_cast<Source*>(events[i].data.ptr));
+
+    now = time::getTimeMs();
+    for(int i = 0; i < ~m_entries; i++) {
+        Entry *e = m_entries[i];
+
+        if(!e->exited) {
+            if(e->fds[kPPI_Count] < 0)
+                reap(e);
+
+            if(!e->exited && e->deadline > 0.0 && !e->timedOut && now >= e->deadline) {
+                e->timedOut = true;
+                e->proc->kill();
+            }
+        }
+
+        if(e->exited && e->timedOut) {
+            //A grandchild may still hold the pipes; waiting for their EOF would defeat the timeout
+            for(int k = kPPI_StdOut; k < kPPI_Count; k++) {
+                if(e->fds[k] >= 0) {
+                    handle(e->sources + k); //Whatever is already there
+                    unwatch(e, k);
+                }
+            }
+        }
+
+        if(e->exited && e->fds[kPPI_StdOut] < 0 && e->fds[kPPI_StdErr] < 0) {
+            m_entries.remove(i--);
+
+            if(m_onExit)
+                m_onExit(*e->proc, e->proc->m_retCode, e->timedOut);
+
+            delete e;
+        }
+    }
+
+    return !m_entries.isEmpty();
+}
+
+void m::ProcessGroup::run()
+{
+    while(poll(1000)) {
+    }
+}
+
+#endif
@@ -215,6 +215,62 @@ bool m::SSLContext::usePrivateKeyFile(const String &file)
     return SSL_CTX_use_PrivateKey_file(m_ctx, file.raw(), SSL_FILETYPE_PEM) > 0;
 }
 
+bool m::SSLContext::enableSessionCache(bool enabled, long maxSize, long timeoutSec)
+{
+    if(m_refs == nullptr)
+        return false;
+
+    if(!enabled) {
+        SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_OFF);
+        return true;
+    }
+
+    //Sessions are only resumed in the context they were created in
+    static const unsigned char sidCtx[] = "mgpcl";
+
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(m_ctx, maxSize);
+    SSL_CTX_set_timeout(m_ctx, timeoutSec);
+    return SSL_CTX_set_session_id_context(m_ctx, sidCtx, sizeof(sidCtx) - 1) == 1;
+}
+
+bool m::SSLContext::enableSessionTickets(bool enabled)
+{
+    if(m_refs == nullptr)
+        return false;
+
+    if(enabled)
+        SSL_CTX_clear_options(m_ctx, SSL_OP_NO_TICKET);
+    else
+        SSL_CTX_set_options(m_ctx, SSL_OP_NO_TICKET);
+
+    return true;
+}
+
+m::SSLSessionStats m::SSLContext::sessionStats() const
+{
+    SSLSessionStats ret;
+    SSL_CTX *ctx = static_cast<SSL_CTX*>(m_ctx_);
+
+    if(m_refs == nullptr) {
+        ret.accepts = 0;
+        ret.hits = 0;
+        ret.misses = 0;
+        ret.timeouts = 0;
+        ret.cacheFull = 0;
+        ret.cacheSize = 0;
+    } else {
+        ret.accepts = SSL_CTX_sess_accept_good(ctx);
+        ret.hits = SSL_CTX_sess_hits(ctx);
+        ret.misses = SSL_CTX_sess_misses(ctx);
+        ret.timeouts = SSL_CTX_sess_timeouts(ctx);
+        ret.cacheFull = SSL_CTX_sess_cache_full(ctx);
+        ret.cacheSize = SSL_CTX_sess_number(ctx);
+    }
+
+    return ret;
+}
+
 #ifdef MGPCL_WIN
 #include <Wincrypt.h>
 #include <iostream>
@@ -25,18 +25,114 @@
 #include <openssl/err.h>
 
 #define m_ssl (*reinterpret_cast<SSL**>(&m_ssl_))
+#define m_sess (*reinterpret_cast<SSL_SESSION**>(&m_sess_))
+
+m::SSLSession::SSLSession(const SSLSession &src)
+{
+    m_sess_ = src.m_sess_;
+
+    if(m_sess != nullptr)
+        SSL_SESSION_up_ref(m_sess);
+}
+
+m::SSLSession::SSLSession(SSLSession &&src)
+{
+    m_sess_ = src.m_sess_;
+    src.m_sess_ = nullptr;
+}
+
+m::SSLSession::~SSLSession()
+{
+    if(m_sess != nullptr)
+        SSL_SESSION_free(m_sess);
+}
+
+m::SSLSession &m::SSLSession::operator = (const SSLSession &src)
+{
+    if(m_sess_ == src.m_sess_)
+        return *this;
+
+    if(m_sess != nullptr)
+        SSL_SESSION_free(m_sess);
+
+    m_sess_ = src.m_sess_;
+    if(m_sess != nullptr)
+        SSL_SESSION_up_ref(m_sess);
+
+    return *this;
+}
+
+m::SSLSession &m::SSLSession::operator = (SSLSession &&src)
+{
+    if(m_sess != nullptr)
+        SSL_SESSION_free(m_sess);
+
+    m_sess_ = src.m_sess_;
+    src.m_sess_ = nullptr;
+    return *this;
+}
+
+bool m::SSLSession::isResumable() const
+{
+    return m_sess_ != nullptr && SSL_SESSION_is_resumable(static_cast<const SSL_SESSION*>(m_sess_)) != 0;
+}
+
+m::String m::SSLSessionCache::hostKey(const String &host, uint16_t port)
+{
+    String ret(host.lower());
+    ret += ':';
+    ret.appendUInteger(port);
+
+    return ret;
+}
+
+m::SSLSession m::SSLSessionCache::get(const String &key)
+{
+    SSLSession ret;
+    m_lock.lock();
+
+    if(m_sessions.hasKey(key))
+        ret = m_sessions[key];
+
+    m_lock.unlock();
+    return ret;
+}
+
+void m::SSLSessionCache::put(const String &key, const SSLSession &sess)
+{
+    m_lock.lock();
+    m_sessions[key] = sess;
+    m_lock.unlock();
+}
+
+void m::SSLSessionCache::remove(const String &key)
+{
+    m_lock.lock();
+    m_sessions.removeKey(key);
+    m_lock.unlock();
+}
+
+void m::SSLSessionCache::clear()
+{
+    m_lock.lock();
+    m_sessions.clear();
+    m_lock.unlock();
+}
 
 m::SSLSocket::SSLSocket()
 {
     m_lastSSLErr = 0;
     m_lastWantedOp = kSWO_None;
     m_ssl = nullptr;
+    m_sessCache = nullptr;
 }
 
-m::SSLSocket::SSLSocket(SSLSocket &&src) : TCPSocket(src), m_ctx(std::move(src.m_ctx))
+m::SSLSocket::SSLSocket(SSLSocket &&src) : TCPSocket(src), m_ctx(std::move(src.m_ctx)), m_sessKey(std::move(src.m_sessKey)), m_serverName(std::move(src.m_serverName))
 {
     m_lastSSLErr = src.m_lastSSLErr;
     m_lastWantedOp = src.m_lastWantedOp;
+    m_sessCache = src.m_sessCache;
+    src.m_sessCache = nullptr;
 
     m_ssl_ = src.m_ssl_;
     src.m_ssl_ = nullptr;
@@ -248,6 +344,8 @@ template<class T> int m::SSLSocket::sslRW(const T &data)
 m::SSLSocket::~SSLSocket()
 {
     if(m_ssl != nullptr) {
+        saveSession();
+
         SSLRWShutdown crap;
         sslRW<SSLRWShutdown>(crap);
         SSL_free(m_ssl);
@@ -299,6 +397,17 @@ m::SocketConnectionError m::SSLSocket::connect(const IPv4Address &addr)
     if(SSL_set_fd(m_ssl, static_cast<int>(m_sock)) == 0)
         return kSCE_UnknownError;
 
+    if(m_sessCache != nullptr) {
+        if(m_sessKey.isEmpty() && !m_serverName.isEmpty())
+            m_sessKey = SSLSessionCache::hostKey(m_serverName, addr.port());
+
+        if(!m_sessKey.isEmpty()) {
+            SSLSession sess(m_sessCache->get(m_sessKey));
+            if(sess.isResumable())
+                setSession(sess);
+        }
+    }
+
     //SSL handshake
     return resumeConnectHandshake();
 }
@@ -331,15 +440,67 @@ m::SSLSocket &m::SSLSocket::operator = (SSLSocket &&src)
     m_lastErr = src.m_lastErr;
     m_lastSSLErr = src.m_lastSSLErr;
     m_ssl_ = src.m_ssl_;
+    m_sessCache = src.m_sessCache;
+    m_sessKey = std::move(src.m_sessKey);
+    m_serverName = std::move(src.m_serverName);
     m_connTimeout = src.m_connTimeout;
     m_readTimeout = src.m_readTimeout;
     m_writeTimeout = src.m_writeTimeout;
 
     src.m_sock = INVALID_SOCKET;
     src.m_ssl_ = nullptr;
+    src.m_sessCache = nullptr;
     return *this;
 }
 
+bool m::SSLSocket::setSession(const SSLSession &sess)
+{
+    if(m_ssl == nullptr || !sess.isValid())
+        return false;
+
+    return SSL_set_session(m_ssl, static_cast<SSL_SESSION*>(sess.raw())) == 1;
+}
+
+m::SSLSession m::SSLSocket::session() const
+{
+    SSLSession ret;
+    if(m_ssl_ != nullptr)
+        ret.m_sess_ = SSL_get1_session(static_cast<SSL*>(m_ssl_));
+
+    return ret;
+}
+
+bool m::SSLSocket::isSessionReused() const
+{
+    return m_ssl_ != nullptr && SSL_session_reused(static_cast<SSL*>(m_ssl_)) != 0;
+}
+
+bool m::SSLSocket::setServerName(const String &host)
+{
+    if(m_ssl == nullptr)
+        return false;
+
+    m_serverName = host;
+    return SSL_set_tlsext_host_name(m_ssl, const_cast<char*>(host.raw())) == 1;
+}
+
+void m::SSLSocket::setSessionCache(SSLSessionCache *cache, const String &key)
+{
+    m_sessCache = cache;
+    m_sessKey = key;
+}
+
+void m::SSLSocket::saveSession()
+{
+    if(m_sessCache == nullptr || m_sessKey.isEmpty() || m_ssl == nullptr || SSL_is_init_finished(m_ssl) == 0)
+        return;
+
+    //With TLS 1.3, tickets come after the handshake, so this is also done before closing
+    SSLSession sess(session());
+    if(sess.isResumable())
+        m_sessCache->put(m_sessKey, sess);
+}
+
 void m::SSLSocket::close()
 {
     close(true);
@@ -349,6 +510,8 @@ bool m::SSLSocket::close(bool sslShutdown)
 {
     bool ret = true;
     if(m_ssl != nullptr) {
+        saveSession();
+
         if(sslShutdown) {
             SSLRWShutdown crap;
             ret = sslRW<SSLRWShutdown>(crap) > 0;
@@ -367,6 +530,7 @@ bool m::SSLSocket::shutdown()
     if(m_ssl == nullptr)
         return true;
 
+    saveSession();
     SSLRWShutdown crap;
     if(sslRW<SSLRWShutdown>(crap) <= 0)
         return false;
@@ -390,6 +554,17 @@ m::SocketConnectionError m::SSLSocket::resumeConnectHandshake()
     if(sslRW<SSLRWConnect>(crap) <= 0)
         return m_lastErr == inet::kSE_NoError ? kSCE_SSLHandshakeTimeout : (m_lastErr == inet::kSE_SSLError ? kSCE_SSLError : kSCE_SocketError);
 
+    if(m_sessCache != nullptr && !m_sessKey.isEmpty()) {
+        m_sessCache->m_lock.lock();
+        if(isSessionReused())
+            m_sessCache->m_hits++;
+        else
+            m_sessCache->m_misses++;
+
+        m_sessCache->m_lock.unlock();
+        saveSession();
+    }
+
     return kSCE_NoError;
 }
 
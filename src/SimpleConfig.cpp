@@ -19,7 +19,16 @@
 
 #include "mgpcl/SimpleConfig.h"
 #include "mgpcl/FileIOStream.h"
-#include "mgpcl/LineReader.h"
+#include "mgpcl/MappedFile.h"
+#include "mgpcl/Util.h"
+
+#ifndef MGPCL_WIN
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
 
 bool m::SimpleConfig::EmptyLine::writeTo(LineOutputStream *los)
 {
@@ -36,22 +45,25 @@ bool m::SimpleConfig::AssignLine::writeTo(LineOutputStream *los)
     return los->write(prefix) && los->write(key) && los->write(inBetween) && los->write(value) && los->writeLine(suffix);
 }
 
-bool m::SimpleConfig::Property::asBool(bool def) const
+bool m::SimpleConfig::Property::parseBool(const String &val)
 {
-    if(m_line->value.isEmpty())
-        return def;
-
-    if(m_line->value.equalsIgnoreCase("false"_m) || m_line->value.equalsIgnoreCase("off"_m))
+    if(val.equalsIgnoreCase("false"_m) || val.equalsIgnoreCase("off"_m))
         return false;
 
-    for(int i = 0; i < m_line->value.length(); i++) {
-        if(m_line->value[i] != '0')
+    for(int i = 0; i < val.length(); i++) {
+        if(val[i] != '0')
             return true;
     }
 
     return false;
 }
 
+void m::SimpleConfig::Property::changed()
+{
+    m_cached = 0;
+    m_parent->m_dirty = true;
+}
+
 m::SimpleConfig::Category &m::SimpleConfig::operator[] (const String &cat)
 {
     if(m_data.hasKey(cat))
@@ -64,6 +76,7 @@ m::SimpleConfig::Category &m::SimpleConfig::operator[] (const String &cat)
 
     ret.m_parent = this;
     ret.m_line = line;
+    ret.m_dirty = true;
     return ret;
 }
 
@@ -82,6 +95,7 @@ m::SimpleConfig::Property &m::SimpleConfig::Category::operator[] (const String &
 
     ret.m_parent = this;
     ret.m_line = line;
+    m_dirty = true;
     return ret;
 }
 
@@ -89,22 +103,96 @@ m::SimpleConfig::Category::Category() : m_data(16)
 {
     m_parent = nullptr;
     m_line = nullptr;
+    m_size = 0;
+    m_checksum = 0;
+    m_gen = 0;
+    m_dirty = true;
 }
 
-m::SimpleConfig::SimpleConfig() : m_data(16)
+m::SimpleConfig::Category::Category(const Category &src) : m_parent(src.m_parent), m_line(src.m_line), m_data(src.m_data),
+                                                           m_size(src.m_size), m_checksum(src.m_checksum), m_gen(src.m_gen), m_dirty(src.m_dirty)
+{
+    adoptProperties();
+}
+
+m::SimpleConfig::Category::Category(Category &&src) : m_parent(src.m_parent), m_line(src.m_line), m_data(std::move(src.m_data)),
+                                                      m_size(src.m_size), m_checksum(src.m_checksum), m_gen(src.m_gen), m_dirty(src.m_dirty)
+{
+    adoptProperties();
+}
+
+m::SimpleConfig::Category &m::SimpleConfig::Category::operator = (const Category &src)
+{
+    m_parent = src.m_parent;
+    m_line = src.m_line;
+    m_data = src.m_data;
+    m_size = src.m_size;
+    m_checksum = src.m_checksum;
+    m_gen = src.m_gen;
+    m_dirty = src.m_dirty;
+
+    adoptProperties();
+    return *this;
+}
+
+m::SimpleConfig::Category &m::SimpleConfig::Category::operator = (Category &&src)
+{
+    m_parent = src.m_parent;
+    m_line = src.m_line;
+    m_data = std::move(src.m_data);
+    m_size = src.m_size;
+    m_checksum = src.m_checksum;
+    m_gen = src.m_gen;
+    m_dirty = src.m_dirty;
+
+    adoptProperties();
+    return *this;
+}
+
+void m::SimpleConfig::Category::adoptProperties()
+{
+    for(HashMap<String, Property>::Pair &p : m_data)
+        p.value.m_parent = this;
+}
+
+m::SimpleConfig::SimpleConfig() : m_data(16), m_watchThread("SimpleConfig"_m)
 {
     m_errLine = -1;
     m_lastErr = kCLE_None;
+    m_gen = 0;
+    m_watching = false;
+
+#ifdef MGPCL_WIN
+    m_watchChange = INVALID_HANDLE_VALUE;
+    m_watchStop = nullptr;
+#else
+    m_watchFd = -1;
+    m_watchPipe[0] = -1;
+    m_watchPipe[1] = -1;
+#endif
 }
 
-m::SimpleConfig::SimpleConfig(const String &fname) : m_fname(fname), m_data(16)
+m::SimpleConfig::SimpleConfig(const String &fname) : m_fname(fname), m_data(16), m_watchThread("SimpleConfig"_m)
 {
     m_errLine = -1;
     m_lastErr = kCLE_None;
+    m_gen = 0;
+    m_watching = false;
+
+#ifdef MGPCL_WIN
+    m_watchChange = INVALID_HANDLE_VALUE;
+    m_watchStop = nullptr;
+#else
+    m_watchFd = -1;
+    m_watchPipe[0] = -1;
+    m_watchPipe[1] = -1;
+#endif
 }
 
 m::SimpleConfig::~SimpleConfig()
 {
+    unwatch();
+
     for(Line *line : m_lines)
         delete line;
 }
@@ -137,40 +225,198 @@ m::ConfigLoadError m::SimpleConfig::load()
         return kCLE_MissingFileName;
     }
 
-    SSharedPtr<FileInputStream> fis(new FileInputStream);
-    if(fis->open(m_fname) != FileInputStream::kOE_Success) {
+    //Forget everything, so that every category gets parsed again
+    for(Line *line : m_lines)
+        delete line;
+
+    m_lines.cleanup();
+    m_data.clear();
+    return reload();
+}
+
+static const char *g_m_scfg_nextLine(const char *ptr, const char *end)
+{
+    const char *eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+    return eol == nullptr ? end : eol + 1;
+}
+
+static bool g_m_scfg_isCategoryLine(const char *ptr, const char *end)
+{
+    while(ptr < end && (*ptr == ' ' || *ptr == '\t'))
+        ptr++;
+
+    return ptr < end && *ptr == '[';
+}
+
+m::ConfigLoadError m::SimpleConfig::reload()
+{
+    if(m_fname.isEmpty()) {
+        m_lastErr = kCLE_MissingFileName;
+        return kCLE_MissingFileName;
+    }
+
+    MappedFile mf;
+    if(mf.open(m_fname, kMH_Sequential) != MappedFile::kOE_Success) {
         m_lastErr = kCLE_FileNotFound;
         return kCLE_FileNotFound;
     }
 
-    for(Line *line : m_lines)
-        delete line;
+    //Find where the lines of each category currently are
+    class Section
+    {
+    public:
+        Section()
+        {
+            first = 0;
+            count = 0;
+            kept = false;
+        }
+
+        int first;
+        int count;
+        bool kept;
+    };
+
+    HashMap<String, Section> sections(m_data.size() > 16 ? m_data.size() : 16);
+    Section *cur = nullptr;
+
+    for(int i = 0; i < m_lines.size(); i++) {
+        if(m_lines[i]->isCategory()) {
+            cur = &sections[static_cast<CategoryLine*>(m_lines[i])->category];
+            cur->first = i;
+            cur->count = 0;
+        }
 
-    int err;
+        if(cur != nullptr)
+            cur->count++;
+    }
+
+    //Now go through the file, one section at a time. A section starts
+    //with a category line (except for the first one) and ends right before
+    //the next category line.
+    List<Line*> lines;
+    lines.reserve(m_lines.size());
+
+    ConfigLoadError err = kCLE_None;
+    const char *ptr = mf.chars();
+    const char *end = ptr + mf.size();
     int cline = 0;
     String ccat;
-    LineReader lr(fis.staticCast<InputStream>());
-    m_lines.cleanup();
+    String line;
+
+    m_gen++;
+
+    while(ptr < end && err == kCLE_None) {
+        const char *secBeg = ptr;
+        int secLines = 0;
+
+        do {
+            ptr = g_m_scfg_nextLine(ptr, end);
+            secLines++;
+        } while(ptr < end && !g_m_scfg_isCategoryLine(ptr, end));
+
+        const uint32_t secSize = static_cast<uint32_t>(ptr - secBeg);
+        const uint32_t secSum = crc32(reinterpret_cast<const uint8_t*>(secBeg), secSize);
+
+        //Extract the category name
+        String name;
+        if(g_m_scfg_isCategoryLine(secBeg, ptr)) {
+            const char *nb = static_cast<const char*>(memchr(secBeg, '[', ptr - secBeg)) + 1;
+            const char *ne = nb;
+
+            while(ne < ptr && *ne != ']' && *ne != '\n')
+                ne++;
+
+            name.append(nb, static_cast<int>(ne - nb));
+        }
+
+        if(!name.isEmpty() && m_data.hasKey(name)) {
+            Category &cat = m_data[name];
+
+            if(!cat.m_dirty && cat.m_gen != m_gen && cat.m_size == secSize && cat.m_checksum == secSum && sections.hasKey(name)) {
+                //Unchanged, just move its lines
+                Section &sec = sections[name];
+                lines.addAll(m_lines.begin() + sec.first, sec.count);
+                sec.kept = true;
+
+                cat.m_gen = m_gen;
+                ccat = name;
+                cline += secLines;
+                continue;
+            }
+
+            if(cat.m_gen == m_gen)
+                cat.m_dirty = true; //Defined twice, can't be skipped
+            else
+                cat.m_data.clear(); //Will be parsed again
+        }
+
+        const char *lptr = secBeg;
+        while(lptr < ptr) {
+            const char *next = g_m_scfg_nextLine(lptr, ptr);
+            const char *eol = next;
+
+            if(eol > lptr && eol[-1] == '\n')
+                eol--;
+
+            if(M_OS_LINEENDING == LineEnding::CRLF && eol > lptr && eol[-1] == '\r')
+                eol--;
+
+            line.cleanup();
+            line.append(lptr, static_cast<int>(eol - lptr));
+            cline++;
+
+            if(!parseLine(line, ccat, lines)) {
+                err = kCLE_FormattingError;
+                m_errLine = cline;
+                break;
+            }
+
+            lptr = next;
+        }
 
-    while((err = lr.next()) > 0) {
-        cline++;
+        if(!name.isEmpty() && m_data.hasKey(name)) {
+            Category &cat = m_data[name];
+            if(cat.m_gen != m_gen)
+                cat.m_dirty = false;
 
-        if(!parseLine(lr.line(), ccat)) {
-            m_lastErr = kCLE_FormattingError;
-            m_errLine = cline;
-            fis->close();
-            return kCLE_FormattingError;
+            cat.m_size = secSize;
+            cat.m_checksum = secSum;
+            cat.m_gen = m_gen;
         }
     }
 
-    fis->close();
-    m_lastErr = (err == 0) ? kCLE_None : kCLE_ReadError;
-    return m_lastErr;
+    //Delete the lines that weren't moved
+    cur = nullptr;
+    for(Line *l : m_lines) {
+        if(l->isCategory())
+            cur = &sections[static_cast<CategoryLine*>(l)->category];
+
+        if(cur == nullptr || !cur->kept)
+            delete l;
+    }
+
+    m_lines = std::move(lines);
+
+    //Remove categories that aren't in the file anymore
+    List<String> removed;
+    for(HashMap<String, Category>::Pair &p : m_data) {
+        if(p.value.m_gen == m_gen)
+            p.value.m_parent = this;
+        else
+            removed.add(p.key);
+    }
+
+    for(const String &key : removed)
+        m_data.removeKey(key);
+
+    m_lastErr = err;
+    return err;
 }
 
 #define M_SCFG_VALID_CHAR(chr) (((chr) >= 'A' && (chr) <= 'Z') || ((chr) >= 'a' && (chr) <= 'z') || ((chr) >= '0' && (chr) <= '9') || (chr) == '_' || (chr) == '-')
 
-bool m::SimpleConfig::parseLine(const String &line, String &ccat)
+bool m::SimpleConfig::parseLine(const String &line, String &ccat, List<Line*> &dst)
 {
     int pos = 0;
     while(pos < line.length() && (line[pos] == ' ' || line[pos] == '\t'))
@@ -180,7 +426,7 @@ bool m::SimpleConfig::parseLine(const String &line, String &ccat)
         //Just an empty line or a comment line
         EmptyLine *el = new EmptyLine;
         el->content = line;
-        m_lines.add(el);
+        dst.add(el);
         return true;
     }
 
@@ -206,7 +452,7 @@ bool m::SimpleConfig::parseLine(const String &line, String &ccat)
         cl->prefix = line.substr(0, pos);
         cl->category = line.substr(pos + 1, end);
         cl->suffix = line.substr(end + 1);
-        m_lines.add(cl);
+        dst.add(cl);
 
         //Add category & set as current
         Category &cat = m_data[cl->category];
@@ -267,13 +513,14 @@ bool m::SimpleConfig::parseLine(const String &line, String &ccat)
                 al->suffix = line.substr(valEnd);
         }
 
-        m_lines.add(al);
+        dst.add(al);
 
         //Add property
         Category &cat = m_data[ccat];
         Property &prop = cat.m_data[al->key];
         prop.m_parent = &cat;
         prop.m_line = al;
+        prop.m_cached = 0;
         return true;
     }
 
@@ -312,3 +559,207 @@ m::String m::SimpleConfig::errorString() const
 
     return ret;
 }
+
+static void g_m_scfg_splitPath(const m::String &path, m::String &dir, m::String &name)
+{
+#ifdef MGPCL_WIN
+    int slash = path.lastIndexOf('\\');
+    int slash2 = path.lastIndexOf('/');
+
+    if(slash2 > slash)
+        slash = slash2;
+#else
+    int slash = path.lastIndexOf('/');
+#endif
+
+    if(slash < 0) {
+        dir = "."_m;
+        name = path;
+    } else {
+        dir = slash == 0 ? path.substr(0, 1) : path.substr(0, slash);
+        name = path.substr(slash + 1);
+    }
+}
+
+bool m::SimpleConfig::watch(std::function<void()> func)
+{
+    if(m_watching || m_fname.isEmpty())
+        return false;
+
+    String dir;
+    g_m_scfg_splitPath(m_fname, dir, m_watchName);
+
+#ifdef MGPCL_WIN
+    //Windows can only tell us that something in the directory changed,
+    //so we'll compare the modification time of the file.
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if(GetFileAttributesEx(m_fname.raw(), GetFileExInfoStandard, &data) != FALSE)
+        m_watchTime = data.ftLastWriteTime;
+    else {
+        m_watchTime.dwLowDateTime = 0;
+        m_watchTime.dwHighDateTime = 0;
+    }
+
+    m_watchChange = FindFirstChangeNotification(dir.raw(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if(m_watchChange == INVALID_HANDLE_VALUE)
+        return false;
+
+    m_watchStop = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if(m_watchStop == nullptr) {
+        FindCloseChangeNotification(m_watchChange);
+        m_watchChange = INVALID_HANDLE_VALUE;
+        return false;
+    }
+#else
+    //Watch the directory, as most editors replace the file instead of writing into it
+    m_watchFd = inotify_init1(IN_CLOEXEC);
+    if(m_watchFd < 0)
+        return false;
+
+    if(inotify_add_watch(m_watchFd, dir.raw(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(m_watchFd);
+        m_watchFd = -1;
+        return false;
+    }
+
+    //Used to wake the thread up in unwatch()
+    if(pipe(m_watchPipe) != 0) {
+        close(m_watchFd);
+        m_watchFd = -1;
+        m_watchPipe[0] = -1;
+        m_watchPipe[1] = -1;
+        return false;
+    }
+
+    fcntl(m_watchPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(m_watchPipe[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    m_watchFunc = func;
+    m_watching = true;
+    m_watchThread.setFunc(this, &SimpleConfig::watchThread);
+
+    if(!m_watchThread.start()) {
+        m_watching = false;
+        unwatch();
+        return false;
+    }
+
+    return true;
+}
+
+void m::SimpleConfig::unwatch()
+{
+    if(m_watching && Thread::currentThreadID() == m_watchThread.threadID()) {
+        //Called from the callback: the thread can't join itself. It stops
+        //as soon as the callback returns, without using the handles again.
+        m_watching = false;
+        m_watchThread.detach();
+    }
+
+#ifdef MGPCL_WIN
+    if(m_watching) {
+        m_watching = false;
+        SetEvent(m_watchStop);
+        m_watchThread.join();
+    }
+
+    if(m_watchStop != nullptr) {
+        FindCloseChangeNotification(m_watchChange);
+        CloseHandle(m_watchStop);
+
+        m_watchChange = INVALID_HANDLE_VALUE;
+        m_watchStop = nullptr;
+    }
+#else
+    if(m_watching) {
+        m_watching = false;
+
+        char c = 0;
+        ssize_t ret;
+
+        do {
+            ret = write(m_watchPipe[1], &c, 1);
+        } while(ret < 0 && errno == EINTR);
+
+        if(ret != 1) {
+            //Closing the write end also wakes poll() up (POLLHUP)
+            close(m_watchPipe[1]);
+            m_watchPipe[1] = -1;
+        }
+
+        //The thread must be gone before its fds are closed
+        m_watchThread.join();
+    }
+
+    if(m_watchFd >= 0) {
+        close(m_watchFd);
+        m_watchFd = -1;
+    }
+
+    for(int i = 0; i < 2; i++) {
+        if(m_watchPipe[i] >= 0) {
+            close(m_watchPipe[i]);
+            m_watchPipe[i] = -1;
+        }
+    }
+#endif
+}
+
+void m::SimpleConfig::watchThread()
+{
+#ifdef MGPCL_WIN
+    HANDLE handles[2] = { m_watchStop, m_watchChange };
+
+    while(WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+
+        if(GetFileAttributesEx(m_fname.raw(), GetFileExInfoStandard, &data) != FALSE && CompareFileTime(&data.ftLastWriteTime, &m_watchTime) != 0) {
+            m_watchTime = data.ftLastWriteTime;
+            m_watchFunc();
+        }
+
+        if(!m_watching || FindNextChangeNotification(m_watchChange) == FALSE)
+            break;
+    }
+#else
+    //Enough for a few events
+    alignas(struct inotify_event) char buf[4096];
+    pollfd fds[2];
+
+    fds[0].fd = m_watchPipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = m_watchFd;
+    fds[1].events = POLLIN;
+
+    while(m_watching) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if(fds[0].revents != 0)
+            break;
+
+        if((fds[1].revents & POLLIN) == 0)
+            continue;
+
+        ssize_t len = read(m_watchFd, buf, sizeof(buf));
+        if(len <= 0)
+            break;
+
+        bool changed = false;
+        for(char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + reinterpret_cast<struct inotify_event*>(ptr)->len) {
+            struct inotify_event *ev = reinterpret_cast<struct inotify_event*>(ptr);
+
+            if(ev->len > 0 && m_watchName == ev->name)
+                changed = true;
+        }
+
+        if(changed)
+            m_watchFunc();
+    }
+#endif
+}
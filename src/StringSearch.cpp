@@ -0,0 +1,240 @@
+/* Copyright (C) 2020 BARBOTIN Nicolas
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+ * OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mgpcl/StringSearch.h"
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define M_STR_SSE2
+#include <emmintrin.h>
+
+#ifdef MGPCL_WIN
+#include <intrin.h>
+#elif defined(__GNUC__)
+#define M_STR_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define M_STR_MAX_SIMD_CHARS 16
+
+#ifdef M_STR_SSE2
+static inline int g_m_str_ctz(uint32_t mask)
+{
+#ifdef MGPCL_WIN
+    unsigned long ret;
+    _BitScanForward(&ret, mask);
+    return static_cast<int>(ret);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+#ifdef M_STR_AVX2
+static bool g_m_str_hasAVX2()
+{
+    static const bool ret = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return ret;
+}
+#endif
+
+static int g_m_str_findScalar(const char *hay, int hayLen, const char *needle, int needleLen, int from)
+{
+    const int last = hayLen - needleLen;
+
+    while(from <= last) {
+        const char *p = static_cast<const char*>(memchr(hay + from, needle[0], last - from + 1));
+        if(p == nullptr)
+            return -1;
+
+        if(memcmp(p + 1, needle + 1, needleLen - 1) == 0)
+            return static_cast<int>(p - hay);
+
+        from = static_cast<int>(p - hay) + 1;
+    }
+
+    return -1;
+}
+
+static int g_m_str_findAnyOfScalar(const char *hay, int hayLen, const char *chars, int numChars, int from)
+{
+    bool table[256];
+    memset(table, 0, sizeof(table));
+
+    for(int i = 0; i < numChars; i++)
+        table[static_cast<uint8_t>(chars[i])] = true;
+
+    for(int i = from; i < hayLen; i++) {
+        if(table[static_cast<uint8_t>(hay[i])])
+            return i;
+    }
+
+    return -1;
+}
+
+#ifdef M_STR_SSE2
+//Compare the first and the last byte of the needle 16 positions at once,
+//and only then check the middle.
+static int g_m_str_findSSE2(const char *hay, int hayLen, const char *needle, int needleLen)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLen - 1]);
+    int i = 0;
+
+    for(; i + needleLen - 1 + 16 <= hayLen; i += 16) {
+        __m128i bFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+        __m128i bLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + needleLen - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, bFirst), _mm_cmpeq_epi8(last, bLast))));
+
+        while(mask != 0) {
+            int bit = g_m_str_ctz(mask);
+            if(memcmp(hay + i + bit + 1, needle + 1, needleLen - 2) == 0)
+                return i + bit;
+
+            mask &= mask - 1;
+        }
+    }
+
+    return g_m_str_findScalar(hay, hayLen, needle, needleLen, i);
+}
+
+static int g_m_str_findAnyOfSSE2(const char *hay, int hayLen, const char *chars, int numChars)
+{
+    __m128i set[M_STR_MAX_SIMD_CHARS];
+    for(int i = 0; i < numChars; i++)
+        set[i] = _mm_set1_epi8(chars[i]);
+
+    int i = 0;
+    for(; i + 16 <= hayLen; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+        __m128i acc = _mm_cmpeq_epi8(block, set[0]);
+
+        for(int j = 1; j < numChars; j++)
+            acc = _mm_or_si128(acc, _mm_cmpeq_epi8(block, set[j]));
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(acc));
+        if(mask != 0)
+            return i + g_m_str_ctz(mask);
+    }
+
+    return g_m_str_findAnyOfScalar(hay, hayLen, chars, numChars, i);
+}
+#endif
+
+#ifdef M_STR_AVX2
+__attribute__((target("avx2"))) static int g_m_str_findAVX2(const char *hay, int hayLen, const char *needle, int needleLen)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needleLen - 1]);
+    int i = 0;
+
+    for(; i + needleLen - 1 + 32 <= hayLen; i += 32) {
+        __m256i bFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        __m256i bLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + needleLen - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, bFirst), _mm256_cmpeq_epi8(last, bLast))));
+
+        while(mask != 0) {
+            int bit = g_m_str_ctz(mask);
+            if(memcmp(hay + i + bit + 1, needle + 1, needleLen - 2) == 0)
+                return i + bit;
+
+            mask &= mask - 1;
+        }
+    }
+
+    return g_m_str_findScalar(hay, hayLen, needle, needleLen, i);
+}
+
+__attribute__((target("avx2"))) static int g_m_str_findAnyOfAVX2(const char *hay, int hayLen, const char *chars, int numChars)
+{
+    __m256i set[M_STR_MAX_SIMD_CHARS];
+    for(int i = 0; i < numChars; i++)
+        set[i] = _mm256_set1_epi8(chars[i]);
+
+    int i = 0;
+    for(; i + 32 <= hayLen; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        __m256i acc = _mm256_cmpeq_epi8(block, set[0]);
+
+        for(int j = 1; j < numChars; j++)
+            acc = _mm256_or_si256(acc, _mm256_cmpeq_epi8(block, set[j]));
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(acc));
+        if(mask != 0)
+            return i + g_m_str_ctz(mask);
+    }
+
+    return g_m_str_findAnyOfScalar(hay, hayLen, chars, numChars, i);
+}
+#endif
+
+int m::str::findChar(const char *hay, int hayLen, char chr)
+{
+    //memchr() is already vectorized by the libc
+    if(hayLen <= 0)
+        return -1;
+
+    const char *p = static_cast<const char*>(memchr(hay, chr, hayLen));
+    return (p == nullptr) ? -1 : static_cast<int>(p - hay);
+}
+
+int m::str::find(const char *hay, int hayLen, const char *needle, int needleLen)
+{
+    if(needleLen <= 0 || needleLen > hayLen)
+        return -1;
+
+    if(needleLen == 1)
+        return findChar(hay, hayLen, needle[0]);
+
+#ifdef M_STR_AVX2
+    if(g_m_str_hasAVX2())
+        return g_m_str_findAVX2(hay, hayLen, needle, needleLen);
+#endif
+
+#ifdef M_STR_SSE2
+    return g_m_str_findSSE2(hay, hayLen, needle, needleLen);
+#else
+    return g_m_str_findScalar(hay, hayLen, needle, needleLen, 0);
+#endif
+}
+
+int m::str::findAnyOf(const char *hay, int hayLen, const char *chars, int numChars)
+{
+    if(numChars <= 0 || hayLen <= 0)
+        return -1;
+
+    if(numChars == 1)
+        return findChar(hay, hayLen, chars[0]);
+
+    if(numChars > M_STR_MAX_SIMD_CHARS)
+        return g_m_str_findAnyOfScalar(hay, hayLen, chars, numChars, 0);
+
+#ifdef M_STR_AVX2
+    if(g_m_str_hasAVX2())
+        return g_m_str_findAnyOfAVX2(hay, hayLen, chars, numChars);
+#endif
+
+#ifdef M_STR_SSE2
+    return g_m_str_findAnyOfSSE2(hay, hayLen, chars, numChars);
+#else
+    return g_m_str_findAnyOfScalar(hay, hayLen, chars, numChars, 0);
+#endif
+}
@@ -18,6 +18,7 @@
  */
 
 #include "mgpcl/TCPClient.h"
+#include "mgpcl/Time.h"
 
 #define M_TCPCLIENT_BUFSZ 8192
 
@@ -148,6 +149,7 @@ void m::TCPClient::threadFunc()
                     //Connection closed
                     m_running.set(0);
                     m_sock.close();
+                    wakeSentWaiters();
                     return;
                 } else
                     err = inet::socketError();
@@ -163,11 +165,15 @@ void m::TCPClient::threadFunc()
                     if(m_sPos >= m_sPkt.size()) { //Everything was sent, we can destroy the packet
                         m_sPkt.destroy();
                         m_sPos = 0;
+
+                        if(m_pending.decrement() <= 0)
+                            wakeSentWaiters();
                     }
                 } else if(ret == 0) {
                     //Connection closed
                     m_running.set(0);
                     m_sock.close();
+                    wakeSentWaiters();
                     return;
                 } else
                     err = inet::socketError();
@@ -182,6 +188,7 @@ void m::TCPClient::threadFunc()
                 m_running.set(0);
                 m_lastError = err;
                 m_sock.close();
+                wakeSentWaiters();
                 return;
             }
         } else
@@ -189,11 +196,41 @@ void m::TCPClient::threadFunc()
     }
 }
 
+void m::TCPClient::wakeSentWaiters()
+{
+    //Taking the lock ensures waitUntilSent() can't miss the signal between its check and its wait
+    m_sLock.lock();
+    m_sentCond.signalAll();
+    m_sLock.unlock();
+}
+
+bool m::TCPClient::waitUntilSent(int timeoutMs)
+{
+    double start = time::getTimeMs();
+    bool ret = true;
+
+    m_sLock.lock();
+    while(m_pending.get() > 0) {
+        double left = static_cast<double>(timeoutMs) - (time::getTimeMs() - start);
+
+        if(m_running.get() == 0 || left <= 0.0) {
+            ret = false;
+            break;
+        }
+
+        m_sentCond.waitFor(m_sLock, static_cast<uint32_t>(left) + 1);
+    }
+
+    m_sLock.unlock();
+    return ret;
+}
+
 void m::TCPClient::stop()
 {
     if(m_running.get()) {
         m_running.set(0);
         m_thread.join();
         m_sock.close();
+        wakeSentWaiters();
     }
 }
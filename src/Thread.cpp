@@ -21,6 +21,7 @@
 #include "mgpcl/Thread.h"
 #include "mgpcl/ReadWriteLock.h"
 #include "mgpcl/HashMap.h"
+#include "mgpcl/Executor.h"
 
 #if defined(MGPCL_WIN) && defined(_DEBUG)
 //From https://msdn.microsoft.com/en-us/library/xcb2z8hs.aspx
@@ -184,6 +185,24 @@ bool m::Thread::join()
 #endif
 }
 
+bool m::Thread::detach()
+{
+#ifdef MGPCL_WIN
+    if(m_handle == nullptr)
+        return false;
+
+    CloseHandle(m_handle);
+    m_handle = nullptr;
+    return true;
+#else
+    if(!m_isValid)
+        return false;
+
+    m_isValid = false;
+    return pthread_detach(m_thread) == 0;
+#endif
+}
+
 bool m::Thread::setAffinityMask(uint64_t mask)
 {
 #ifdef MGPCL_WIN
@@ -481,7 +500,7 @@ static DWORD WINAPI g_stdFuncThreadProc(LPVOID func)
     return 0;
 }
 
-bool m::execAsync(std::function<void()> func)
+static bool g_m_spawnThread(std::function<void()> func)
 {
     auto ptrFunc = new std::function<void()>(func);
     HANDLE handle = CreateThread(nullptr, 0, g_stdFuncThreadProc, ptrFunc, 0, nullptr);
@@ -497,7 +516,7 @@ bool m::execAsync(std::function<void()> func)
 
 #else
 
-void *g_stdFuncThreadProc(void *func)
+static void *g_stdFuncThreadProc(void *func)
 {
     auto realFunc = static_cast<std::function<void()>*>(func);
     std::function<void()> funcCpy(*realFunc);
@@ -506,7 +525,7 @@ void *g_stdFuncThreadProc(void *func)
     return 0;
 }
 
-bool m::execAsync(std::function<void()> func)
+static bool g_m_spawnThread(std::function<void()> func)
 {
     auto ptrFunc = new std::function<void()>(func);
     pthread_attr_t attrs;
@@ -523,3 +542,14 @@ bool m::execAsync(std::function<void()> func)
 }
 
 #endif
+
+bool m::execAsync(std::function<void()> func)
+{
+    Executor &ex = globalExecutor();
+    if(ex.tryExecute(func))
+        return true;
+
+    //The global executor couldn't start or is full. func must not run on the
+    //caller (which may hold a lock func needs), so it gets its own thread.
+    return g_m_spawnThread(func);
+}
@@ -0,0 +1,355 @@
+#define M_BENCHAPI_SRC
+#include "BenchAPI.h"
+#include <mgpcl/HashMap.h>
+#include <mgpcl/JSON.h>
+#include <mgpcl/FileIOStream.h>
+#include <mgpcl/ConsoleUtils.h>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+#define M_BENCH_MAX_ITERATIONS (uint64_t(1) << 40)
+
+class BenchData
+{
+public:
+    BenchData()
+    {
+        name = nullptr;
+        func = nullptr;
+    }
+
+    BenchData(const char *n, benchAPI::BenchFunc f)
+    {
+        name = n;
+        func = f;
+    }
+
+    const char *name;
+    benchAPI::BenchFunc func;
+};
+
+class BenchResult
+{
+public:
+    BenchResult()
+    {
+        iterations = 0;
+        itemsPerIteration = 1;
+    }
+
+    m::String name;
+    uint64_t iterations;
+    uint64_t itemsPerIteration;
+    benchAPI::Stats stats;
+};
+
+typedef m::List<BenchData> BenchList;
+
+static uint8_t *_g_benchList[sizeof(BenchList)];
+#define g_benchList reinterpret_cast<BenchList*>(_g_benchList)
+
+M_DEFINE_NIFTY_COUNTER(BenchAPI)
+M_NIFTY_COUNTER_CTOR(BenchAPI)
+{
+    new(g_benchList) BenchList;
+}
+
+M_NIFTY_COUNTER_DTOR(BenchAPI)
+{
+    g_benchList->~BenchList();
+}
+
+void benchAPI::addBench(const char *name, BenchFunc fc)
+{
+    g_benchList->add(BenchData(name, fc));
+}
+
+void benchAPI::useCharPointer(const volatile char *ptr)
+{
+    //Out-of-line on purpose; see doNotOptimize()
+    static_cast<void>(ptr);
+}
+
+//Sorted list only
+static double g_m_median(const m::List<double> &values)
+{
+    int n = values.size();
+    if(n <= 0)
+        return 0.0;
+
+    if(n & 1)
+        return values[n / 2];
+
+    return (values[n / 2 - 1] + values[n / 2]) * 0.5;
+}
+
+void benchAPI::computeStats(m::List<double> &values, Stats &dst)
+{
+    if(values.isEmpty()) {
+        dst = Stats();
+        return;
+    }
+
+    values.insertionSort();
+
+    double sum = 0.0;
+    for(double v : values)
+        sum += v;
+
+    dst.min = values.first();
+    dst.max = values.last();
+    dst.mean = sum / static_cast<double>(values.size());
+    dst.median = g_m_median(values);
+
+    //Nearest-rank percentile
+    int p99 = static_cast<int>(std::ceil(0.99 * static_cast<double>(values.size()))) - 1;
+    dst.p99 = values[p99 < 0 ? 0 : p99];
+
+    m::List<double> dev(values.size());
+    for(double v : values)
+        dev.add(std::fabs(v - dst.median));
+
+    dev.insertionSort();
+    dst.mad = g_m_median(dev);
+}
+
+//Returns the elapsed time in milliseconds, or a negative value
+//if the benchmark didn't run its loop until the end.
+static double g_m_runBatch(benchAPI::BenchFunc fc, uint64_t n, uint64_t &items)
+{
+    benchAPI::State st(n);
+    fc(st);
+
+    if(!st.finished())
+        return -1.0;
+
+    items = st.itemsPerIteration();
+    return st.elapsedMs();
+}
+
+static bool g_m_runBench(const BenchData &bd, const benchAPI::BenchOptions &opts, BenchResult &res)
+{
+    uint64_t n = 1;
+    uint64_t items = 1;
+    double ms;
+
+    //Scale the iteration count until a batch lasts long enough
+    for(;;) {
+        ms = g_m_runBatch(bd.func, n, items);
+        if(ms < 0.0)
+            return false;
+
+        if(ms >= opts.minSampleMs || n >= M_BENCH_MAX_ITERATIONS)
+            break;
+
+        double factor = ms <= 0.0 ? 10.0 : opts.minSampleMs * 1.2 / ms;
+        if(factor < 2.0)
+            factor = 2.0;
+        else if(factor > 10.0)
+            factor = 10.0;
+
+        n = static_cast<uint64_t>(std::ceil(static_cast<double>(n) * factor));
+    }
+
+    //Warmup
+    double warmup = ms;
+    while(warmup < opts.warmupMs) {
+        ms = g_m_runBatch(bd.func, n, items);
+        if(ms < 0.0)
+            return false;
+
+        warmup += ms;
+    }
+
+    m::List<double> samples(opts.samples);
+    for(int i = 0; i < opts.samples; i++) {
+        ms = g_m_runBatch(bd.func, n, items);
+        if(ms < 0.0)
+            return false;
+
+        samples.add(ms * 1000000.0 / static_cast<double>(n));
+    }
+
+    res.name = m::String(bd.name);
+    res.iterations = n;
+    res.itemsPerIteration = items;
+    benchAPI::computeStats(samples, res.stats);
+    return true;
+}
+
+static void g_m_printResult(const BenchResult &res, const benchAPI::BenchOptions &opts)
+{
+    std::ios::fmtflags flags(std::cout.flags());
+    std::streamsize prec = std::cout.precision();
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "[i]\t" << res.name.raw() << ": " << res.stats.median << " ns/op (p99 " << res.stats.p99 << ", MAD " << res.stats.mad << ", ";
+    std::cout << opts.samples << " x " << res.iterations << " iters)";
+
+    if(res.itemsPerIteration > 1 && res.stats.median > 0.0)
+        std::cout << ", " << static_cast<double>(res.itemsPerIteration) * 1000.0 / res.stats.median << " M items/s";
+
+    std::cout << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(prec);
+}
+
+static bool g_m_writeJSON(const m::List<BenchResult> &results, const benchAPI::BenchOptions &opts)
+{
+    m::JSONElement arr(m::kJT_Array);
+
+    for(const BenchResult &res : results) {
+        m::JSONElement obj(m::kJT_Object);
+        obj["name"_m] = res.name;
+        obj["iterations"_m] = static_cast<double>(res.iterations);
+        obj["items_per_iteration"_m] = static_cast<double>(res.itemsPerIteration);
+        obj["median_ns"_m] = res.stats.median;
+        obj["p99_ns"_m] = res.stats.p99;
+        obj["mad_ns"_m] = res.stats.mad;
+        obj["min_ns"_m] = res.stats.min;
+        obj["max_ns"_m] = res.stats.max;
+        obj["mean_ns"_m] = res.stats.mean;
+        arr.addElement(std::move(obj));
+    }
+
+    m::JSONElement root(m::kJT_Object);
+    root["samples"_m] = opts.samples;
+    root["min_sample_ms"_m] = opts.minSampleMs;
+    root["benchmarks"_m] = std::move(arr);
+
+    m::FileOutputStream *fos = new m::FileOutputStream;
+    if(!fos->open(opts.jsonOut, m::FileOutputStream::kOM_Truncate)) {
+        delete fos;
+        std::cout << "[!]\tCould not open " << opts.jsonOut.raw() << " for writing" << std::endl;
+        return false;
+    }
+
+    m::SSharedPtr<m::OutputStream> out(fos);
+    if(!m::json::serializeHumanReadable(out, root)) {
+        std::cout << "[!]\tCould not write " << opts.jsonOut.raw() << std::endl;
+        return false;
+    }
+
+    out->close();
+    std::cout << "[i] Results written to " << opts.jsonOut.raw() << std::endl;
+    return true;
+}
+
+static bool g_m_compareBaseline(const m::List<BenchResult> &results, const benchAPI::BenchOptions &opts)
+{
+    m::FileInputStream *fis = new m::FileInputStream;
+    if(fis->open(opts.baseline) != m::FileInputStream::kOE_Success) {
+        delete fis;
+        std::cout << "[!]\tCould not open baseline " << opts.baseline.raw() << std::endl;
+        return false;
+    }
+
+    m::SSharedPtr<m::InputStream> in(fis);
+    m::JSONElement root;
+    m::String err;
+
+    if(!m::json::parse(in, root, err)) {
+        std::cout << "[!]\tCould not parse baseline: " << err.raw() << std::endl;
+        return false;
+    }
+
+    if(!root.isObject() || !root.has("benchmarks", m::kJT_Array)) {
+        std::cout << "[!]\tBaseline has no benchmark list" << std::endl;
+        return false;
+    }
+
+    m::HashMap<m::String, int> byName;
+    m::JSONElement &arr = root["benchmarks"_m];
+
+    for(int i = 0; i < arr.size(); i++) {
+        m::JSONElement &e = arr[i];
+        if(e.isObject() && e.has("name", m::kJT_String) && e.has("median_ns", m::kJT_Number) && e.has("mad_ns", m::kJT_Number))
+            byName[e["name"_m].asString()] = i;
+    }
+
+    int regressions = 0;
+    std::ios::fmtflags flags(std::cout.flags());
+    std::streamsize prec = std::cout.precision();
+
+    m::console::setTextColor(m::kCC_Cyan);
+    std::cout << "[i] Comparing against " << opts.baseline.raw() << "..." << std::endl;
+    m::console::resetColor();
+    std::cout << std::fixed << std::setprecision(1);
+
+    for(const BenchResult &res : results) {
+        if(!byName.hasKey(res.name)) {
+            std::cout << "[i]\t" << res.name.raw() << ": not in baseline" << std::endl;
+            continue;
+        }
+
+        m::JSONElement &e = arr[byName[res.name]];
+        double base = e["median_ns"_m].asDouble();
+        double baseMad = e["mad_ns"_m].asDouble();
+        double diff = res.stats.median - base;
+        double delta = base > 0.0 ? diff / base : 0.0;
+
+        //A change only counts if it's bigger than the threshold AND the noise
+        double noise = 3.0 * (res.stats.mad > baseMad ? res.stats.mad : baseMad);
+        bool significant = std::fabs(diff) > noise && std::fabs(delta) > opts.threshold;
+
+        if(significant && diff > 0.0) {
+            m::console::setTextColor(m::kCC_Red);
+            std::cout << "[!]\t" << res.name.raw() << ": REGRESSION " << base << " -> " << res.stats.median << " ns/op (+" << delta * 100.0 << "%)" << std::endl;
+            regressions++;
+        } else if(significant) {
+            m::console::setTextColor(m::kCC_Green);
+            std::cout << "[i]\t" << res.name.raw() << ": improved " << base << " -> " << res.stats.median << " ns/op (" << delta * 100.0 << "%)" << std::endl;
+        } else
+            std::cout << "[i]\t" << res.name.raw() << ": unchanged " << base << " -> " << res.stats.median << " ns/op (" << (delta >= 0.0 ? "+" : "") << delta * 100.0 << "%)" << std::endl;
+
+        m::console::resetColor();
+    }
+
+    std::cout.flags(flags);
+    std::cout.precision(prec);
+
+    if(regressions > 0) {
+        m::console::setTextColor(m::kCC_Red);
+        std::cout << "[!] " << regressions << " benchmark(s) regressed by more than " << opts.threshold * 100.0 << '%' << std::endl;
+        m::console::resetColor();
+        return false;
+    }
+
+    return true;
+}
+
+bool benchAPI::runAll(const BenchOptions &opts)
+{
+    m::List<BenchResult> results;
+    bool ok = true;
+
+    for(const BenchData &bd : *g_benchList) {
+        if(!opts.filter.isEmpty() && m::String(bd.name).indexOf(opts.filter.raw(), 0, opts.filter.length()) < 0)
+            continue;
+
+        BenchResult res;
+        if(g_m_runBench(bd, opts, res)) {
+            g_m_printResult(res, opts);
+            results.add(res);
+        } else {
+            m::console::setTextColor(m::kCC_Red);
+            std::cout << "[!]\tBenchmark " << bd.name << " returned before keepRunning() returned false" << std::endl;
+            m::console::resetColor();
+            ok = false;
+        }
+    }
+
+    if(results.isEmpty()) {
+        std::cout << "[?] Note: no benchmark matched \"" << opts.filter.raw() << "\"" << std::endl;
+        return ok;
+    }
+
+    if(!opts.jsonOut.isEmpty() && !g_m_writeJSON(results, opts))
+        ok = false;
+
+    if(!opts.baseline.isEmpty() && !g_m_compareBaseline(results, opts))
+        ok = false;
+
+    return ok;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <mgpcl/NiftyCounter.h>
+#include <mgpcl/String.h>
+#include <mgpcl/List.h>
+#include <mgpcl/Time.h>
+#include <cstdint>
+
+//Benchmarks live next to the tests and are only run with --bench.
+//A benchmark body looks like this:
+//
+//	BENCH("hashmap/get")
+//	{
+//		m::HashMap<int, int> map; //Setup is not timed...
+//		fill(map);
+//
+//		while(state.keepRunning()) //...only the loop is
+//			benchAPI::doNotOptimize(map.get(42));
+//	}
+//
+//The runner picks the iteration count so that a sample lasts at
+//least BenchOptions::minSampleMs, warms up, and then collects
+//BenchOptions::samples samples to compute the statistics.
+
+M_DECLARE_NIFTY_COUNTER(BenchAPI)
+#ifdef M_BENCHAPI_SRC
+#define M_BENCHAPI_PREFIX
+#else
+M_SPAWN_NIFTY_COUNTER(BenchAPI)
+#define M_BENCHAPI_PREFIX extern
+#endif
+
+namespace benchAPI
+{
+	class State
+	{
+	public:
+		State(uint64_t iterations) : m_iterations(iterations), m_left(iterations), m_started(false), m_begin(0.0), m_end(0.0), m_items(1)
+		{
+		}
+
+		//Timing starts with the first call and stops when it returns false
+		bool keepRunning()
+		{
+			if(!m_started) {
+				m_started = true;
+				m_begin = m::time::getTimeMs();
+			}
+
+			if(m_left == 0) {
+				m_end = m::time::getTimeMs();
+				return false;
+			}
+
+			m_left--;
+			return true;
+		}
+
+		bool finished() const
+		{
+			return m_started && m_left == 0;
+		}
+
+		uint64_t iterations() const
+		{
+			return m_iterations;
+		}
+
+		//For throughput: how many items (bytes, elements...) a single iteration handles
+		void setItemsPerIteration(uint64_t items)
+		{
+			m_items = items;
+		}
+
+		uint64_t itemsPerIteration() const
+		{
+			return m_items;
+		}
+
+		double elapsedMs() const
+		{
+			return m_end - m_begin;
+		}
+
+	private:
+		uint64_t m_iterations;
+		uint64_t m_left;
+		bool m_started;
+		double m_begin;
+		double m_end;
+		uint64_t m_items;
+	};
+
+	class Stats
+	{
+	public:
+		Stats() : median(0.0), p99(0.0), mad(0.0), min(0.0), max(0.0), mean(0.0)
+		{
+		}
+
+		//All values are in nanoseconds per iteration
+		double median;
+		double p99;
+		double mad; //Median absolute deviation
+		double min;
+		double max;
+		double mean;
+	};
+
+	class BenchOptions
+	{
+	public:
+		BenchOptions() : minSampleMs(5.0), warmupMs(50.0), samples(25), threshold(0.1)
+		{
+		}
+
+		m::String filter;   //Only run benchmarks whose name contains this
+		m::String jsonOut;  //Results are written there if not empty
+		m::String baseline; //Results are compared against this file if not empty
+		double minSampleMs;
+		double warmupMs;
+		int samples;
+		double threshold;   //Relative slowdown considered as a regression
+	};
+
+	typedef void(*BenchFunc)(State &state);
+	M_BENCHAPI_PREFIX void addBench(const char *name, BenchFunc fc);
+	M_BENCHAPI_PREFIX void computeStats(m::List<double> &values, Stats &dst); //Sorts values
+	M_BENCHAPI_PREFIX bool runAll(const BenchOptions &opts); //Returns false if a regression was detected
+	M_BENCHAPI_PREFIX void useCharPointer(const volatile char *ptr);
+
+	//Prevents the compiler from optimizing away the computation of val
+	template<typename T> inline void doNotOptimize(const T &val)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(val) : "memory");
+#else
+		useCharPointer(&reinterpret_cast<const volatile char&>(val));
+#endif
+	}
+
+	//Forces pending memory writes to be considered as observable
+	inline void clobberMemory()
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : : "memory");
+#else
+		useCharPointer(nullptr);
+#endif
+	}
+}
+
+class _DeclareBench
+{
+public:
+	_DeclareBench(const char *name, benchAPI::BenchFunc fc)
+	{
+		benchAPI::addBench(name, fc);
+	}
+
+private:
+	_DeclareBench()
+	{
+	}
+};
+
+#define _MAKEBFID(id) _bf_ ## id
+#define _MAKEBOID(id) _bo_ ## id
+#define MAKEBFID(id) _MAKEBFID(id)
+#define MAKEBOID(id) _MAKEBOID(id)
+#define BENCH(name) static void MAKEBFID(__LINE__)(benchAPI::State &state); static _DeclareBench MAKEBOID(__LINE__)(name, MAKEBFID(__LINE__)); static void MAKEBFID(__LINE__)(benchAPI::State &state)
+#define DISABLED_BENCH(name) static void MAKEBFID(__LINE__)(benchAPI::State &state); static void MAKEBFID(__LINE__)(benchAPI::State &state)
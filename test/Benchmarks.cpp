@@ -0,0 +1,294 @@
+#include "TestAPI.h"
+#include "BenchAPI.h"
+#include <mgpcl/HashMap.h>
+#include <mgpcl/List.h>
+#include <mgpcl/String.h>
+#include <mgpcl/JSON.h>
+#include <mgpcl/StringIOStream.h>
+#include <mgpcl/Packet.h>
+
+#ifdef MGPCL_ENABLE_PATTERNS
+#include <mgpcl/Pattern.h>
+#endif
+
+Declare Test("bench"), Priority(15.0);
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::List<double> values;
+    benchAPI::Stats st;
+
+    for(int i = 10; i >= 1; i--)
+        values.add(static_cast<double>(i));
+
+    values.add(100.0); //Outlier
+    benchAPI::computeStats(values, st);
+
+    testAssert(st.min == 1.0 && st.max == 100.0, "wrong min/max");
+    testAssert(st.median == 6.0, "wrong median");
+    testAssert(st.p99 == 100.0, "wrong p99");
+    testAssert(st.mad == 3.0, "wrong MAD"); //Deviations: 0 1 1 2 2 3 3 4 4 5 94
+    testAssert(st.mean == 155.0 / 11.0, "wrong mean");
+
+    values.clear();
+    values.add(2.0);
+    values.add(4.0);
+    benchAPI::computeStats(values, st);
+    testAssert(st.median == 3.0 && st.mad == 1.0, "wrong stats for even sample count");
+
+    benchAPI::State state(3);
+    int count = 0;
+    while(state.keepRunning())
+        count++;
+
+    testAssert(count == 3 && state.finished(), "State::keepRunning() ran the wrong amount of iterations");
+    return true;
+}
+
+static int g_m_benchKey(int i)
+{
+    //Knuth's multiplicative hash; gives scattered but reproducible keys
+    return static_cast<int>(static_cast<uint32_t>(i) * 2654435761U >> 1);
+}
+
+/********************************** HashMap **********************************/
+
+BENCH("hashmap/put-int")
+{
+    state.setItemsPerIteration(1024);
+
+    while(state.keepRunning()) {
+        m::HashMap<int, int> map;
+        for(int i = 0; i < 1024; i++)
+            map[g_m_benchKey(i)] = i;
+
+        benchAPI::doNotOptimize(map);
+    }
+}
+
+BENCH("hashmap/get-int")
+{
+    m::HashMap<int, int> map;
+    for(int i = 0; i < 4096; i++)
+        map[g_m_benchKey(i)] = i;
+
+    int i = 0;
+    while(state.keepRunning())
+        benchAPI::doNotOptimize(map.get(g_m_benchKey(i++ & 4095)));
+}
+
+BENCH("hashmap/get-string")
+{
+    m::HashMap<m::String, int> map;
+    m::List<m::String> keys(4096);
+
+    for(int i = 0; i < 4096; i++) {
+        keys.add("key-"_m + m::String::fromInteger(g_m_benchKey(i)));
+        map[keys.last()] = i;
+    }
+
+    int i = 0;
+    while(state.keepRunning())
+        benchAPI::doNotOptimize(map.get(keys[i++ & 4095]));
+}
+
+/*********************************** List ************************************/
+
+BENCH("list/add-int")
+{
+    state.setItemsPerIteration(1024);
+
+    while(state.keepRunning()) {
+        m::List<int> lst;
+        for(int i = 0; i < 1024; i++)
+            lst.add(i);
+
+        benchAPI::doNotOptimize(lst);
+    }
+}
+
+BENCH("list/iterate-int")
+{
+    m::List<int> lst(4096);
+    for(int i = 0; i < 4096; i++)
+        lst.add(g_m_benchKey(i));
+
+    state.setItemsPerIteration(4096);
+    while(state.keepRunning()) {
+        int sum = 0;
+        for(int v : lst)
+            sum += v;
+
+        benchAPI::doNotOptimize(sum);
+    }
+}
+
+BENCH("list/sort-int") //Includes the copy of the list
+{
+    m::List<int> src(4096);
+    for(int i = 0; i < 4096; i++)
+        src.add(g_m_benchKey(i));
+
+    state.setItemsPerIteration(4096);
+    while(state.keepRunning()) {
+        m::List<int> lst(src);
+        lst.introSort();
+        benchAPI::doNotOptimize(lst);
+    }
+}
+
+/********************************** String ***********************************/
+
+BENCH("string/append")
+{
+    while(state.keepRunning()) {
+        m::String str;
+        for(int i = 0; i < 32; i++)
+            str += "append"_m;
+
+        benchAPI::doNotOptimize(str);
+    }
+}
+
+BENCH("string/hash")
+{
+    m::String str("The quick brown fox jumps over the lazy dog, twice."_m);
+    state.setItemsPerIteration(static_cast<uint64_t>(str.length()));
+
+    while(state.keepRunning()) {
+        benchAPI::doNotOptimize(str);
+        benchAPI::doNotOptimize(str.hash());
+    }
+}
+
+BENCH("string/split")
+{
+    m::String str("GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\nConnection: keep-alive"_m);
+    m::List<m::String> parts;
+
+    while(state.keepRunning()) {
+        parts.clear();
+        str.splitOnOneOf(" \r\n", parts);
+        benchAPI::doNotOptimize(parts);
+    }
+}
+
+BENCH("string/from-integer")
+{
+    int i = 0;
+    while(state.keepRunning())
+        benchAPI::doNotOptimize(m::String::fromInteger(g_m_benchKey(i++)));
+}
+
+/*********************************** JSON ************************************/
+
+static const char g_m_benchJSON[] = "{\"name\": \"mgpcl\", \"version\": 3.14, \"enabled\": true, \"tags\": [\"a\", \"bb\", \"ccc\"], "
+                                    "\"nested\": {\"list\": [1, 2, 3, 4, 5, 6, 7, 8, 9, 10], \"text\": \"hel\\tlo \\u00e9\", \"none\": null}, "
+                                    "\"numbers\": [1e3, -2.5E-3, 0.1, 12345678901]}";
+
+BENCH("json/parse")
+{
+    uint32_t len = static_cast<uint32_t>(sizeof(g_m_benchJSON) - 1);
+    m::String err;
+
+    state.setItemsPerIteration(len);
+    while(state.keepRunning()) {
+        m::JSONElement root;
+        m::json::parse(g_m_benchJSON, len, root, err);
+        benchAPI::doNotOptimize(root);
+    }
+}
+
+BENCH("json/serialize")
+{
+    m::JSONElement root;
+    m::String err;
+    m::json::parse(g_m_benchJSON, sizeof(g_m_benchJSON) - 1, root, err);
+
+    m::SSharedPtr<m::StringOStream> sos(new m::StringOStream);
+    m::SSharedPtr<m::OutputStream> out(sos.staticCast<m::OutputStream>());
+
+    while(state.keepRunning()) {
+        sos->cleanup();
+        m::json::serializeCompact(out, root);
+        benchAPI::doNotOptimize(sos->data());
+    }
+}
+
+#ifdef MGPCL_ENABLE_PATTERNS
+/********************************** Pattern **********************************/
+
+BENCH("pattern/compile")
+{
+    while(state.keepRunning()) {
+        m::Pattern pat;
+        benchAPI::doNotOptimize(pat.compile("^[E-T]+ *=%s*[ste]+$"));
+    }
+}
+
+BENCH("pattern/match")
+{
+    m::Pattern pat("(%d+)%-(%l+)");
+    m::String str("12-ab, 345-cde; 6-, 7890-fghij and some trailing text 42-z"_m);
+
+    while(state.keepRunning()) {
+        m::Matcher matcher(pat.matcher(str));
+        int cnt = 0;
+
+        while(matcher.next())
+            cnt++;
+
+        benchAPI::doNotOptimize(cnt);
+    }
+}
+#endif
+
+/********************************** Packet ***********************************/
+
+static void g_m_benchWritePacket(m::Packet &pkt)
+{
+    pkt << int32_t(42) << uint16_t(1337) << uint64_t(0xDEADBEEFCAFEBABEULL) << 3.5f;
+    pkt << "some payload string"_m;
+
+    for(int i = 0; i < 16; i++)
+        pkt << int32_t(i);
+}
+
+BENCH("packet/write")
+{
+    while(state.keepRunning()) {
+        m::Packet pkt;
+        g_m_benchWritePacket(pkt);
+
+        m::FPacket fp(pkt.finalize());
+        benchAPI::doNotOptimize(fp.data());
+        fp.destroy();
+    }
+}
+
+BENCH("packet/read") //Includes the copy of the packet, since readers take ownership
+{
+    m::Packet pkt;
+    g_m_benchWritePacket(pkt);
+    m::FPacket src(pkt.finalize());
+
+    while(state.keepRunning()) {
+        m::PacketReader in(src.duplicate());
+        uint32_t size;
+        int32_t a;
+        uint16_t b;
+        uint64_t c;
+        float d;
+        m::String str;
+
+        in >> size >> a >> b >> c >> d >> str; //finalize() prepends the size
+        for(int i = 0; i < 16; i++)
+            in >> a;
+
+        benchAPI::doNotOptimize(str);
+        benchAPI::doNotOptimize(a);
+    }
+
+    src.destroy();
+}
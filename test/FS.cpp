@@ -1,5 +1,9 @@
 #include "TestAPI.h"
 #include <mgpcl/File.h>
+#include <mgpcl/MappedFile.h>
+#include <mgpcl/FileIOStream.h>
+#include <mgpcl/TextSerializer.h>
+#include <mgpcl/JSON.h>
 
 Declare Test("io"), Priority(8.0);
 
@@ -55,3 +59,41 @@ TEST
     std::cout << "[i]\tFont dir: " << m::File::usualDirectory(m::kUD_SystemFonts).path().raw() << std::endl;
     return true;
 }
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::MappedFile mf("test.json"_m);
+    testAssert(mf.isOpen(), "couldn't map test.json");
+    testAssert(mf.advise(m::kMH_WillNeed), "madvise failed");
+
+    //Mapped data should match what FileInputStream reads
+    m::FileInputStream fis("test.json"_m);
+    uint8_t *buf = new uint8_t[static_cast<size_t>(mf.size())];
+    int rd = fis.read(buf, static_cast<int>(mf.size()));
+    bool same = (rd == static_cast<int>(mf.size())) && m::mem::cmp(buf, mf.data(), rd) == 0;
+    delete[] buf;
+    testAssert(same, "mapped data differs from file content");
+
+    m::String err;
+    m::JSONElement root;
+    testAssert(m::json::parse(mf.chars(), mf.size(), root, err), "couldn't parse mapped JSON");
+    testAssert(root["someArray"_m].isArray(), "'someArray' is not an array");
+
+    m::MappedInputStream mis("test.json"_m);
+    uint8_t chr;
+    testAssert(mis.seek(-1, m::SeekPos::End), "couldn't seek from end");
+    testAssert(mis.read(&chr, 1) == 1 && chr == mf.data()[mf.size() - 1], "read after seek failed");
+    testAssert(mis.read(&chr, 1) == 0 && mis.remaining() == 0, "should have reached EOF");
+    testAssert(!mis.seek(1, m::SeekPos::Relative), "seek past the end should fail");
+
+    const char txt[] = "42 -7 3.5 word";
+    m::MemoryTextDeserializer mtd(txt, sizeof(txt) - 1);
+    int a, b;
+    double c;
+    m::String d;
+
+    mtd >> a >> b >> c >> d;
+    testAssert(a == 42 && b == -7 && c == 3.5 && d == "word"_m, "memory deserialization failed");
+    return true;
+}
@@ -82,3 +82,42 @@ TEST
 
     return true;
 }
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::FlatMap<int, int> built;
+    m::FlatMap<int, int> put;
+
+    //Covers both the linear search of small maps and the binary search
+    for(int sz = 1; sz <= 40; sz++) {
+        built.clear();
+        put.clear();
+        built.reserve(sz * 2);
+
+        for(int i = 0; i < sz * 2; i++) {
+            int key = (i * 7919) % (sz + 3); //Some duplicates
+            built.bulkAdd(key, i);
+            put.put(key, i);
+        }
+
+        built.bulkBuild();
+        testAssert(built.size() == put.size(), "bulkBuild() didn't remove duplicates");
+
+        const m::FlatMap<int, int>::Pair *a = built.begin();
+        for(const m::FlatMap<int, int>::Pair &b : put) {
+            testAssert(a->key == b.key && a->value == b.value, "bulkBuild() doesn't match put()");
+            a++;
+        }
+
+        for(int key = -1; key < sz + 4; key++) {
+            const int *val;
+            bool exists = put.getIfExists(key, val);
+
+            testAssert(built.hasKey(key) == exists, "invalid hasKey() result");
+            testAssert(!exists || built[key] == *val, "invalid lookup");
+        }
+    }
+
+    return true;
+}
@@ -7,6 +7,10 @@
 #include <mgpcl/ByteBuf.h>
 #include <mgpcl/SerialIO.h>
 #include <mgpcl/Time.h>
+#include <mgpcl/FileIOStream.h>
+#include <mgpcl/AsyncFileOStream.h>
+#include <mgpcl/MappedFile.h>
+#include <mgpcl/File.h>
 
 Declare Test("io"), Priority(5.0);
 
@@ -103,6 +107,173 @@ TEST
     return true;
 }
 
+struct DSTestPoint
+{
+    int32_t id;
+    float x;
+    double y;
+    uint16_t flags;
+};
+
+struct DSTestNamed
+{
+    DSTestPoint pt;
+    m::String name;
+    int64_t delta;
+};
+
+namespace m
+{
+    template<> class DataStruct<DSTestPoint>
+    {
+    public:
+        template<class V> static void fields(V &v, DSTestPoint &obj)
+        {
+            v & obj.id & obj.x & obj.y & obj.flags;
+        }
+    };
+
+    template<> class DataStruct<DSTestNamed>
+    {
+    public:
+        template<class V> static void fields(V &v, DSTestNamed &obj)
+        {
+            v & obj.pt & obj.name & obj.delta;
+        }
+    };
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    for(int i = 0; i < 4; i++) {
+        const m::Endianness e = (i & 1) ? m::Endianness::Big : m::Endianness::Little;
+        const m::IntegerEncoding ie = (i & 2) ? m::IntegerEncoding::VarInt : m::IntegerEncoding::Fixed;
+
+        m::List<uint32_t> ints;
+        m::List<double> dbls;
+        m::List<int16_t> shorts;
+        for(int j = 0; j < 5000; j++) {
+            ints.add(static_cast<uint32_t>(j) * 2654435761U);
+            dbls.add(static_cast<double>(j) * 0.37 - 100.0);
+            shorts.add(static_cast<int16_t>(j * 13 - 30000));
+        }
+
+        DSTestPoint pts[300];
+        for(int j = 0; j < 300; j++) {
+            pts[j].id = -j;
+            pts[j].x = static_cast<float>(j) * 0.5f;
+            pts[j].y = static_cast<double>(j) / 3.0;
+            pts[j].flags = static_cast<uint16_t>(j * 7);
+        }
+
+        DSTestNamed named;
+        named.pt = pts[42];
+        named.name = "named struct"_m;
+        named.delta = INT64_MIN;
+
+        m::ByteBuf bb;
+        {
+            m::SSharedPtr<m::DataOutputStream> dos(new m::DataOutputStream(bb.outputStream<m::RefCounter>()));
+            dos->setEndianness(e);
+            dos->setIntegerEncoding(ie);
+
+            dos->writeList(ints);
+            dos->writeArray(dbls.begin(), dbls.size());
+            dos->writeList(shorts);
+            *dos << int64_t(-1) << uint64_t(UINT64_MAX) << int32_t(INT32_MIN);
+            dos->writeVarInt(-300);
+            dos->writeStructs(pts, 300);
+            dos->writeStruct(named);
+        }
+
+        {
+            m::SSharedPtr<m::DataInputStream> dis(new m::DataInputStream(bb.inputStream<m::RefCounter>()));
+            dis->setEndianness(e);
+            dis->setIntegerEncoding(ie);
+
+            m::List<uint32_t> ints2;
+            m::List<double> dbls2;
+            m::List<int16_t> shorts2;
+            dbls2.add(0.0, dbls.size());
+
+            dis->readList(ints2);
+            dis->readArray(dbls2.begin(), dbls2.size());
+            dis->readList(shorts2);
+
+            testAssert(ints2.size() == ints.size() && shorts2.size() == shorts.size(), "invalid list size");
+            for(int j = 0; j < ints.size(); j++) {
+                testAssert(ints2[j] == ints[j], "invalid uint32 array element");
+                testAssert(dbls2[j] == dbls[j], "invalid double array element");
+                testAssert(shorts2[j] == shorts[j], "invalid int16 array element");
+            }
+
+            testAssert(dis->readInt64() == -1, "invalid int64 reading");
+            testAssert(dis->readUInt64() == UINT64_MAX, "invalid uint64 reading");
+            testAssert(dis->readInt() == INT32_MIN, "invalid int reading");
+            testAssert(dis->readVarInt() == -300, "invalid varint reading");
+
+            DSTestPoint pts2[300];
+            dis->readStructs(pts2, 300);
+
+            for(int j = 0; j < 300; j++) {
+                testAssert(pts2[j].id == pts[j].id && pts2[j].x == pts[j].x, "invalid struct reading");
+                testAssert(pts2[j].y == pts[j].y && pts2[j].flags == pts[j].flags, "invalid struct reading");
+            }
+
+            DSTestNamed named2;
+            dis->readStruct(named2);
+            testAssert(named2.pt.id == -42 && named2.pt.flags == 42 * 7, "invalid nested struct reading");
+            testAssert(named2.name == "named struct"_m, "invalid struct string reading");
+            testAssert(named2.delta == INT64_MIN, "invalid struct int64 reading");
+            testAssert(dis->pos() == static_cast<uint64_t>(bb.size()), "didn't read everything");
+        }
+
+        if(ie == m::IntegerEncoding::VarInt) {
+            std::cout << "[i]\tVarInt mode (" << (i & 1 ? "big" : "little") << " endian) used " << bb.size() << " bytes" << std::endl;
+        }
+    }
+
+    //Compare with per-element writes
+    m::List<float> floats;
+    for(int j = 0; j < 1000000; j++)
+        floats.add(static_cast<float>(j) * 1.5f);
+
+    for(int i = 0; i < 2; i++) {
+        const m::Endianness e = i == 0 ? m::Endianness::Little : m::Endianness::Big;
+        double oneByOne, bulk;
+
+        {
+            m::ByteBuf bb;
+            m::DataOutputStream dos(bb.outputStream<m::RefCounter>());
+            dos.setEndianness(e);
+
+            double start = m::time::getTimeMs();
+            for(float f : floats)
+                dos << f;
+
+            oneByOne = m::time::getTimeMs() - start;
+        }
+
+        {
+            m::ByteBuf bb;
+            m::DataOutputStream dos(bb.outputStream<m::RefCounter>());
+            dos.setEndianness(e);
+
+            double start = m::time::getTimeMs();
+            dos.writeArray(floats.begin(), floats.size());
+            bulk = m::time::getTimeMs() - start;
+
+            testAssert(bb.size() == 4 * 1000000, "invalid bulk size");
+        }
+
+        std::cout << "[i]\t1M floats (" << (i == 0 ? "little" : "big") << " endian): " << oneByOne << " ms one by one, " << bulk << " ms with writeArray()" << std::endl;
+    }
+
+    return true;
+}
+
 TEST
 {
     volatile StackIntegrityChecker sic;
@@ -133,6 +304,82 @@ TEST
     return true;
 }
 
+static bool checkSequence(const m::String &fname, int count)
+{
+    m::MappedFile mf(fname);
+    if(!mf.isOpen() || mf.size() != static_cast<uint64_t>(count) * sizeof(int))
+        return false;
+
+    const int *data = reinterpret_cast<const int*>(mf.data());
+    for(int i = 0; i < count; i++) {
+        if(data[i] != i)
+            return false;
+    }
+
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    {
+        m::FileOutputStream fos("buffered.bin"_m, m::FileOutputStream::kOM_Truncate);
+        testAssert(fos.setBufferSize(1000), "couldn't enable buffering");
+
+        for(int i = 0; i < 10000; i++)
+            testAssert(fos.write(reinterpret_cast<const uint8_t*>(&i), sizeof(int)) == sizeof(int), "buffered write failed");
+
+        testAssert(fos.pos() == 10000 * sizeof(int), "invalid buffered position");
+
+        int more[3] = { 10000, 10001, 10002 };
+        m::IOSlice slices[2] = { { reinterpret_cast<const uint8_t*>(more), sizeof(int) }, { reinterpret_cast<const uint8_t*>(more + 1), 2 * sizeof(int) } };
+        testAssert(fos.writeV(slices, 2) == 3 * sizeof(int), "gathered write failed");
+        testAssert(fos.flush(), "couldn't flush");
+    }
+
+    testAssert(checkSequence("buffered.bin"_m, 10003), "buffered file content is wrong");
+
+    {
+        m::AsyncFileOutputStream afos;
+        afos.setChunkSize(256);
+        afos.setMaxInFlight(1024);
+        testAssert(afos.open("async.bin"_m, m::FileOutputStream::kOM_Truncate), "couldn't open async file");
+
+        for(int i = 0; i < 5000; i++) {
+            testAssert(afos.write(reinterpret_cast<const uint8_t*>(&i), sizeof(int)) == sizeof(int), "async write failed");
+            testAssert(afos.inFlight() <= 1024, "too many bytes in flight");
+
+            if(i == 2500)
+                testAssert(afos.flush(), "async flush failed");
+        }
+
+        uint64_t ticket = afos.requestSync();
+        testAssert(afos.waitSync(ticket), "async sync failed");
+        testAssert(checkSequence("async.bin"_m, 5000), "synced async file content is wrong");
+
+        for(int i = 5000; i < 6000; i++)
+            afos.write(reinterpret_cast<const uint8_t*>(&i), sizeof(int));
+
+        afos.close();
+        testAssert(checkSequence("async.bin"_m, 6000), "async file content is wrong");
+
+        //Chunks kept from the previous open() must not be reused with a bigger size
+        afos.setChunkSize(4096);
+        testAssert(afos.open("async.bin"_m, m::FileOutputStream::kOM_Truncate), "couldn't reopen async file");
+
+        for(int i = 0; i < 7000; i++)
+            afos.write(reinterpret_cast<const uint8_t*>(&i), sizeof(int));
+
+        afos.close();
+    }
+
+    testAssert(checkSequence("async.bin"_m, 7000), "async file content is wrong after reopening");
+    m::File("buffered.bin"_m).deleteFile();
+    m::File("async.bin"_m).deleteFile();
+    return true;
+}
+
 //Serial IO test. Disabled by default to avoid messing
 //around with your serial devices. If you have any, that is.
 #ifdef MGPCL_WIN
@@ -40,6 +40,40 @@ TEST
     return true;
 }
 
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::SSharedPtr<m::InputStream> is(new m::StringIStream("[1e3, -2.5E-3, 0.1, 12345678901, 2.2250738585072014e-308]"_m));
+    m::String err;
+    m::JSONElement root;
+
+    if(!m::json::parse(is, root, err)) {
+        std::cout << "[!]\t" << err.raw() << std::endl;
+        return false;
+    }
+
+    testAssert(root.isArray() && root.size() == 5, "bad number array");
+    testAssert(root[0].asDouble() == 1000.0, "bad exponent parsing");
+    testAssert(root[1].asDouble() == -0.0025, "bad negative exponent parsing");
+    testAssert(root[2].asDouble() == 0.1, "bad fraction parsing");
+    testAssert(root[3].asDouble() == 12345678901.0, "big integers shouldn't be truncated");
+    testAssert(root[4].asDouble() == 2.2250738585072014e-308, "bad tiny number parsing");
+
+    m::SSharedPtr<m::StringOStream> sos(new m::StringOStream);
+    testAssert(m::json::serializeCompact(sos.staticCast<m::OutputStream>(), root), "couldn't serialize numbers");
+    testAssert(sos->data() == "[1000,-0.0025,0.1,12345678901,2.2250738585072014e-308]", "numbers should be written in their shortest form");
+
+    m::SSharedPtr<m::InputStream> bad(new m::StringIStream("[1e3e4]"_m));
+    testAssert(!m::json::parse(bad, root, err), "'1e3e4' shouldn't parse");
+
+    //What was parsed before an error must still be searchable
+    const char partial[] = "{\"z\": 1, \"y\": 2, \"x\": 3, \"w\": 4, \"v\": {\"b\": 5, \"a\": 6, \"c\": ]}";
+    testAssert(!m::json::parse(partial, sizeof(partial) - 1, root, err), "truncated object shouldn't parse");
+    testAssert(root.isObject() && root.has("w") && root.has("z") && root["x"_m].asInt() == 3, "partially parsed object isn't sorted");
+
+    return true;
+}
+
 DISABLED_TEST
 {
     volatile StackIntegrityChecker sic;
@@ -2,7 +2,10 @@
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 #include <mgpcl/List.h>
+#include <mgpcl/ParallelSort.h>
 #include <mgpcl/Queue.h>
 #include <mgpcl/Time.h>
 
@@ -151,7 +154,7 @@ TEST
 
     lst3.clear();
 
-    /*for(int i = 0; i < 1048576; i++) {
+    for(int i = 0; i < 1048576; i++) {
         float a = static_cast<float>(rand() % 10000 - 5000);
         float b = static_cast<float>(rand() % 10000 - 5000) / 10000.f;
 
@@ -163,7 +166,93 @@ TEST
     std::cout << "[i]\tMerge sort (floats) took " << m::time::getTimeMs() - s << "ms" << std::endl;
 
     for(int i = 0; i < lst3.size() - 1; i++)
-        testAssert(lst3[i] <= lst3[i + 1], "list merge sorting failed");*/
+        testAssert(lst3[i] <= lst3[i + 1], "list merge sorting failed");
+
+    return true;
+}
+
+template<typename T> static bool isSorted(const m::List<T> &lst)
+{
+    for(int i = 1; i < ~lst; i++) {
+        if(lst[i - 1] > lst[i])
+            return false;
+    }
+
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::List<int> ints;
+    std::vector<int> vec;
+
+    for(int i = 0; i < 1048576; i++) {
+        int v = (rand() << 8) ^ rand();
+        ints << ((i & 1) ? -v : v);
+        vec.push_back(ints.last());
+    }
+
+    m::List<int> intro(ints);
+    m::List<int> radix(ints);
+    m::List<int> parallel(ints);
+
+    double s = m::time::getTimeMs();
+    std::sort(vec.begin(), vec.end());
+    std::cout << "[i]\tstd::sort (ints) took " << m::time::getTimeMs() - s << "ms" << std::endl;
+
+    s = m::time::getTimeMs();
+    intro.introSort();
+    std::cout << "[i]\tIntrosort (ints) took " << m::time::getTimeMs() - s << "ms" << std::endl;
+
+    s = m::time::getTimeMs();
+    radix.radixSort();
+    std::cout << "[i]\tRadix sort (ints) took " << m::time::getTimeMs() - s << "ms" << std::endl;
+
+    s = m::time::getTimeMs();
+    m::parallelSort(parallel, 4);
+    std::cout << "[i]\tParallel sort (ints, 4 threads) took " << m::time::getTimeMs() - s << "ms" << std::endl;
+
+    for(int i = 0; i < ~ints; i++)
+        testAssert(intro[i] == vec[i] && radix[i] == vec[i] && parallel[i] == vec[i], "list sorting failed");
+
+    //Descending order, and already sorted input (quicksort's worst case without median of three)
+    intro.introSort([] (int a, int b) -> bool { return a < b; });
+    for(int i = 0; i < ~intro; i++)
+        testAssert(intro[i] == vec[~intro - 1 - i], "descending introsort failed");
+
+    m::List<double> doubles;
+    for(int i = 0; i < 100000; i++)
+        doubles << static_cast<double>(rand() % 20000 - 10000) / 7.0;
+
+    doubles << -0.0 << 0.0 << 1e300 << -1e300;
+    doubles.radixSort();
+    testAssert(isSorted(doubles), "radix sort of doubles failed");
+
+    //Stability: sort by key only, the index must stay in order for equal keys
+    m::List<TestObject> objs;
+    for(int i = 0; i < 50000; i++)
+        objs << TestObject((rand() % 100) * 65536 + i);
+
+    m::List<TestObject> objs2(objs);
+    objs.mergeSort([] (const TestObject &a, const TestObject &b) -> bool { return (a.value() >> 16) > (b.value() >> 16); });
+    objs2.radixSort([] (const TestObject &o) -> int { return o.value() >> 16; });
+
+    for(int i = 1; i < ~objs; i++) {
+        testAssert(objs[i - 1].value() < objs[i].value(), "merge sort isn't stable");
+        testAssert(objs2[i - 1].value() == objs[i - 1].value(), "radix sort isn't stable");
+    }
+
+    objs.clear();
+    objs2.clear();
+    testAssert(TestObject::instances() == 0, "invalid test object count");
+
+    //Binary searches
+    m::List<int> sorted{ 1, 3, 3, 3, 5, 8 };
+    testAssert(sorted.lowerBound(3) == 1 && sorted.upperBound(3) == 4, "invalid bounds");
+    testAssert(sorted.lowerBound(0) == 0 && sorted.upperBound(8) == 6 && sorted.lowerBound(9) == 6, "invalid bounds at the ends");
+    testAssert(sorted.binarySearch(5) == 4 && sorted.binarySearch(4) == -1, "invalid binary search");
+    testAssert(radix.binarySearch(vec[12345]) >= 0 && radix[radix.binarySearch(vec[12345])] == vec[12345], "invalid binary search in large list");
 
     return true;
 }
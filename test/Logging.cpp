@@ -2,6 +2,8 @@
 #include <mgpcl/BasicLogger.h>
 #include <mgpcl/NetLogger.h>
 #include <mgpcl/Time.h>
+#include <mgpcl/TCPSocket.h>
+#include <mgpcl/List.h>
 
 Declare Test("logging"), Priority(12.0);
 
@@ -35,6 +37,146 @@ TEST
     return true;
 }
 
+//Minimal LZ4 block decoder, to check what NetLogger sends
+static bool lz4Decompress(const uint8_t *src, int len, m::List<uint8_t> &dst)
+{
+    int ip = 0;
+
+    while(ip < len) {
+        int token = src[ip++];
+        int lit = token >> 4;
+
+        if(lit == 15) {
+            int b;
+            do {
+                b = src[ip++];
+                lit += b;
+            } while(b == 255);
+        }
+
+        dst.addAll(src + ip, lit);
+        ip += lit;
+
+        if(ip >= len)
+            break;
+
+        int offset = src[ip] | (src[ip + 1] << 8);
+        int mlen = token & 15;
+        ip += 2;
+
+        if(mlen == 15) {
+            int b;
+            do {
+                b = src[ip++];
+                mlen += b;
+            } while(b == 255);
+        }
+
+        mlen += 4;
+        if(offset == 0 || offset > dst.size())
+            return false;
+
+        for(int i = 0; i < mlen; i++)
+            dst.add(dst[dst.size() - offset]);
+    }
+
+    return true;
+}
+
+static int readU16(const uint8_t *src)
+{
+    return (src[0] << 8) | src[1];
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    testAssert(m::Logger::instance() == nullptr, "found an old logger");
+
+    m::TCPSocket server;
+    testAssert(server.initialize(), "could not create server socket");
+    testAssert(server.bind(m::IPv4Address(127, 0, 0, 1, 23456)) && server.listen(), "could not start server");
+
+    m::NetLogger *logger = new m::NetLogger;
+    logger->setBatching(true, 4096, 10000);
+    logger->setCompression(true);
+    testAssert(logger->connect("127.0.0.1:23456"_m), "could not connect to local server");
+
+    m::IPv4Address cliAddr;
+    m::TCPSocket cli(server.accept(cliAddr));
+    testAssert(cli.isValid(), "could not accept logger");
+
+    for(int i = 0; i < 500; i++)
+        logger->info(M_LOG, "Record number %d is quite repetitive", i);
+
+    logger->flush();
+    logger->disconnect();
+    delete logger;
+
+    m::List<uint8_t> stream;
+    uint8_t buf[4096];
+    int rd;
+
+    while((rd = cli.receive(buf, 4096)) > 0)
+        stream.addAll(buf, rd);
+
+    //Walk through packets: first the handshake, then compressed frames
+    int pos = 0;
+    int packets = 0;
+    int records = 0;
+    m::List<m::String> names;
+
+    while(pos + 4 <= stream.size()) {
+        const uint8_t *pkt = stream.begin() + pos;
+        int pktSize = (pkt[0] << 24) | (pkt[1] << 16) | (pkt[2] << 8) | pkt[3];
+        testAssert(pktSize >= 4 && pos + pktSize <= stream.size(), "truncated packet");
+
+        if(packets == 0) {
+            testAssert(pktSize == 6 && pkt[4] == 0xB0 && pkt[5] == 2, "expected a handshake");
+        } else {
+            testAssert((pkt[4] & 1) != 0, "frames should be compressed");
+
+            int rawSize = (pkt[5] << 24) | (pkt[6] << 16) | (pkt[7] << 8) | pkt[8];
+            m::List<uint8_t> frame(rawSize);
+            testAssert(lz4Decompress(pkt + 9, pktSize - 9, frame) && frame.size() == rawSize, "bad LZ4 frame");
+            testAssert(rawSize <= 4096, "frame is bigger than requested");
+
+            for(int i = 0; i < frame.size();) {
+                const uint8_t *e = frame.begin() + i;
+
+                if(e[0] == 0xF0) {
+                    int id = readU16(e + 1);
+                    int len = readU16(e + 3);
+                    testAssert(id == names.size(), "names should be defined in order");
+
+                    names.add(m::String(reinterpret_cast<const char*>(e + 5), len));
+                    i += 5 + len;
+                } else {
+                    int len = readU16(e + 7);
+                    m::String msg(reinterpret_cast<const char*>(e + 9), len);
+
+                    testAssert(e[0] == static_cast<uint8_t>(m::LogLevel::Info), "bad log level");
+                    testAssert(names[readU16(e + 1)] == "MAIN", "bad thread name");
+                    testAssert(names[readU16(e + 3)] == "Logging.cpp", "bad file name");
+                    testAssert(msg == m::String::format("Record number %d is quite repetitive", records), "bad message");
+
+                    records++;
+                    i += 9 + len;
+                }
+            }
+        }
+
+        pos += pktSize;
+        packets++;
+    }
+
+    std::cout << "[i]\tReceived " << records << " records in " << packets - 1 << " frames (" << stream.size() << " bytes)" << std::endl;
+    testAssert(records == 500, "some records are missing");
+    testAssert(names.size() == 2, "names should only be sent once");
+
+    return true;
+}
+
 TEST
 {
     volatile StackIntegrityChecker sic;
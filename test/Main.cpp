@@ -4,6 +4,7 @@
 #include <string>
 #include <cstring>
 #include "TestAPI.h"
+#include "BenchAPI.h"
 #include "HTTPServerTest.h"
 #include <mgpcl/ConsoleUtils.h>
 #include <mgpcl/INet.h>
@@ -55,6 +56,7 @@ static TestObject randomTestObj()
 
 static bool g_noSound = false;
 static bool g_simpleEnd = false;
+static bool g_bench = false;
 
 static void playSound(const m::String &snd)
 {
@@ -144,6 +146,8 @@ static void drawCenteredRect(int rw, int rh)
 
 int main(int argc, char *argv[])
 {
+    benchAPI::BenchOptions benchOpts;
+
     for(int i = 1; i < argc; i++) {
         if(strcmp(argv[i], "--print-test-objs") == 0)
             TestObject::setPrintDebug();
@@ -174,6 +178,35 @@ int main(int argc, char *argv[])
                 testAPI::testExcept(argv[i]);
             else
                 std::cout << "[?] Note: --except argument was specified with no following test name" << std::endl;
+        } else if(strcmp(argv[i], "--bench") == 0) {
+            g_bench = true;
+
+            if(i + 1 < argc && argv[i + 1][0] != '-')
+                benchOpts.filter = m::String(argv[++i]);
+        } else if(strcmp(argv[i], "--bench-json") == 0) {
+            i++;
+            if(i < argc)
+                benchOpts.jsonOut = m::String(argv[i]);
+            else
+                std::cout << "[?] Note: --bench-json argument was specified with no following file name" << std::endl;
+        } else if(strcmp(argv[i], "--bench-baseline") == 0) {
+            i++;
+            if(i < argc)
+                benchOpts.baseline = m::String(argv[i]);
+            else
+                std::cout << "[?] Note: --bench-baseline argument was specified with no following file name" << std::endl;
+        } else if(strcmp(argv[i], "--bench-samples") == 0) {
+            i++;
+            if(i < argc)
+                benchOpts.samples = atoi(argv[i]);
+            else
+                std::cout << "[?] Note: --bench-samples argument was specified with no following value" << std::endl;
+        } else if(strcmp(argv[i], "--bench-threshold") == 0) {
+            i++;
+            if(i < argc)
+                benchOpts.threshold = atof(argv[i]) / 100.0;
+            else
+                std::cout << "[?] Note: --bench-threshold argument was specified with no following percentage" << std::endl;
         } else if(strcmp(argv[i], "--http-server") == 0) {
             mTestHTTPServer();
             return 0;
@@ -181,6 +214,17 @@ int main(int argc, char *argv[])
             std::cout << "[?] Note: ignoring unrecognized CLI argument \"" << argv[i] << "\"" << std::endl;
     }
 
+    if(g_bench) {
+        if(benchOpts.samples < 1)
+            benchOpts.samples = 1;
+
+        m::console::setTextColor(m::kCC_Cyan);
+        std::cout << "[i] Running benchmarks..." << std::endl;
+        m::console::resetColor();
+
+        return benchAPI::runAll(benchOpts) ? 0 : 255;
+    }
+
     m::console::setTitle(WINDOW_TITLE);
     m::console::setTextColor(m::kCC_Yellow);
     std::cout << g_aperture << std::endl;
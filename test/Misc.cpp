@@ -361,6 +361,101 @@ TEST
     return true;
 }
 
+static bool writeReloadIni(int changedCat, const char *extra)
+{
+    std::ofstream out("reload.ini");
+    if(!out)
+        return false;
+
+    out << "#Generated config" << std::endl;
+    for(int i = 0; i < 200; i++) {
+        out << "[cat" << i << ']' << std::endl;
+        out << "count=" << (i == changedCat ? i * 10 : i) << std::endl;
+        out << "ratio=" << i << ".5 #comment" << std::endl;
+        out << "enabled=" << (i & 1 ? "on" : "off") << std::endl;
+    }
+
+    out << extra;
+    out.close();
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    testAssert(writeReloadIni(-1, "[removed]\nprop=1\n"), "couldn't write reload.ini");
+
+    m::SimpleConfig cfg("reload.ini"_m);
+    testAssert(cfg.load() == m::kCLE_None, "could not load reload.ini");
+    testAssert(cfg["cat7"_m]["count"_m].asInt() == 7, "cat7.count should be 7");
+    testAssert(cfg["cat7"_m]["ratio"_m].asDouble() == 7.5, "cat7.ratio should be 7.5");
+    testAssert(cfg["cat7"_m]["enabled"_m].asBool(), "cat7.enabled should be true");
+    testAssert(cfg["removed"_m]["prop"_m].asInt() == 1, "removed.prop should be 1");
+
+    //Cached values follow modifications
+    cfg["cat8"_m]["count"_m].setValue("1234"_m);
+    testAssert(cfg["cat8"_m]["count"_m].asInt() == 1234, "cached value wasn't invalidated");
+    cfg["cat9"_m]["ratio"_m].setDoubleValue(0.1);
+    testAssert(cfg["cat9"_m]["ratio"_m].asDouble() == 0.1, "cat9.ratio should be 0.1");
+
+    //Adding categories moves the others around; their properties must follow
+    for(int i = 0; i < 64; i++)
+        cfg["new"_m + m::String::fromInteger(i)];
+
+    m::SimpleConfig::Property &moved = cfg["cat10"_m]["count"_m];
+    moved.setValue("1234"_m);
+    testAssert(&moved.category() == &cfg["cat10"_m], "property points to a moved category");
+
+    volatile int notifications = 0;
+    testAssert(cfg.watch([&notifications] () { notifications++; }), "couldn't watch reload.ini");
+
+    //Change one category, remove one and add another one
+    const m::String *untouched = &cfg["cat100"_m]["count"_m].value();
+    testAssert(writeReloadIni(3, "[added]\nprop=2\n"), "couldn't write reload.ini");
+
+    double start = m::time::getTimeMs();
+    while(notifications == 0 && m::time::getTimeMs() - start < 5000.0)
+        m::time::sleepMs(10);
+
+    cfg.unwatch();
+    testAssert(notifications > 0, "didn't get notified");
+
+    testAssert(cfg.reload() == m::kCLE_None, "could not reload reload.ini");
+    testAssert(&cfg["cat100"_m]["count"_m].value() == untouched, "untouched category was parsed again");
+    testAssert(cfg["cat3"_m]["count"_m].asInt() == 30, "cat3.count should be 30");
+    testAssert(cfg["cat8"_m]["count"_m].asInt() == 8, "cat8 modifications should be discarded");
+    testAssert(cfg["cat9"_m]["ratio"_m].asDouble() == 9.5, "cat9 modifications should be discarded");
+    testAssert(cfg["cat10"_m]["count"_m].asInt() == 10, "cat10 modifications should be discarded");
+    testAssert(cfg["added"_m]["prop"_m].asInt() == 2, "added.prop should be 2");
+    testAssert(cfg["removed"_m]["prop"_m].isEmpty(), "removed category should be gone");
+
+    //Make sure nothing got lost
+    cfg.setFileName("reload_result.ini"_m);
+    testAssert(cfg.save(), "couldn't save reload_result.ini");
+
+    m::SimpleConfig check("reload_result.ini"_m);
+    testAssert(check.load() == m::kCLE_None, "could not load reload_result.ini");
+
+    for(int i = 0; i < 200; i++) {
+        m::String cat("cat"_m);
+        cat += m::String::fromInteger(i);
+
+        testAssert(check[cat]["count"_m].asInt() == (i == 3 ? 30 : i), "invalid count after reload");
+        testAssert(check[cat]["ratio"_m].asDouble() == i + 0.5, "invalid ratio after reload");
+    }
+
+    //unwatch() from the callback must not deadlock
+    testAssert(cfg.watch([&cfg] () { cfg.unwatch(); }), "couldn't watch reload_result.ini");
+    testAssert(cfg.save(), "couldn't save reload_result.ini");
+
+    start = m::time::getTimeMs();
+    while(cfg.isWatching() && m::time::getTimeMs() - start < 5000.0)
+        m::time::sleepMs(10);
+
+    testAssert(!cfg.isWatching(), "unwatch() from the callback didn't work");
+    return true;
+}
+
 #ifndef MGPCL_NO_SSL
 
 TEST
@@ -1,11 +1,21 @@
 #include "TestAPI.h"
 #include <mgpcl/HTTPRequest.h>
+#include <mgpcl/HTTPClient.h>
+#include <mgpcl/HTTPServer.h>
 #include <mgpcl/StringIOStream.h>
 #include <mgpcl/FileIOStream.h>
 #include <mgpcl/Util.h>
 #include <mgpcl/TCPClient.h>
 #include <mgpcl/TCPServer.h>
 #include <mgpcl/Time.h>
+#include <mgpcl/Thread.h>
+#include <mgpcl/DNSResolver.h>
+#include <mgpcl/File.h>
+#include <mgpcl/SSLSocket.h>
+
+#ifndef MGPCL_NO_ZLIB
+#include <zlib.h>
+#endif
 
 Declare Test("net"), Priority(10.0);
 
@@ -224,6 +234,645 @@ TEST
     return true;
 }
 
+//Minimal keep-alive HTTP server, serves one connection at a time
+class KeepAliveServer
+{
+public:
+    KeepAliveServer() : running(1), connections(0), thread(std::bind(&KeepAliveServer::run, this), "KeepAliveServer"_m)
+    {
+    }
+
+    bool start(uint16_t port)
+    {
+        server.setAcceptTimeout(50);
+        if(!server.initialize())
+            return false;
+
+        //The server closes connections, so the port may still be in TIME_WAIT
+        int yes = 1;
+        setsockopt(server.raw(), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
+
+        if(!server.bind(m::IPv4Address(127, 0, 0, 1, port)) || !server.listen())
+            return false;
+
+        return thread.start();
+    }
+
+    void stop()
+    {
+        running.set(0);
+        thread.join();
+    }
+
+    void run()
+    {
+        m::List<m::FunctionalThread*> workers;
+
+        while(running.get() != 0) {
+            m::IPv4Address addr;
+            m::TCPSocket *cli = new m::TCPSocket(server.accept(addr));
+
+            if(cli->isValid()) {
+                connections.increment();
+
+                m::FunctionalThread *worker = new m::FunctionalThread([this, cli] () {
+                    serve(*cli);
+                    delete cli;
+                }, "KeepAliveWorker"_m);
+
+                workers.add(worker);
+                worker->start();
+            } else
+                delete cli;
+        }
+
+        for(m::FunctionalThread *worker : workers) {
+            worker->join();
+            delete worker;
+        }
+    }
+
+    void serve(m::TCPSocket &cli)
+    {
+        m::String buf;
+        uint8_t tmp[1024];
+        cli.setReadAndWriteTimeouts(50, 1000);
+
+        while(running.get() != 0) {
+            int hdrEnd = buf.indexOf("\r\n\r\n");
+            if(hdrEnd < 0) {
+                int rd = cli.receive(tmp, sizeof(tmp));
+                if(rd < 0 && cli.lastError() == m::inet::kSE_NoError)
+                    continue; //Timed out
+
+                if(rd <= 0)
+                    return;
+
+                buf.append(reinterpret_cast<char*>(tmp), rd);
+                continue;
+            }
+
+            m::String reqLine(buf.substr(0, buf.indexOf('\r')));
+            buf = buf.substr(hdrEnd + 4);
+
+            m::String body("hello world"_m);
+            m::String resp("HTTP/1.1 200 OK\r\n"_m);
+            bool close = false;
+
+            if(reqLine.startsWith("GET /redir "_m)) {
+                body = "moved"_m;
+                resp = "HTTP/1.1 302 Found\r\nLocation: /hello\r\n"_m;
+            } else if(reqLine.startsWith("GET /close "_m)) {
+                body = "bye"_m;
+                resp += "Connection: close\r\n"_m;
+                close = true;
+            } else if(reqLine.startsWith("GET /big "_m)) {
+                body.clear();
+                body.append('a', 1000000);
+            }
+
+            if(reqLine.startsWith("GET /chunked "_m))
+                resp += "Transfer-Encoding: chunked\r\n\r\n5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: yes\r\n\r\n"_m;
+            else {
+                resp += "Content-Length: "_m;
+                resp.appendInteger(body.length());
+                resp += "\r\n\r\n"_m;
+                resp += body;
+            }
+
+            if(cli.send(reinterpret_cast<const uint8_t*>(resp.raw()), resp.length()) != resp.length() || close)
+                return;
+        }
+    }
+
+    m::TCPSocket server;
+    m::Atomic running;
+    m::Atomic connections;
+    m::FunctionalThread thread;
+};
+
+static bool pooledGet(m::HTTPRequest &req, const m::String &expected)
+{
+    testAssert(req.perform(), "Could not perform HTTP request");
+    testAssert(req.responseCode() == 200, "Expected response code to be 200");
+
+    m::SSharedPtr<m::InputStream> his(req.inputStream<m::RefCounter>());
+    m::StringOStream sos;
+    testAssert(m::IO::transfer(&sos, his.ptr(), 256), "could not transfer http data to string");
+    testAssert(sos.data() == expected, "data does not match");
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    KeepAliveServer srv;
+    testAssert(srv.start(15254), "could not start keep-alive server");
+
+    m::HTTPConnectionPool pool;
+    m::HTTPRequest req("http://127.0.0.1:15254/hello"_m);
+    req.setConnectionPool(&pool);
+    req.setFollowsLocation(true);
+
+    double start = m::time::getTimeMs();
+    for(int i = 0; i < 50; i++) {
+        if(!pooledGet(req, "hello world"_m))
+            return false;
+    }
+
+    std::cout << "[i]\t50 pooled requests took " << m::time::getTimeMs() - start << " ms" << std::endl;
+    testAssert(pool.numIdle() == 1, "connection wasn't given back");
+
+    //The body of the redirection should be skipped
+    req.setURL(m::URL("http://127.0.0.1:15254/redir"_m));
+    if(!pooledGet(req, "hello world"_m))
+        return false;
+
+    testAssert(srv.connections.get() == 1, "connection wasn't reused");
+    testAssert(pool.numConnects() == 1 && pool.numReuses() == 51, "invalid pool statistics");
+
+    //The server closes this one, so a new connection is needed afterwards
+    req.setURL(m::URL("http://127.0.0.1:15254/close"_m));
+    if(!pooledGet(req, "bye"_m))
+        return false;
+
+    testAssert(pool.numIdle() == 0, "closed connection was kept");
+    req.setURL(m::URL("http://127.0.0.1:15254/hello"_m));
+    if(!pooledGet(req, "hello world"_m))
+        return false;
+
+    testAssert(srv.connections.get() == 2, "invalid connection count");
+    pool.closeIdle();
+    srv.stop();
+    return true;
+}
+
+static bool clientGet(m::HTTPClient &client, const m::String &url, const m::String &expected)
+{
+    m::Future<m::HTTPClientResponse> f(client.get(m::URL(url)));
+    testAssert(f.waitFor(5000), "async HTTP request timed out");
+    testAssert(f.get().isOK(), "async HTTP request failed");
+    testAssert(f.get().body == expected, "async HTTP data does not match");
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    KeepAliveServer srv;
+    testAssert(srv.start(15255), "could not start keep-alive server");
+
+    m::HTTPClient client;
+    client.setMaxConnectionsPerHost(4);
+    testAssert(client.start(), "could not start HTTP client");
+
+    m::List<m::Future<m::HTTPClientResponse>> futures;
+    double start = m::time::getTimeMs();
+
+    for(int i = 0; i < 200; i++)
+        futures.add(client.get(m::URL("http://127.0.0.1:15255/hello"_m)));
+
+    for(m::Future<m::HTTPClientResponse> &f : futures) {
+        testAssert(f.waitFor(5000), "async HTTP request timed out");
+        testAssert(f.get().isOK() && f.get().body == "hello world"_m, "invalid async HTTP response");
+    }
+
+    std::cout << "[i]	200 concurrent requests took " << m::time::getTimeMs() - start << " ms" << std::endl;
+    testAssert(srv.connections.get() <= 4 && client.numConnects() == static_cast<uint32_t>(srv.connections.get()), "too many connections");
+
+    if(!clientGet(client, "http://127.0.0.1:15255/chunked"_m, "hello world"_m) || !clientGet(client, "http://127.0.0.1:15255/close"_m, "bye"_m) ||
+       !clientGet(client, "http://127.0.0.1:15255/hello"_m, "hello world"_m))
+        return false;
+
+    //Streamed responses aren't stored
+    uint32_t received = 0;
+    m::Future<m::HTTPClientResponse> big(client.get(m::URL("http://127.0.0.1:15255/big"_m), [&received] (const uint8_t *data, int len) {
+        received += static_cast<uint32_t>(len);
+    }));
+
+    testAssert(big.waitFor(5000) && big.get().isOK(), "streamed HTTP request failed");
+    testAssert(received == 1000000 && big.get().body.isEmpty(), "invalid streamed data");
+
+    m::Future<m::HTTPClientResponse> refused(client.get(m::URL("http://127.0.0.1:15256/"_m)));
+    testAssert(refused.waitFor(5000) && refused.get().error == m::kHCE_ConnectionFailed, "connection should have been refused");
+
+    m::Future<m::HTTPClientResponse> unknown(client.get(m::URL("http://mgpcl-test.invalid:15255/"_m)));
+    testAssert(unknown.waitFor(10000) && unknown.get().error == m::kHCE_ResolveFailed && unknown.get().resolveError != m::kRE_NoError, "invalid host shouldn't resolve");
+
+    m::Future<m::HTTPClientResponse> https(client.get(m::URL("https://127.0.0.1:15255/"_m)));
+    testAssert(https.waitFor(5000) && https.get().error == m::kHCE_UnsupportedProtocol, "HTTPS isn't supported yet");
+
+    //New connections resolve the host again once the resolver's entry expired
+    m::DNSResolver &dns = m::DNSResolver::instance();
+    m::Atomic64 lookups;
+    dns.setTTL(100, 100);
+    dns.setLookupFunction([&lookups] (const m::String &host, m::IPv4Address &dst) {
+        lookups.increment();
+        dst.setAddr(127, 0, 0, 1);
+        return m::kRE_NoError;
+    });
+
+    bool ttlOK = clientGet(client, "http://ttl.test:15255/close"_m, "bye"_m);
+    m::time::sleepMs(150);
+    ttlOK = ttlOK && clientGet(client, "http://ttl.test:15255/close"_m, "bye"_m);
+
+    dns.setLookupFunction([] (const m::String &host, m::IPv4Address &dst) { return dst.resolve(host); });
+    dns.setTTL(M_DNS_POSITIVE_TTL, M_DNS_NEGATIVE_TTL);
+    dns.clearCache();
+
+    testAssert(ttlOK && lookups.get() == 2, "HTTP client didn't honor the DNS cache TTL");
+    client.stop();
+
+    //Everything on a single connection
+    m::HTTPClient pipelined;
+    pipelined.setMaxConnectionsPerHost(1);
+    pipelined.setPipelining(true);
+    testAssert(pipelined.start(), "could not start HTTP client");
+
+    int before = srv.connections.get();
+    if(!clientGet(pipelined, "http://127.0.0.1:15255/hello"_m, "hello world"_m))
+        return false;
+
+    futures.clear();
+    for(int i = 0; i < 50; i++)
+        futures.add(pipelined.get(m::URL("http://127.0.0.1:15255/hello"_m)));
+
+    for(m::Future<m::HTTPClientResponse> &f : futures) {
+        testAssert(f.waitFor(5000), "pipelined HTTP request timed out");
+        testAssert(f.get().isOK() && f.get().body == "hello world"_m, "invalid pipelined HTTP response");
+    }
+
+    testAssert(srv.connections.get() == before + 1, "pipelined requests should share one connection");
+    testAssert(pipelined.numPipelined() > 0, "nothing was pipelined");
+
+    pipelined.stop();
+    srv.stop();
+    return true;
+}
+
+class CountingHandler : public m::HTTPRequestHandler
+{
+public:
+    void beginRequest(m::HTTPServerRequest *req) override
+    {
+        req->setUserdata(new int(0));
+    }
+
+    void receiveData(m::HTTPServerRequest *req, uint8_t *data, int sz) override
+    {
+    }
+
+    void processRequest(m::HTTPServerRequest *req) override
+    {
+        req->setResponse(200, "OK"_m);
+        req->setResponseHeader("Content-Type"_m, "text/plain"_m);
+        req->setResponseStreaming();
+    }
+
+    int sendData(m::HTTPServerRequest *req, uint8_t *dst, int dstSz) override
+    {
+        int &i = *static_cast<int*>(req->userdata());
+        if(i >= 10000)
+            return 0;
+
+        m::String line("line "_m);
+        line.appendInteger(i++);
+        line += '\n';
+
+        m::mem::copy(dst, line.raw(), line.length());
+        return line.length();
+    }
+
+    void finishRequest(m::HTTPServerRequest *req, bool success) override
+    {
+        delete static_cast<int*>(req->userdata());
+    }
+};
+
+//Declares a fixed length, but would happily send more than that
+class FixedLengthHandler : public m::HTTPRequestHandler
+{
+public:
+    void beginRequest(m::HTTPServerRequest *req) override
+    {
+    }
+
+    void receiveData(m::HTTPServerRequest *req, uint8_t *data, int sz) override
+    {
+    }
+
+    void processRequest(m::HTTPServerRequest *req) override
+    {
+        req->setResponse(200, "OK"_m);
+        req->setResponseHeader("Content-Type"_m, "text/plain"_m);
+        req->setResponseLength(3000);
+    }
+
+    int sendData(m::HTTPServerRequest *req, uint8_t *dst, int dstSz) override
+    {
+        memset(dst, 'y', static_cast<size_t>(dstSz));
+        return dstSz;
+    }
+
+    void finishRequest(m::HTTPServerRequest *req, bool success) override
+    {
+    }
+};
+
+#ifndef MGPCL_NO_ZLIB
+static bool inflateString(const m::String &src, m::String &dst)
+{
+    z_stream zs;
+    m::mem::zero(&zs, sizeof(z_stream));
+
+    //+32 detects gzip and zlib headers
+    if(inflateInit2(&zs, 15 + 32) != Z_OK)
+        return false;
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.raw()));
+    zs.avail_in = static_cast<uInt>(src.length());
+
+    uint8_t buf[4096];
+    int ret;
+
+    do {
+        zs.next_out = buf;
+        zs.avail_out = sizeof(buf);
+        ret = inflate(&zs, Z_NO_FLUSH);
+
+        if(ret != Z_OK && ret != Z_STREAM_END) {
+            inflateEnd(&zs);
+            return false;
+        }
+
+        dst.append(reinterpret_cast<char*>(buf), static_cast<int>(sizeof(buf) - zs.avail_out));
+    } while(ret != Z_STREAM_END);
+
+    inflateEnd(&zs);
+    return true;
+}
+#endif
+
+static bool encodedGet(m::HTTPClient &client, const m::String &url, const m::String &encoding, m::HTTPClientResponse &dst)
+{
+    m::HTTPClientRequest req(m::kHRT_Get, m::URL(url));
+    if(!encoding.isEmpty())
+        req.headers["Accept-Encoding"_m] = encoding;
+
+    m::Future<m::HTTPClientResponse> f(client.submit(req));
+    testAssert(f.waitFor(5000), "HTTP request timed out");
+    testAssert(f.get().isOK(), "HTTP request failed");
+
+    dst = f.get();
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::String expected;
+    for(int i = 0; i < 10000; i++) {
+        expected += "line "_m;
+        expected.appendInteger(i);
+        expected += '\n';
+    }
+
+    m::String page;
+    page.append('x', 1000);
+
+    m::HTTPServer server;
+    server.bindHandler("/count"_m, new CountingHandler);
+    server.bindHandler("/page"_m, new m::StaticHTTPRequestHandler(page));
+    server.bindHandler("/tiny"_m, new m::StaticHTTPRequestHandler("tiny"_m));
+    server.bindHandler("/fixed"_m, new FixedLengthHandler);
+
+#ifndef MGPCL_NO_ZLIB
+    server.setCompression(true);
+#endif
+
+    testAssert(server.start(m::IPv4Address(127, 0, 0, 1, 15257), 2), "could not start HTTP server");
+
+    m::HTTPClient client;
+    testAssert(client.start(), "could not start HTTP client");
+
+    m::HTTPClientResponse resp;
+    if(!encodedGet(client, "http://127.0.0.1:15257/count"_m, ""_m, resp))
+        return false;
+
+    testAssert(resp.headers.hasKey("Transfer-Encoding"_m) && !resp.headers.hasKey("Content-Length"_m), "streamed response should be chunked");
+    testAssert(resp.body == expected, "invalid streamed data");
+
+    if(!encodedGet(client, "http://127.0.0.1:15257/tiny"_m, "gzip"_m, resp))
+        return false;
+
+    testAssert(!resp.headers.hasKey("Content-Encoding"_m) && resp.body == "tiny"_m, "tiny responses shouldn't be compressed");
+
+#ifndef MGPCL_NO_ZLIB
+    const char *encodings[] = { "gzip", "deflate" };
+    for(const char *enc : encodings) {
+        if(!encodedGet(client, "http://127.0.0.1:15257/count"_m, m::String(enc), resp))
+            return false;
+
+        m::String data;
+        testAssert(resp.headers.hasKey("Content-Encoding"_m) && resp.headers["Content-Encoding"_m] == m::String(enc), "response wasn't compressed");
+        testAssert(inflateString(resp.body, data) && data == expected, "invalid compressed streamed data");
+        std::cout << "[i]\t" << enc << ": " << expected.length() << " -> " << resp.body.length() << " bytes" << std::endl;
+    }
+
+    if(!encodedGet(client, "http://127.0.0.1:15257/page"_m, "br;q=1.0, gzip;q=0, deflate"_m, resp))
+        return false;
+
+    m::String data;
+    testAssert(resp.headers["Content-Encoding"_m] == "deflate"_m, "invalid Accept-Encoding negotiation");
+    testAssert(inflateString(resp.body, data) && data == page, "invalid compressed data");
+
+    //Compressed responses stop at the declared length too
+    m::String fixed;
+    fixed.append('y', 3000);
+
+    if(!encodedGet(client, "http://127.0.0.1:15257/fixed"_m, "gzip"_m, resp))
+        return false;
+
+    data.cleanup();
+    testAssert(resp.headers["Content-Encoding"_m] == "gzip"_m, "fixed length response wasn't compressed");
+    testAssert(inflateString(resp.body, data) && data == fixed, "compressor read past the response length");
+#endif
+
+    client.stop();
+    server.stop();
+    return true;
+}
+
+static m::HTTPRequestHandler *routeOf(const m::HTTPServer &server, m::HTTPRequestType method, const char *path, int *wc = nullptr, int *numWc = nullptr)
+{
+    return server.route(method, path, static_cast<int>(strlen(path)), wc, numWc);
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::HTTPServer server;
+    m::HTTPRequestHandler *notFound = new m::StaticHTTPRequestHandler("404"_m);
+    m::HTTPRequestHandler *root = new m::StaticHTTPRequestHandler("root"_m);
+    m::HTTPRequestHandler *users = new m::StaticHTTPRequestHandler("users"_m);
+    m::HTTPRequestHandler *userGet = new m::StaticHTTPRequestHandler("user get"_m);
+    m::HTTPRequestHandler *userPost = new m::StaticHTTPRequestHandler("user post"_m);
+    m::HTTPRequestHandler *me = new m::StaticHTTPRequestHandler("me"_m);
+    m::HTTPRequestHandler *item = new m::StaticHTTPRequestHandler("item"_m);
+    m::HTTPRequestHandler *file = new m::StaticHTTPRequestHandler("file"_m);
+    m::HTTPRequestHandler *resources[300];
+
+    server.set404Handler(notFound);
+    server.bindHandler("/"_m, root);
+    server.bindHandler(m::kHRT_Get, "/users"_m, users);
+    server.bindHandler(m::kHRT_Get, "/users/*"_m, userGet);
+    server.bindHandler(m::kHRT_Post, "/users/*"_m, userPost);
+    server.bindHandler("/users/me"_m, me);
+    server.bindHandler("/users/*/items/*"_m, item);
+    server.bindHandler("/static/*/file"_m, file);
+
+    for(int i = 0; i < 300; i++) {
+        m::String path("/api/v1/resource"_m);
+        path.appendInteger(i);
+        path += "/*"_m;
+
+        resources[i] = new m::StaticHTTPRequestHandler;
+        server.bindHandler(m::kHRT_Get, path, resources[i]);
+    }
+
+    int wc[M_HTTP_SERVER_MAX_WILDCARDS * 2];
+    int numWc;
+
+    testAssert(routeOf(server, m::kHRT_Get, "/") == root && routeOf(server, m::kHRT_Post, "//") == root, "invalid root route");
+    testAssert(routeOf(server, m::kHRT_Get, "/users") == users && routeOf(server, m::kHRT_Get, "/users/") == users, "invalid static route");
+    testAssert(routeOf(server, m::kHRT_Head, "/users") == users, "GET handlers should answer HEAD requests");
+
+    m::HTTPRequestHandler *notAllowed = routeOf(server, m::kHRT_Delete, "/users");
+    testAssert(notAllowed != notFound && notAllowed != users, "expected a 405 handler");
+
+    testAssert(routeOf(server, m::kHRT_Get, "/users/42", wc, &numWc) == userGet, "invalid wildcard route");
+    testAssert(numWc == 1 && wc[0] == 7 && wc[1] == 2, "invalid wildcard capture");
+    testAssert(routeOf(server, m::kHRT_Post, "/users/42") == userPost, "invalid method-specific route");
+    testAssert(routeOf(server, m::kHRT_Get, "/users/me") == me, "static components should take precedence");
+
+    testAssert(routeOf(server, m::kHRT_Get, "/users/me/items/3", wc, &numWc) == item, "wildcard route should be used after static route failed");
+    testAssert(numWc == 2 && wc[0] == 7 && wc[1] == 2 && wc[2] == 16 && wc[3] == 1, "invalid wildcard captures");
+    testAssert(routeOf(server, m::kHRT_Put, "//users//42//items/7/") == item, "repeated slashes should be ignored");
+
+    testAssert(routeOf(server, m::kHRT_Get, "/nope") == notFound && routeOf(server, m::kHRT_Get, "/users/42/items") == notFound, "expected 404");
+    testAssert(routeOf(server, m::kHRT_Get, "/static/x/file") == file && routeOf(server, m::kHRT_Get, "/static/x/y/file") == notFound, "wildcards should match one component");
+
+    char path[64];
+    for(int i = 0; i < 300; i++) {
+        sprintf(path, "/api/v1/resource%d/abc", i);
+        testAssert(routeOf(server, m::kHRT_Get, path) == resources[i], "invalid route in large table");
+    }
+
+    const char *benchPath = "/api/v1/resource271/abc";
+    const int benchLen = static_cast<int>(strlen(benchPath));
+    int found = 0;
+
+    double start = m::time::getTimeMs();
+    for(int i = 0; i < 1000000; i++) {
+        if(server.route(m::kHRT_Get, benchPath, benchLen, wc, &numWc) == resources[271])
+            found++;
+    }
+
+    std::cout << "[i]\t1M route lookups took " << m::time::getTimeMs() - start << " ms" << std::endl;
+    testAssert(found == 1000000, "invalid route lookups");
+    return true;
+}
+
+static bool metricsGet(m::HTTPClient &client, const char *path, int code, m::HTTPClientResponse &dst)
+{
+    m::Future<m::HTTPClientResponse> f(client.get(m::URL(m::String("http://127.0.0.1:15258") + path)));
+    testAssert(f.waitFor(5000), "HTTP request timed out");
+    testAssert(f.get().error == m::kHCE_NoError && f.get().code == code, "invalid HTTP response");
+
+    dst = f.get();
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    const uint64_t values[] = { 0, 1, 7, 8, 9, 15, 16, 17, 1000, 123456, 1ULL << 33 };
+
+    for(uint64_t v : values) {
+        int idx = m::HTTPHistogram::bucketOf(v);
+        testAssert(m::HTTPHistogram::bucketUpperBound(idx) > v, "value above its bucket");
+        testAssert(idx == 0 || m::HTTPHistogram::bucketUpperBound(idx - 1) <= v, "value below its bucket");
+    }
+
+    m::HTTPHistogram hist;
+    for(uint64_t i = 1; i <= 1000; i++)
+        hist.record(i * 1000);
+
+    const uint64_t median = hist.percentile(50.0);
+    testAssert(hist.count() == 1000 && hist.sum() == 500500000, "invalid histogram count or sum");
+    testAssert(median >= 500000 && median < 500000 + 500000 / 8, "invalid histogram percentile");
+
+    m::HTTPServer server;
+    m::StaticHTTPRequestHandler *fail = new m::StaticHTTPRequestHandler("fail"_m);
+    fail->setResponseCode(503, "Service Unavailable"_m);
+
+    server.bindHandler(m::kHRT_Get, "/hello"_m, new m::StaticHTTPRequestHandler("hello"_m));
+    server.bindHandler(m::kHRT_Get, "/fail"_m, fail);
+    server.bindHandler(m::kHRT_Get, "/metrics"_m, new m::HTTPMetricsHandler(&server));
+    testAssert(server.start(m::IPv4Address(127, 0, 0, 1, 15258), 2), "could not start HTTP server");
+
+    m::HTTPClient client;
+    testAssert(client.start(), "could not start HTTP client");
+
+    m::HTTPClientResponse resp;
+    for(int i = 0; i < 5; i++) {
+        if(!metricsGet(client, "/hello", 200, resp))
+            return false;
+    }
+
+    for(int i = 0; i < 2; i++) {
+        if(!metricsGet(client, "/fail", 503, resp))
+            return false;
+    }
+
+    if(!metricsGet(client, "/nope", 404, resp) || !metricsGet(client, "/metrics", 200, resp))
+        return false;
+
+    const m::String &text = resp.body;
+    testAssert(resp.headers["Content-Type"_m].startsWith("text/plain"_m), "invalid metrics content type");
+    testAssert(text.indexOf("# TYPE mgpcl_http_route_requests_total counter\n") >= 0, "missing metric type");
+    testAssert(text.indexOf("mgpcl_http_route_requests_total{route=\"/hello\"} 5\n") >= 0, "invalid route request count");
+    testAssert(text.indexOf("mgpcl_http_route_requests_total{route=\"<unmatched>\"} 1\n") >= 0, "invalid unmatched request count");
+    testAssert(text.indexOf("mgpcl_http_route_handler_seconds_count{route=\"/hello\"} 5\n") >= 0, "invalid handler histogram");
+    testAssert(text.indexOf("mgpcl_http_worker_headers_seconds_bucket{worker=\"1\",le=\"+Inf\"}") >= 0, "missing worker histogram");
+
+    client.stop();
+    server.stop();
+
+    m::HTTPRouteMetrics *hello = server.routeMetrics("/hello"_m);
+    testAssert(hello != nullptr && server.routeMetrics("/unbound"_m) == nullptr, "invalid route metrics lookup");
+    testAssert(hello->requests() == 5 && hello->errors() == 0 && hello->handlerTime().count() == 5, "invalid route metrics");
+    testAssert(hello->bytesIn() > 0 && hello->bytesOut() > 5 * 5, "invalid route byte counts");
+    testAssert(server.routeMetrics("/fail"_m)->errors() == 2, "invalid route error count");
+
+    uint64_t requests = 0;
+    uint64_t active = 0;
+    uint64_t sends = 0;
+
+    for(int i = 0; i < server.numWorkers(); i++) {
+        m::HTTPWorkerMetrics &wm = server.workerMetrics(i);
+        requests += wm.requests();
+        active += wm.activeConnections();
+        sends += wm.sendTime().count();
+    }
+
+    testAssert(requests == 9 && sends == 9, "invalid worker request count");
+    testAssert(active == 0, "connections still marked as active");
+
+    std::cout << "[i]\t" << text.length() << " bytes of metrics" << std::endl;
+    return true;
+}
+
 class ClSvTest : public m::SlotCapable
 {
 public:
@@ -378,3 +1027,173 @@ TEST
 }
 
 #endif
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::DNSResolver dns(2);
+    m::Atomic64 calls;
+
+    //Stub resolver, slow enough for lookups to overlap
+    dns.setLookupFunction([&calls] (const m::String &host, m::IPv4Address &dst) {
+        calls.increment();
+        m::time::sleepMs(100);
+
+        if(host != "good.test"_m)
+            return m::kRE_UnknownHost;
+
+        dst.setAddr(10, 0, 0, 1);
+        return m::kRE_NoError;
+    });
+
+    m::List<m::FunctionalThread*> threads;
+    m::Atomic64 ok;
+
+    for(int i = 0; i < 8; i++) {
+        threads.add(new m::FunctionalThread([&dns, &ok] () {
+            m::IPv4Address addr;
+            if(dns.resolve("good.test"_m, addr, 80) == m::kRE_NoError && addr == m::IPv4Address(10, 0, 0, 1, 80))
+                ok.increment();
+        }));
+    }
+
+    for(m::FunctionalThread *t : threads)
+        t->start();
+
+    for(m::FunctionalThread *t : threads) {
+        t->join();
+        delete t;
+    }
+
+    testAssert(ok.get() == 8, "concurrent lookups failed");
+    testAssert(calls.get() == 1, "concurrent lookups weren't merged");
+
+    m::IPv4Address addr;
+    testAssert(dns.resolve("GOOD.test"_m, addr) == m::kRE_NoError && calls.get() == 1 && dns.numHits() > 0, "positive result wasn't cached");
+    testAssert(dns.resolve("bad.test"_m, addr) == m::kRE_UnknownHost, "stub resolver ignored");
+    testAssert(dns.resolve("bad.test"_m, addr) == m::kRE_UnknownHost && calls.get() == 2, "negative result wasn't cached");
+
+    //Async, coalesced with each other
+    m::Future<m::IPv4Address> f1(dns.resolveAsync("other.test"_m, 80));
+    m::Future<m::IPv4Address> f2(dns.resolveAsync("other.test"_m, 81));
+    m::Future<m::IPv4Address> f3(dns.resolveAsync("good.test"_m, 443));
+    testAssert(f1.get().isAny() && f2.get().isAny() && calls.get() == 3, "async failure wasn't merged");
+    testAssert(f3.get() == m::IPv4Address(10, 0, 0, 1, 443), "invalid async result");
+
+    dns.setTTL(50, 50);
+    dns.clearCache();
+    testAssert(dns.resolve("good.test"_m, addr) == m::kRE_NoError && calls.get() == 4, "cache wasn't cleared");
+    m::time::sleepMs(80);
+    testAssert(dns.resolve("good.test"_m, addr) == m::kRE_NoError && calls.get() == 5, "entry didn't expire");
+
+    //Hosts file entries never expire, and skip the lookup function
+    {
+        m::FileOutputStream fos;
+        testAssert(fos.open("test_hosts.txt"_m, m::FileOutputStream::kOM_Truncate), "couldn't write hosts file");
+
+        const char hosts[] = "# comment\n127.0.0.1 localhost.test  alias.test # local\n::1 ip6.test\n\n192.168.1.2\tbox.test\n";
+        fos.write(reinterpret_cast<const uint8_t*>(hosts), static_cast<int>(sizeof(hosts) - 1));
+        fos.close();
+    }
+
+    testAssert(dns.loadHostsFile("test_hosts.txt"_m) == 2, "invalid hosts file entries count");
+    m::File("test_hosts.txt"_m).deleteFile();
+
+    testAssert(dns.resolve("alias.test"_m, addr, 8080) == m::kRE_NoError && addr == m::IPv4Address(127, 0, 0, 1, 8080), "hosts file alias not found");
+    testAssert(dns.resolve("box.test"_m, addr) == m::kRE_NoError && addr == m::IPv4Address(192, 168, 1, 2, 0), "hosts file entry not found");
+    testAssert(dns.resolve("ip6.test"_m, addr) == m::kRE_UnknownHost && calls.get() == 6, "IPv6 entry wasn't skipped");
+
+    //Overflowing the cache must not evict hosts entries
+    dns.setTTL(60000, 60000);
+    dns.setLookupFunction([&calls] (const m::String &host, m::IPv4Address &dst) {
+        calls.increment();
+        dst.setAddr(10, 0, 0, 2);
+        return m::kRE_NoError;
+    });
+
+    for(int i = 0; i <= M_DNS_CACHE_MAX; i++)
+        dns.resolve("host"_m + m::String::fromInteger(i) + ".test"_m, addr);
+
+    int64_t before = calls.get();
+    testAssert(dns.resolve("box.test"_m, addr) == m::kRE_NoError && addr == m::IPv4Address(192, 168, 1, 2, 0) && calls.get() == before, "hosts entry was evicted");
+
+    std::cout << "[i]	DNS: " << dns.numLookups() << " lookups, " << dns.numHits() << " hits, " << dns.numCoalesced() << " merged" << std::endl;
+    return true;
+}
+
+#ifndef MGPCL_NO_SSL
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    const int numHandshakes = 50;
+    const m::IPv4Address addr(127, 0, 0, 1, 15259);
+
+    m::SSLContext serverCtx(m::kSCM_v23Server);
+    serverCtx.enableAutoECDH(true);
+    testAssert(serverCtx.useCertificateFile("certificate.pem"_m) && serverCtx.usePrivateKeyFile("key.pem"_m), "couldn't load certificate");
+    testAssert(serverCtx.enableSessionCache(true) && serverCtx.enableSessionTickets(true), "couldn't enable resumption");
+
+    m::TCPSocket server;
+    testAssert(server.initialize() && server.bind(addr) && server.listen(), "couldn't start server");
+
+    //Sends a byte so that TLS 1.3 clients get their ticket
+    m::FunctionalThread serverThread([&server, &serverCtx] () {
+        for(int i = 0; i < numHandshakes * 2; i++) {
+            m::IPv4Address cliAddr;
+            m::TCPSocket cli(server.accept(cliAddr));
+            m::SSLSocket ssl;
+
+            if(cli.isValid() && ssl.initializeAndAccept(serverCtx, cli) == m::kSAE_NoError) {
+                uint8_t b = 42;
+                ssl.send(&b, 1);
+                ssl.close();
+            }
+        }
+    });
+
+    testAssert(serverThread.start(), "couldn't start server thread");
+
+    m::SSLContext clientCtx(m::kSCM_v23Client);
+    m::SSLSessionCache cache;
+    double rates[2];
+    bool ok = true;
+
+    for(int resume = 0; resume < 2; resume++) {
+        double start = m::time::getTimeMs();
+
+        for(int i = 0; i < numHandshakes; i++) {
+            m::SSLSocket sock;
+            uint8_t b = 0;
+
+            if(!sock.initialize(clientCtx)) {
+                ok = false;
+                continue;
+            }
+
+            //Keyed by the server name, not by the address
+            sock.setServerName("localhost"_m);
+            if(resume != 0)
+                sock.setSessionCache(&cache);
+
+            if(sock.connect(addr) != m::kSCE_NoError || sock.receive(&b, 1) != 1 || b != 42)
+                ok = false;
+
+            sock.close();
+        }
+
+        rates[resume] = static_cast<double>(numHandshakes) * 1000.0 / (m::time::getTimeMs() - start);
+    }
+
+    serverThread.join();
+    m::SSLSessionStats stats(serverCtx.sessionStats());
+
+    testAssert(ok, "a TLS connection failed");
+    testAssert(cache.numMisses() == 1 && cache.numHits() == numHandshakes - 1, "client didn't resume its session");
+    testAssert(cache.get(m::SSLSessionCache::hostKey("LocalHost"_m, 15259)).isResumable(), "session isn't keyed by host");
+    testAssert(stats.hits >= numHandshakes - 1 && stats.accepts == numHandshakes * 2, "server didn't resume sessions");
+
+    std::cout << "[i]	Full handshakes: " << rates[0] << "/s, resumed: " << rates[1] << "/s" << std::endl;
+    std::cout << "[i]	Server: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.cacheSize << " cached" << std::endl;
+    return true;
+}
+#endif
@@ -2,6 +2,11 @@
 #include <string>
 #include <mgpcl/Process.h>
 #include <mgpcl/StringIOStream.h>
+#include <mgpcl/Time.h>
+
+#ifdef MGPCL_LINUX
+#include <sys/wait.h>
+#endif
 
 #define TEST_USER_NAME "montoyo"
 #define TEST_GROUP_NAME "sudo"
@@ -86,6 +91,136 @@ TEST
     return true;
 }
 
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    m::Process bad;
+    testAssert(!bad.setExecutable("/this/does/not/exist"_m).start().hasStarted(), "nonexistent executable started");
+
+    const char *exe = exeLoc;
+    m::ProcessPool pool([exe] (m::Process &p) {
+        p.setExecutable(m::String(exe)).pushArg("--print-hash"_m).redirectSTDIO();
+    }, 2);
+
+    testAssert(pool.fill() == 2 && pool.readyCount() == 2, "couldn't fill process pool");
+
+    for(int i = 0; i < 4; i++) {
+        m::String test("line "_m + m::String::fromInteger(i));
+        m::Process *proc = pool.take();
+        testAssert(proc != nullptr && proc->hasStarted(), "couldn't take process from pool");
+
+        m::StringOStream sos;
+        m::SSharedPtr<m::PipeOutputStream> pos(proc->stdIn<m::RefCounter>());
+        m::SSharedPtr<m::PipeInputStream> pis(proc->stdOut<m::RefCounter>());
+        testAssert(m::IO::writeLine(test, pos.ptr()), "couldn't write to stdin!");
+        testAssert(m::IO::transfer(&sos, pis.ptr(), 64), "couldn't read stdout!");
+        pos->close();
+        pis->close();
+
+        testAssert(sos.data().trimmed().toInteger() == test.hash(), "result is wrong");
+        testAssert(proc->waitFor().exitCode() == 0, "invalid exit code");
+        delete proc;
+    }
+
+    testAssert(pool.numHits() > 0, "process pool never had a warm child");
+    std::cout << "[i]	Process pool: " << pool.numHits() << " hit(s), " << pool.numMisses() << " miss(es)" << std::endl;
+
+    //fork() copies the page tables, posix_spawn() doesn't
+    const m::ProcessSpawnMethod methods[] = { m::kPSM_Fork, m::kPSM_Spawn };
+    const char *names[] = { "fork()", "posix_spawn()" };
+
+    for(int i = 0; i < 2; i++) {
+        double start = m::time::getTimeMs();
+
+        for(int j = 0; j < 50; j++) {
+            m::Process proc;
+            testAssert(proc.setExecutable("true"_m).setSpawnMethod(methods[i]).start().hasStarted(), "process didn't start");
+            testAssert(proc.waitFor().exitCode() == 0, "invalid exit code");
+        }
+
+        std::cout << "[i]	50 processes with " << names[i] << " in " << m::time::getTimeMs() - start << " ms" << std::endl;
+    }
+
+    return true;
+}
+
+#ifdef MGPCL_LINUX
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    //Much more than a pipe buffer on both outputs, a slow child and a child that says something
+    m::Process big, slow, env;
+    big.setExecutable("sh"_m).pushArgs({ "-c"_m, "head -c 300000 /dev/zero; head -c 200000 /dev/zero >&2"_m }).redirectSTDIO();
+    slow.setExecutable("sleep"_m).pushArg("10"_m).redirectSTDIO();
+    env.setExecutable(m::String(exeLoc)).pushArg("--print-env"_m).setEnv("MGPCL_TEST"_m, "hello"_m).redirectSTDIO();
+
+    testAssert(big.start().hasStarted() && slow.start().hasStarted() && env.start().hasStarted(), "process didn't start");
+
+    int64_t bytes[m::kPPI_Count] = { 0, 0, 0 };
+    m::String envOut;
+    int exits = 0;
+    bool slowTimedOut = false;
+    bool othersOk = true;
+
+    m::ProcessGroup group;
+    group.setOutputCallback([&bytes, &envOut, &env] (m::Process &p, m::ProcessPipeID pipe, const uint8_t *data, int sz) {
+        bytes[pipe] += sz;
+        if(&p == &env)
+            envOut += m::String(reinterpret_cast<const char*>(data), sz);
+    }).setExitCallback([&] (m::Process &p, int code, bool timedOut) {
+        exits++;
+
+        if(&p == &slow)
+            slowTimedOut = timedOut;
+        else if(timedOut || code != 0)
+            othersOk = false;
+    });
+
+    testAssert(group.add(big) && group.add(slow, 200) && group.add(env, 5000), "couldn't add processes to group");
+
+    double start = m::time::getTimeMs();
+    group.run();
+    double took = m::time::getTimeMs() - start;
+
+    testAssert(exits == 3 && group.size() == 0, "not every exit was reported");
+    testAssert(slowTimedOut && !slow.isRunning(), "slow child wasn't killed");
+    testAssert(othersOk, "a child failed or timed out");
+    testAssert(bytes[m::kPPI_StdErr] == 200000 && envOut.trimmed() == "hello"_m, "invalid output");
+    testAssert(took < 5000.0, "timeout was ignored");
+
+    std::cout << "[i]	Process group done in " << took << " ms, " << bytes[m::kPPI_StdOut] << " bytes on stdout" << std::endl;
+
+    //A child reaped behind the group's back must not keep it busy forever
+    m::Process stolen;
+    stolen.setExecutable("sh"_m).pushArgs({ "-c"_m, "exit 3"_m }).redirectSTDIO();
+    testAssert(stolen.start().hasStarted() && group.add(stolen), "couldn't add process to group");
+
+    int status;
+    testAssert(waitpid(static_cast<pid_t>(stolen.pid()), &status, 0) > 0, "couldn't reap child");
+
+    exits = 0;
+    start = m::time::getTimeMs();
+    while(group.poll(100) && m::time::getTimeMs() - start < 3000.0) {
+    }
+
+    testAssert(exits == 1 && group.size() == 0, "group didn't notice the child was already reaped");
+
+    //The grandchild keeps the pipes open after the child got killed
+    m::Process parent;
+    parent.setExecutable("sh"_m).pushArgs({ "-c"_m, "sleep 5; echo"_m }).redirectSTDIO();
+    testAssert(parent.start().hasStarted() && group.add(parent, 200), "couldn't add process to group");
+
+    exits = 0;
+    start = m::time::getTimeMs();
+    group.run();
+
+    testAssert(exits == 1 && m::time::getTimeMs() - start < 2000.0, "timeout wasn't enforced because of a grandchild");
+    return true;
+}
+#endif
+
 #ifdef MGPCL_LINUX
 TEST
 {
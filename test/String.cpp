@@ -5,6 +5,8 @@
 #include <mgpcl/CPUInfo.h>
 #include <mgpcl/UUID.h>
 #include <mgpcl/Random.h>
+#include <mgpcl/Thread.h>
+#include <mgpcl/Atomic.h>
 
 Declare Test("strings"), Priority(2.0);
 
@@ -238,6 +240,111 @@ TEST
     return true;
 }
 
+static int naiveIndexOf(const m::String &str, const char *needle, int len, int beg)
+{
+    for(int i = beg; i + len <= str.length(); i++) {
+        int j = 0;
+        while(j < len && str[i + j] == needle[j])
+            j++;
+
+        if(j >= len)
+            return i;
+    }
+
+    return -1;
+}
+
+static int naiveIndexOfAnyOf(const m::String &str, const char *chars, int len, int beg)
+{
+    for(int i = beg; i < str.length(); i++) {
+        for(int j = 0; j < len; j++) {
+            if(str[i] == chars[j])
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::prng::Xoroshiro rng;
+
+    //Small alphabet, so that there's a lot of partial matches
+    m::String hay(1 << 20);
+    for(int i = 0; i < (1 << 20); i++)
+        hay += "abcd"[rng.next() & 3];
+
+    const char *needles[] = { "a", "ab", "abc", "dcbad", "aabbccdd", "abcdabcdabcdabcdabcdabcdabcdabcda" };
+    for(const char *n : needles) {
+        const int len = static_cast<int>(strlen(n));
+
+        for(int beg = 0; beg < 64; beg += 7)
+            testAssert(hay.indexOf(n, beg) == naiveIndexOf(hay, n, len, beg), "indexOf() returned a wrong position");
+    }
+
+    testAssert("aaab"_m.indexOf("aab") == 1, "indexOf() missed an overlapping match");
+    testAssert("ab.ab.ab"_m.lastIndexOf("ab") == 6, "lastIndexOf() returned a wrong position");
+    testAssert(hay.indexOf("abcdabcdabcdabcdabcdabcdabcdabcdx") < 0, "indexOf() found something that isn't there");
+    testAssert(hay.indexOfAnyOf("xyz") < 0, "indexOfAnyOf() found something that isn't there");
+    testAssert(hay.indexOfAnyOf("xd", 100) == naiveIndexOfAnyOf(hay, "xd", 2, 100), "indexOfAnyOf() returned a wrong position");
+
+    //Benchmark against the plain loops
+    m::String sparse(1 << 20);
+    sparse.append('a', (1 << 20) - 16);
+    sparse += "Content-Length: ";
+
+    m::time::initTime();
+    double t = m::time::getTimeMs();
+    int r1 = naiveIndexOf(sparse, "Content-Length", 14, 0);
+    double tNaive = m::time::getTimeMs() - t;
+
+    t = m::time::getTimeMs();
+    int r2 = sparse.indexOf("Content-Length");
+    double tFast = m::time::getTimeMs() - t;
+
+    testAssert(r1 == r2, "indexOf() and the naive loop disagree");
+    std::cout << "[i]	Substring search on 1 MiB: " << tNaive << " ms (naive), " << tFast << " ms (indexOf)" << std::endl;
+
+    t = m::time::getTimeMs();
+    r1 = naiveIndexOfAnyOf(sparse, ":\r\n", 3, 0);
+    tNaive = m::time::getTimeMs() - t;
+
+    t = m::time::getTimeMs();
+    r2 = sparse.indexOfAnyOf(":\r\n");
+    tFast = m::time::getTimeMs() - t;
+
+    testAssert(r1 == r2, "indexOfAnyOf() and the naive loop disagree");
+    std::cout << "[i]	Any-of search on 1 MiB: " << tNaive << " ms (naive), " << tFast << " ms (indexOfAnyOf)" << std::endl;
+
+    //Splits
+    const m::String line("GET /index.html  HTTP/1.1"_m);
+    m::List<m::String> parts;
+    m::List<m::StringView> views;
+
+    line.splitOn(' ', parts);
+    line.splitOn(' ', views);
+    testAssert(parts.size() == 4 && views.size() == 4, "wrong number of split parts");
+
+    for(int i = 0; i < parts.size(); i++)
+        testAssert(views[i] == parts[i], "split views don't match split strings");
+
+    testAssert(views[2].isEmpty() && views[3] == "HTTP/1.1", "wrong split views");
+
+    parts.clear();
+    views.clear();
+    "a::b::::c"_m.splitOn("::", views);
+    testAssert(views.size() == 4 && views[0] == "a" && views[2].isEmpty() && views[3] == "c", "wrong split on string");
+
+    views.clear();
+    "k = v;x\ty"_m.splitOnOneOf(" =;\t", views);
+    testAssert(views.size() == 6 && views[0] == "k" && views[3] == "v" && views[5].toString() == "y", "wrong split on one of");
+    testAssert(line.view(4, 15) == "/index.html", "wrong string view");
+
+    return true;
+}
+
 #ifdef MGPCL_ENABLE_PATTERNS
 
 TEST
@@ -307,11 +414,211 @@ TEST
         testAssert(matcher.capture() == "01/11/2024", "pattern #3 test #2 captured match is wrong");
     }
 
+    {
+        m::Pattern pat;
+        testAssert(pat.compile("(%d+)%-(%l+)"), "could not compile pattern #4");
+
+        m::Matcher matcher(pat.matcher("12-ab, 345-cde; 6-"));
+        testAssert(matcher.next(), "pattern #4 test #1 should match");
+        testAssert(matcher.numCaptures() == 3, "pattern #4 should have 3 captures");
+        testAssert(matcher.capture() == "12-ab", "pattern #4 test #1 capture 0 is wrong");
+        testAssert(matcher.capture(1) == "12" && matcher.capture(2) == "ab", "pattern #4 test #1 captures are wrong");
+        testAssert(matcher.next(), "pattern #4 test #2 should match");
+        testAssert(matcher.captureBegin(1) == 7 && matcher.capture(2) == "cde", "pattern #4 test #2 captures are wrong");
+        testAssert(!matcher.next(), "pattern #4 test #3 shouldn't match");
+    }
+
+    {
+        //Would take forever with a backtracking matcher
+        m::Pattern pat;
+        testAssert(pat.compile("(a*)*(a*)*(a*)*b"), "could not compile pattern #5");
+
+        m::String str;
+        str.append('a', 5000);
+        testAssert(pat != str, "pattern #5 test #1 shouldn't match");
+
+        str += 'b';
+        testAssert(pat == str, "pattern #5 test #2 should match");
+    }
+
+    {
+        m::Pattern pat;
+        testAssert(pat.compile("ab+$"), "could not compile pattern #6");
+        testAssert(pat == "abbab", "pattern #6 test #1 should match");
+        testAssert(pat != "abba", "pattern #6 test #2 shouldn't match");
+
+        m::Matcher matcher(pat.matcher("xxabbabb"));
+        testAssert(matcher.next() && matcher.captureBegin() == 5, "pattern #6 test #3 should match the last 'abb'");
+    }
+
+    {
+        m::PatternSet set;
+        testAssert(set.add("^/api/") == 0, "could not add pattern #1 to set");
+        testAssert(set.add("%.json$") == 1, "could not add pattern #2 to set");
+        testAssert(set.add("user%d+") == 2, "could not add pattern #3 to set");
+        testAssert(set.add("te(st") < 0 && set.parseError() == m::kPPE_UnclosedParenthesis, "pattern set should refuse invalid patterns");
+        testAssert(set.size() == 3, "pattern set should contain 3 patterns");
+
+        m::List<int> ids;
+        testAssert(set.matches("/api/user42/profile.json", ids), "pattern set test #1 should match");
+        testAssert(ids.size() == 3 && ids[0] == 0 && ids[1] == 1 && ids[2] == 2, "pattern set test #1 should match everything");
+
+        ids.clear();
+        testAssert(set.matches("/static/api/user.json", ids), "pattern set test #2 should match");
+        testAssert(ids.size() == 1 && ids[0] == 1, "pattern set test #2 should only match pattern #2");
+
+        ids.clear();
+        testAssert(!set.matches("/static/index.json.bak", ids) && ids.isEmpty(), "pattern set test #3 shouldn't match");
+
+        //The automaton is built again after add(); threads racing to build it must agree
+        testAssert(set.add("profile") == 3, "could not add pattern #4 to set");
+
+        const m::PatternSet &shared = set;
+        m::Atomic failures;
+        m::List<m::FunctionalThread*> threads;
+
+        for(int i = 0; i < 4; i++) {
+            threads.add(new m::FunctionalThread([&shared, &failures] () {
+                m::List<int> found;
+                if(!shared.matches("/api/user42/profile.json", found) || found.size() != 4)
+                    failures.increment();
+            }));
+        }
+
+        for(m::FunctionalThread *t : threads)
+            t->start();
+
+        for(m::FunctionalThread *t : threads) {
+            t->join();
+            delete t;
+        }
+
+        testAssert(failures.get() == 0, "concurrent pattern set matches failed");
+    }
+
     return true;
 }
 
 #endif
 
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    m::String small("hello");
+    testAssert(small.isInline(), "short strings should be stored inline");
+
+    m::String moved(std::move(small));
+    testAssert(moved == "hello" && moved.isInline(), "moving an inline string failed");
+
+    m::String big;
+    for(int i = 0; i < 64; i++)
+        big.append(static_cast<char>('a' + i % 26), 1);
+
+    testAssert(big.length() == 64 && !big.isInline(), "long strings should be heap allocated");
+    testAssert(big[63] == 'a' + 63 % 26, "growing from inline storage failed");
+
+    m::String copy(big);
+    copy = "short";
+    testAssert(copy == "short" && big.length() == 64, "assigning to a heap string failed");
+
+    m::String line;
+    line.append("id=").appendInteger(-42).append(' ', 1).appendFormat("%s:%d", "port", 8080).append(' ', 1).appendUInteger(255, 16);
+    testAssert(line == "id=-42 port:8080 ff", "append formatting failed");
+
+    testAssert(m::String::fromInteger64(-9000000000LL) == "-9000000000", "fromInteger64 truncated its input");
+    testAssert(m::String::fromUInteger64(18446744073709551615ULL) == "18446744073709551615", "fromUInteger64 failed");
+    testAssert(m::String::fromInteger(0) == "0", "fromInteger(0) failed");
+
+    //Building a string with appends should avoid all the temporaries
+    m::time::initTime();
+    double start = m::time::getTimeMs();
+    int total = 0;
+
+    for(int i = 0; i < 100000; i++) {
+        m::String str;
+        str.append("k").appendInteger(i).append('=', 1).appendInteger(i * 3);
+        total += str.length();
+    }
+
+    double appendMs = m::time::getTimeMs() - start;
+    start = m::time::getTimeMs();
+
+    for(int i = 0; i < 100000; i++) {
+        m::String str(m::String("k") + m::String::fromInteger(i) + m::String("=") + m::String::fromInteger(i * 3));
+        total -= str.length();
+    }
+
+    double concatMs = m::time::getTimeMs() - start;
+    std::cout << "[i]\tappend: " << appendMs << " ms, concatenation: " << concatMs << " ms" << std::endl;
+    testAssert(total == 0, "append and concatenation disagree");
+
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    testAssert(m::String::fromDouble(0.1, M_DOUBLE_SHORTEST) == "0.1", "0.1 isn't formatted in its shortest form");
+    testAssert(m::String::fromDouble(1.0 / 3.0, M_DOUBLE_SHORTEST) == "0.3333333333333333", "bad 1/3 formatting");
+    testAssert(m::String::fromDouble(-1e22, M_DOUBLE_SHORTEST) == "-1e+22", "bad scientific notation");
+    testAssert(m::String::fromDouble(1.5e-7, M_DOUBLE_SHORTEST) == "1.5e-7", "bad small numbers formatting");
+    testAssert(m::String::fromDouble(123456.0, M_DOUBLE_SHORTEST) == "123456.0", "bad integer formatting");
+    testAssert(m::String::fromDouble(5e-324, M_DOUBLE_SHORTEST) == "5e-324", "bad subnormal formatting");
+    testAssert(m::String::fromDouble(0.5, 3) == "0.500", "fixed precision mode is broken");
+    testAssert(m::String::fromDouble(0.1) == "0.100000", "fixed precision should stay the default");
+
+    testAssert("1.7976931348623157e308"_m.toDouble() == 1.7976931348623157e308, "bad max double parsing");
+    testAssert("9007199254740993"_m.toDouble() == 9007199254740992.0, "ties should round to even");
+    testAssert("0.30000000000000004"_m.toDouble() != 0.3, "parsing isn't exact");
+    testAssert("12.5kg"_m.toDouble() == 12.5, "toDouble() should stop at the first invalid char");
+    testAssert(m::WString(L"-2.5e2").toDouble() == -250.0, "bad wide string parsing");
+
+    //Random doubles have to survive the round trip, bit for bit
+    m::prng::Xoroshiro x;
+    m::List<double> values(10000);
+    m::List<m::String> strs(10000);
+
+    while(values.size() < 10000) {
+        uint64_t bits = x.next();
+        double d;
+        m::mem::copy(&d, &bits, sizeof(double));
+
+        if(d == d)
+            values.add(d);
+    }
+
+    m::time::initTime();
+    double start = m::time::getTimeMs();
+
+    for(double d : values)
+        strs.add(m::String::fromDouble(d, M_DOUBLE_SHORTEST));
+
+    double fmtMs = m::time::getTimeMs() - start;
+    start = m::time::getTimeMs();
+    int errors = 0;
+
+    for(int i = 0; i < values.size(); i++) {
+        double d = strs[i].toDouble();
+        if(m::mem::cmp(&d, &values[i], sizeof(double)) != 0)
+            errors++;
+    }
+
+    double parseMs = m::time::getTimeMs() - start;
+    start = m::time::getTimeMs();
+
+    char buf[32];
+    for(double d : values)
+        snprintf(buf, 32, "%.17g", d);
+
+    double libcMs = m::time::getTimeMs() - start;
+    std::cout << "[i]\tdouble formatting: " << fmtMs << " ms (%.17g: " << libcMs << " ms), parsing: " << parseMs << " ms" << std::endl;
+    testAssert(errors == 0, "some doubles didn't survive the round trip");
+
+    return true;
+}
+
 TEST
 {
     volatile StackIntegrityChecker sic;
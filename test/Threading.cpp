@@ -1,7 +1,12 @@
 #include "TestAPI.h"
+#include "BenchAPI.h"
 #include <mgpcl/Thread.h>
 #include <mgpcl/Time.h>
 #include <mgpcl/Future.h>
+#include <mgpcl/ConcurrentQueue.h>
+#include <mgpcl/Executor.h>
+#include <mgpcl/List.h>
+#include "TestObject.h"
 
 Declare Test("threading"), Priority(9.0);
 
@@ -63,3 +68,298 @@ TEST
     testAssert(future.get() == 42, "future != promise");
     return true;
 }
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+
+    {
+        m::SPSCQueue<TestObject> spsc(3);
+        testAssert(spsc.capacity() == 4 && spsc.first() == nullptr, "invalid empty SPSC queue");
+
+        for(int i = 0; i < 4; i++)
+            testAssert(spsc.offer(TestObject(i)), "couldn't offer to SPSC queue");
+
+        testAssert(!spsc.offer(TestObject(4)), "SPSC queue accepted too many elements");
+        testAssert(spsc.first()->value() == 0 && spsc.poll(), "invalid first SPSC element");
+
+        TestObject obj;
+        testAssert(spsc.poll(obj) && obj.value() == 1, "invalid SPSC poll");
+
+        m::ConcurrentQueue<TestObject> mpmc(4);
+        for(int i = 0; i < 4; i++)
+            testAssert(mpmc.offer(TestObject(i)), "couldn't offer to MPMC queue");
+
+        testAssert(!mpmc.offer(TestObject(4)) && mpmc.size() == 4, "MPMC queue accepted too many elements");
+        testAssert(mpmc.poll(obj) && obj.value() == 0 && mpmc.poll(), "invalid MPMC poll");
+        testAssert(mpmc.offer(TestObject(5)), "MPMC queue didn't wrap around");
+
+        //Leave some elements, the destructors have to free them
+    }
+
+    testAssert(TestObject::instances() == 0, "invalid test object count");
+
+    m::BlockingQueue<int> bq(4);
+    int val;
+    double start = m::time::getTimeMs();
+
+    testAssert(!bq.pollWait(val, 50), "pollWait() didn't time out");
+    testAssert(m::time::getTimeMs() - start >= 45.0, "pollWait() returned too early");
+    return true;
+}
+
+//Sends count integers from each producer and checks they are all received once
+template<typename Q> static bool runQueueThreads(Q &q, int producers, int consumers, int count, double &took)
+{
+    const int64_t total = static_cast<int64_t>(producers) * count;
+    m::Atomic64 received;
+    m::Atomic64 sum;
+    m::List<m::FunctionalThread*> threads;
+
+    for(int p = 0; p < producers; p++) {
+        threads.add(new m::FunctionalThread([&q, p, count] () {
+            for(int i = 0; i < count; i++)
+                q.offerWait(p * count + i);
+        }));
+    }
+
+    for(int c = 0; c < consumers; c++) {
+        threads.add(new m::FunctionalThread([&q, &received, &sum, total] () {
+            int v;
+
+            while(received.get() < total) {
+                if(q.pollWait(v, 5)) {
+                    sum.add(v);
+                    received.increment();
+                }
+            }
+        }));
+    }
+
+    took = m::time::getTimeMs();
+    for(m::FunctionalThread *t : threads)
+        t->start();
+
+    for(m::FunctionalThread *t : threads) {
+        t->join();
+        delete t;
+    }
+
+    took = m::time::getTimeMs() - took;
+    return received.get() == total && sum.get() == total * (total - 1) / 2;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    double took;
+
+    {
+        m::BlockingQueue<int, m::SPSCQueue<int>> q(64);
+        testAssert(runQueueThreads(q, 1, 1, 10000, took), "SPSC queue lost or duplicated elements");
+    }
+
+    {
+        m::BlockingQueue<int> q(64);
+        testAssert(runQueueThreads(q, 4, 4, 2500, took), "MPMC queue lost or duplicated elements");
+    }
+
+    return true;
+}
+
+//Throughput sweep, see --bench
+#define M_QUEUE_BENCH_ITEMS 65536
+
+template<typename Q> static void g_m_benchQueue(benchAPI::State &state, int threads)
+{
+    double took;
+    state.setItemsPerIteration(M_QUEUE_BENCH_ITEMS / threads * threads);
+
+    while(state.keepRunning()) {
+        Q q(1024);
+        runQueueThreads(q, threads, threads, M_QUEUE_BENCH_ITEMS / threads, took);
+    }
+}
+
+BENCH("concurrentqueue/spsc")
+{
+    g_m_benchQueue<m::BlockingQueue<int, m::SPSCQueue<int>>>(state, 1);
+}
+
+BENCH("concurrentqueue/mpmc-1")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 1);
+}
+
+BENCH("concurrentqueue/mpmc-2")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 2);
+}
+
+BENCH("concurrentqueue/mpmc-4")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 4);
+}
+
+BENCH("concurrentqueue/mpmc-8")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 8);
+}
+
+BENCH("concurrentqueue/mpmc-16")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 16);
+}
+
+BENCH("concurrentqueue/mpmc-32")
+{
+    g_m_benchQueue<m::BlockingQueue<int>>(state, 32);
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::Executor ex(4, "TestExec-"_m);
+    testAssert(ex.start(), "couldn't start executor");
+
+    m::Future<int> future(ex.submit<int>([] () { return 42; }));
+    testAssert(future.get() == 42, "invalid submit() result");
+
+    m::List<int> hits;
+    for(int i = 0; i < 10000; i++)
+        hits.add(0);
+
+    ex.parallelFor(0, 10000, 64, [&hits] (int i) { hits[i]++; });
+    for(int i = 0; i < 10000; i++)
+        testAssert(hits[i] == 1, "parallelFor() missed or repeated an index");
+
+    int64_t sum = ex.parallelReduce<int64_t>(1, 100001, 1000, 0, [] (int i) { return static_cast<int64_t>(i); }, [] (int64_t a, int64_t b) { return a + b; });
+    testAssert(sum == 5000050000LL, "invalid parallelReduce() result");
+
+    //Nested parallelFor() from tasks must not deadlock, even with every worker busy
+    m::Atomic64 nested;
+    ex.parallelFor(0, 16, 1, [&ex, &nested] (int) {
+        ex.parallelFor(0, 100, 10, [&nested] (int) { nested.increment(); });
+    });
+
+    testAssert(nested.get() == 1600, "nested parallelFor() failed");
+
+    //a -> (b, c) -> d
+    m::TaskGraph graph;
+    m::Mutex orderLock;
+    m::List<int> order;
+    auto record = [&orderLock, &order] (int id) {
+        orderLock.lock();
+        order.add(id);
+        orderLock.unlock();
+    };
+
+    int a = graph.add([&record] () { record(0); });
+    int b = graph.add([&record] () { m::time::sleepMs(10); record(1); });
+    int c = graph.add([&record] () { record(2); });
+    int d = graph.add([&record] () { record(3); });
+    graph.precede(a, b);
+    graph.precede(a, c);
+    graph.precede(b, d);
+    graph.precede(c, d);
+
+    testAssert(graph.run(ex).get(), "task graph failed");
+    testAssert(~order == 4 && order[0] == 0 && order[3] == 3, "task graph didn't respect dependencies");
+
+    order.clear();
+    testAssert(graph.run(ex).get() && ~order == 4, "task graph can't be run twice");
+
+    graph.precede(d, a);
+    testAssert(!graph.run(ex).get(), "task graph accepted a cycle");
+
+    testAssert(ex.setAffinityMask(0, 1), "couldn't set worker affinity");
+
+    //Small tasks, compared to one thread per task with execAsync()
+    const int numTasks = 20000;
+    m::Atomic64 done;
+    double start = m::time::getTimeMs();
+
+    for(int i = 0; i < numTasks; i++)
+        ex.execute([&done] () { done.increment(); });
+
+    while(done.load() < numTasks && m::time::getTimeMs() - start < 10000.0)
+        m::time::sleepMs(1);
+
+    double took = m::time::getTimeMs() - start;
+    testAssert(done.load() == numTasks, "missing tasks");
+
+    std::cout << "[i]\t" << numTasks << " tasks in " << took << " ms (" << static_cast<double>(numTasks) / took << " tasks/ms)" << std::endl;
+    testAssert(ex.currentWorker() == -1, "main thread isn't a worker");
+    testAssert(ex.submit<int>([&ex] () { return ex.currentWorker(); }).get() >= 0, "tasks don't know their worker");
+
+    //Tasks racing with stop() are either refused or run, never lost
+    m::Atomic64 accepted;
+    done.set(0);
+
+    m::FunctionalThread producer([&ex, &accepted, &done] () {
+        while(ex.execute([&done] () { done.increment(); }))
+            accepted.increment();
+    });
+
+    testAssert(producer.start(), "couldn't start producer thread");
+    m::time::sleepMs(5);
+    ex.stop();
+    producer.join();
+
+    testAssert(!ex.isRunning() && done.load() == accepted.load(), "a task submitted during stop() was lost");
+    testAssert(ex.start() && ex.count() == 4, "couldn't restart executor");
+    ex.stop();
+    return true;
+}
+
+TEST
+{
+    volatile StackIntegrityChecker sic;
+    m::Executor &ex = m::globalExecutor();
+    testAssert(&ex == &m::globalExecutor() && ex.isRunning(), "global executor isn't a running singleton");
+    testAssert(!m::configureGlobalExecutor(2), "global executor reconfigured after creation");
+
+    //Bursts used to create one thread per call
+    const int numCalls = 10000;
+    const int64_t completed = ex.numCompleted();
+    m::Atomic64 done;
+    double start = m::time::getTimeMs();
+
+    for(int i = 0; i < numCalls; i++)
+        testAssert(m::execAsync([&done] () { done.increment(); }), "execAsync() failed");
+
+    while(done.load() < numCalls && m::time::getTimeMs() - start < 10000.0)
+        m::time::sleepMs(1);
+
+    testAssert(done.load() == numCalls, "execAsync() lost calls");
+    testAssert(ex.numCompleted() - completed >= numCalls, "invalid completed tasks count");
+
+    std::cout << "[i]	" << numCalls << " execAsync() calls in " << m::time::getTimeMs() - start << " ms on ";
+    std::cout << ex.count() << " worker(s), " << ex.numOverflows() << " overflow(s)" << std::endl;
+
+    m::Future<int> future(m::async<int>([] () { return 1337; }));
+    testAssert(future.get() == 1337, "invalid async() result");
+
+    m::Future<uint64_t> tid(m::async<uint64_t>([] () { return m::Thread::currentThreadID(); }));
+    testAssert(tid.get() != m::Thread::currentThreadID(), "async() ran on the calling thread");
+
+    //Back-pressure: a full queue makes the caller run the task
+    m::Executor small(1, "Small-"_m, 2);
+    m::Futex gate;
+    testAssert(small.start(), "couldn't start executor");
+    testAssert(small.execute([&gate] () { while(gate.value() == 0) gate.wait(0); }), "couldn't block the worker");
+
+    for(int i = 0; i < 8; i++)
+        small.execute([] () {});
+
+    testAssert(small.numOverflows() > 0 && small.queueLength() <= 2, "full queue didn't push back");
+
+    bool ranInline = false;
+    testAssert(!small.tryExecute([&ranInline] () { ranInline = true; }) && !ranInline, "tryExecute() ran a task on a full queue");
+    gate.increment();
+    gate.wakeAll();
+    small.stop();
+
+    testAssert(small.numCompleted() == small.numSubmitted(), "tasks were lost");
+    return true;
+}